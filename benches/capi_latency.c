@@ -0,0 +1,181 @@
+/*
+ * capi_latency.c - Per-call latency of libbash_ast against the bash-ast CLI
+ *
+ * Parses the same small scripts through bash_ast_parse_json(), through
+ * bash_ast_parse_json_batch(), and by running `bash-ast -c` with the
+ * script on stdin, as services that shell out to the binary do, and prints
+ * the mean time per script for each.
+ *
+ * Build and run with `make bench-capi`, or by hand:
+ *
+ *     cargo build --release
+ *     cc -O2 -Iinclude benches/capi_latency.c -Ltarget/release -lbash_ast \
+ *         -Wl,-rpath,target/release -o target/release/capi_latency
+ *     target/release/capi_latency target/release/bash-ast [ITERATIONS]
+ */
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bash_ast.h"
+
+extern char **environ;
+
+static const char *scripts[] = {
+    "ls -la",
+    "git status --short | wc -l",
+    "make && make install",
+    "for f in *.txt; do echo \"$f\"; done",
+    "if [ -f /etc/passwd ]; then grep root /etc/passwd > /dev/null; fi",
+    "curl -fsSL \"$URL\" -o \"$TMP/out\" 2>&1 || exit 1",
+};
+
+#define SCRIPT_COUNT (sizeof(scripts) / sizeof(scripts[0]))
+
+/* Monotonic time, in microseconds */
+static double now_micros(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e6 + (double)now.tv_nsec / 1e3;
+}
+
+static void die(const char *what) {
+    perror(what);
+    exit(1);
+}
+
+/* Parse each script once through bash_ast_parse_json() */
+static void run_library(void) {
+    size_t i;
+    char *json;
+    size_t length;
+    bash_ast_error error = {0};
+
+    for (i = 0; i < SCRIPT_COUNT; i++) {
+        if (bash_ast_parse_json(scripts[i], strlen(scripts[i]), 0, &json, &length, &error)
+            != BASH_AST_OK) {
+            fprintf(stderr, "%s: %s\n", scripts[i], error.message);
+            exit(1);
+        }
+        bash_ast_free(json);
+    }
+}
+
+/* Parse all the scripts in one bash_ast_parse_json_batch() call */
+static void run_batch(void) {
+    size_t i;
+    size_t lengths[SCRIPT_COUNT];
+    bash_ast_result results[SCRIPT_COUNT];
+
+    for (i = 0; i < SCRIPT_COUNT; i++) {
+        lengths[i] = strlen(scripts[i]);
+    }
+    if (bash_ast_parse_json_batch(scripts, lengths, SCRIPT_COUNT, 0, results) != 0) {
+        fprintf(stderr, "batch parse failed\n");
+        exit(1);
+    }
+    bash_ast_result_clear(results, SCRIPT_COUNT);
+}
+
+/* Parse one script with `cli -c`, reading and discarding its output */
+static void run_cli_once(const char *cli, const char *script) {
+    int in[2], out[2];
+    char buffer[4096];
+    char *argv[] = {(char *)cli, "-c", NULL};
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int status;
+    ssize_t n;
+
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        die("pipe");
+    }
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, in[1]);
+    posix_spawn_file_actions_addclose(&actions, out[0]);
+    errno = posix_spawn(&pid, cli, &actions, NULL, argv, environ);
+    if (errno != 0) {
+        die(cli);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+    close(out[1]);
+
+    if (write(in[1], script, strlen(script)) < 0) {
+        die("write");
+    }
+    close(in[1]);
+    while ((n = read(out[0], buffer, sizeof(buffer))) > 0) {
+    }
+    close(out[0]);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed on: %s\n", cli, script);
+        exit(1);
+    }
+}
+
+static void run_cli(const char *cli) {
+    size_t i;
+
+    for (i = 0; i < SCRIPT_COUNT; i++) {
+        run_cli_once(cli, scripts[i]);
+    }
+}
+
+/* Mean microseconds per script over `rounds` rounds of all the scripts */
+static double measure_library(void (*round)(void), int rounds) {
+    double start = now_micros();
+    int i;
+
+    for (i = 0; i < rounds; i++) {
+        round();
+    }
+    return (now_micros() - start) / ((double)rounds * SCRIPT_COUNT);
+}
+
+int main(int argc, char **argv) {
+    const char *cli;
+    int iterations, cli_rounds, i;
+    double library, batch, spawned, start;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s PATH_TO_BASH_AST [ITERATIONS]\n", argv[0]);
+        return 2;
+    }
+    cli = argv[1];
+    iterations = (argc > 2) ? atoi(argv[2]) : 2000;
+    if (iterations <= 0) {
+        iterations = 2000;
+    }
+    /* Spawning is orders of magnitude slower; a smaller sample will do */
+    cli_rounds = (iterations / 20 > 0) ? iterations / 20 : 1;
+
+    printf("libbash_ast %s, %zu scripts\n", bash_ast_version(), SCRIPT_COUNT);
+
+    /* Warm up: the first call initializes bash */
+    run_library();
+
+    library = measure_library(run_library, iterations);
+    batch = measure_library(run_batch, iterations);
+
+    start = now_micros();
+    for (i = 0; i < cli_rounds; i++) {
+        run_cli(cli);
+    }
+    spawned = (now_micros() - start) / ((double)cli_rounds * SCRIPT_COUNT);
+
+    printf("%-28s %10.2f us/script\n", "bash_ast_parse_json", library);
+    printf("%-28s %10.2f us/script\n", "bash_ast_parse_json_batch", batch);
+    printf("%-28s %10.2f us/script\n", "bash-ast -c (spawned)", spawned);
+    printf("in-process is %.0fx faster than spawning\n", spawned / library);
+    return 0;
+}
@@ -4,10 +4,18 @@
 //!
 //! Results are saved to target/criterion/ with HTML reports.
 
-use bash_ast::{init, parse, parse_to_json};
+use bash_ast::{
+    arena::NodeKind, from_json_with_limits, init, parse, parse_fast, parse_file, parse_flat,
+    parse_interned, parse_iter, parse_lines, parse_to_json, parse_to_json_writer,
+    parse_with_limits, to_bash, to_json, view::RedirectTargetRef, AstArena, Command, CommandRef,
+    IncrementalDocument, Interner, ParseLimits, ParseSession, ParsedScript, ParserPool,
+};
 use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use std::alloc::{GlobalAlloc, Layout, System};
 use std::hint::black_box;
+use std::sync::atomic::{AtomicUsize, Ordering};
 use std::sync::Once;
+use std::thread;
 
 static INIT: Once = Once::new();
 
@@ -17,6 +25,182 @@ fn setup() {
     });
 }
 
+/// Limits for the long generated scripts below: bash nests each statement
+/// a list level deeper than the one before, so they go past `MAX_DEPTH`
+fn long_script_limits() -> ParseLimits {
+    ParseLimits::default().with_max_depth(usize::MAX)
+}
+
+// ============================================================================
+// Allocation Accounting
+// ============================================================================
+
+/// Global allocator that counts Rust heap traffic, so benchmarks can report
+/// allocations and bytes per operation alongside timings
+struct CountingAlloc;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+static ALLOCATED_BYTES: AtomicUsize = AtomicUsize::new(0);
+static LIVE_BYTES: AtomicUsize = AtomicUsize::new(0);
+static PEAK_LIVE_BYTES: AtomicUsize = AtomicUsize::new(0);
+
+fn track_live(grow: usize, shrink: usize) {
+    let live = LIVE_BYTES.fetch_add(grow, Ordering::Relaxed) + grow;
+    LIVE_BYTES.fetch_sub(shrink, Ordering::Relaxed);
+    PEAK_LIVE_BYTES.fetch_max(live, Ordering::Relaxed);
+}
+
+// SAFETY: forwards every call to the system allocator unchanged
+unsafe impl GlobalAlloc for CountingAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        ALLOCATED_BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        track_live(layout.size(), 0);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        track_live(0, layout.size());
+        System.dealloc(ptr, layout);
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        ALLOCATED_BYTES.fetch_add(new_size, Ordering::Relaxed);
+        track_live(new_size, layout.size());
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAlloc = CountingAlloc;
+
+/// Heap allocations and bytes requested while running `f` once
+fn count_allocations<R>(f: impl FnOnce() -> R) -> (usize, usize) {
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed);
+    let bytes = ALLOCATED_BYTES.load(Ordering::Relaxed);
+    black_box(f());
+    (
+        ALLOCATIONS.load(Ordering::Relaxed) - allocations,
+        ALLOCATED_BYTES.load(Ordering::Relaxed) - bytes,
+    )
+}
+
+/// Peak Rust heap bytes in use while running `f`, above the level before it
+fn peak_heap<R>(f: impl FnOnce() -> R) -> usize {
+    let base = LIVE_BYTES.load(Ordering::Relaxed);
+    PEAK_LIVE_BYTES.store(base, Ordering::Relaxed);
+    black_box(f());
+    PEAK_LIVE_BYTES.load(Ordering::Relaxed) - base
+}
+
+/// Counts calls into glibc's malloc, from bash's C code and Rust alike
+///
+/// The statically linked bash objects and std's `System` allocator bind to
+/// these definitions instead of glibc's. Allocations glibc makes internally
+/// are not counted.
+#[cfg(all(target_os = "linux", target_env = "gnu"))]
+mod libc_calls {
+    use std::ffi::c_void;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    pub static MALLOCS: AtomicUsize = AtomicUsize::new(0);
+    pub static FREES: AtomicUsize = AtomicUsize::new(0);
+
+    extern "C" {
+        fn __libc_malloc(size: usize) -> *mut c_void;
+        fn __libc_calloc(count: usize, size: usize) -> *mut c_void;
+        fn __libc_realloc(ptr: *mut c_void, size: usize) -> *mut c_void;
+        fn __libc_free(ptr: *mut c_void);
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn malloc(size: usize) -> *mut c_void {
+        MALLOCS.fetch_add(1, Ordering::Relaxed);
+        __libc_malloc(size)
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn calloc(count: usize, size: usize) -> *mut c_void {
+        MALLOCS.fetch_add(1, Ordering::Relaxed);
+        __libc_calloc(count, size)
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn realloc(ptr: *mut c_void, size: usize) -> *mut c_void {
+        if ptr.is_null() {
+            MALLOCS.fetch_add(1, Ordering::Relaxed);
+        }
+        __libc_realloc(ptr, size)
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn free(ptr: *mut c_void) {
+        if !ptr.is_null() {
+            FREES.fetch_add(1, Ordering::Relaxed);
+        }
+        __libc_free(ptr);
+    }
+}
+
+/// malloc and free calls (C and Rust) made while running `f` once, where
+/// they can be counted
+#[cfg(all(target_os = "linux", target_env = "gnu"))]
+#[allow(clippy::unnecessary_wraps)]
+fn count_libc_calls<R>(f: impl FnOnce() -> R) -> Option<(usize, usize)> {
+    use libc_calls::{FREES, MALLOCS};
+
+    let mallocs = MALLOCS.load(Ordering::Relaxed);
+    let frees = FREES.load(Ordering::Relaxed);
+    black_box(f());
+    Some((
+        MALLOCS.load(Ordering::Relaxed) - mallocs,
+        FREES.load(Ordering::Relaxed) - frees,
+    ))
+}
+
+#[cfg(not(all(target_os = "linux", target_env = "gnu")))]
+fn count_libc_calls<R>(f: impl FnOnce() -> R) -> Option<(usize, usize)> {
+    black_box(f());
+    None
+}
+
+// ============================================================================
+// Node Cache Benchmarks
+// ============================================================================
+
+/// Per-parse malloc/free calls with bash's word caches empty and warm
+///
+/// Registered first in `criterion_group!`: the caches are process-wide, so
+/// only the very first parse in the process sees them empty, which is how
+/// every parse behaved before the caches were enabled.
+fn bench_node_caches(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("node_caches");
+    group.sample_size(10);
+
+    let script = provisioning_script(1_000);
+    let limits = long_script_limits();
+    let (rust_allocs, _) = count_allocations(|| parse_with_limits(&script, &limits));
+    let cold = count_libc_calls(|| parse_with_limits(&script, &limits));
+    let warm = count_libc_calls(|| parse_with_limits(&script, &limits));
+    if let (Some((cold_mallocs, cold_frees)), Some((warm_mallocs, warm_frees))) = (cold, warm) {
+        eprintln!(
+            "node_caches/provisioning_1000: {cold_mallocs} mallocs / {cold_frees} frees for the \
+             first parse, {warm_mallocs} / {warm_frees} once the caches are warm \
+             ({rust_allocs} of the allocations are Rust's)"
+        );
+    }
+
+    group.throughput(Throughput::Bytes(script.len() as u64));
+    group.bench_function("parse_warm", |b| {
+        b.iter(|| parse_with_limits(black_box(&script), &limits));
+    });
+
+    group.finish();
+}
+
 // ============================================================================
 // Simple Command Benchmarks
 // ============================================================================
@@ -210,6 +394,19 @@ fn bench_scaling(c: &mut Criterion) {
         });
     }
 
+    // Scale by pipeline length. Bash's grammar stack limits a pipeline to
+    // about 3,300 stages; conversion should stay linear up to there
+    for n in &[10usize, 100, 1_000, 3_000] {
+        let script = vec!["cat"; *n].join(" | ");
+        let (allocations, bytes) = count_allocations(|| parse(&script).unwrap());
+        eprintln!("scaling/pipe_{n}: {allocations} allocations, {bytes} heap bytes per parse");
+
+        group.throughput(Throughput::Elements(*n as u64));
+        group.bench_with_input(BenchmarkId::new("pipe_n", n), &script, |b, script| {
+            b.iter(|| parse(black_box(script)));
+        });
+    }
+
     // Scale by nesting depth
     for depth in &[5, 10, 20, 50] {
         let mut script = String::new();
@@ -255,16 +452,1041 @@ fn bench_json_output(c: &mut Criterion) {
         b.iter(|| parse_to_json(black_box(script), true));
     });
 
+    // The typed AST serialized with serde, against JSON written straight
+    // from bash's tree
+    let limits = long_script_limits();
+    for n in &[10usize, 1_000] {
+        let script = provisioning_script(*n);
+
+        let (via_ast, _) = count_allocations(|| {
+            serde_json::to_string(&parse_with_limits(&script, &limits).unwrap())
+        });
+        let (direct, _) =
+            count_allocations(|| parse_to_json_writer(&script, &limits, false, &mut Vec::new()));
+        eprintln!(
+            "json_output/{n}: {via_ast} Rust allocations via the AST, {direct} written directly"
+        );
+
+        group.throughput(Throughput::Bytes(script.len() as u64));
+        group.bench_with_input(BenchmarkId::new("via_ast", n), &script, |b, script| {
+            let mut json = Vec::new();
+            b.iter(|| {
+                json.clear();
+                let ast = parse_with_limits(black_box(script), &limits).unwrap();
+                serde_json::to_writer(&mut json, &ast).unwrap();
+            });
+        });
+        group.bench_with_input(BenchmarkId::new("direct", n), &script, |b, script| {
+            let mut json = Vec::new();
+            b.iter(|| {
+                json.clear();
+                parse_to_json_writer(black_box(script), &limits, false, &mut json).unwrap();
+            });
+        });
+    }
+
+    group.finish();
+}
+
+// ============================================================================
+// Query Benchmarks
+// ============================================================================
+
+/// Count simple commands named `name` in a typed AST
+fn count_named(cmd: &Command, name: &str) -> usize {
+    let own = match cmd {
+        Command::Simple { words, .. } => usize::from(words.first().is_some_and(|w| w.word == name)),
+        _ => 0,
+    };
+    let children: usize = match cmd {
+        Command::Simple { .. } | Command::Arithmetic { .. } | Command::Conditional { .. } => 0,
+        Command::Pipeline { commands, .. } => commands.iter().map(|c| count_named(c, name)).sum(),
+        Command::List { left, right, .. } => count_named(left, name) + count_named(right, name),
+        Command::Sequence { items, .. } => items.iter().map(|(c, _)| count_named(c, name)).sum(),
+        Command::While { test, body, .. } | Command::Until { test, body, .. } => {
+            count_named(test, name) + count_named(body, name)
+        }
+        Command::If {
+            condition,
+            then_branch,
+            else_branch,
+            ..
+        } => {
+            count_named(condition, name)
+                + count_named(then_branch, name)
+                + else_branch.as_ref().map_or(0, |c| count_named(c, name))
+        }
+        Command::Case { clauses, .. } => clauses
+            .iter()
+            .filter_map(|clause| clause.action.as_ref())
+            .map(|c| count_named(c, name))
+            .sum(),
+        Command::For { body, .. }
+        | Command::Select { body, .. }
+        | Command::Group { body, .. }
+        | Command::Subshell { body, .. }
+        | Command::FunctionDef { body, .. }
+        | Command::ArithmeticFor { body, .. }
+        | Command::Coproc { body, .. } => count_named(body, name),
+    };
+    own + children
+}
+
+/// Count simple commands named `name` through borrowed views
+fn count_named_view(cmd: CommandRef<'_>, name: &[u8]) -> usize {
+    let own = match cmd {
+        CommandRef::Simple(simple) => {
+            usize::from(simple.words().next().is_some_and(|w| w.as_bytes() == name))
+        }
+        _ => 0,
+    };
+    own + cmd
+        .children()
+        .map(|c| count_named_view(c, name))
+        .sum::<usize>()
+}
+
+/// Count simple commands named `name` in an arena, visiting every node
+fn count_named_arena(arena: &AstArena, name: &str) -> usize {
+    arena
+        .iter()
+        .filter(|(_, node)| match node.kind {
+            NodeKind::Simple { words, .. } => arena
+                .words(words)
+                .first()
+                .is_some_and(|w| arena.text(w.text) == name),
+            _ => false,
+        })
+        .count()
+}
+
+fn bench_query(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("query");
+
+    // Find every useradd: the typed AST converts the whole tree first, the
+    // views only read the nodes the walk visits
+    let limits = long_script_limits();
+    for n in &[10usize, 1_000] {
+        let script = provisioning_script(*n);
+
+        let (owned, _) = count_allocations(|| {
+            count_named(&parse_with_limits(&script, &limits).unwrap(), "useradd")
+        });
+        let (view, _) = count_allocations(|| {
+            count_named_view(ParsedScript::parse(&script).unwrap().command(), b"useradd")
+        });
+        eprintln!("query/{n}: {owned} Rust allocations with the AST, {view} with views");
+
+        group.throughput(Throughput::Bytes(script.len() as u64));
+        group.bench_with_input(BenchmarkId::new("owned_ast", n), &script, |b, script| {
+            b.iter(|| {
+                count_named(
+                    &parse_with_limits(black_box(script), &limits).unwrap(),
+                    "useradd",
+                )
+            });
+        });
+        group.bench_with_input(BenchmarkId::new("view", n), &script, |b, script| {
+            b.iter(|| {
+                let parsed = ParsedScript::parse(black_box(script)).unwrap();
+                count_named_view(parsed.command(), b"useradd")
+            });
+        });
+    }
+
+    group.finish();
+}
+
+// ============================================================================
+// Fast Path Benchmarks
+// ============================================================================
+
+/// Shell history: mostly one-liners the fast path takes, and some it
+/// leaves to bash
+const HISTORY: &[&str] = &[
+    "ls -la",
+    "git status",
+    "git add -p",
+    "git commit -m 'fix off-by-one in the pager'",
+    "git log --oneline -20 | grep -i fix",
+    "cd build; cmake ..; make -j8",
+    "make && sudo make install",
+    "cat access.log | grep 404 | sort | uniq -c | sort -rn | head",
+    "docker ps -a --format \"table {{.Names}}\"",
+    "kubectl get pods -n kube-system -o wide",
+    "ssh deploy@web-1 uptime",
+    "cargo test --release -- --nocapture",
+    "echo $PATH | tr : '\\n'",
+    "for f in *.log; do gzip \"$f\"; done",
+    "tail -f /var/log/syslog > /tmp/sys.log &",
+];
+
+fn bench_fast_path(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("fast_path");
+
+    let limits = ParseLimits::default();
+    let bytes: usize = HISTORY.iter().map(|line| line.len()).sum();
+    group.throughput(Throughput::Bytes(bytes as u64));
+    group.bench_function("bash", |b| {
+        b.iter(|| {
+            for line in HISTORY {
+                black_box(parse_with_limits(black_box(line), &limits).unwrap());
+            }
+        });
+    });
+    group.bench_function("parse_fast", |b| {
+        b.iter(|| {
+            for line in HISTORY {
+                black_box(parse_fast(black_box(line), &limits).unwrap());
+            }
+        });
+    });
+
+    group.finish();
+}
+
+/// A history log of `n` records cycling through [`HISTORY`], with a line
+/// bash rejects every 16 records
+fn history_log(n: usize) -> String {
+    (0..n)
+        .map(|i| {
+            let line = if i % 16 == 15 {
+                "echo 'unterminated"
+            } else {
+                HISTORY[i % HISTORY.len()]
+            };
+            format!("{line}\n")
+        })
+        .collect()
+}
+
+fn bench_lines(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("lines");
+    group.sample_size(20);
+
+    for n in &[1_000usize, 10_000] {
+        let log = history_log(*n);
+        group.throughput(Throughput::Elements(*n as u64));
+        group.bench_with_input(BenchmarkId::new("parse_per_line", n), &log, |b, log| {
+            b.iter(|| {
+                for line in black_box(log).lines() {
+                    drop(black_box(parse(line)));
+                }
+            });
+        });
+        group.bench_with_input(BenchmarkId::new("parse_lines", n), &log, |b, log| {
+            b.iter(|| parse_lines(black_box(log.as_bytes())).for_each(|r| drop(black_box(r))));
+        });
+    }
+
+    group.finish();
+}
+
+// ============================================================================
+// Interning Benchmarks
+// ============================================================================
+
+/// Rust heap bytes still held by what `f` returns
+fn retained_heap<R>(f: impl FnOnce() -> R) -> (R, usize) {
+    let base = LIVE_BYTES.load(Ordering::Relaxed);
+    let result = f();
+    (
+        result,
+        LIVE_BYTES.load(Ordering::Relaxed).saturating_sub(base),
+    )
+}
+
+fn bench_interning(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("interning");
+    group.sample_size(10);
+
+    // Many small scripts kept in memory at once, the way a linter or
+    // indexer holds a repository: the same commands, flags and paths recur
+    // in every one
+    let scripts: Vec<String> = (0..10_000).map(provisioning_script_step).collect();
+    let limits = ParseLimits::default();
+
+    let (asts, plain_bytes) = retained_heap(|| {
+        scripts
+            .iter()
+            .map(|script| parse(script).unwrap())
+            .collect::<Vec<_>>()
+    });
+    drop(asts);
+    let ((asts, interner), interned_bytes) = retained_heap(|| {
+        let mut interner = Interner::new();
+        let asts: Vec<_> = scripts
+            .iter()
+            .map(|script| parse_interned(script, &limits, &mut interner).unwrap())
+            .collect();
+        (asts, interner)
+    });
+    let stats = interner.stats();
+    eprintln!(
+        "interning/10000: {plain_bytes} bytes resident with parse(), {interned_bytes} with \
+         parse_interned() ({} symbols, {:.1}% hits)",
+        stats.symbols,
+        stats.hit_rate() * 100.0
+    );
+    drop((asts, interner));
+
+    group.throughput(Throughput::Elements(scripts.len() as u64));
+    group.bench_function("parse", |b| {
+        b.iter(|| {
+            scripts
+                .iter()
+                .map(|script| parse(black_box(script)).unwrap())
+                .collect::<Vec<_>>()
+        });
+    });
+    group.bench_function("parse_interned", |b| {
+        b.iter(|| {
+            let mut interner = Interner::new();
+            scripts
+                .iter()
+                .map(|script| parse_interned(black_box(script), &limits, &mut interner).unwrap())
+                .collect::<Vec<_>>()
+        });
+    });
+
+    group.finish();
+}
+
+// ============================================================================
+// Arena Benchmarks
+// ============================================================================
+
+/// Every snapshot script, and the largest one repeated into one long script
+fn snapshot_corpus() -> Vec<(String, String)> {
+    let dir = concat!(env!("CARGO_MANIFEST_DIR"), "/tests/snapshots");
+    let mut scripts: Vec<_> = std::fs::read_dir(dir)
+        .expect("failed to read snapshots")
+        .filter_map(Result::ok)
+        .map(|entry| entry.path())
+        .filter(|path| path.extension().is_some_and(|ext| ext == "sh"))
+        .collect();
+    scripts.sort();
+
+    let all: String = scripts
+        .iter()
+        .map(|path| std::fs::read_to_string(path).unwrap() + "\n")
+        .collect();
+    let largest = std::fs::read_to_string(format!("{dir}/50_comprehensive_script.sh")).unwrap();
+    vec![
+        ("all_snapshots".to_string(), all),
+        (
+            "comprehensive_x100".to_string(),
+            format!("{largest}\n").repeat(100),
+        ),
+    ]
+}
+
+fn bench_arena(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("arena");
+
+    // The boxed tree against the same tree flattened into an arena: a full
+    // walk, a deep copy and a drop of each
+    let limits = long_script_limits();
+    for (name, script) in snapshot_corpus() {
+        let cmd = parse_with_limits(&script, &limits).unwrap();
+        let arena = AstArena::try_from(&cmd).unwrap();
+
+        let (boxed_allocs, _) = count_allocations(|| cmd.clone());
+        let (arena_allocs, _) = count_allocations(|| arena.clone());
+        eprintln!(
+            "arena/{name}: {} nodes, {boxed_allocs} allocations per clone of the tree, \
+             {arena_allocs} of the arena",
+            arena.node_count()
+        );
+
+        group.bench_with_input(BenchmarkId::new("walk_boxed", &name), &cmd, |b, cmd| {
+            b.iter(|| count_named(black_box(cmd), "echo"));
+        });
+        group.bench_with_input(BenchmarkId::new("walk_arena", &name), &arena, |b, arena| {
+            b.iter(|| count_named_arena(black_box(arena), "echo"));
+        });
+        group.bench_with_input(BenchmarkId::new("clone_boxed", &name), &cmd, |b, cmd| {
+            b.iter(|| black_box(cmd).clone());
+        });
+        group.bench_with_input(
+            BenchmarkId::new("clone_arena", &name),
+            &arena,
+            |b, arena| {
+                b.iter(|| black_box(arena).clone());
+            },
+        );
+        group.bench_with_input(BenchmarkId::new("drop_boxed", &name), &cmd, |b, cmd| {
+            b.iter_batched(|| cmd.clone(), drop, criterion::BatchSize::LargeInput);
+        });
+        group.bench_with_input(BenchmarkId::new("drop_arena", &name), &arena, |b, arena| {
+            b.iter_batched(|| arena.clone(), drop, criterion::BatchSize::LargeInput);
+        });
+        group.bench_with_input(BenchmarkId::new("from_command", &name), &cmd, |b, cmd| {
+            b.iter(|| AstArena::try_from(black_box(cmd)));
+        });
+        group.bench_with_input(BenchmarkId::new("to_command", &name), &arena, |b, arena| {
+            b.iter(|| black_box(arena).to_command());
+        });
+    }
+
+    group.finish();
+}
+
+// ============================================================================
+// Session Benchmarks
+// ============================================================================
+
+fn bench_session(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("session");
+
+    // A stream of small scripts parsed one at a time and then discarded, the
+    // way a service checks each command it is sent
+    let scripts: Vec<String> = (0..1_000).map(provisioning_script_step).collect();
+    let mut session = ParseSession::new();
+    for script in &scripts {
+        session.parse_into(script).unwrap();
+        session.parse_into_arena(script).unwrap();
+    }
+
+    let per_script =
+        |(allocations, bytes): (usize, usize)| (allocations / scripts.len(), bytes / scripts.len());
+    let (parse_allocs, parse_bytes) = per_script(count_allocations(|| {
+        for script in &scripts {
+            drop(parse(script).unwrap());
+        }
+    }));
+    let (session_allocs, session_bytes) = per_script(count_allocations(|| {
+        for script in &scripts {
+            session.parse_into(script).unwrap();
+        }
+    }));
+    let (arena_allocs, arena_bytes) = per_script(count_allocations(|| {
+        for script in &scripts {
+            session.parse_into_arena(script).unwrap();
+        }
+    }));
+    eprintln!(
+        "session/1000: per script, {parse_allocs} allocations ({parse_bytes} bytes) with \
+         parse(), {session_allocs} ({session_bytes}) with parse_into(), {arena_allocs} \
+         ({arena_bytes}) with parse_into_arena()"
+    );
+
+    group.throughput(Throughput::Elements(scripts.len() as u64));
+    group.bench_function("parse", |b| {
+        b.iter(|| {
+            for script in &scripts {
+                drop(parse(black_box(script)).unwrap());
+            }
+        });
+    });
+    group.bench_function("parse_into", |b| {
+        b.iter(|| {
+            for script in &scripts {
+                black_box(session.parse_into(black_box(script)).unwrap());
+            }
+        });
+    });
+    group.bench_function("parse_into_arena", |b| {
+        b.iter(|| {
+            for script in &scripts {
+                black_box(session.parse_into_arena(black_box(script)).unwrap());
+            }
+        });
+    });
+
+    group.finish();
+}
+
+// ============================================================================
+// Visitor Benchmarks
+// ============================================================================
+
+/// Count simple commands named `name` in the JSON value of an AST, the way
+/// tools did before the visitor API
+fn count_named_json(value: &serde_json::Value, name: &str) -> usize {
+    let mut count = 0;
+    let mut stack = vec![value];
+    while let Some(value) = stack.pop() {
+        match value {
+            serde_json::Value::Object(map) => {
+                if map.get("type").is_some_and(|t| t == "simple")
+                    && map["words"][0]["word"].as_str() == Some(name)
+                {
+                    count += 1;
+                }
+                stack.extend(map.values());
+            }
+            serde_json::Value::Array(items) => stack.extend(items),
+            _ => {}
+        }
+    }
+    count
+}
+
+/// Count simple commands named `name` through [`Command::simple_commands()`]
+fn count_named_walk(cmd: &Command, name: &str) -> usize {
+    cmd.simple_commands()
+        .filter(|cmd| match cmd {
+            Command::Simple { words, .. } => words.first().is_some_and(|w| w.word == name),
+            _ => false,
+        })
+        .count()
+}
+
+fn bench_visit(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("visit");
+
+    // The same query through a JSON value of the tree, and with the walk
+    // iterator; both count the commands inside substitutions
+    let limits = long_script_limits();
+    for (name, script) in snapshot_corpus() {
+        let cmd = parse_with_limits(&script, &limits).unwrap();
+        let expected = count_named_walk(&cmd, "echo");
+        assert_eq!(
+            count_named_json(&serde_json::to_value(&cmd).unwrap(), "echo"),
+            expected
+        );
+
+        let (json_allocs, _) =
+            count_allocations(|| count_named_json(&serde_json::to_value(&cmd).unwrap(), "echo"));
+        let (walk_allocs, _) = count_allocations(|| count_named_walk(&cmd, "echo"));
+        eprintln!(
+            "visit/{name}: {expected} matches, {json_allocs} allocations through JSON, \
+             {walk_allocs} through the walk"
+        );
+
+        group.bench_with_input(BenchmarkId::new("json_value", &name), &cmd, |b, cmd| {
+            b.iter(|| count_named_json(&serde_json::to_value(black_box(cmd)).unwrap(), "echo"));
+        });
+        group.bench_with_input(BenchmarkId::new("walk", &name), &cmd, |b, cmd| {
+            b.iter(|| count_named_walk(black_box(cmd), "echo"));
+        });
+    }
+
+    group.finish();
+}
+
+// ============================================================================
+// Input Path Benchmarks
+// ============================================================================
+
+/// A script of roughly `size` bytes that is almost entirely comments
+///
+/// The AST stays tiny, so any heap traffic that grows with the input is a
+/// copy of the script itself.
+fn comment_heavy_script(size: usize) -> String {
+    let line = "# generated provisioning step: nothing to see here, just filler text\n";
+    let mut script = String::with_capacity(size + 64);
+    while script.len() < size {
+        script.push_str(line);
+    }
+    script.push_str("echo done\n");
+    script
+}
+
+fn bench_input_path(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("input_path");
+    group.sample_size(20);
+
+    for size_kib in &[64usize, 1024, 8192] {
+        let script = comment_heavy_script(size_kib * 1024);
+
+        // Report how many bytes the Rust side copies per parse. The script is
+        // read straight from the borrowed &str, so this should stay flat as
+        // the input grows (it used to include a CString copy of the script).
+        let (allocations, bytes) = count_allocations(|| parse(&script));
+        eprintln!(
+            "input_path/{size_kib}KiB: {} script bytes, {allocations} allocations, \
+             {bytes} heap bytes per parse",
+            script.len()
+        );
+
+        group.throughput(Throughput::Bytes(script.len() as u64));
+        group.bench_with_input(
+            BenchmarkId::new("comments_kib", size_kib),
+            &script,
+            |b, script| {
+                b.iter(|| parse(black_box(script)));
+            },
+        );
+
+        // Reading the file into a String vs mapping it with parse_file()
+        let path = std::env::temp_dir().join(format!("bash-ast-bench-{size_kib}.sh"));
+        std::fs::write(&path, &script).expect("failed to write bench script");
+        let limits = ParseLimits::unlimited();
+
+        group.bench_with_input(
+            BenchmarkId::new("read_then_parse_kib", size_kib),
+            &path,
+            |b, path| {
+                b.iter(|| parse(&std::fs::read_to_string(path).unwrap()));
+            },
+        );
+        group.bench_with_input(
+            BenchmarkId::new("parse_file_kib", size_kib),
+            &path,
+            |b, path| {
+                // SAFETY: the bench's file isn't changed until it is removed
+                b.iter(|| unsafe { parse_file(path, &limits) });
+            },
+        );
+
+        let _ = std::fs::remove_file(&path);
+    }
+
+    group.finish();
+}
+
+/// A script of `count` here-documents of roughly `size` bytes each, with
+/// `accent` in every line of their bodies
+fn heredoc_script(count: usize, size: usize, accent: &[u8]) -> Vec<u8> {
+    let mut line = b"install -m 0644 config/".to_vec();
+    line.extend_from_slice(accent);
+    line.extend_from_slice(b" /etc/app # d\xc3\xa9ploiement\n");
+    let mut script = Vec::new();
+    for i in 0..count {
+        script.extend_from_slice(format!("cat > /tmp/part{i} <<'EOF'\n").as_bytes());
+        for _ in 0..size / line.len() {
+            script.extend_from_slice(&line);
+        }
+        script.extend_from_slice(b"EOF\n");
+    }
+    script
+}
+
+/// Total length of every word and redirect target, read as bytes
+fn text_bytes(cmd: CommandRef<'_>) -> usize {
+    let own = match cmd {
+        CommandRef::Simple(simple) => {
+            simple.words().map(|w| w.as_bytes().len()).sum::<usize>()
+                + simple
+                    .redirects()
+                    .map(|r| match r.target() {
+                        RedirectTargetRef::File(text) => text.to_bytes().len(),
+                        RedirectTargetRef::Fd(_) => 0,
+                    })
+                    .sum::<usize>()
+        }
+        _ => 0,
+    };
+    own + cmd.children().map(text_bytes).sum::<usize>()
+}
+
+fn bench_bytes(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("bytes");
+    group.sample_size(20);
+
+    // Here-document heavy scripts, in UTF-8 and in Latin-1. A &str parse
+    // has to validate the script first, and Latin-1 has to be decoded
+    // lossily before it can be parsed at all; parse_bytes() takes either
+    // as it is and leaves the text as bytes
+    for (encoding, accent) in [("utf8", &b"caf\xc3\xa9"[..]), ("latin1", &b"caf\xe9"[..])] {
+        let script = heredoc_script(16, 64 * 1024, accent);
+        let limits = ParseLimits::unlimited();
+
+        let (lossy_allocs, lossy_bytes) = count_allocations(|| {
+            ParsedScript::parse_with_limits(&String::from_utf8_lossy(&script), &limits)
+        });
+        let (bytes_allocs, bytes_bytes) =
+            count_allocations(|| ParsedScript::parse_bytes_with_limits(&script, &limits));
+        eprintln!(
+            "bytes/{encoding}: {} script bytes, {lossy_allocs} allocations and {lossy_bytes} \
+             heap bytes decoding first, {bytes_allocs} and {bytes_bytes} with parse_bytes()",
+            script.len()
+        );
+
+        group.throughput(Throughput::Bytes(script.len() as u64));
+        group.bench_with_input(
+            BenchmarkId::new("lossy_str", encoding),
+            &script,
+            |b, script| {
+                b.iter(|| {
+                    let text = String::from_utf8_lossy(black_box(script));
+                    text_bytes(
+                        ParsedScript::parse_with_limits(&text, &limits)
+                            .unwrap()
+                            .command(),
+                    )
+                });
+            },
+        );
+        group.bench_with_input(
+            BenchmarkId::new("parse_bytes", encoding),
+            &script,
+            |b, script| {
+                b.iter(|| {
+                    let parsed = ParsedScript::parse_bytes_with_limits(black_box(script), &limits);
+                    text_bytes(parsed.unwrap().command())
+                });
+            },
+        );
+        if let Ok(text) = std::str::from_utf8(&script) {
+            group.bench_with_input(BenchmarkId::new("owned_ast", encoding), text, |b, text| {
+                b.iter(|| parse_with_limits(black_box(text), &limits).unwrap());
+            });
+        }
+    }
+
+    group.finish();
+}
+
+// ============================================================================
+// Streaming Benchmarks
+// ============================================================================
+
+/// A generated provisioning-style script with `n` top-level commands
+fn provisioning_script(n: usize) -> String {
+    (0..n).map(provisioning_script_step).collect()
+}
+
+/// The `i`th command of [`provisioning_script()`]
+fn provisioning_script_step(i: usize) -> String {
+    format!(
+        "if ! id user{i} >/dev/null 2>&1; then\n  useradd -m user{i} && \
+         echo \"created user{i}\" | tee -a /var/log/provision.log\nfi\n"
+    )
+}
+
+fn bench_streaming(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("streaming");
+    group.sample_size(10);
+
+    for n in &[1_000usize, 10_000] {
+        let script = provisioning_script(*n);
+
+        let limits = long_script_limits();
+        let whole = peak_heap(|| parse_with_limits(&script, &limits).map(drop));
+        let streamed = peak_heap(|| parse_iter(&script).for_each(|cmd| drop(black_box(cmd))));
+        eprintln!(
+            "streaming/{n}: {} script bytes, peak Rust heap {whole} bytes for parse(), \
+             {streamed} bytes for parse_iter()",
+            script.len()
+        );
+
+        group.throughput(Throughput::Bytes(script.len() as u64));
+        group.bench_with_input(BenchmarkId::new("parse_whole", n), &script, |b, script| {
+            b.iter(|| parse_with_limits(black_box(script), &limits).map(drop));
+        });
+        group.bench_with_input(
+            BenchmarkId::new("parse_iter_all", n),
+            &script,
+            |b, script| {
+                b.iter(|| parse_iter(black_box(script)).for_each(|cmd| drop(black_box(cmd))));
+            },
+        );
+        group.bench_with_input(
+            BenchmarkId::new("parse_iter_first", n),
+            &script,
+            |b, script| {
+                b.iter(|| parse_iter(black_box(script)).next());
+            },
+        );
+    }
+
+    group.finish();
+}
+
+// ============================================================================
+// Parser Pool Benchmarks
+// ============================================================================
+
+fn bench_parser_pool(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("parser_pool");
+    group.sample_size(20);
+
+    let script = r#"
+for file in *.txt; do
+    if [[ -f "$file" ]]; then
+        cat "$file" | grep pattern || echo "No match"
+    fi
+done
+"#
+    .repeat(20);
+    let batch = 256;
+
+    // One client thread per worker, each parsing its share of the batch
+    for workers in &[1usize, 2, 4, 8] {
+        let pool = ParserPool::new(*workers).expect("failed to start parser pool");
+
+        group.throughput(Throughput::Elements(batch as u64));
+        group.bench_with_input(BenchmarkId::new("workers", workers), &pool, |b, pool| {
+            b.iter(|| {
+                thread::scope(|s| {
+                    for _ in 0..*workers {
+                        s.spawn(|| {
+                            for _ in 0..batch / workers {
+                                black_box(pool.parse(&script).unwrap());
+                            }
+                        });
+                    }
+                });
+            });
+        });
+    }
+
+    group.finish();
+}
+
+// ============================================================================
+// Parser Instance Benchmarks
+// ============================================================================
+
+/// Compare `parse()` on one thread against N threads with their own
+/// `ParserInstance`, over the same batch of scripts
+#[cfg(target_os = "linux")]
+fn bench_parser_instances(c: &mut Criterion) {
+    use bash_ast::ParserInstance;
+
+    setup();
+
+    let mut group = c.benchmark_group("parser_instances");
+    group.sample_size(20);
+
+    let script = r#"
+for file in *.txt; do
+    if [[ -f "$file" ]]; then
+        cat "$file" | grep pattern || echo "No match"
+    fi
+done
+"#
+    .repeat(20);
+    let batch = 256;
+
+    group.throughput(Throughput::Elements(batch as u64));
+    group.bench_function("single_parse", |b| {
+        b.iter(|| {
+            for _ in 0..batch {
+                black_box(parse(&script).unwrap());
+            }
+        });
+    });
+
+    for threads in &[1usize, 2, 4, 8] {
+        let Ok(mut parsers) = (0..*threads)
+            .map(|_| ParserInstance::new())
+            .collect::<Result<Vec<_>, _>>()
+        else {
+            eprintln!("parser_instances: shared parser library unavailable, skipping");
+            break;
+        };
+
+        group.bench_function(BenchmarkId::new("instances", threads), |b| {
+            b.iter(|| {
+                thread::scope(|s| {
+                    for parser in &mut parsers {
+                        let script = &script;
+                        s.spawn(move || {
+                            for _ in 0..batch / threads {
+                                black_box(parser.parse(script).unwrap());
+                            }
+                        });
+                    }
+                });
+            });
+        });
+    }
+
+    group.finish();
+}
+
+#[cfg(not(target_os = "linux"))]
+fn bench_parser_instances(_c: &mut Criterion) {}
+
+// ============================================================================
+// Incremental Re-parse Benchmarks
+// ============================================================================
+
+/// An editing session on `script`: open a line after the first command
+/// past the middle, type a command into it key by key, then delete it again
+fn edit_session(script: &str) -> Vec<(std::ops::Range<usize>, String)> {
+    let at = script[script.len() / 2..].find("\nfi\n").unwrap() + script.len() / 2 + 4;
+    let typed = "apt-get install -y nginx";
+
+    let mut edits = vec![(at..at, "\n".to_string())];
+    for (i, c) in typed.char_indices() {
+        edits.push((at + i..at + i, c.to_string()));
+    }
+    for i in (0..typed.len()).rev() {
+        edits.push((at + i..at + i + 1, String::new()));
+    }
+    edits.push((at..at + 1, String::new()));
+    edits
+}
+
+fn bench_incremental(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("incremental");
+    group.sample_size(10);
+
+    // About 10k lines
+    let script = provisioning_script(3_334);
+    let limits = long_script_limits();
+    let edits = edit_session(&script);
+    group.throughput(Throughput::Elements(edits.len() as u64));
+
+    group.bench_function("full_reparse_per_edit", |b| {
+        b.iter(|| {
+            let mut text = script.clone();
+            for (range, replacement) in &edits {
+                text.replace_range(range.clone(), replacement);
+                black_box(parse_with_limits(&text, &limits).ok());
+            }
+        });
+    });
+    group.bench_function("incremental_edit", |b| {
+        b.iter_batched(
+            || IncrementalDocument::new(script.as_str()).unwrap(),
+            |mut doc| {
+                for (range, replacement) in &edits {
+                    black_box(doc.edit(range.clone(), replacement).ok());
+                }
+                doc
+            },
+            criterion::BatchSize::LargeInput,
+        );
+    });
+
+    group.finish();
+}
+
+// ============================================================================
+// Deep Nesting Benchmarks
+// ============================================================================
+
+fn bench_deep_nesting(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("deep_nesting");
+    group.sample_size(10);
+
+    for depth in &[1_000usize, 10_000] {
+        // An `&&` chain nests one list level per command
+        let script = vec!["true"; *depth].join(" && ");
+        let limits = ParseLimits::default().with_max_depth(*depth);
+        let cmd = parse_with_limits(&script, &limits).unwrap();
+        let json = to_json(&cmd, false);
+
+        group.bench_with_input(BenchmarkId::new("parse", depth), &script, |b, s| {
+            b.iter(|| parse_with_limits(black_box(s), &limits).map(drop));
+        });
+        group.bench_with_input(BenchmarkId::new("parse_to_json", depth), &script, |b, s| {
+            b.iter(|| {
+                let mut out = Vec::with_capacity(json.len());
+                parse_to_json_writer(black_box(s), &limits, false, &mut out).unwrap();
+                out
+            });
+        });
+        group.bench_with_input(BenchmarkId::new("to_json", depth), &cmd, |b, cmd| {
+            b.iter(|| to_json(black_box(cmd), false));
+        });
+        group.bench_with_input(BenchmarkId::new("from_json", depth), &json, |b, json| {
+            b.iter(|| from_json_with_limits(black_box(json), &limits).map(drop));
+        });
+        group.bench_with_input(BenchmarkId::new("to_bash", depth), &cmd, |b, cmd| {
+            b.iter(|| to_bash(black_box(cmd)));
+        });
+    }
+
+    group.finish();
+}
+
+// ============================================================================
+// Flat List Benchmarks
+// ============================================================================
+
+fn bench_flat_lists(c: &mut Criterion) {
+    setup();
+
+    let mut group = c.benchmark_group("flat_lists");
+    group.sample_size(20);
+
+    let limits = ParseLimits::unlimited();
+    for n in &[1_000usize, 5_000] {
+        // One statement per line: bash nests a list level per statement
+        let script = provisioning_script(*n);
+        let nested = parse_with_limits(&script, &limits).unwrap();
+        let flat = parse_flat(&script, &limits).unwrap();
+
+        let (nested_allocations, _) = count_allocations(|| parse_with_limits(&script, &limits));
+        let (flat_allocations, _) = count_allocations(|| parse_flat(&script, &limits));
+        eprintln!(
+            "flat_lists/{n}: {nested_allocations} allocations nested, {flat_allocations} flat"
+        );
+
+        group.throughput(Throughput::Elements(*n as u64));
+        group.bench_with_input(BenchmarkId::new("convert_nested", n), &script, |b, s| {
+            b.iter(|| parse_with_limits(black_box(s), &limits));
+        });
+        group.bench_with_input(BenchmarkId::new("convert_flat", n), &script, |b, s| {
+            b.iter(|| parse_flat(black_box(s), &limits));
+        });
+        group.bench_with_input(
+            BenchmarkId::new("serialize_nested", n),
+            &nested,
+            |b, cmd| {
+                b.iter(|| to_json(black_box(cmd), false));
+            },
+        );
+        group.bench_with_input(BenchmarkId::new("serialize_flat", n), &flat, |b, cmd| {
+            b.iter(|| to_json(black_box(cmd), false));
+        });
+        group.bench_with_input(BenchmarkId::new("to_bash_nested", n), &nested, |b, cmd| {
+            b.iter(|| to_bash(black_box(cmd)));
+        });
+        group.bench_with_input(BenchmarkId::new("to_bash_flat", n), &flat, |b, cmd| {
+            b.iter(|| to_bash(black_box(cmd)));
+        });
+    }
+
     group.finish();
 }
 
 criterion_group!(
     benches,
+    bench_node_caches,
     bench_simple_command,
     bench_pipelines,
     bench_control_flow,
     bench_complex_scripts,
     bench_scaling,
     bench_json_output,
+    bench_query,
+    bench_fast_path,
+    bench_lines,
+    bench_interning,
+    bench_arena,
+    bench_session,
+    bench_visit,
+    bench_input_path,
+    bench_bytes,
+    bench_streaming,
+    bench_parser_pool,
+    bench_parser_instances,
+    bench_incremental,
+    bench_deep_nesting,
+    bench_flat_lists,
 );
 criterion_main!(benches);
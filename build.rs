@@ -4,6 +4,7 @@
 // 1. Configures and builds GNU Bash if needed
 // 2. Generates Rust FFI bindings using bindgen
 // 3. Links the bash static library
+// 4. On Linux, also links a shared object used by ParserInstance
 
 use std::env;
 use std::path::{Path, PathBuf};
@@ -17,6 +18,8 @@ fn main() {
     println!("cargo:rerun-if-changed=wrapper.h");
     println!("cargo:rerun-if-changed=safe_parse.c");
     println!("cargo:rerun-if-changed=bash/");
+    // Set when libbash_parser.so was linked, for the tests that load it
+    println!("cargo:rustc-check-cfg=cfg(bash_ast_parser_so)");
 
     // Step 1: Configure and build bash if not already done
     if !bash_src.join("config.h").exists() {
@@ -36,6 +39,10 @@ fn main() {
     // Step 4: Generate bindings
     generate_bindings(&bash_src, &out_dir);
 
+    // Step 4b: Shared object for dlmopen-based ParserInstance (best effort)
+    #[cfg(target_os = "linux")]
+    create_shared_library(&out_dir);
+
     // Step 5: Link libraries
     println!("cargo:rustc-link-search=native={}", out_dir.display());
     println!("cargo:rustc-link-lib=static=bash_parser");
@@ -66,6 +73,10 @@ fn main() {
     #[cfg(target_os = "linux")]
     {
         println!("cargo:rustc-link-arg=-Wl,--allow-multiple-definition");
+        // Route the parser's calls to these through safe_parse.c
+        for function in WRAPPED_FUNCTIONS {
+            println!("cargo:rustc-link-arg=-Wl,--wrap={function}");
+        }
     }
 
     // On macOS, use -Wl,-multiply_defined,suppress for the same effect
@@ -75,10 +86,34 @@ fn main() {
     }
 }
 
+/// Functions linked with `--wrap` on Linux, so safe_parse.c sees the
+/// parser's calls to them: `print_comsub` to capture command substitution
+/// trees, `parser_error` and `internal_warning` to record syntax errors and
+/// keep quiet parses off stderr, and the rest to record where words,
+/// redirects and some commands end
+#[cfg(target_os = "linux")]
+const WRAPPED_FUNCTIONS: &[&str] = &[
+    "print_comsub",
+    "parser_error",
+    "internal_warning",
+    "alloc_word_desc",
+    "make_redirection",
+    "make_case_command",
+    "make_arith_command",
+    "make_cond_command",
+];
+
 fn configure_bash(bash_src: &PathBuf) {
     eprintln!("Configuring bash...");
 
-    let status = Command::new("./configure")
+    let mut configure = Command::new("./configure");
+
+    // Position-independent objects can also be linked into the shared
+    // object that ParserInstance loads
+    #[cfg(target_os = "linux")]
+    configure.env("CFLAGS", "-g -O2 -fPIC");
+
+    let status = configure
         .current_dir(bash_src)
         .args([
             "--disable-nls",
@@ -136,7 +171,17 @@ fn compile_safe_parse(manifest_dir: &Path, bash_src: &Path, out_dir: &Path) {
     let safe_parse_c = manifest_dir.join("safe_parse.c");
 
     // Use the cc crate for better cross-platform support
-    cc::Build::new()
+    let mut build = cc::Build::new();
+
+    // Linux links with --wrap (see WRAPPED_FUNCTIONS), so safe_parse.c can
+    // capture command substitution trees, syntax errors and source positions
+    #[cfg(target_os = "linux")]
+    build
+        .define("BASH_AST_WRAP_PRINT_COMSUB", None)
+        .define("BASH_AST_WRAP_PARSER_ERROR", None)
+        .define("BASH_AST_WRAP_POSITIONS", None);
+
+    build
         .file(&safe_parse_c)
         .define("HAVE_CONFIG_H", None)
         .define("SHELL", None)
@@ -267,6 +312,64 @@ fn create_static_library(bash_src: &Path, out_dir: &Path) {
     eprintln!("Created static library at {}", lib_path.display());
 }
 
+/// Link libbash_parser.a and safe_parse into libbash_parser.so
+///
+/// `ParserInstance` loads this into separate link-map namespaces. Failure is
+/// not fatal: bash trees configured without -fPIC can't be linked this way,
+/// and only `ParserInstance` needs the shared object.
+#[cfg(target_os = "linux")]
+fn create_shared_library(out_dir: &Path) {
+    let so_path = out_dir.join("libbash_parser.so");
+
+    // Entry points ParserInstance resolves with dlsym (see src/instance.rs),
+    // which pull in everything else they need from the archives
+    let exported = [
+        "safe_parse_buffer",
+        "safe_parse_input_had_nul",
+        "safe_parse_error",
+        "safe_parse_set_budget",
+        "safe_parse_budget_exceeded",
+        "safe_parse_set_cancel",
+        "dispose_command",
+        "interactive",
+        "interactive_shell",
+        "login_shell",
+        "posixly_correct",
+        "shell_initialized",
+        "startup_state",
+        "parsing_command",
+    ];
+
+    let mut cc_cmd = Command::new(env::var("CC").unwrap_or_else(|_| "cc".to_string()));
+    cc_cmd.arg("-shared").arg("-o").arg(&so_path);
+    for symbol in exported {
+        cc_cmd.arg(format!("-Wl,--undefined={symbol}"));
+    }
+    cc_cmd.arg("-Wl,--allow-multiple-definition");
+    for function in WRAPPED_FUNCTIONS {
+        cc_cmd.arg(format!("-Wl,--wrap={function}"));
+    }
+    cc_cmd
+        .arg("-Wl,--start-group")
+        .arg(out_dir.join("libsafe_parse.a"))
+        .arg(out_dir.join("libbash_parser.a"))
+        .arg("-Wl,--end-group")
+        .arg("-lncurses");
+
+    match cc_cmd.status() {
+        Ok(status) if status.success() => {
+            eprintln!("Created shared library at {}", so_path.display());
+            println!("cargo:rustc-env=BASH_AST_PARSER_SO={}", so_path.display());
+            println!("cargo:rustc-cfg=bash_ast_parser_so");
+        }
+        _ => println!(
+            "cargo:warning=Could not link {}; ParserInstance will need BASH_AST_PARSER_SO \
+             (rebuild bash with -fPIC to fix)",
+            so_path.display()
+        ),
+    }
+}
+
 fn generate_bindings(bash_src: &Path, out_dir: &Path) {
     eprintln!("Generating FFI bindings...");
 
@@ -286,6 +389,23 @@ fn generate_bindings(bash_src: &Path, out_dir: &Path) {
         .allowlist_function("safe_parse_string_to_command")
         .allowlist_function("safe_parse_verbose")
         .allowlist_function("safe_parse_script")
+        .allowlist_function("safe_parse_buffer")
+        .allowlist_function("safe_parse_buffer_verbose")
+        .allowlist_function("safe_parse_input_had_nul")
+        .allowlist_function("safe_parse_error")
+        .allowlist_function("safe_parse_set_budget")
+        .allowlist_function("safe_parse_budget_exceeded")
+        .allowlist_function("safe_parse_set_cancel")
+        .allowlist_function("safe_parse_capture_substitutions")
+        .allowlist_function("safe_parse_substitution_count")
+        .allowlist_function("safe_parse_substitution")
+        .allowlist_function("safe_parse_record_positions")
+        .allowlist_function("safe_parse_position_count")
+        .allowlist_function("safe_parse_position")
+        .allowlist_function("safe_parse_stream_begin")
+        .allowlist_function("safe_parse_stream_next")
+        .allowlist_function("safe_parse_stream_offset")
+        .allowlist_function("safe_parse_stream_end")
         .allowlist_function("dispose_command")
         .allowlist_function("reset_parser")
         .allowlist_function("yyparse")
@@ -0,0 +1,159 @@
+/*
+ * bash_ast.h - C interface to libbash_ast
+ *
+ * Parses bash scripts to the JSON AST that `bash-ast -c` prints, and turns
+ * such JSON back into bash, inside the calling process. Link with
+ * -lbash_ast (the cdylib cargo builds as libbash_ast.so or
+ * libbash_ast.dylib).
+ *
+ * Conventions:
+ *  - Input is a buffer and its length; it needn't be NUL-terminated.
+ *    Scripts that aren't UTF-8 are parsed as they are, with invalid bytes
+ *    replaced in the output.
+ *  - Output is written to a buffer from malloc(), NUL-terminated, that the
+ *    caller releases with bash_ast_free() (or free()).
+ *  - Each function returns BASH_AST_OK or one of the BASH_AST_E_* codes
+ *    below, and describes a failure in `error` when that isn't NULL.
+ *  - Any thread may call these. Parses are serialized on one lock, since
+ *    bash's parser is global; a batch takes the lock once for all of its
+ *    scripts.
+ */
+
+#ifndef BASH_AST_H
+#define BASH_AST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Return codes */
+#define BASH_AST_OK                 0
+#define BASH_AST_E_SYNTAX           1   /* the script isn't valid bash */
+#define BASH_AST_E_EMPTY            2   /* the script is empty or only blanks */
+#define BASH_AST_E_TOO_LARGE        3   /* the script is over 10MB */
+#define BASH_AST_E_LIMIT            4   /* the parse went over a limit */
+#define BASH_AST_E_INVALID          5   /* a NUL byte in a script, or bad JSON */
+#define BASH_AST_E_CONVERSION       6   /* bash's tree couldn't be converted,
+                                           e.g. it nests too deeply */
+#define BASH_AST_E_ARGUMENT         7   /* a NULL pointer or unknown flag */
+#define BASH_AST_E_INTERNAL         8   /* out of memory, or a bug */
+
+/* Flags */
+#define BASH_AST_PRETTY     0x1     /* indent the JSON output */
+
+/**
+ * Why a call failed
+ *
+ * Set by every call it is passed to, so clear it with
+ * bash_ast_error_clear() before passing it again.
+ */
+typedef struct bash_ast_error {
+    int code;           /* BASH_AST_OK or BASH_AST_E_* */
+    uint32_t line;      /* of a syntax error or bad JSON, from 1; 0 if unknown */
+    uint32_t column;    /* byte column in that line, from 1; 0 if unknown */
+    char *message;      /* NUL-terminated; NULL on success */
+} bash_ast_error;
+
+/**
+ * The outcome of one item of a batch
+ */
+typedef struct bash_ast_result {
+    char *output;       /* as for `out` below; NULL on failure */
+    size_t length;      /* of `output`, without its NUL */
+    bash_ast_error error;
+} bash_ast_result;
+
+/**
+ * bash_ast_parse_json - Parse a bash script to its JSON AST
+ *
+ * @param script   The script
+ * @param length   Length of the script in bytes
+ * @param flags    0 or BASH_AST_PRETTY
+ * @param out      Receives the JSON, or NULL on failure
+ * @param out_len  Receives the length of the JSON; may be NULL
+ * @param error    Receives why the parse failed; may be NULL
+ *
+ * @return  BASH_AST_OK or a BASH_AST_E_* code
+ */
+int bash_ast_parse_json(const char *script, size_t length, uint32_t flags,
+                        char **out, size_t *out_len, bash_ast_error *error);
+
+/**
+ * bash_ast_to_bash - Turn a JSON AST back into a bash script
+ *
+ * @param json     The AST, as bash_ast_parse_json() gives it
+ * @param length   Length of the JSON in bytes
+ * @param flags    0; there are none yet
+ * @param out      Receives the script, or NULL on failure
+ * @param out_len  Receives the length of the script; may be NULL
+ * @param error    Receives why it failed; may be NULL
+ *
+ * @return  BASH_AST_OK or a BASH_AST_E_* code
+ */
+int bash_ast_to_bash(const char *json, size_t length, uint32_t flags,
+                     char **out, size_t *out_len, bash_ast_error *error);
+
+/**
+ * bash_ast_parse_json_batch - Parse many scripts in one call
+ *
+ * Like bash_ast_parse_json() on each script in turn, with one result per
+ * script. Release the results with bash_ast_result_clear().
+ *
+ * @param scripts  `count` scripts
+ * @param lengths  Their lengths in bytes
+ * @param count    Number of scripts
+ * @param flags    As for bash_ast_parse_json()
+ * @param results  Receives `count` results
+ *
+ * @return  The number of scripts that failed, or (size_t)-1 if the
+ *          arguments are invalid and no results were written
+ */
+size_t bash_ast_parse_json_batch(const char *const *scripts, const size_t *lengths,
+                                 size_t count, uint32_t flags, bash_ast_result *results);
+
+/**
+ * bash_ast_to_bash_batch - Turn many JSON ASTs back into bash in one call
+ *
+ * Like bash_ast_to_bash() on each AST in turn; otherwise as
+ * bash_ast_parse_json_batch().
+ */
+size_t bash_ast_to_bash_batch(const char *const *jsons, const size_t *lengths,
+                              size_t count, uint32_t flags, bash_ast_result *results);
+
+/**
+ * bash_ast_free - Release a buffer this library returned
+ *
+ * @param buffer  The buffer; NULL is ignored
+ */
+void bash_ast_free(char *buffer);
+
+/**
+ * bash_ast_error_clear - Release an error's message and reset it
+ *
+ * @param error  The error; NULL is ignored
+ */
+void bash_ast_error_clear(bash_ast_error *error);
+
+/**
+ * bash_ast_result_clear - Release the outputs and errors of a batch
+ *
+ * @param results  The results
+ * @param count    Number of results
+ */
+void bash_ast_result_clear(bash_ast_result *results, size_t count);
+
+/**
+ * bash_ast_version - The version of the library, e.g. "0.3.3"
+ *
+ * @return  A static NUL-terminated string
+ */
+const char *bash_ast_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BASH_AST_H */
@@ -16,10 +16,12 @@
 
 /* System headers needed for basic types */
 #include <sys/types.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <setjmp.h>
 
@@ -33,6 +35,8 @@
 #include "make_cmd.h"
 #include "dispose_cmd.h"
 #include "sig.h"
+#include "parser.h"
+#include "ocache.h"
 
 /* Flags from subst.h - defined here to avoid header dependency issues.
  * subst.h has complex dependencies (SHELL_VAR, etc.) that we don't need.
@@ -60,6 +64,22 @@ extern sigjmp_buf top_level;
 extern void initialize_shell_builtins(void);
 extern SHELL_VAR *make_new_array_variable(const char *name);
 
+/**
+ * Word node caches.
+ *
+ * make_cmd.c allocates every WORD_DESC and WORD_LIST through these object
+ * caches, and dispose_cmd.c returns them there instead of freeing them.
+ * bash's main() sets them up with cmd_init(); without that (as in a library)
+ * they are empty and every word costs two malloc/free pairs. Words are most
+ * of a parse tree's nodes, so we size the caches for whole scripts: after
+ * the first parse, building and disposing a tree of up to this many words
+ * recycles cached nodes instead of going through malloc. Cached nodes are
+ * small, so the memory kept back is bounded at about 1 MB.
+ */
+#define WORD_CACHE_SIZE 16384
+
+extern sh_obj_cache_t wdcache, wlcache;
+
 /* Internal flag to track if we've done our initialization */
 static int parser_lib_initialized = 0;
 
@@ -80,6 +100,12 @@ static void ensure_initialized(void) {
     /* Initialize the shell builtins (needed for some parsing operations) */
     initialize_shell_builtins();
 
+    /* Same as cmd_init(), with caches sized for whole scripts */
+    ocache_destroy(wdcache);
+    ocache_destroy(wlcache);
+    ocache_create(wdcache, WORD_DESC, WORD_CACHE_SIZE);
+    ocache_create(wlcache, WORD_LIST, WORD_CACHE_SIZE);
+
     /* Create a dummy variable to trigger variable table creation.
      * We use bind_variable which will create the hash tables if needed. */
     bind_variable("_BASH_AST_INIT", "1", 0);
@@ -108,6 +134,660 @@ extern void reset_parser(void);
 extern void clear_shell_input_line(void);
 extern int parser_expanding_alias(void);
 
+/* Input stream stack - lets us install our own input source for one parse */
+extern void push_stream(int reset_lineno);
+extern void pop_stream(void);
+extern void init_yy_io(sh_cget_func_t *get, sh_cunget_func_t *unget,
+                       enum stream_type type, const char *name, INPUT_STREAM location);
+
+/* Group wrapper injected around every script (see safe_parse_buffer) */
+#define SCRIPT_PREFIX   "{ "
+#define SCRIPT_SUFFIX   "\n}"
+
+/**
+ * Virtual script input source.
+ *
+ * Instead of building "{ " + script + "\n}" in a freshly malloc'd buffer,
+ * the lexer reads three segments in sequence: the prefix, the caller's
+ * buffer (borrowed, not NUL-terminated) and the suffix. Bash's shell_getc
+ * still copies each line into its own line buffer, but nothing else copies
+ * the script.
+ *
+ * Inputs nest like bash's own input streams: a wrapped parse may run
+ * between two commands of an open stream (see safe_parse_stream_begin).
+ */
+typedef struct script_input {
+    const char *segments[3];
+    size_t lengths[3];
+    int segment;         /* index of the segment being read */
+    size_t offset;       /* read position within that segment */
+    int saw_nul;         /* the caller's buffer contained a NUL byte */
+    int quiet;           /* keep the parser's messages off stderr */
+    int saved_parser_state;
+    struct script_input *previous;
+} SCRIPT_INPUT;
+
+/* Input the lexer is currently reading, and the two kinds we install */
+static SCRIPT_INPUT *script_input = NULL;
+static SCRIPT_INPUT wrapped_input;
+static SCRIPT_INPUT stream_input;
+static int stream_active = 0;
+
+/**
+ * Parser errors.
+ *
+ * Bash reports syntax errors through parser_error(), and warnings such as
+ * an unterminated here-document through internal_warning(); both print to
+ * stderr from deep inside the parser. On Linux, build.rs links with --wrap
+ * for both, so those calls come here first. During our parses, the first
+ * error is recorded field by field for safe_parse_error(), along with where
+ * the lexer was in the caller's buffer, and messages only reach stderr for
+ * verbose parses. Other calls pass straight through.
+ *
+ * Elsewhere nothing is recorded, and quiet parses ask the parser not to
+ * report errors at all (PST_NOERROR).
+ */
+typedef struct parse_error {
+    int line;
+    char *message;       /* NULL if the parse reported no error */
+    char *token;
+    char *expected;
+    char *source_line;
+    size_t offset;       /* read position in the caller's buffer, or SIZE_MAX */
+} PARSE_ERROR;
+
+static PARSE_ERROR last_error;
+
+static void last_error_clear(void) {
+    free(last_error.message);
+    free(last_error.token);
+    free(last_error.expected);
+    free(last_error.source_line);
+    memset(&last_error, 0, sizeof(last_error));
+    last_error.offset = SIZE_MAX;
+}
+
+#ifdef BASH_AST_WRAP_PARSER_ERROR
+#ifdef BASH_AST_WRAP_POSITIONS
+static size_t script_input_position(const SCRIPT_INPUT *input);
+#endif
+
+extern void __real_parser_error(int lineno, const char *format, ...);
+extern void __real_internal_warning(const char *format, ...);
+
+enum { ERROR_ARGUMENT_NONE, ERROR_ARGUMENT_TOKEN, ERROR_ARGUMENT_EXPECTED, ERROR_ARGUMENT_LINE };
+
+/* The messages whose parts we record: what the format's one argument (a
+ * string, or a character for %c) is, and any token the parser expected
+ * instead. Bash is configured with --disable-nls, so these are exactly the
+ * format strings parse.y passes. Unlisted messages keep only their text. */
+static const struct {
+    const char *format;
+    int argument;
+    const char *expected;
+} error_formats[] = {
+    {"syntax error near unexpected token `%s'", ERROR_ARGUMENT_TOKEN, NULL},
+    {"syntax error near `%s'", ERROR_ARGUMENT_TOKEN, NULL},
+    {"unexpected EOF while looking for matching `%c'", ERROR_ARGUMENT_EXPECTED, NULL},
+    {"syntax error in conditional expression: unexpected token `%s'", ERROR_ARGUMENT_TOKEN,
+     NULL},
+    {"unexpected token `%s', expected `)'", ERROR_ARGUMENT_TOKEN, ")"},
+    {"expected `)'", ERROR_ARGUMENT_NONE, ")"},
+    {"unexpected token `%s', conditional binary operator expected", ERROR_ARGUMENT_TOKEN, NULL},
+    {"unexpected token `%c' in conditional command", ERROR_ARGUMENT_TOKEN, NULL},
+    {"unexpected token `%s' in conditional command", ERROR_ARGUMENT_TOKEN, NULL},
+    /* print_offending_line(): the line of the error before it */
+    {"`%s'", ERROR_ARGUMENT_LINE, NULL},
+};
+
+/* The message `format` and `args` make, in a new string */
+static char *format_message(const char *format, va_list args) {
+    va_list copy;
+    int length;
+    char *message;
+
+    va_copy(copy, args);
+    length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (length < 0) {
+        return savestring("");
+    }
+
+    message = xmalloc((size_t)length + 1);
+    vsnprintf(message, (size_t)length + 1, format, args);
+    return message;
+}
+
+/* Record one parser_error() of our parse; takes ownership of `message` */
+static void last_error_record(int lineno, const char *format, char *message, va_list args) {
+    const size_t count = sizeof(error_formats) / sizeof(error_formats[0]);
+    char character[2] = {0, 0};
+    const char *argument = NULL;
+    const char *expected = NULL;
+    int kind = ERROR_ARGUMENT_NONE;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (strcmp(format, error_formats[i].format) == 0) {
+            kind = error_formats[i].argument;
+            expected = error_formats[i].expected;
+            break;
+        }
+    }
+    if (kind != ERROR_ARGUMENT_NONE) {
+        if (strstr(format, "%c") != NULL) {
+            character[0] = (char)va_arg(args, int);
+            argument = character;
+        } else {
+            argument = va_arg(args, const char *);
+        }
+    }
+
+    /* The offending line follows its error; later errors are ignored */
+    if (last_error.message != NULL) {
+        if (kind == ERROR_ARGUMENT_LINE && last_error.source_line == NULL) {
+            last_error.source_line = savestring(argument);
+        }
+        free(message);
+        return;
+    }
+
+    last_error.line = lineno;
+    last_error.message = message;
+#ifdef BASH_AST_WRAP_POSITIONS
+    /* Just past the token the parser choked on, for errors about a token */
+    last_error.offset = script_input_position(script_input);
+#endif
+    if (kind == ERROR_ARGUMENT_TOKEN) {
+        last_error.token = savestring(argument);
+    } else if (kind == ERROR_ARGUMENT_EXPECTED) {
+        expected = argument;
+    }
+    if (expected != NULL) {
+        last_error.expected = savestring(expected);
+    }
+}
+
+void __wrap_parser_error(int lineno, const char *format, ...) {
+    va_list args;
+    char *message;
+
+    va_start(args, format);
+    message = format_message(format, args);
+    va_end(args);
+
+    if (script_input == NULL || !script_input->quiet) {
+        __real_parser_error(lineno, "%s", message);
+    }
+    if (script_input == NULL) {
+        free(message);
+        return;
+    }
+
+    va_start(args, format);
+    last_error_record(lineno, format, message, args);
+    va_end(args);
+}
+
+void __wrap_internal_warning(const char *format, ...) {
+    va_list args;
+    char *message;
+
+    if (script_input != NULL && script_input->quiet) {
+        return;
+    }
+
+    va_start(args, format);
+    message = format_message(format, args);
+    va_end(args);
+    __real_internal_warning("%s", message);
+    free(message);
+}
+#endif
+
+/**
+ * Command substitution capture.
+ *
+ * When the lexer meets $(...), or <(...) and >(...), parse_comsub() parses
+ * the inner command in full, then turns the tree back into text with
+ * print_comsub() and disposes of it: only the text reaches the word. On
+ * Linux, build.rs links with --wrap=print_comsub so that call comes here
+ * first, and while capture is on we keep a copy of each tree along with its
+ * text. Substitutions are recorded as they end, so nested ones come before
+ * the substitution that contains them. Captures belong to the last wrapped
+ * parse and stay valid until the next one.
+ */
+typedef struct substitution {
+    COMMAND *command;
+    char *text;
+} SUBSTITUTION;
+
+static SUBSTITUTION *substitutions = NULL;
+static size_t substitution_count = 0;
+static size_t substitution_capacity = 0;
+static int capture_substitutions = 0;
+
+static void substitutions_clear(void) {
+    size_t i;
+
+    for (i = 0; i < substitution_count; i++) {
+        dispose_command(substitutions[i].command);
+        free(substitutions[i].text);
+    }
+    substitution_count = 0;
+}
+
+#ifdef BASH_AST_WRAP_PRINT_COMSUB
+extern char *__real_print_comsub(COMMAND *command);
+
+char *__wrap_print_comsub(COMMAND *command) {
+    char *text = __real_print_comsub(command);
+
+    /* Only substitutions in our own wrapped parses */
+    if (!capture_substitutions || script_input != &wrapped_input || command == NULL ||
+        text == NULL) {
+        return text;
+    }
+
+    if (substitution_count == substitution_capacity) {
+        substitution_capacity = (substitution_capacity > 0) ? substitution_capacity * 2 : 16;
+        substitutions = xrealloc(substitutions, substitution_capacity * sizeof(SUBSTITUTION));
+    }
+    substitutions[substitution_count].command = copy_command(command);
+    substitutions[substitution_count].text = savestring(text);
+    substitution_count++;
+
+    return text;
+}
+#endif
+
+/**
+ * Parse budget.
+ *
+ * Bash builds a script's whole tree before handing any of it back, so a
+ * pathological script would cost all of its words and parse time before
+ * the caller could turn it down. While a wrapped parse runs under a budget,
+ * the input source gives the lexer end of input as soon as the parse has
+ * made more words than allowed (counted as they are allocated, so only
+ * where alloc_word_desc is wrapped) or run past its deadline. The parse
+ * then fails, and safe_parse_budget_exceeded() says which ran out.
+ *
+ * A parse is cancelled the same way once the flag passed to
+ * safe_parse_set_cancel() turns non-zero, which another thread may do at
+ * any time. Bash's own interrupt_state isn't used for this: its QUIT checks
+ * would throw_to_top_level(), which runs the shell's interrupt cleanup.
+ * Ending the input instead lets the parse fail as any truncated script
+ * does, leaving the parser ready for the next one.
+ */
+#define BUDGET_WORDS        1
+#define BUDGET_TIME         2
+#define BUDGET_CANCELLED    3
+
+/* Input bytes read between readings of the clock */
+#define BUDGET_CLOCK_INTERVAL   4096
+
+static size_t budget_max_words = SIZE_MAX;
+static uint64_t budget_max_micros = 0;  /* 0: no deadline */
+static int budget_active = 0;
+static size_t budget_words = 0;         /* words made by the current parse */
+static uint64_t budget_deadline = 0;    /* on budget_clock(), 0 for none */
+static int budget_exceeded = 0;         /* BUDGET_* that ran out, or 0 */
+static const int *budget_cancel = NULL; /* written by other threads */
+
+/* Monotonic time, in microseconds */
+static uint64_t budget_clock(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+/* Start counting a parse against the budget */
+static void budget_begin(void) {
+    uint64_t now;
+
+    budget_words = 0;
+    budget_exceeded = 0;
+    budget_deadline = 0;
+    if (budget_max_micros > 0) {
+        now = budget_clock();
+        budget_deadline = (budget_max_micros < UINT64_MAX - now) ? now + budget_max_micros
+                                                                 : UINT64_MAX;
+    }
+    budget_active = 1;
+}
+
+static void budget_end(void) {
+    budget_active = 0;
+    budget_cancel = NULL;
+}
+
+/* Count a word the parser made */
+static void budget_charge_word(void) {
+    if (budget_active && ++budget_words > budget_max_words && budget_exceeded == 0) {
+        budget_exceeded = BUDGET_WORDS;
+    }
+}
+
+/* Has the parse run out of budget? `offset` is the read position */
+static int budget_check(size_t offset) {
+    if (budget_active && budget_exceeded == 0 && budget_cancel != NULL
+        && __atomic_load_n(budget_cancel, __ATOMIC_RELAXED) != 0) {
+        budget_exceeded = BUDGET_CANCELLED;
+    }
+    if (budget_active && budget_exceeded == 0 && budget_deadline != 0
+        && offset % BUDGET_CLOCK_INTERVAL == 0 && budget_clock() > budget_deadline) {
+        budget_exceeded = BUDGET_TIME;
+    }
+    return budget_active && budget_exceeded != 0;
+}
+
+/**
+ * Source positions.
+ *
+ * Bash keeps no offsets in its trees, and reads input a line at a time into
+ * a buffer of its own. While recording is on, the parser's calls to the
+ * functions that make words, redirects and the commands that end in a
+ * closing token come here first (Linux, --wrap again) and we note where the
+ * lexer was in the caller's buffer when each was made: just past a word's
+ * last byte, and at or past the end of the others, depending on how far
+ * the parser looked ahead. The Rust side (src/convert/spans.rs) works the
+ * starts out from the source. Positions belong to the last wrapped parse.
+ */
+typedef struct position {
+    const void *node;
+    size_t end;
+    int kind;
+} POSITION;
+
+#define POSITION_WORD       0
+#define POSITION_REDIRECT   1
+#define POSITION_COMMAND    2
+
+static POSITION *positions = NULL;
+static size_t position_count = 0;
+static size_t position_capacity = 0;
+static int record_positions = 0;
+
+#ifdef BASH_AST_WRAP_POSITIONS
+/* The unread part of the line the lexer is reading */
+extern char *parser_remaining_input(void);
+
+/* Offset in the caller's buffer of the next byte the lexer will read */
+static size_t script_input_position(const SCRIPT_INPUT *input) {
+    size_t read = input->offset;
+    size_t pending;
+    char *rest;
+    int i;
+
+    for (i = 0; i < input->segment && i < 3; i++) {
+        read += input->lengths[i];
+    }
+    /* Bytes bash has taken into its line buffer but not lexed yet */
+    rest = parser_remaining_input();
+    pending = (rest != NULL) ? strlen(rest) : 0;
+    read = (read > pending) ? read - pending : 0;
+    read = (read > input->lengths[0]) ? read - input->lengths[0] : 0;
+    return (read < input->lengths[1]) ? read : input->lengths[1];
+}
+
+static void position_record(const void *node, int kind) {
+    if (!record_positions || script_input != &wrapped_input || node == NULL) {
+        return;
+    }
+
+    if (position_count == position_capacity) {
+        position_capacity = (position_capacity > 0) ? position_capacity * 2 : 64;
+        positions = xrealloc(positions, position_capacity * sizeof(POSITION));
+    }
+    positions[position_count].node = node;
+    positions[position_count].end = script_input_position(&wrapped_input);
+    positions[position_count].kind = kind;
+    position_count++;
+}
+
+extern WORD_DESC *__real_alloc_word_desc(void);
+extern REDIRECT *__real_make_redirection(REDIRECTEE source, enum r_instruction instruction,
+                                         REDIRECTEE dest_and_filename, int flags);
+extern COMMAND *__real_make_case_command(WORD_DESC *word, PATTERN_LIST *clauses, int lineno);
+extern COMMAND *__real_make_arith_command(WORD_LIST *exp);
+extern COMMAND *__real_make_cond_command(COND_COM *cond_node);
+
+WORD_DESC *__wrap_alloc_word_desc(void) {
+    WORD_DESC *word = __real_alloc_word_desc();
+
+    budget_charge_word();
+    position_record(word, POSITION_WORD);
+    return word;
+}
+
+REDIRECT *__wrap_make_redirection(REDIRECTEE source, enum r_instruction instruction,
+                                  REDIRECTEE dest_and_filename, int flags) {
+    REDIRECT *redirect = __real_make_redirection(source, instruction, dest_and_filename, flags);
+
+    position_record(redirect, POSITION_REDIRECT);
+    return redirect;
+}
+
+COMMAND *__wrap_make_case_command(WORD_DESC *word, PATTERN_LIST *clauses, int lineno) {
+    COMMAND *command = __real_make_case_command(word, clauses, lineno);
+
+    position_record(command, POSITION_COMMAND);
+    return command;
+}
+
+COMMAND *__wrap_make_arith_command(WORD_LIST *exp) {
+    COMMAND *command = __real_make_arith_command(exp);
+
+    position_record(command, POSITION_COMMAND);
+    return command;
+}
+
+COMMAND *__wrap_make_cond_command(COND_COM *cond_node) {
+    COMMAND *command = __real_make_cond_command(cond_node);
+
+    position_record(command, POSITION_COMMAND);
+    return command;
+}
+#endif
+
+/* Empty string for bash_input.location, so code that peeks at the remaining
+ * string input sees none instead of reading past the caller's buffer. */
+static char no_string_input[] = "";
+
+static void script_input_init(SCRIPT_INPUT *input, const char *prefix, const char *buffer,
+                              size_t length, const char *suffix) {
+    input->segments[0] = prefix;
+    input->lengths[0] = strlen(prefix);
+    input->segments[1] = buffer;
+    input->lengths[1] = length;
+    input->segments[2] = suffix;
+    input->lengths[2] = strlen(suffix);
+    input->segment = 0;
+    input->offset = 0;
+    input->saw_nul = 0;
+}
+
+/* Is the read position past the last byte of the last segment? */
+static int script_input_exhausted(const SCRIPT_INPUT *input) {
+    int i;
+
+    for (i = input->segment; i < 3; i++) {
+        size_t start = (i == input->segment) ? input->offset : 0;
+        if (start < input->lengths[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Number of bytes of the caller's buffer the lexer has read so far */
+static size_t script_input_consumed(const SCRIPT_INPUT *input) {
+    if (input->segment == 0) {
+        return 0;
+    }
+    return (input->segment == 1) ? input->offset : input->lengths[1];
+}
+
+/* sh_cget_func_t: return the next input byte, or EOF */
+static int script_input_getc(void) {
+    SCRIPT_INPUT *input = script_input;
+    unsigned char c;
+
+    if (budget_check(input->offset)) {
+        return EOF;
+    }
+    while (input->segment < 3) {
+        if (input->offset < input->lengths[input->segment]) {
+            c = (unsigned char)input->segments[input->segment][input->offset++];
+            if (c == '\0' && input->segment == 1) {
+                input->saw_nul = 1;
+            }
+            return c;
+        }
+        input->segment++;
+        input->offset = 0;
+    }
+    return EOF;
+}
+
+/* sh_cunget_func_t: step back over the byte returned by the last getc */
+static int script_input_ungetc(int c) {
+    SCRIPT_INPUT *input = script_input;
+
+    if (c == EOF) {
+        return c;
+    }
+    while (input->offset == 0 && input->segment > 0) {
+        input->segment--;
+        input->offset = input->lengths[input->segment];
+    }
+    if (input->offset > 0) {
+        input->offset--;
+    }
+    return c;
+}
+
+/**
+ * Make `input` the lexer's input source.
+ *
+ * push_stream(1) saves the current input and line_number and resets
+ * line_number to 0: shell_getc increments it before reading each line, so
+ * the first line of the script is line 1. script_input_pop() restores both,
+ * so this nests inside bash's (or our own) input.
+ */
+static void script_input_push(SCRIPT_INPUT *input, int quiet) {
+    INPUT_STREAM location;
+
+    input->quiet = quiet;
+    input->previous = script_input;
+    input->saved_parser_state = parser_state;
+    script_input = input;
+
+    push_stream(1);
+    location.string = no_string_input;
+    init_yy_io(script_input_getc, script_input_ungetc, st_string, "bash-ast", location);
+}
+
+/* Undo script_input_push() for the current input */
+static void script_input_pop(void) {
+    SCRIPT_INPUT *input = script_input;
+
+    /* Don't let a partially consumed line leak into the next parse */
+    clear_shell_input_line();
+    parser_state = input->saved_parser_state;
+    pop_stream();
+    EOF_Reached = 0;
+    script_input = input->previous;
+}
+
+/**
+ * Run one parse_command() over the installed script input.
+ *
+ * Mirrors what parse_string() does for string input: a top_level landing
+ * pad catches any jump_to_top_level() from deep inside the parser, and
+ * global_command is handed to the caller and cleared.
+ *
+ * @param command  Receives the parsed command; NULL for an empty input
+ *                 unit (blank line, comment, or end of input)
+ *
+ * @return  0 on success, -1 on syntax error
+ */
+static int parse_one_command(COMMAND **command) {
+    COMMAND *volatile result = NULL;
+    volatile int status = 0;
+    COMMAND *saved_global_command;
+    sigjmp_buf saved_top_level;
+
+    saved_global_command = global_command;
+    global_command = NULL;
+    memcpy(saved_top_level, top_level, sizeof(sigjmp_buf));
+
+#ifndef BASH_AST_WRAP_PARSER_ERROR
+    /* Without the parser_error wrapper, quiet parses can't keep errors off
+     * stderr any other way. reset_parser() clears parser_state after each
+     * error, so this is set per command. */
+    if (script_input->quiet) {
+        parser_state |= PST_NOERROR;
+    }
+#endif
+
+    if (sigsetjmp(top_level, 0) == 0) {
+        if (parse_command() == 0) {
+            result = global_command;
+        } else {
+            reset_parser();
+            status = -1;
+        }
+    } else {
+        /* The parser longjmp'd out (fatal error); discard any partial tree */
+        reset_parser();
+        result = NULL;
+        status = -1;
+    }
+
+    memcpy(top_level, saved_top_level, sizeof(sigjmp_buf));
+    global_command = saved_global_command;
+
+    *command = result;
+    return status;
+}
+
+/**
+ * Parse the next non-empty top-level command, like bash's reader loop.
+ *
+ * Empty input units are skipped. These include the one reset_parser()
+ * leaves queued after a syntax error in an earlier parse.
+ *
+ * After a syntax error, reset_parser() has also discarded the rest of the
+ * current input line, so calling this again resumes at the next line, just
+ * as an interactive shell does.
+ *
+ * The first error the parser reports is recorded for safe_parse_error().
+ *
+ * @param command  Receives the parsed command (NULL unless 1 is returned)
+ *
+ * @return  1 if a command was parsed, 0 at end of input, -1 on syntax error
+ */
+static int parse_next_command(COMMAND **command) {
+    int status = 0;
+
+    *command = NULL;
+    last_error_clear();
+    while (!EOF_Reached) {
+        if (parse_one_command(command) != 0) {
+            status = -1;
+            break;
+        }
+        if (*command != NULL) {
+            status = 1;
+            break;
+        }
+    }
+
+    return status;
+}
+
 /**
  * safe_parse_string_to_command - Parse a string without longjmp on error
  *
@@ -149,14 +829,168 @@ COMMAND *safe_parse_verbose(char *string, int flags) {
 }
 
 /**
- * safe_parse_script - Parse a multi-command script
+ * parse_wrapped_buffer - Shared implementation of safe_parse_buffer{,_verbose}
+ *
+ * @param buffer     The script bytes (need not be NUL-terminated)
+ * @param length     Number of bytes in buffer
+ * @param quiet      Non-zero to keep bash's messages off stderr
+ *
+ * @return  The parsed group command, or NULL on error
+ */
+static COMMAND *parse_wrapped_buffer(const char *buffer, size_t length, int quiet) {
+    COMMAND *result;
+
+    if (buffer == NULL || length == 0) {
+        return NULL;
+    }
+
+    ensure_initialized();
+    substitutions_clear();
+    position_count = 0;
+
+    /* The prefix "{ " is on the same line as the script's first line, so
+     * line numbers in the AST match the original script's line numbers.
+     * The suffix starts with a newline in case the script ends in a comment. */
+    script_input_init(&wrapped_input, SCRIPT_PREFIX, buffer, length, SCRIPT_SUFFIX);
+    script_input_push(&wrapped_input, quiet);
+    budget_begin();
+
+    /* The wrapper is a single group command; anything left over means the
+     * script closed our group early (e.g. a stray "}"), which is an error. */
+    if (parse_next_command(&result) == 1 && !script_input_exhausted(&wrapped_input)) {
+        dispose_command(result);
+        result = NULL;
+        reset_parser();
+    }
+
+    /* Cut short before our closing brace, so this is only a safeguard */
+    if (budget_exceeded != 0 && result != NULL) {
+        dispose_command(result);
+        result = NULL;
+    }
+
+    budget_end();
+    script_input_pop();
+
+    return result;
+}
+
+/**
+ * safe_parse_buffer - Parse a multi-command script from a borrowed buffer
  *
  * This function parses a complete bash script that may contain multiple
- * commands separated by newlines or semicolons. All commands are connected
- * into a single COMMAND tree using newline (';') separators.
+ * commands separated by newlines or semicolons. The script is parsed as if
+ * it were wrapped in a group "{ ... }", so the result is a single group
+ * command whose body holds all the script's commands.
+ *
+ * The wrapper is injected virtually by the input source: neither the
+ * script nor the wrapped form is copied, and the buffer does not need to be
+ * NUL-terminated. Error messages are not printed, but the first one can be
+ * retrieved with safe_parse_error().
  *
- * For simple/safer parsing, this wraps the entire script in a group { }
- * and uses the single-command parser with SX_NOLONGJMP.
+ * @param buffer  The bash script to parse (may contain multiple commands)
+ * @param length  Length of the script in bytes
+ *
+ * @return  The parsed COMMAND structure containing all commands, or NULL on error
+ */
+COMMAND *safe_parse_buffer(const char *buffer, size_t length) {
+    return parse_wrapped_buffer(buffer, length, 1);
+}
+
+/**
+ * safe_parse_buffer_verbose - Like safe_parse_buffer, printing errors to stderr
+ *
+ * @param buffer  The bash script to parse (may contain multiple commands)
+ * @param length  Length of the script in bytes
+ *
+ * @return  The parsed COMMAND structure containing all commands, or NULL on error
+ */
+COMMAND *safe_parse_buffer_verbose(const char *buffer, size_t length) {
+    return parse_wrapped_buffer(buffer, length, 0);
+}
+
+/**
+ * safe_parse_input_had_nul - Did the last parsed buffer contain a NUL byte?
+ *
+ * Bash's lexer silently drops NUL bytes, so the caller checks this after a
+ * successful parse to reject such input. Only bytes the lexer actually read
+ * are inspected.
+ *
+ * @return  Non-zero if a NUL byte was read from the caller's buffer
+ */
+int safe_parse_input_had_nul(void) {
+    return wrapped_input.saw_nul;
+}
+
+/**
+ * safe_parse_set_budget - Limit the safe_parse_buffer{,_verbose}() and
+ * safe_parse_stream_next() calls that follow
+ *
+ * @param max_words   Most words a parse may make, counting those of command
+ *                    substitutions and redirect targets (SIZE_MAX for no
+ *                    limit; only enforced on Linux, see the parse budget)
+ * @param max_micros  Longest a parse may run, in microseconds (0 for no limit)
+ */
+void safe_parse_set_budget(size_t max_words, uint64_t max_micros) {
+    budget_max_words = max_words;
+    budget_max_micros = max_micros;
+}
+
+/**
+ * safe_parse_set_cancel - Let `flag` cancel the next safe_parse_buffer{,_verbose}() or
+ * safe_parse_stream_next() call
+ *
+ * The parse is cut short once `flag` is non-zero; it may be set from any
+ * thread, and must stay valid until the parse returns. Only that parse is
+ * affected.
+ *
+ * @param flag  Read atomically while parsing; NULL for none
+ */
+void safe_parse_set_cancel(const int *flag) {
+    budget_cancel = flag;
+}
+
+/**
+ * safe_parse_budget_exceeded - Which budget cut the last wrapped or stream parse short
+ *
+ * @return  0 if none did, BUDGET_WORDS (1), BUDGET_TIME (2) or BUDGET_CANCELLED (3)
+ */
+int safe_parse_budget_exceeded(void) {
+    return budget_exceeded;
+}
+
+/**
+ * safe_parse_error - The first syntax error of the last parse
+ *
+ * Covers the last safe_parse_buffer{,_verbose}() or safe_parse_stream_next()
+ * call. The message is bash's, without the "bash-ast: line 3: " prefix:
+ * "syntax error near unexpected token `fi'". The strings stay valid until
+ * the next parse. Only recorded on Linux (see parser errors).
+ *
+ * @param line         Receives the line of the error (0 if none)
+ * @param token        Receives the token the parser didn't expect, or NULL
+ * @param expected     Receives what it was looking for instead, or NULL
+ * @param source_line  Receives the text of the offending line, or NULL
+ * @param offset       Receives the lexer's read position in the caller's
+ *                     buffer when the error was reported (SIZE_MAX if not
+ *                     recorded)
+ *
+ * @return  The error message, or NULL if the parse reported no error
+ */
+const char *safe_parse_error(int *line, const char **token, const char **expected,
+                             const char **source_line, size_t *offset) {
+    *line = last_error.line;
+    *token = last_error.token;
+    *expected = last_error.expected;
+    *source_line = last_error.source_line;
+    *offset = last_error.offset;
+    return last_error.message;
+}
+
+/**
+ * safe_parse_script - Parse a multi-command NUL-terminated script
+ *
+ * Convenience wrapper around safe_parse_buffer() for C strings.
  *
  * @param string  The bash script to parse (may contain multiple commands)
  * @param flags   Parser flags (currently unused, reserved for future use)
@@ -164,49 +998,224 @@ COMMAND *safe_parse_verbose(char *string, int flags) {
  * @return  The parsed COMMAND structure containing all commands, or NULL on error
  */
 COMMAND *safe_parse_script(char *string, int flags) {
-    COMMAND *result;
-    char *wrapped;
-    size_t len;
-    int saved_line_number;
-
     (void)flags;  /* Reserved for future use */
 
     if (string == NULL || *string == '\0') {
         return NULL;
     }
 
-    /* Wrap the script in a group { ... } to make it a single compound command.
-     * This allows the single-command parser to handle multi-statement scripts.
-     * We need a trailing newline before } in case the script ends with a comment.
-     *
-     * The wrapper "{ " is on the same line as the script's first line, so
-     * line numbers in the AST will match the original script's line numbers.
-     */
-    len = strlen(string);
-    wrapped = malloc(len + 6);  /* "{ " + string + "\n}" + null */
-    if (wrapped == NULL) {
-        return NULL;
+    return safe_parse_buffer(string, strlen(string));
+}
+
+/**
+ * safe_parse_stream_begin - Start parsing a script one top-level command at a time
+ *
+ * Unlike safe_parse_buffer(), no group wrapper is added: each call to
+ * safe_parse_stream_next() runs bash's own parse_command() loop and returns
+ * the next top-level command, so callers can process (and dispose) commands
+ * while the rest of the script is still unparsed. Line numbers are relative
+ * to the start of the buffer, as with safe_parse_buffer().
+ *
+ * Only one stream can be open at a time, but other parses may run between
+ * calls to safe_parse_stream_next(). The buffer must stay valid until
+ * safe_parse_stream_end().
+ *
+ * @param buffer  The bash script to parse (need not be NUL-terminated)
+ * @param length  Length of the script in bytes
+ *
+ * @return  0 on success, -1 if a stream is already open
+ */
+int safe_parse_stream_begin(const char *buffer, size_t length) {
+    if (stream_active) {
+        return -1;
     }
 
-    strcpy(wrapped, "{ ");
-    strcat(wrapped, string);
-    strcat(wrapped, "\n}");
+    ensure_initialized();
 
-    /* Initialize line_number so the AST has accurate line information.
-     * We start at 0 because shell_getc increments line_number BEFORE reading
-     * each line. So after the increment before reading the first line,
-     * line_number will be 1, which is correct.
-     */
-    saved_line_number = line_number;
-    line_number = 0;
+    script_input_init(&stream_input, "", buffer, length, "");
+    script_input_push(&stream_input, 1);
+    stream_active = 1;
 
-    /* Use the safe single-command parser (ensure_initialized called inside) */
-    result = safe_parse_string_to_command(wrapped, 0);
+    return 0;
+}
 
-    /* Restore line_number in case this is called from within bash */
-    line_number = saved_line_number;
+/**
+ * safe_parse_stream_next - Parse the next top-level command of the open stream
+ *
+ * The budget set by safe_parse_set_budget() and safe_parse_set_cancel()
+ * applies to this command alone; once it runs out, the stream ends.
+ *
+ * @param command  Receives the parsed command, owned by the caller
+ *                 (dispose_command); NULL unless 1 is returned
+ *
+ * @return  1 if a command was parsed, 0 at end of input, -1 on syntax error,
+ *          -2 if the command's input contained a NUL byte
+ */
+int safe_parse_stream_next(COMMAND **command) {
+    int status;
 
-    free(wrapped);
+    *command = NULL;
+    if (!stream_active || script_input != &stream_input) {
+        return 0;
+    }
 
-    return result;
+    stream_input.saw_nul = 0;
+    budget_begin();
+    status = parse_next_command(command);
+
+    /* A budget that ran out ended the input early, so the command may have
+     * parsed from only part of its text */
+    if (budget_exceeded != 0 && *command != NULL) {
+        dispose_command(*command);
+        *command = NULL;
+        status = -1;
+    }
+    budget_end();
+
+    /* Bash's lexer drops NUL bytes silently; report them like the Rust side
+     * does for whole-script parses */
+    if (status == 1 && stream_input.saw_nul) {
+        dispose_command(*command);
+        *command = NULL;
+        return -2;
+    }
+
+    return status;
+}
+
+/**
+ * safe_parse_stream_offset - Bytes of the stream's buffer read so far
+ *
+ * Bash reads input a line at a time, so after a command has been returned
+ * this is the offset just past the line the command ended on.
+ *
+ * @return  The read offset into the buffer passed to safe_parse_stream_begin()
+ */
+size_t safe_parse_stream_offset(void) {
+    return stream_active ? script_input_consumed(&stream_input) : 0;
+}
+
+/**
+ * safe_parse_stream_end - Close the stream opened by safe_parse_stream_begin
+ *
+ * Restores the parser's previous input and state. Safe to call when no
+ * stream is open.
+ */
+void safe_parse_stream_end(void) {
+    if (!stream_active || script_input != &stream_input) {
+        return;
+    }
+
+    script_input_pop();
+    stream_active = 0;
+}
+
+/**
+ * safe_parse_capture_substitutions - Keep the trees of command substitutions
+ *
+ * While enabled, each safe_parse_buffer{,_verbose}() call records the
+ * command tree of every command and process substitution it parses (see
+ * safe_parse_substitution). Changing the setting discards the captures of
+ * the last parse.
+ *
+ * @param enable  Non-zero to capture, zero to stop
+ *
+ * @return  1 if substitutions can be captured on this platform, 0 if not
+ */
+int safe_parse_capture_substitutions(int enable) {
+    substitutions_clear();
+#ifdef BASH_AST_WRAP_PRINT_COMSUB
+    capture_substitutions = (enable != 0);
+    return 1;
+#else
+    (void)enable;
+    return 0;
+#endif
+}
+
+/**
+ * safe_parse_substitution_count - Substitutions captured by the last parse
+ *
+ * @return  The number of captured substitutions
+ */
+size_t safe_parse_substitution_count(void) {
+    return substitution_count;
+}
+
+/**
+ * safe_parse_substitution - One captured substitution of the last parse
+ *
+ * Substitutions are numbered in the order bash finished parsing them. The
+ * command and text are owned by the capture and stay valid until the next
+ * parse.
+ *
+ * @param index  Which substitution, below safe_parse_substitution_count()
+ * @param text   Receives the text bash put between the parentheses
+ *
+ * @return  The substitution's command, or NULL if index is out of range
+ */
+COMMAND *safe_parse_substitution(size_t index, const char **text) {
+    if (index >= substitution_count) {
+        *text = NULL;
+        return NULL;
+    }
+    *text = substitutions[index].text;
+    return substitutions[index].command;
+}
+
+/**
+ * safe_parse_record_positions - Note where words, redirects and commands end
+ *
+ * While enabled, each safe_parse_buffer{,_verbose}() call records the end
+ * offset of the words and redirects it makes, and of its case, arithmetic
+ * and [[ ]] commands (see safe_parse_position). Changing the setting
+ * discards the positions of the last parse.
+ *
+ * @param enable  Non-zero to record, zero to stop
+ *
+ * @return  1 if positions can be recorded on this platform, 0 if not
+ */
+int safe_parse_record_positions(int enable) {
+    position_count = 0;
+#ifdef BASH_AST_WRAP_POSITIONS
+    record_positions = (enable != 0);
+    return 1;
+#else
+    (void)enable;
+    return 0;
+#endif
+}
+
+/**
+ * safe_parse_position_count - Positions recorded by the last parse
+ *
+ * @return  The number of recorded positions
+ */
+size_t safe_parse_position_count(void) {
+    return position_count;
+}
+
+/**
+ * safe_parse_position - One recorded position of the last parse
+ *
+ * Positions are numbered in the order the nodes were made. A node's address
+ * may appear more than once, as bash reuses the memory of nodes it frees
+ * during the parse; the last record is the one for the node in the tree.
+ *
+ * @param index  Which position, below safe_parse_position_count()
+ * @param node   Receives the WORD_DESC, REDIRECT or COMMAND
+ * @param end    Receives the offset in the parsed buffer
+ *
+ * @return  0 for a word, 1 for a redirect, 2 for a command, or -1 if index
+ *          is out of range
+ */
+int safe_parse_position(size_t index, const void **node, size_t *end) {
+    if (index >= position_count) {
+        *node = NULL;
+        *end = 0;
+        return -1;
+    }
+    *node = positions[index].node;
+    *end = positions[index].end;
+    return positions[index].kind;
 }
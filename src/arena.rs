@@ -0,0 +1,1182 @@
+//! A flat representation of the AST
+//!
+//! [`Command`] is a tree of boxed nodes: every node, word list and redirect
+//! is its own allocation, walking the tree chases pointers across the heap,
+//! and cloning or dropping it visits every one of them. An [`AstArena`]
+//! holds the same tree in a handful of vectors. Nodes sit in one `Vec` in
+//! the order a depth-first walk meets them and refer to each other by
+//! [`NodeId`]; all text lives in one string buffer, and words, redirects,
+//! case clauses and `[[ ]]` expressions live in side tables that nodes
+//! index with [`Run`]s.
+//!
+//! Because nodes are stored in walk order, every subtree is a contiguous
+//! run of nodes: a full traversal reads the node vector front to back.
+
+use crate::ast::{
+    self, CaseClause, CaseClauseFlags, Command, ConditionalExpr, ListOp, Nested, Redirect,
+    RedirectTarget, RedirectType, Word,
+};
+use crate::{ParseError, Symbol};
+use std::fmt;
+use std::marker::PhantomData;
+use std::ops::{Index, Range};
+use thiserror::Error;
+
+/// The index of a node in an [`AstArena`]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub struct NodeId(u32);
+
+impl NodeId {
+    /// The node's position in walk order
+    #[must_use]
+    pub const fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// The index of a conditional expression in an [`AstArena`]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct CondId(u32);
+
+/// A string in an [`AstArena`]'s text buffer
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct Text {
+    start: u32,
+    len: u32,
+}
+
+/// A run of entries in one of an [`AstArena`]'s side tables
+pub struct Run<T> {
+    start: u32,
+    len: u32,
+    marker: PhantomData<fn() -> T>,
+}
+
+impl<T> Run<T> {
+    const EMPTY: Self = Self {
+        start: 0,
+        len: 0,
+        marker: PhantomData,
+    };
+
+    /// Number of entries
+    #[must_use]
+    pub const fn len(self) -> usize {
+        self.len as usize
+    }
+
+    /// Whether the run has no entries
+    #[must_use]
+    pub const fn is_empty(self) -> bool {
+        self.len == 0
+    }
+
+    const fn range(self) -> Range<usize> {
+        self.start as usize..(self.start + self.len) as usize
+    }
+}
+
+impl<T> Clone for Run<T> {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+
+impl<T> Copy for Run<T> {}
+
+impl<T> PartialEq for Run<T> {
+    fn eq(&self, other: &Self) -> bool {
+        (self.start, self.len) == (other.start, other.len)
+    }
+}
+
+impl<T> Eq for Run<T> {}
+
+impl<T> fmt::Debug for Run<T> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(f, "Run({:?})", self.range())
+    }
+}
+
+/// One command in an [`AstArena`]
+#[derive(Debug, Clone)]
+pub struct Node {
+    /// Line number where the command starts, if known
+    pub line: Option<u32>,
+    /// Where the command is in the source, if known
+    pub span: Option<ast::Span>,
+    /// What kind of command this is, and its parts
+    pub kind: NodeKind,
+    /// Redirects attached to the command
+    pub redirects: Run<ArenaRedirect>,
+    /// One past the last node of this node's subtree
+    end: u32,
+}
+
+/// The kinds of [`Node`], matching [`Command`]'s variants
+#[derive(Debug, Clone)]
+pub enum NodeKind {
+    /// Simple command: `cmd arg1 arg2`
+    Simple {
+        words: Run<ArenaWord>,
+        assignments: Option<Run<Text>>,
+    },
+    /// Pipeline: `cmd1 | cmd2 | cmd3`
+    Pipeline {
+        commands: Run<NodeId>,
+        negated: bool,
+    },
+    /// List/connection: commands joined by &&, ||, ;, &
+    List {
+        op: ListOp,
+        left: NodeId,
+        right: NodeId,
+    },
+    /// Flattened list: commands each followed by an operator
+    Sequence {
+        commands: Run<NodeId>,
+        ops: Run<ListOp>,
+    },
+    /// For loop: `for var in list; do ...; done`
+    For {
+        variable: Text,
+        words: Option<Run<Text>>,
+        body: NodeId,
+    },
+    /// While loop: `while test; do ...; done`
+    While { test: NodeId, body: NodeId },
+    /// Until loop: `until test; do ...; done`
+    Until { test: NodeId, body: NodeId },
+    /// If statement: `if test; then ...; [else ...;] fi`
+    If {
+        condition: NodeId,
+        then_branch: NodeId,
+        else_branch: Option<NodeId>,
+    },
+    /// Case statement: `case word in pattern) ...;; esac`
+    Case {
+        word: Text,
+        clauses: Run<ArenaClause>,
+    },
+    /// Select statement: `select var in list; do ...; done`
+    Select {
+        variable: Text,
+        words: Option<Run<Text>>,
+        body: NodeId,
+    },
+    /// Brace group: `{ ...; }`
+    Group { body: NodeId },
+    /// Subshell: `( ... )`
+    Subshell { body: NodeId },
+    /// Function definition: `name() { ...; }`
+    FunctionDef {
+        name: Text,
+        body: NodeId,
+        source_file: Option<Text>,
+    },
+    /// Arithmetic evaluation: `(( expr ))`
+    Arithmetic { expression: Text },
+    /// C-style for loop: `for ((init; test; step)); do ...; done`
+    ArithmeticFor {
+        init: Text,
+        test: Text,
+        step: Text,
+        body: NodeId,
+    },
+    /// Conditional expression: `[[ expr ]]`
+    Conditional { expr: CondId },
+    /// Coprocess: `coproc [name] { ...; }`
+    Coproc { name: Option<Text>, body: NodeId },
+}
+
+/// A word of a simple command
+#[derive(Debug, Clone, Copy)]
+pub struct ArenaWord {
+    /// The word text
+    pub text: Text,
+    /// Word flags (`W_HASDOLLAR`, `W_QUOTED`, etc.)
+    pub flags: u32,
+    /// The commands of the word's substitutions, children of its command
+    pub substitutions: Run<NodeId>,
+    /// Where the word is in the source, if known
+    pub span: Option<ast::Span>,
+}
+
+/// A case clause
+#[derive(Debug, Clone)]
+pub struct ArenaClause {
+    /// Patterns to match
+    pub patterns: Run<Text>,
+    /// Command to execute if matched
+    pub action: Option<NodeId>,
+    /// Clause flags (fallthrough, testnext)
+    pub flags: Option<CaseClauseFlags>,
+}
+
+/// A redirect
+#[derive(Debug, Clone, Copy)]
+pub struct ArenaRedirect {
+    /// The type of redirection
+    pub direction: RedirectType,
+    /// Source file descriptor (if applicable)
+    pub source_fd: Option<i32>,
+    /// Target (filename or fd number)
+    pub target: ArenaTarget,
+    /// For here-documents, the delimiter word
+    pub here_doc_eof: Option<Text>,
+    /// Where the redirect is in the source, if known
+    pub span: Option<ast::Span>,
+}
+
+/// Target of a redirect
+#[derive(Debug, Clone, Copy)]
+pub enum ArenaTarget {
+    /// A filename
+    File(Text),
+    /// A file descriptor number
+    Fd(i32),
+}
+
+/// A conditional expression for `[[ ... ]]`, matching [`ConditionalExpr`]
+#[derive(Debug, Clone, Copy)]
+pub enum ArenaCond {
+    /// `[[ -flag arg ]]` - unary test
+    Unary { op: Text, arg: Text },
+    /// `[[ arg1 op arg2 ]]` - binary test
+    Binary { op: Text, left: Text, right: Text },
+    /// `[[ expr1 && expr2 ]]` - AND
+    And { left: CondId, right: CondId },
+    /// `[[ expr1 || expr2 ]]` - OR
+    Or { left: CondId, right: CondId },
+    /// `[[ ! expr ]]` - negation (inside the expression)
+    Not { expr: CondId },
+    /// A single word/term in a conditional
+    Term { word: Text },
+    /// A grouped expression `( expr )`
+    Expr { expr: CondId },
+}
+
+/// A command tree stored in a few contiguous vectors
+///
+/// Built from a [`Command`] with [`TryFrom`], and converted back with
+/// [`From`]. Nodes are reached by
+/// [`NodeId`] and stored in walk order, so [`iter()`](Self::iter) and
+/// [`descendants()`](Self::descendants) visit them without following any
+/// pointers. The parts of a node - words, redirects, clauses - are
+/// [`Run`]s and [`Text`]s that the arena resolves.
+///
+/// # Example
+///
+/// ```
+/// use bash_ast::arena::NodeKind;
+/// use bash_ast::{AstArena, Command, Symbol, Word};
+///
+/// let cmd = Command::Simple {
+///     line: Some(1),
+///     span: None,
+///     words: vec![Word {
+///         word: Symbol::from("echo"),
+///         flags: 0,
+///         substitutions: Vec::new(),
+///         span: None,
+///     }],
+///     redirects: Vec::new(),
+///     assignments: None,
+/// };
+/// let arena = AstArena::try_from(&cmd).unwrap();
+///
+/// for (_, node) in arena.iter() {
+///     if let NodeKind::Simple { words, .. } = node.kind {
+///         let name = arena.words(words)[0].text;
+///         assert_eq!(arena.text(name), "echo");
+///     }
+/// }
+/// assert_eq!(arena.to_command().line(), Some(1));
+/// ```
+#[derive(Debug, Clone)]
+pub struct AstArena {
+    nodes: Vec<Node>,
+    text: String,
+    texts: Vec<Text>,
+    words: Vec<ArenaWord>,
+    node_lists: Vec<NodeId>,
+    list_ops: Vec<ListOp>,
+    redirects: Vec<ArenaRedirect>,
+    clauses: Vec<ArenaClause>,
+    conds: Vec<ArenaCond>,
+}
+
+impl AstArena {
+    /// The node for the whole command
+    #[must_use]
+    pub const fn root(&self) -> NodeId {
+        NodeId(0)
+    }
+
+    /// The node with the given id
+    ///
+    /// # Panics
+    ///
+    /// Panics if `id` belongs to another arena with more nodes.
+    #[must_use]
+    pub fn node(&self, id: NodeId) -> &Node {
+        &self.nodes[id.index()]
+    }
+
+    /// Number of nodes
+    #[must_use]
+    pub const fn node_count(&self) -> usize {
+        self.nodes.len()
+    }
+
+    /// Every node, in walk order
+    pub fn iter(&self) -> impl Iterator<Item = (NodeId, &Node)> {
+        self.descendants(self.root())
+    }
+
+    /// A node and everything below it, in walk order
+    pub fn descendants(&self, id: NodeId) -> impl Iterator<Item = (NodeId, &Node)> {
+        let end = self.node(id).end;
+        (id.0..end).map(|i| (NodeId(i), &self.nodes[i as usize]))
+    }
+
+    /// The commands directly below a node, in source order
+    ///
+    /// Includes the actions of case clauses and the substitutions of words.
+    pub fn children(&self, id: NodeId) -> impl Iterator<Item = NodeId> + '_ {
+        // Each child's subtree ends where the next child starts
+        let end = self.node(id).end;
+        let mut next = id.0 + 1;
+        std::iter::from_fn(move || {
+            (next < end).then(|| {
+                let child = next;
+                next = self.nodes[child as usize].end;
+                NodeId(child)
+            })
+        })
+    }
+
+    /// The text of a string
+    #[must_use]
+    pub fn text(&self, text: Text) -> &str {
+        &self.text[text.start as usize..(text.start + text.len) as usize]
+    }
+
+    /// A list of strings (patterns, for-loop words, assignments)
+    #[must_use]
+    pub fn texts(&self, run: Run<Text>) -> &[Text] {
+        &self.texts[run.range()]
+    }
+
+    /// The words of a simple command
+    #[must_use]
+    pub fn words(&self, run: Run<ArenaWord>) -> &[ArenaWord] {
+        &self.words[run.range()]
+    }
+
+    /// The commands of a pipeline or sequence
+    #[must_use]
+    pub fn nodes(&self, run: Run<NodeId>) -> &[NodeId] {
+        &self.node_lists[run.range()]
+    }
+
+    /// The operators of a sequence
+    #[must_use]
+    pub fn ops(&self, run: Run<ListOp>) -> &[ListOp] {
+        &self.list_ops[run.range()]
+    }
+
+    /// The redirects of a command
+    #[must_use]
+    pub fn redirects(&self, run: Run<ArenaRedirect>) -> &[ArenaRedirect] {
+        &self.redirects[run.range()]
+    }
+
+    /// The clauses of a case statement
+    #[must_use]
+    pub fn clauses(&self, run: Run<ArenaClause>) -> &[ArenaClause] {
+        &self.clauses[run.range()]
+    }
+
+    /// A conditional expression
+    #[must_use]
+    pub fn cond(&self, id: CondId) -> &ArenaCond {
+        &self.conds[id.0 as usize]
+    }
+
+    /// Replace the tree with `cmd`, keeping the capacity of every table
+    ///
+    /// Cheaper than building a new arena when one is filled again and
+    /// again with trees of similar size.
+    ///
+    /// # Errors
+    ///
+    /// Returns [`ArenaTooLarge`] if `cmd` doesn't fit in an arena. The arena
+    /// is then left empty, and its nodes can't be read until a rebuild
+    /// succeeds.
+    pub fn rebuild(&mut self, cmd: &Command) -> Result<(), ArenaTooLarge> {
+        self.clear();
+        if let Err(e) = self.push_command(cmd) {
+            self.clear();
+            return Err(e);
+        }
+        Ok(())
+    }
+
+    fn clear(&mut self) {
+        self.nodes.clear();
+        self.text.clear();
+        self.texts.clear();
+        self.words.clear();
+        self.node_lists.clear();
+        self.list_ops.clear();
+        self.redirects.clear();
+        self.clauses.clear();
+        self.conds.clear();
+    }
+
+    /// Convert the whole tree back to a [`Command`]
+    #[must_use]
+    pub fn to_command(&self) -> Command {
+        self.command(self.root())
+    }
+
+    /// Convert the subtree at `id` to a [`Command`]
+    #[must_use]
+    #[allow(clippy::too_many_lines)] // One arm per command type
+    pub fn command(&self, id: NodeId) -> Command {
+        let node = self.node(id);
+        let (line, span) = (node.line, node.span.map(Box::new));
+        let redirects = || self.owned_redirects(node.redirects);
+        let boxed = |id| Nested::new(self.command(id));
+        match node.kind {
+            NodeKind::Simple { words, assignments } => Command::Simple {
+                line,
+                span,
+                words: self
+                    .words(words)
+                    .iter()
+                    .map(|word| Word {
+                        word: self.symbol(word.text),
+                        flags: word.flags,
+                        substitutions: self
+                            .nodes(word.substitutions)
+                            .iter()
+                            .map(|&id| self.command(id))
+                            .collect(),
+                        span: word.span.map(Box::new),
+                    })
+                    .collect(),
+                redirects: redirects(),
+                assignments: assignments.map(|run| self.strings(run)),
+            },
+            NodeKind::Pipeline { commands, negated } => Command::Pipeline {
+                line,
+                span,
+                commands: self
+                    .nodes(commands)
+                    .iter()
+                    .map(|&id| self.command(id))
+                    .collect(),
+                negated,
+            },
+            NodeKind::List { op, left, right } => Command::List {
+                line,
+                span,
+                op,
+                left: boxed(left),
+                right: boxed(right),
+            },
+            NodeKind::Sequence { commands, ops } => Command::Sequence {
+                line,
+                span,
+                items: self
+                    .nodes(commands)
+                    .iter()
+                    .map(|&id| self.command(id))
+                    .zip(self.ops(ops).iter().copied())
+                    .collect(),
+            },
+            NodeKind::For {
+                variable,
+                words,
+                body,
+            } => Command::For {
+                line,
+                span,
+                variable: self.symbol(variable),
+                words: words.map(|run| self.symbols(run)),
+                body: boxed(body),
+                redirects: redirects(),
+            },
+            NodeKind::While { test, body } => Command::While {
+                line,
+                span,
+                test: boxed(test),
+                body: boxed(body),
+                redirects: redirects(),
+            },
+            NodeKind::Until { test, body } => Command::Until {
+                line,
+                span,
+                test: boxed(test),
+                body: boxed(body),
+                redirects: redirects(),
+            },
+            NodeKind::If {
+                condition,
+                then_branch,
+                else_branch,
+            } => Command::If {
+                line,
+                span,
+                condition: boxed(condition),
+                then_branch: boxed(then_branch),
+                else_branch: else_branch.map(boxed),
+                redirects: redirects(),
+            },
+            NodeKind::Case { word, clauses } => Command::Case {
+                line,
+                span,
+                word: self.symbol(word),
+                clauses: self
+                    .clauses(clauses)
+                    .iter()
+                    .map(|clause| CaseClause {
+                        patterns: self.symbols(clause.patterns),
+                        action: clause.action.map(boxed),
+                        flags: clause.flags.clone(),
+                    })
+                    .collect(),
+                redirects: redirects(),
+            },
+            NodeKind::Select {
+                variable,
+                words,
+                body,
+            } => Command::Select {
+                line,
+                span,
+                variable: self.symbol(variable),
+                words: words.map(|run| self.symbols(run)),
+                body: boxed(body),
+                redirects: redirects(),
+            },
+            NodeKind::Group { body } => Command::Group {
+                line,
+                span,
+                body: boxed(body),
+                redirects: redirects(),
+            },
+            NodeKind::Subshell { body } => Command::Subshell {
+                line,
+                span,
+                body: boxed(body),
+                redirects: redirects(),
+            },
+            NodeKind::FunctionDef {
+                name,
+                body,
+                source_file,
+            } => Command::FunctionDef {
+                line,
+                span,
+                name: self.symbol(name),
+                body: boxed(body),
+                source_file: source_file.map(|text| self.text(text).to_string()),
+            },
+            NodeKind::Arithmetic { expression } => Command::Arithmetic {
+                line,
+                span,
+                expression: self.text(expression).to_string(),
+            },
+            NodeKind::ArithmeticFor {
+                init,
+                test,
+                step,
+                body,
+            } => Command::ArithmeticFor {
+                line,
+                span,
+                init: self.text(init).to_string(),
+                test: self.text(test).to_string(),
+                step: self.text(step).to_string(),
+                body: boxed(body),
+            },
+            NodeKind::Conditional { expr } => Command::Conditional {
+                line,
+                span,
+                expr: self.conditional_expr(expr),
+            },
+            NodeKind::Coproc { name, body } => Command::Coproc {
+                line,
+                span,
+                name: name.map(|text| self.text(text).to_string()),
+                body: boxed(body),
+            },
+        }
+    }
+
+    fn symbol(&self, text: Text) -> Symbol {
+        Symbol::from(self.text(text))
+    }
+
+    fn symbols(&self, run: Run<Text>) -> Vec<Symbol> {
+        self.texts(run)
+            .iter()
+            .map(|&text| self.symbol(text))
+            .collect()
+    }
+
+    fn strings(&self, run: Run<Text>) -> Vec<String> {
+        self.texts(run)
+            .iter()
+            .map(|&text| self.text(text).to_string())
+            .collect()
+    }
+
+    fn owned_redirects(&self, run: Run<ArenaRedirect>) -> Vec<Redirect> {
+        self.redirects(run)
+            .iter()
+            .map(|redir| Redirect {
+                direction: redir.direction,
+                source_fd: redir.source_fd,
+                target: match redir.target {
+                    ArenaTarget::File(text) => RedirectTarget::File(self.text(text).to_string()),
+                    ArenaTarget::Fd(fd) => RedirectTarget::Fd(fd),
+                },
+                here_doc_eof: redir.here_doc_eof.map(|text| self.text(text).to_string()),
+                span: redir.span.map(Box::new),
+            })
+            .collect()
+    }
+
+    fn conditional_expr(&self, id: CondId) -> ConditionalExpr {
+        let text = |text| self.text(text).to_string();
+        let boxed = |id| Nested::new(self.conditional_expr(id));
+        match *self.cond(id) {
+            ArenaCond::Unary { op, arg } => ConditionalExpr::Unary {
+                op: text(op),
+                arg: text(arg),
+            },
+            ArenaCond::Binary { op, left, right } => ConditionalExpr::Binary {
+                op: text(op),
+                left: text(left),
+                right: text(right),
+            },
+            ArenaCond::And { left, right } => ConditionalExpr::And {
+                left: boxed(left),
+                right: boxed(right),
+            },
+            ArenaCond::Or { left, right } => ConditionalExpr::Or {
+                left: boxed(left),
+                right: boxed(right),
+            },
+            ArenaCond::Not { expr } => ConditionalExpr::Not { expr: boxed(expr) },
+            ArenaCond::Term { word } => ConditionalExpr::Term { word: text(word) },
+            ArenaCond::Expr { expr } => ConditionalExpr::Expr { expr: boxed(expr) },
+        }
+    }
+}
+
+impl Index<NodeId> for AstArena {
+    type Output = Node;
+
+    fn index(&self, id: NodeId) -> &Node {
+        self.node(id)
+    }
+}
+
+impl TryFrom<&Command> for AstArena {
+    type Error = ArenaTooLarge;
+
+    /// Flatten a command tree into an arena
+    fn try_from(cmd: &Command) -> Result<Self, ArenaTooLarge> {
+        let mut arena = Self {
+            nodes: Vec::new(),
+            text: String::new(),
+            texts: Vec::new(),
+            words: Vec::new(),
+            node_lists: Vec::new(),
+            list_ops: Vec::new(),
+            redirects: Vec::new(),
+            clauses: Vec::new(),
+            conds: Vec::new(),
+        };
+        arena.push_command(cmd)?;
+        Ok(arena)
+    }
+}
+
+impl From<&AstArena> for Command {
+    fn from(arena: &AstArena) -> Self {
+        arena.to_command()
+    }
+}
+
+/// A tree too large for an [`AstArena`]
+///
+/// Arenas index their tables with `u32`s, so a tree can't have more than
+/// `u32::MAX` nodes, words, redirects or bytes of text.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Error)]
+#[error("AST too large for an arena")]
+pub struct ArenaTooLarge;
+
+impl From<ArenaTooLarge> for ParseError {
+    fn from(e: ArenaTooLarge) -> Self {
+        Self::ConversionError(Some(e.to_string()))
+    }
+}
+
+/// Convert a table length to an index
+fn index(len: usize) -> Result<u32, ArenaTooLarge> {
+    u32::try_from(len).map_err(|_| ArenaTooLarge)
+}
+
+/// Building an arena from a [`Command`]
+impl AstArena {
+    /// Append a command and its subtree, returning its id
+    ///
+    /// The node is reserved before its children so that it precedes them.
+    #[allow(clippy::too_many_lines)] // One arm per command type
+    fn push_command(&mut self, cmd: &Command) -> Result<NodeId, ArenaTooLarge> {
+        let id = NodeId(index(self.nodes.len())?);
+        self.nodes.push(Node {
+            line: cmd.line(),
+            span: cmd.span(),
+            kind: NodeKind::Arithmetic {
+                expression: Text { start: 0, len: 0 },
+            },
+            redirects: Run::EMPTY,
+            end: 0,
+        });
+
+        let kind = match cmd {
+            Command::Simple {
+                words, assignments, ..
+            } => NodeKind::Simple {
+                words: self.push_words(words)?,
+                assignments: assignments
+                    .as_deref()
+                    .map(|list| self.push_texts(list))
+                    .transpose()?,
+            },
+            Command::Pipeline {
+                commands, negated, ..
+            } => {
+                // Nested pipelines append their own lists, so gather the ids
+                // before adding this one
+                let ids = self.push_commands(commands)?;
+                let start = index(self.node_lists.len())?;
+                self.node_lists.extend(ids);
+                NodeKind::Pipeline {
+                    commands: Self::run_from(start, self.node_lists.len())?,
+                    negated: *negated,
+                }
+            }
+            Command::List {
+                op, left, right, ..
+            } => NodeKind::List {
+                op: *op,
+                left: self.push_command(left)?,
+                right: self.push_command(right)?,
+            },
+            Command::Sequence { items, .. } => {
+                let ids = items
+                    .iter()
+                    .map(|(cmd, _)| self.push_command(cmd))
+                    .collect::<Result<Vec<_>, _>>()?;
+                let start = index(self.node_lists.len())?;
+                self.node_lists.extend(ids);
+                let ops_start = index(self.list_ops.len())?;
+                self.list_ops.extend(items.iter().map(|&(_, op)| op));
+                NodeKind::Sequence {
+                    commands: Self::run_from(start, self.node_lists.len())?,
+                    ops: Self::run_from(ops_start, self.list_ops.len())?,
+                }
+            }
+            Command::For {
+                variable,
+                words,
+                body,
+                ..
+            } => NodeKind::For {
+                variable: self.push_text(variable)?,
+                words: words
+                    .as_deref()
+                    .map(|list| self.push_texts(list))
+                    .transpose()?,
+                body: self.push_command(body)?,
+            },
+            Command::While { test, body, .. } => NodeKind::While {
+                test: self.push_command(test)?,
+                body: self.push_command(body)?,
+            },
+            Command::Until { test, body, .. } => NodeKind::Until {
+                test: self.push_command(test)?,
+                body: self.push_command(body)?,
+            },
+            Command::If {
+                condition,
+                then_branch,
+                else_branch,
+                ..
+            } => NodeKind::If {
+                condition: self.push_command(condition)?,
+                then_branch: self.push_command(then_branch)?,
+                else_branch: else_branch
+                    .as_deref()
+                    .map(|cmd| self.push_command(cmd))
+                    .transpose()?,
+            },
+            Command::Case { word, clauses, .. } => {
+                let word = self.push_text(word)?;
+                let clauses = clauses
+                    .iter()
+                    .map(|clause| {
+                        Ok(ArenaClause {
+                            patterns: self.push_texts(&clause.patterns)?,
+                            action: clause
+                                .action
+                                .as_deref()
+                                .map(|cmd| self.push_command(cmd))
+                                .transpose()?,
+                            flags: clause.flags.clone(),
+                        })
+                    })
+                    .collect::<Result<Vec<_>, _>>()?;
+                let start = index(self.clauses.len())?;
+                self.clauses.extend(clauses);
+                NodeKind::Case {
+                    word,
+                    clauses: Self::run_from(start, self.clauses.len())?,
+                }
+            }
+            Command::Select {
+                variable,
+                words,
+                body,
+                ..
+            } => NodeKind::Select {
+                variable: self.push_text(variable)?,
+                words: words
+                    .as_deref()
+                    .map(|list| self.push_texts(list))
+                    .transpose()?,
+                body: self.push_command(body)?,
+            },
+            Command::Group { body, .. } => NodeKind::Group {
+                body: self.push_command(body)?,
+            },
+            Command::Subshell { body, .. } => NodeKind::Subshell {
+                body: self.push_command(body)?,
+            },
+            Command::FunctionDef {
+                name,
+                body,
+                source_file,
+                ..
+            } => NodeKind::FunctionDef {
+                name: self.push_text(name)?,
+                body: self.push_command(body)?,
+                source_file: source_file
+                    .as_deref()
+                    .map(|file| self.push_text(file))
+                    .transpose()?,
+            },
+            Command::Arithmetic { expression, .. } => NodeKind::Arithmetic {
+                expression: self.push_text(expression)?,
+            },
+            Command::ArithmeticFor {
+                init,
+                test,
+                step,
+                body,
+                ..
+            } => NodeKind::ArithmeticFor {
+                init: self.push_text(init)?,
+                test: self.push_text(test)?,
+                step: self.push_text(step)?,
+                body: self.push_command(body)?,
+            },
+            Command::Conditional { expr, .. } => NodeKind::Conditional {
+                expr: self.push_cond(expr)?,
+            },
+            Command::Coproc { name, body, .. } => NodeKind::Coproc {
+                name: name
+                    .as_deref()
+                    .map(|name| self.push_text(name))
+                    .transpose()?,
+                body: self.push_command(body)?,
+            },
+        };
+        let redirects = cmd
+            .redirects()
+            .map_or(Ok(Run::EMPTY), |list| self.push_redirects(list))?;
+
+        let end = index(self.nodes.len())?;
+        let node = &mut self.nodes[id.index()];
+        node.kind = kind;
+        node.redirects = redirects;
+        node.end = end;
+        Ok(id)
+    }
+
+    /// Append each command and its subtree, returning their ids
+    fn push_commands(&mut self, commands: &[Command]) -> Result<Vec<NodeId>, ArenaTooLarge> {
+        commands.iter().map(|cmd| self.push_command(cmd)).collect()
+    }
+
+    fn run_from<T>(start: u32, end: usize) -> Result<Run<T>, ArenaTooLarge> {
+        Ok(Run {
+            start,
+            len: index(end)? - start,
+            marker: PhantomData,
+        })
+    }
+
+    fn push_text(&mut self, text: &str) -> Result<Text, ArenaTooLarge> {
+        let start = index(self.text.len())?;
+        self.text.push_str(text);
+        Ok(Text {
+            start,
+            len: index(self.text.len())? - start,
+        })
+    }
+
+    fn push_texts<S: AsRef<str>>(&mut self, list: &[S]) -> Result<Run<Text>, ArenaTooLarge> {
+        let start = index(self.texts.len())?;
+        for text in list {
+            let text = self.push_text(text.as_ref())?;
+            self.texts.push(text);
+        }
+        Self::run_from(start, self.texts.len())
+    }
+
+    fn push_words(&mut self, words: &[Word]) -> Result<Run<ArenaWord>, ArenaTooLarge> {
+        // Substitutions append their own words, so add them first
+        let substitutions = words
+            .iter()
+            .map(|word| {
+                let ids = self.push_commands(&word.substitutions)?;
+                let start = index(self.node_lists.len())?;
+                self.node_lists.extend(ids);
+                Self::run_from(start, self.node_lists.len())
+            })
+            .collect::<Result<Vec<_>, _>>()?;
+
+        let start = index(self.words.len())?;
+        for (word, substitutions) in words.iter().zip(substitutions) {
+            let text = self.push_text(&word.word)?;
+            self.words.push(ArenaWord {
+                text,
+                flags: word.flags,
+                substitutions,
+                span: word.span.as_deref().copied(),
+            });
+        }
+        Self::run_from(start, self.words.len())
+    }
+
+    fn push_redirects(
+        &mut self,
+        redirects: &[Redirect],
+    ) -> Result<Run<ArenaRedirect>, ArenaTooLarge> {
+        let start = index(self.redirects.len())?;
+        for redir in redirects {
+            let target = match &redir.target {
+                RedirectTarget::File(file) => ArenaTarget::File(self.push_text(file)?),
+                RedirectTarget::Fd(fd) => ArenaTarget::Fd(*fd),
+            };
+            let here_doc_eof = redir
+                .here_doc_eof
+                .as_deref()
+                .map(|eof| self.push_text(eof))
+                .transpose()?;
+            self.redirects.push(ArenaRedirect {
+                direction: redir.direction,
+                source_fd: redir.source_fd,
+                target,
+                here_doc_eof,
+                span: redir.span.as_deref().copied(),
+            });
+        }
+        Self::run_from(start, self.redirects.len())
+    }
+
+    fn push_cond(&mut self, expr: &ConditionalExpr) -> Result<CondId, ArenaTooLarge> {
+        let cond = match expr {
+            ConditionalExpr::Unary { op, arg } => ArenaCond::Unary {
+                op: self.push_text(op)?,
+                arg: self.push_text(arg)?,
+            },
+            ConditionalExpr::Binary { op, left, right } => ArenaCond::Binary {
+                op: self.push_text(op)?,
+                left: self.push_text(left)?,
+                right: self.push_text(right)?,
+            },
+            ConditionalExpr::And { left, right } => ArenaCond::And {
+                left: self.push_cond(left)?,
+                right: self.push_cond(right)?,
+            },
+            ConditionalExpr::Or { left, right } => ArenaCond::Or {
+                left: self.push_cond(left)?,
+                right: self.push_cond(right)?,
+            },
+            ConditionalExpr::Not { expr } => ArenaCond::Not {
+                expr: self.push_cond(expr)?,
+            },
+            ConditionalExpr::Term { word } => ArenaCond::Term {
+                word: self.push_text(word)?,
+            },
+            ConditionalExpr::Expr { expr } => ArenaCond::Expr {
+                expr: self.push_cond(expr)?,
+            },
+        };
+        self.conds.push(cond);
+        Ok(CondId(index(self.conds.len() - 1)?))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A tree covering every node kind, in the JSON the AST serializes to
+    const EVERY_KIND: &str = r#"{"type":"list","op":"semi",
+        "left":{"type":"function_def","line":1,"name":"f","source_file":"x.sh",
+          "body":{"type":"group","redirects":[{"direction":"output","source_fd":2,
+            "target":"/dev/null"}],
+          "body":{"type":"if",
+            "condition":{"type":"conditional","expr":{"cond_type":"and",
+              "left":{"cond_type":"unary","op":"-f","arg":"a"},
+              "right":{"cond_type":"not","expr":{"cond_type":"expr","expr":
+                {"cond_type":"or","left":{"cond_type":"term","word":"b"},
+                  "right":{"cond_type":"binary","op":"==","left":"c","right":"d"}}}}}},
+            "then_branch":{"type":"pipeline","negated":true,"commands":[
+              {"type":"simple","words":[{"word":"cat","flags":0},{"word":"$x","flags":1}],
+                "redirects":[{"direction":"here_doc","source_fd":0,"target":"",
+                  "here_doc_eof":"EOF"}],"assignments":["a=1"]},
+              {"type":"subshell","body":{"type":"arithmetic","expression":"i++"},
+                "redirects":[]}]},
+            "else_branch":{"type":"case","word":"$1","redirects":[],"clauses":[
+              {"patterns":["a","b"],"action":{"type":"simple","words":[],
+                "redirects":[{"direction":"dup_output","source_fd":1,"target":2}]},
+                "flags":{"fallthrough":true}},
+              {"patterns":["*"],"action":null}]},
+            "redirects":[]}}},
+        "right":{"type":"list","op":"and",
+          "left":{"type":"for","variable":"i","words":["1","2"],
+            "body":{"type":"while","test":{"type":"simple","words":[{"word":"true"}],
+              "redirects":[]},"body":{"type":"until","test":{"type":"simple",
+              "words":[],"redirects":[]},"body":{"type":"select","variable":"s",
+              "body":{"type":"arithmetic_for","init":"i=0","test":"i<3","step":"i++",
+              "body":{"type":"coproc","name":"w","body":{"type":"simple",
+              "words":[],"redirects":[]}}}}}}},
+          "right":{"type":"pipeline","commands":[{"type":"simple","words":[],
+            "redirects":[]},{"type":"simple","words":[{"word":"wc"}],"redirects":[]}]}}}"#;
+
+    fn every_kind() -> Command {
+        serde_json::from_str(EVERY_KIND).unwrap()
+    }
+
+    #[test]
+    fn test_round_trip() {
+        let cmd = every_kind();
+        let arena = AstArena::try_from(&cmd).unwrap();
+        assert_eq!(
+            serde_json::to_string(&arena.to_command()).unwrap(),
+            serde_json::to_string(&cmd).unwrap()
+        );
+
+        // Clones share nothing with the original
+        let copy = arena.clone();
+        drop(arena);
+        assert_eq!(
+            serde_json::to_string(&Command::from(&copy)).unwrap(),
+            serde_json::to_string(&cmd).unwrap()
+        );
+    }
+
+    #[test]
+    fn test_rebuild() {
+        let mut arena = AstArena::try_from(&every_kind()).unwrap();
+        let capacity = arena.nodes.capacity();
+        let cmd: Command =
+            serde_json::from_str(r#"{"type":"simple","words":[{"word":"ls"}],"redirects":[]}"#)
+                .unwrap();
+        arena.rebuild(&cmd).unwrap();
+        assert_eq!(arena.node_count(), 1);
+        assert_eq!(arena.nodes.capacity(), capacity);
+        assert_eq!(
+            serde_json::to_string(&arena.to_command()).unwrap(),
+            serde_json::to_string(&cmd).unwrap()
+        );
+    }
+
+    #[test]
+    fn test_walk_order() {
+        let arena = AstArena::try_from(&every_kind()).unwrap();
+        assert_eq!(arena.node_count(), 24);
+
+        // Children are visited in source order, and each is followed by its
+        // own subtree
+        let mut walked = Vec::new();
+        let mut stack = vec![arena.root()];
+        while let Some(id) = stack.pop() {
+            walked.push(id);
+            let start = stack.len();
+            stack.extend(arena.children(id));
+            stack[start..].reverse();
+        }
+        let ids: Vec<_> = arena.iter().map(|(id, _)| id).collect();
+        assert_eq!(walked, ids);
+
+        let NodeKind::List { left, right, .. } = arena[arena.root()].kind else {
+            panic!("Expected a list");
+        };
+        assert_eq!(
+            arena.children(arena.root()).collect::<Vec<_>>(),
+            [left, right]
+        );
+        assert_eq!(
+            arena.descendants(left).count(),
+            right.index() - left.index()
+        );
+    }
+
+    #[test]
+    fn test_parts() {
+        let arena = AstArena::try_from(&every_kind()).unwrap();
+        let (_, case) = arena
+            .iter()
+            .find(|(_, node)| matches!(node.kind, NodeKind::Case { .. }))
+            .unwrap();
+        let NodeKind::Case { word, clauses } = case.kind else {
+            unreachable!();
+        };
+        assert_eq!(arena.text(word), "$1");
+        let patterns: Vec<_> = arena
+            .texts(arena.clauses(clauses)[0].patterns)
+            .iter()
+            .map(|&text| arena.text(text))
+            .collect();
+        assert_eq!(patterns, ["a", "b"]);
+        assert!(arena.clauses(clauses)[1].action.is_none());
+
+        let redirects = arena.redirects(arena.node(arena.root()).redirects);
+        assert!(redirects.is_empty());
+    }
+
+    #[test]
+    fn test_too_large() {
+        assert_eq!(index(u32::MAX as usize), Ok(u32::MAX));
+        if let Some(len) = (u32::MAX as usize).checked_add(1) {
+            assert_eq!(index(len), Err(ArenaTooLarge));
+        }
+        assert!(matches!(
+            ParseError::from(ArenaTooLarge),
+            ParseError::ConversionError(Some(_))
+        ));
+    }
+}
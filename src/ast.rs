@@ -3,8 +3,13 @@
 //! These types mirror bash's internal command representation but in idiomatic Rust.
 //! They are serializable to JSON via serde.
 
-use schemars::JsonSchema;
-use serde::{Deserialize, Serialize};
+use crate::Symbol;
+use schemars::{JsonSchema, Schema, SchemaGenerator};
+use sealed::Dismantle;
+use serde::{Deserialize, Deserializer, Serialize, Serializer};
+use std::borrow::Cow;
+use std::fmt;
+use std::ops::{Deref, DerefMut};
 
 /// A bash command - the top-level AST node
 #[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
@@ -14,6 +19,8 @@ pub enum Command {
     Simple {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
         words: Vec<Word>,
         redirects: Vec<Redirect>,
         #[serde(skip_serializing_if = "Option::is_none")]
@@ -24,6 +31,8 @@ pub enum Command {
     Pipeline {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
         commands: Vec<Self>,
         /// True if pipeline is negated with !
         #[serde(skip_serializing_if = "std::ops::Not::not", default)]
@@ -34,19 +43,39 @@ pub enum Command {
     List {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
         op: ListOp,
-        left: Box<Self>,
-        right: Box<Self>,
+        left: Nested<Self>,
+        right: Nested<Self>,
+    },
+
+    /// Flattened list: a run of commands joined by operators of equal
+    /// precedence, such as the statements of a script
+    ///
+    /// Only produced by [`parse_flat()`](crate::parse_flat), in place of
+    /// every chain of `List`s. Each command is paired with the operator that
+    /// follows it; the last one's is `Amp` if it runs in the background and
+    /// `Semi` otherwise. Operators are either all `&&`/`||` or all
+    /// `;`/`&`/newline, as bash gives those two groups different precedence.
+    Sequence {
+        #[serde(skip_serializing_if = "Option::is_none")]
+        line: Option<u32>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        items: Vec<(Self, ListOp)>,
     },
 
     /// For loop: `for var in list; do ...; done`
     For {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
-        variable: String,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        variable: Symbol,
         #[serde(skip_serializing_if = "Option::is_none")]
-        words: Option<Vec<String>>,
-        body: Box<Self>,
+        words: Option<Vec<Symbol>>,
+        body: Nested<Self>,
         #[serde(skip_serializing_if = "Vec::is_empty", default)]
         redirects: Vec<Redirect>,
     },
@@ -55,8 +84,10 @@ pub enum Command {
     While {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
-        test: Box<Self>,
-        body: Box<Self>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        test: Nested<Self>,
+        body: Nested<Self>,
         #[serde(skip_serializing_if = "Vec::is_empty", default)]
         redirects: Vec<Redirect>,
     },
@@ -65,8 +96,10 @@ pub enum Command {
     Until {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
-        test: Box<Self>,
-        body: Box<Self>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        test: Nested<Self>,
+        body: Nested<Self>,
         #[serde(skip_serializing_if = "Vec::is_empty", default)]
         redirects: Vec<Redirect>,
     },
@@ -75,10 +108,12 @@ pub enum Command {
     If {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
-        condition: Box<Self>,
-        then_branch: Box<Self>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        condition: Nested<Self>,
+        then_branch: Nested<Self>,
         #[serde(skip_serializing_if = "Option::is_none")]
-        else_branch: Option<Box<Self>>,
+        else_branch: Option<Nested<Self>>,
         #[serde(skip_serializing_if = "Vec::is_empty", default)]
         redirects: Vec<Redirect>,
     },
@@ -87,7 +122,9 @@ pub enum Command {
     Case {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
-        word: String,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        word: Symbol,
         clauses: Vec<CaseClause>,
         #[serde(skip_serializing_if = "Vec::is_empty", default)]
         redirects: Vec<Redirect>,
@@ -97,10 +134,12 @@ pub enum Command {
     Select {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
-        variable: String,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        variable: Symbol,
         #[serde(skip_serializing_if = "Option::is_none")]
-        words: Option<Vec<String>>,
-        body: Box<Self>,
+        words: Option<Vec<Symbol>>,
+        body: Nested<Self>,
         #[serde(skip_serializing_if = "Vec::is_empty", default)]
         redirects: Vec<Redirect>,
     },
@@ -109,7 +148,9 @@ pub enum Command {
     Group {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
-        body: Box<Self>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        body: Nested<Self>,
         #[serde(skip_serializing_if = "Vec::is_empty", default)]
         redirects: Vec<Redirect>,
     },
@@ -118,7 +159,9 @@ pub enum Command {
     Subshell {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
-        body: Box<Self>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        body: Nested<Self>,
         #[serde(skip_serializing_if = "Vec::is_empty", default)]
         redirects: Vec<Redirect>,
     },
@@ -127,8 +170,10 @@ pub enum Command {
     FunctionDef {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
-        name: String,
-        body: Box<Self>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
+        name: Symbol,
+        body: Nested<Self>,
         #[serde(skip_serializing_if = "Option::is_none")]
         source_file: Option<String>,
     },
@@ -137,6 +182,8 @@ pub enum Command {
     Arithmetic {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
         expression: String,
     },
 
@@ -144,16 +191,20 @@ pub enum Command {
     ArithmeticFor {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
         init: String,
         test: String,
         step: String,
-        body: Box<Self>,
+        body: Nested<Self>,
     },
 
     /// Conditional expression: `[[ expr ]]`
     Conditional {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
         expr: ConditionalExpr,
     },
 
@@ -161,9 +212,11 @@ pub enum Command {
     Coproc {
         #[serde(skip_serializing_if = "Option::is_none")]
         line: Option<u32>,
+        #[serde(skip_serializing_if = "Option::is_none", default)]
+        span: Option<Box<Span>>,
         #[serde(skip_serializing_if = "Option::is_none")]
         name: Option<String>,
-        body: Box<Self>,
+        body: Nested<Self>,
     },
 }
 
@@ -171,10 +224,20 @@ pub enum Command {
 #[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
 pub struct Word {
     /// The word text
-    pub word: String,
+    pub word: Symbol,
     /// Word flags (`W_HASDOLLAR`, `W_QUOTED`, etc.)
     #[serde(skip_serializing_if = "is_zero", default)]
     pub flags: u32,
+    /// The commands of the word's `$(...)`, `<(...)` and `>(...)`
+    /// substitutions, in the order they appear
+    ///
+    /// Only filled in by `parse_with_substitutions()`, from the trees bash
+    /// built while parsing the word, and empty otherwise.
+    #[serde(skip_serializing_if = "Vec::is_empty", default)]
+    pub substitutions: Vec<Command>,
+    /// Where the word is in the source, if known
+    #[serde(skip_serializing_if = "Option::is_none", default)]
+    pub span: Option<Box<Span>>,
 }
 
 /// Helper for serde `skip_serializing_if` (requires reference signature)
@@ -183,6 +246,52 @@ const fn is_zero(n: &u32) -> bool {
     *n == 0
 }
 
+/// Where a node is in the source script
+///
+/// Offsets are in bytes from the start of the script; `end` is just past
+/// the node's last byte. Lines and columns count from 1, columns in bytes,
+/// and `end_line`/`end_column` give the position of `end`.
+///
+/// Only filled in by [`parse_with_spans()`](crate::parse_with_spans), and
+/// kept in a box of its own so that nodes parsed without spans pay only
+/// for a null pointer.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
+pub struct Span {
+    /// Offset of the first byte
+    pub start: usize,
+    /// Offset just past the last byte
+    pub end: usize,
+    /// Line of `start`
+    pub line: u32,
+    /// Column of `start`
+    pub column: u32,
+    /// Line of `end`
+    pub end_line: u32,
+    /// Column of `end`
+    pub end_column: u32,
+}
+
+impl Span {
+    /// The smallest span covering both
+    #[must_use]
+    pub const fn cover(self, other: Self) -> Self {
+        let first = if other.start < self.start {
+            other
+        } else {
+            self
+        };
+        let last = if other.end > self.end { other } else { self };
+        Self {
+            start: first.start,
+            end: last.end,
+            line: first.line,
+            column: first.column,
+            end_line: last.end_line,
+            end_column: last.end_column,
+        }
+    }
+}
+
 /// List operator connecting commands
 #[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize, JsonSchema)]
 #[serde(rename_all = "snake_case")]
@@ -199,13 +308,21 @@ pub enum ListOp {
     Newline,
 }
 
+impl ListOp {
+    /// Whether this is `&&` or `||`, which bind tighter than the others
+    #[must_use]
+    pub const fn is_and_or(self) -> bool {
+        matches!(self, Self::And | Self::Or)
+    }
+}
+
 /// A case clause in a case statement
 #[derive(Debug, Clone, Serialize, Deserialize, JsonSchema)]
 pub struct CaseClause {
     /// Patterns to match
-    pub patterns: Vec<String>,
+    pub patterns: Vec<Symbol>,
     /// Command to execute if matched
-    pub action: Option<Box<Command>>,
+    pub action: Option<Nested<Command>>,
     /// Clause flags (fallthrough, testnext)
     #[serde(skip_serializing_if = "Option::is_none")]
     pub flags: Option<CaseClauseFlags>,
@@ -235,6 +352,12 @@ pub struct Redirect {
     /// For here-documents, the delimiter word
     #[serde(skip_serializing_if = "Option::is_none")]
     pub here_doc_eof: Option<String>,
+    /// Where the redirect is in the source, if known
+    ///
+    /// Covers the operator and its target; a here-document's body is not
+    /// included.
+    #[serde(skip_serializing_if = "Option::is_none", default)]
+    pub span: Option<Box<Span>>,
 }
 
 /// Redirect direction/type
@@ -294,15 +417,21 @@ pub enum ConditionalExpr {
         right: String,
     },
     /// `[[ expr1 && expr2 ]]` - AND
-    And { left: Box<Self>, right: Box<Self> },
+    And {
+        left: Nested<Self>,
+        right: Nested<Self>,
+    },
     /// `[[ expr1 || expr2 ]]` - OR
-    Or { left: Box<Self>, right: Box<Self> },
+    Or {
+        left: Nested<Self>,
+        right: Nested<Self>,
+    },
     /// `[[ ! expr ]]` - negation (inside the expression)
-    Not { expr: Box<Self> },
+    Not { expr: Nested<Self> },
     /// A single word/term in a conditional
     Term { word: String },
     /// A grouped expression `( expr )`
-    Expr { expr: Box<Self> },
+    Expr { expr: Nested<Self> },
 }
 
 impl Command {
@@ -313,6 +442,7 @@ impl Command {
             Self::Simple { line, .. }
             | Self::Pipeline { line, .. }
             | Self::List { line, .. }
+            | Self::Sequence { line, .. }
             | Self::For { line, .. }
             | Self::While { line, .. }
             | Self::Until { line, .. }
@@ -329,6 +459,77 @@ impl Command {
         }
     }
 
+    /// Mutable access to the line number, for relocating reused subtrees
+    pub(crate) const fn line_mut(&mut self) -> &mut Option<u32> {
+        match self {
+            Self::Simple { line, .. }
+            | Self::Pipeline { line, .. }
+            | Self::List { line, .. }
+            | Self::Sequence { line, .. }
+            | Self::For { line, .. }
+            | Self::While { line, .. }
+            | Self::Until { line, .. }
+            | Self::If { line, .. }
+            | Self::Case { line, .. }
+            | Self::Select { line, .. }
+            | Self::Group { line, .. }
+            | Self::Subshell { line, .. }
+            | Self::FunctionDef { line, .. }
+            | Self::Arithmetic { line, .. }
+            | Self::ArithmeticFor { line, .. }
+            | Self::Conditional { line, .. }
+            | Self::Coproc { line, .. } => line,
+        }
+    }
+
+    /// Where this command is in the source, if known
+    #[must_use]
+    pub fn span(&self) -> Option<Span> {
+        match self {
+            Self::Simple { span, .. }
+            | Self::Pipeline { span, .. }
+            | Self::List { span, .. }
+            | Self::Sequence { span, .. }
+            | Self::For { span, .. }
+            | Self::While { span, .. }
+            | Self::Until { span, .. }
+            | Self::If { span, .. }
+            | Self::Case { span, .. }
+            | Self::Select { span, .. }
+            | Self::Group { span, .. }
+            | Self::Subshell { span, .. }
+            | Self::FunctionDef { span, .. }
+            | Self::Arithmetic { span, .. }
+            | Self::ArithmeticFor { span, .. }
+            | Self::Conditional { span, .. }
+            | Self::Coproc { span, .. } => span.as_deref().copied(),
+        }
+    }
+
+    /// Mutable access to the span, for filling it in once the children
+    /// have theirs
+    pub(crate) const fn span_mut(&mut self) -> &mut Option<Box<Span>> {
+        match self {
+            Self::Simple { span, .. }
+            | Self::Pipeline { span, .. }
+            | Self::List { span, .. }
+            | Self::Sequence { span, .. }
+            | Self::For { span, .. }
+            | Self::While { span, .. }
+            | Self::Until { span, .. }
+            | Self::If { span, .. }
+            | Self::Case { span, .. }
+            | Self::Select { span, .. }
+            | Self::Group { span, .. }
+            | Self::Subshell { span, .. }
+            | Self::FunctionDef { span, .. }
+            | Self::Arithmetic { span, .. }
+            | Self::ArithmeticFor { span, .. }
+            | Self::Conditional { span, .. }
+            | Self::Coproc { span, .. } => span,
+        }
+    }
+
     /// Get the redirects for this command, if it has any.
     /// Returns `None` for command types that don't support redirects directly.
     #[must_use]
@@ -347,3 +548,244 @@ impl Command {
         }
     }
 }
+
+/// A command or `[[ ]]` expression nested in another
+///
+/// Holds the child on the heap like a `Box`, and derefs to it, but drops
+/// it one level of nesting at a time, moving each node's children onto a
+/// heap stack, so dropping a tree deeper than [`MAX_DEPTH`](crate::MAX_DEPTH)
+/// does not overflow the stack. It serializes, and has the same JSON
+/// schema, as the child itself.
+#[derive(Clone)]
+pub struct Nested<T: Dismantle>(Box<T>);
+
+impl<T: Dismantle> Nested<T> {
+    /// Nest `value` in its parent
+    #[must_use]
+    pub fn new(value: T) -> Self {
+        Self(Box::new(value))
+    }
+
+    /// Move the child out
+    #[must_use]
+    pub fn into_inner(mut self) -> T {
+        self.take()
+    }
+
+    /// Move the child out, leaving a leaf that is cheap to drop
+    fn take(&mut self) -> T {
+        self.0.take()
+    }
+}
+
+impl<T: Dismantle> Drop for Nested<T> {
+    fn drop(&mut self) {
+        self.take().dispose();
+    }
+}
+
+impl<T: Dismantle> Deref for Nested<T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        &self.0
+    }
+}
+
+impl<T: Dismantle> DerefMut for Nested<T> {
+    fn deref_mut(&mut self) -> &mut T {
+        &mut self.0
+    }
+}
+
+impl<T: Dismantle> AsRef<T> for Nested<T> {
+    fn as_ref(&self) -> &T {
+        &self.0
+    }
+}
+
+impl<T: Dismantle> AsMut<T> for Nested<T> {
+    fn as_mut(&mut self) -> &mut T {
+        &mut self.0
+    }
+}
+
+impl<T: Dismantle> From<T> for Nested<T> {
+    fn from(value: T) -> Self {
+        Self::new(value)
+    }
+}
+
+impl<T: Dismantle> From<Box<T>> for Nested<T> {
+    fn from(value: Box<T>) -> Self {
+        Self(value)
+    }
+}
+
+impl<T: Dismantle + fmt::Debug> fmt::Debug for Nested<T> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        fmt::Debug::fmt(&self.0, f)
+    }
+}
+
+impl<T: Dismantle + Serialize> Serialize for Nested<T> {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        self.0.serialize(serializer)
+    }
+}
+
+impl<'de, T: Dismantle + Deserialize<'de>> Deserialize<'de> for Nested<T> {
+    fn deserialize<D: Deserializer<'de>>(deserializer: D) -> Result<Self, D::Error> {
+        Box::deserialize(deserializer).map(Self)
+    }
+}
+
+impl<T: Dismantle + JsonSchema> JsonSchema for Nested<T> {
+    fn inline_schema() -> bool {
+        T::inline_schema()
+    }
+
+    fn schema_name() -> Cow<'static, str> {
+        T::schema_name()
+    }
+
+    fn schema_id() -> Cow<'static, str> {
+        T::schema_id()
+    }
+
+    fn json_schema(generator: &mut SchemaGenerator) -> Schema {
+        T::json_schema(generator)
+    }
+}
+
+pub(crate) mod sealed {
+    /// A node type that [`Nested`](super::Nested) can hold
+    pub trait Dismantle: Sized {
+        /// Move this node out, leaving a leaf that is cheap to create and
+        /// to drop
+        fn take(&mut self) -> Self;
+
+        /// Drop this node one level of nesting at a time
+        fn dispose(self);
+    }
+}
+
+impl Dismantle for Command {
+    /// Leaves an empty arithmetic command
+    fn take(&mut self) -> Self {
+        std::mem::replace(
+            self,
+            Self::Arithmetic {
+                line: None,
+                span: None,
+                expression: String::new(),
+            },
+        )
+    }
+
+    fn dispose(mut self) {
+        let mut commands = Vec::new();
+        let mut exprs = Vec::new();
+        self.detach_children(&mut commands, &mut exprs);
+        while let Some(mut cmd) = commands.pop() {
+            cmd.detach_children(&mut commands, &mut exprs);
+        }
+        while let Some(mut expr) = exprs.pop() {
+            expr.detach_operands(&mut exprs);
+        }
+    }
+}
+
+impl Command {
+    /// Move the commands directly inside this one onto `commands`, and its
+    /// `[[ ]]` expression onto `exprs`
+    fn detach_children(&mut self, commands: &mut Vec<Self>, exprs: &mut Vec<ConditionalExpr>) {
+        match self {
+            Self::Simple { words, .. } => {
+                for word in words {
+                    commands.append(&mut word.substitutions);
+                }
+            }
+            Self::Arithmetic { .. } => {}
+            Self::Conditional { expr, .. } => exprs.push(expr.take()),
+            Self::Pipeline {
+                commands: stages, ..
+            } => commands.append(stages),
+            Self::Sequence { items, .. } => commands.extend(items.drain(..).map(|(cmd, _)| cmd)),
+            Self::List { left, right, .. }
+            | Self::While {
+                test: left,
+                body: right,
+                ..
+            }
+            | Self::Until {
+                test: left,
+                body: right,
+                ..
+            } => {
+                commands.push(left.take());
+                commands.push(right.take());
+            }
+            Self::If {
+                condition,
+                then_branch,
+                else_branch,
+                ..
+            } => {
+                commands.push(condition.take());
+                commands.push(then_branch.take());
+                if let Some(else_branch) = else_branch {
+                    commands.push(else_branch.take());
+                }
+            }
+            Self::Case { clauses, .. } => {
+                for clause in clauses {
+                    if let Some(action) = &mut clause.action {
+                        commands.push(action.take());
+                    }
+                }
+            }
+            Self::For { body, .. }
+            | Self::Select { body, .. }
+            | Self::Group { body, .. }
+            | Self::Subshell { body, .. }
+            | Self::FunctionDef { body, .. }
+            | Self::ArithmeticFor { body, .. }
+            | Self::Coproc { body, .. } => commands.push(body.take()),
+        }
+    }
+}
+
+impl Dismantle for ConditionalExpr {
+    /// Leaves an empty term
+    fn take(&mut self) -> Self {
+        std::mem::replace(
+            self,
+            Self::Term {
+                word: String::new(),
+            },
+        )
+    }
+
+    fn dispose(mut self) {
+        let mut pending = Vec::new();
+        self.detach_operands(&mut pending);
+        while let Some(mut expr) = pending.pop() {
+            expr.detach_operands(&mut pending);
+        }
+    }
+}
+
+impl ConditionalExpr {
+    /// Move the operands directly inside this expression onto `out`
+    fn detach_operands(&mut self, out: &mut Vec<Self>) {
+        match self {
+            Self::And { left, right } | Self::Or { left, right } => {
+                out.push(left.take());
+                out.push(right.take());
+            }
+            Self::Not { expr } | Self::Expr { expr } => out.push(expr.take()),
+            Self::Unary { .. } | Self::Binary { .. } | Self::Term { .. } => {}
+        }
+    }
+}
@@ -19,6 +19,21 @@ extern "C" {
     static mut parsing_command: i32;
 }
 
+/// Bash globals set for pure parsing, by symbol name
+///
+/// Mirrors `init_bash_globals` for parsers that can only be reached through
+/// `dlsym` (each `ParserInstance` namespace has its own copies).
+#[cfg(target_os = "linux")]
+pub const PARSER_GLOBALS: [(&str, i32); 7] = [
+    ("interactive", 0),
+    ("interactive_shell", 0),
+    ("login_shell", 0),
+    ("posixly_correct", 0),
+    ("shell_initialized", 1),
+    ("startup_state", 0),
+    ("parsing_command", 0),
+];
+
 /// Initialize bash internals for parsing
 ///
 /// This must be called once before any parsing operations.
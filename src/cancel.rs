@@ -0,0 +1,220 @@
+//! Stopping a parse before it finishes
+//!
+//! A [`CancelToken`] is shared with whatever decides a parse has run long
+//! enough (another thread, a timer, a closed connection) and cancelled from
+//! there. Bash's parser checks it as it reads each byte of the script and
+//! the conversion as it reaches each command; either stops with
+//! `ParseError::Cancelled` and leaves the parser ready for the next parse.
+
+use crate::{parse_with_options, Command, ParseError, ParseLimits, ParseOptions};
+use std::sync::atomic::{AtomicI32, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+/// A flag that cancels the parses given it
+///
+/// Clones share the flag, so one can be kept to cancel with while another
+/// is moved to the parsing thread. Once cancelled, a token stays cancelled.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_cancellable, CancelToken, ParseError, ParseLimits};
+/// use std::time::Duration;
+///
+/// init();
+///
+/// let token = CancelToken::new();
+/// let canceller = token.clone();
+/// std::thread::spawn(move || {
+///     std::thread::sleep(Duration::from_millis(100));
+///     canceller.cancel();
+/// });
+///
+/// // A million commands, each nested a level deeper than the one before
+/// let script = "echo hello\n".repeat(1_000_000);
+/// let limits = ParseLimits::default().with_max_depth(usize::MAX);
+/// match parse_cancellable(&script, &limits, &token) {
+///     Ok(_) => println!("parsed"),
+///     Err(ParseError::Cancelled) => eprintln!("gave up"),
+///     Err(e) => eprintln!("{e}"),
+/// }
+/// ```
+#[derive(Debug, Clone, Default)]
+pub struct CancelToken {
+    /// Read by the C side as an `int`
+    flag: Arc<AtomicI32>,
+}
+
+impl CancelToken {
+    /// A token that hasn't been cancelled
+    #[must_use]
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Cancel the parses using this token, now and from now on
+    pub fn cancel(&self) {
+        self.flag.store(1, Ordering::Relaxed);
+    }
+
+    /// Whether [`cancel()`](Self::cancel) has been called
+    #[must_use]
+    pub fn is_cancelled(&self) -> bool {
+        self.flag.load(Ordering::Relaxed) != 0
+    }
+}
+
+/// What may cut one parse short besides its limits
+#[derive(Clone, Copy, Default)]
+pub struct Interrupt<'a> {
+    pub token: Option<&'a CancelToken>,
+    pub deadline: Option<Instant>,
+}
+
+impl Interrupt<'_> {
+    /// Nothing at all
+    pub const NONE: Self = Self {
+        token: None,
+        deadline: None,
+    };
+
+    /// The flag the C side reads, or null
+    pub fn flag(&self) -> *const i32 {
+        self.token
+            .map_or(std::ptr::null(), |token| token.flag.as_ptr().cast_const())
+    }
+
+    /// Whether the parse should stop
+    pub fn is_due(&self) -> bool {
+        self.token.is_some_and(CancelToken::is_cancelled)
+            || self
+                .deadline
+                .is_some_and(|deadline| Instant::now() >= deadline)
+    }
+
+    /// The time left before the deadline, if there is one
+    pub fn time_left(&self) -> Option<Duration> {
+        self.deadline
+            .map(|deadline| deadline.saturating_duration_since(Instant::now()))
+    }
+}
+
+/// Parse a bash script, giving up once `token` is cancelled
+///
+/// Like [`parse_with_limits()`](crate::parse_with_limits), but fails with
+/// `ParseError::Cancelled` if `token` is cancelled before or while the
+/// script is parsed.
+pub fn parse_cancellable(
+    script: &str,
+    limits: &ParseLimits,
+    token: &CancelToken,
+) -> Result<Command, ParseError> {
+    parse_with_options(
+        script,
+        ParseOptions::new().with_limits(limits).with_cancel(token),
+    )
+}
+
+/// Parse a bash script, giving up at `deadline`
+///
+/// Like [`parse_with_limits()`](crate::parse_with_limits), but fails with
+/// `ParseError::Cancelled` once `deadline` has passed. Unlike
+/// `limits.max_time`, which bounds bash's parse and the conversion each,
+/// the deadline bounds the whole call.
+pub fn parse_with_deadline(
+    script: &str,
+    limits: &ParseLimits,
+    deadline: Instant,
+) -> Result<Command, ParseError> {
+    parse_with_options(
+        script,
+        ParseOptions::new()
+            .with_limits(limits)
+            .with_deadline(deadline),
+    )
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{init, parse, parse_with_limits, to_json};
+    use std::thread;
+
+    fn setup() {
+        init();
+    }
+
+    /// A script long enough to take a while to parse
+    ///
+    /// Each of its commands nests a level deeper than the one before, so it
+    /// needs a larger `max_depth` than the default.
+    fn long_script() -> String {
+        "for f in *.txt; do grep -c \"$1\" \"$f\" | sort -n > /dev/null; done\n".repeat(20_000)
+    }
+
+    #[test]
+    fn test_cancelled_before_parse() {
+        setup();
+        let token = CancelToken::new();
+        token.cancel();
+        let result = parse_cancellable("echo hello", &ParseLimits::default(), &token);
+        assert!(matches!(result, Err(ParseError::Cancelled)));
+        assert!(parse("echo hello").is_ok());
+    }
+
+    #[test]
+    fn test_deadline() {
+        setup();
+        let limits = ParseLimits::default();
+        let past = Instant::now();
+        let result = parse_with_deadline("echo hello", &limits, past);
+        assert!(matches!(result, Err(ParseError::Cancelled)));
+
+        let future = Instant::now() + Duration::from_secs(60);
+        let cmd = parse_with_deadline("echo hello", &limits, future).unwrap();
+        assert_eq!(
+            to_json(&cmd, false),
+            to_json(&parse("echo hello").unwrap(), false)
+        );
+    }
+
+    #[test]
+    fn test_cancel_mid_parse_leaves_parser_usable() {
+        setup();
+        let script = long_script();
+        let limits = ParseLimits::default().with_max_depth(usize::MAX);
+        let expected = to_json(&parse_with_limits(&script, &limits).unwrap(), false);
+        let small = "if [[ -n $x ]]; then cat <<EOF\n$x\nEOF\nfi";
+        let expected_small = to_json(&parse(small).unwrap(), false);
+
+        let mut stopped = 0;
+        for round in 0..20_u64 {
+            let token = CancelToken::new();
+            let canceller = token.clone();
+            let timer = thread::spawn(move || {
+                thread::sleep(Duration::from_micros(round * 500));
+                canceller.cancel();
+            });
+            match parse_cancellable(&script, &limits, &token) {
+                Err(ParseError::Cancelled) => stopped += 1,
+                Ok(cmd) => {
+                    assert_eq!(to_json(&cmd, false), expected);
+                }
+                Err(e) => panic!("unexpected error: {e}"),
+            }
+            timer.join().unwrap();
+
+            let cmd = parse(small).unwrap();
+            assert_eq!(to_json(&cmd, false), expected_small);
+            assert!(matches!(
+                parse("if then fi"),
+                Err(ParseError::SyntaxError(_))
+            ));
+        }
+        assert!(stopped > 0);
+
+        let cmd = parse_cancellable(&script, &limits, &CancelToken::new()).unwrap();
+        assert_eq!(to_json(&cmd, false), expected);
+    }
+}
@@ -0,0 +1,619 @@
+//! C interface, for runtimes that can't link Rust
+//!
+//! These are the functions `include/bash_ast.h` declares, exported from the
+//! crate's `cdylib`; the header documents them for their callers. Each one
+//! checks its arguments, runs the Rust entry point it wraps with panics
+//! caught, and copies the output into a buffer from `malloc()` so that any
+//! runtime can release it. Parses hold [`PARSER`], since bash's parser is
+//! global and a foreign runtime may call in from any thread.
+
+use crate::{
+    from_json, init, parse_to_json_writer, to_bash, write_json, ParseError, ParseLimits,
+    ParsedScript,
+};
+use std::ffi::{c_char, c_int, c_void};
+use std::panic::{catch_unwind, AssertUnwindSafe};
+use std::sync::{Mutex, PoisonError};
+
+const BASH_AST_OK: c_int = 0;
+const BASH_AST_E_SYNTAX: c_int = 1;
+const BASH_AST_E_EMPTY: c_int = 2;
+const BASH_AST_E_TOO_LARGE: c_int = 3;
+const BASH_AST_E_LIMIT: c_int = 4;
+const BASH_AST_E_INVALID: c_int = 5;
+const BASH_AST_E_CONVERSION: c_int = 6;
+const BASH_AST_E_ARGUMENT: c_int = 7;
+const BASH_AST_E_INTERNAL: c_int = 8;
+
+const BASH_AST_PRETTY: u32 = 0x1;
+
+/// Held for each parse, or for a whole batch of them
+static PARSER: Mutex<()> = Mutex::new(());
+
+extern "C" {
+    fn malloc(size: usize) -> *mut c_void;
+    fn free(ptr: *mut c_void);
+}
+
+/// `bash_ast_error`
+#[repr(C)]
+pub struct BashAstError {
+    code: c_int,
+    line: u32,
+    column: u32,
+    message: *mut c_char,
+}
+
+impl BashAstError {
+    /// No error
+    const NONE: Self = Self {
+        code: BASH_AST_OK,
+        line: 0,
+        column: 0,
+        message: std::ptr::null_mut(),
+    };
+}
+
+/// `bash_ast_result`
+#[repr(C)]
+pub struct BashAstResult {
+    output: *mut c_char,
+    length: usize,
+    error: BashAstError,
+}
+
+/// A failed call, before it is copied into a `bash_ast_error`
+struct Failure {
+    code: c_int,
+    line: u32,
+    column: u32,
+    message: String,
+}
+
+impl Failure {
+    fn new(code: c_int, message: &str) -> Self {
+        Self {
+            code,
+            line: 0,
+            column: 0,
+            message: message.to_string(),
+        }
+    }
+}
+
+impl From<ParseError> for Failure {
+    fn from(err: ParseError) -> Self {
+        let code = match &err {
+            ParseError::SyntaxError(_) => BASH_AST_E_SYNTAX,
+            ParseError::EmptyInput => BASH_AST_E_EMPTY,
+            ParseError::InputTooLarge => BASH_AST_E_TOO_LARGE,
+            ParseError::LimitExceeded(_) => BASH_AST_E_LIMIT,
+            ParseError::InvalidString(_) => BASH_AST_E_INVALID,
+            ParseError::ConversionError(_) => BASH_AST_E_CONVERSION,
+            ParseError::Cancelled
+            | ParseError::Io(_)
+            | ParseError::WorkerCrashed
+            | ParseError::StreamBusy => BASH_AST_E_INTERNAL,
+        };
+        let (line, column) = match &err {
+            ParseError::SyntaxError(Some(detail)) => {
+                (detail.line.unwrap_or(0), detail.column.unwrap_or(0))
+            }
+            _ => (0, 0),
+        };
+        Self {
+            code,
+            line,
+            column,
+            message: err.to_string(),
+        }
+    }
+}
+
+impl From<serde_json::Error> for Failure {
+    fn from(err: serde_json::Error) -> Self {
+        Self {
+            code: BASH_AST_E_INVALID,
+            line: u32::try_from(err.line()).unwrap_or(u32::MAX),
+            column: u32::try_from(err.column()).unwrap_or(u32::MAX),
+            message: format!("Invalid JSON AST: {err}"),
+        }
+    }
+}
+
+/// Parse a script to JSON, with [`PARSER`] held by the caller
+fn parse_json(script: &[u8], pretty: bool) -> Result<Vec<u8>, Failure> {
+    init();
+    let limits = ParseLimits::default();
+    let mut json = Vec::new();
+    if let Ok(script) = std::str::from_utf8(script) {
+        parse_to_json_writer(script, &limits, pretty, &mut json)?;
+    } else {
+        let cmd = ParsedScript::parse_bytes_with_limits(script, &limits)?.to_owned()?;
+        write_json(&cmd, pretty, &mut json)
+            .map_err(|err| Failure::new(BASH_AST_E_INTERNAL, &err.to_string()))?;
+    }
+    Ok(json)
+}
+
+fn json_to_bash(json: &[u8]) -> Result<Vec<u8>, Failure> {
+    let json = std::str::from_utf8(json)
+        .map_err(|_| Failure::new(BASH_AST_E_INVALID, "Invalid JSON AST: not UTF-8"))?;
+    Ok(to_bash(&from_json(json)?).into_bytes())
+}
+
+/// Whether `flags` holds only flags from `known`
+const fn known_flags(flags: u32, known: u32) -> bool {
+    flags & !known == 0
+}
+
+/// Copy `bytes` into a NUL-terminated buffer from `malloc()`
+///
+/// Returns null if there is no memory for it.
+unsafe fn malloc_copy(bytes: &[u8]) -> *mut c_char {
+    let buffer = malloc(bytes.len() + 1).cast::<u8>();
+    if !buffer.is_null() {
+        buffer.copy_from_nonoverlapping(bytes.as_ptr(), bytes.len());
+        buffer.add(bytes.len()).write(0);
+    }
+    buffer.cast()
+}
+
+/// Write `failure` into `error`, if there is one, and return its code
+unsafe fn report(error: *mut BashAstError, failure: &Failure) -> c_int {
+    if let Some(error) = error.as_mut() {
+        *error = BashAstError {
+            code: failure.code,
+            line: failure.line,
+            column: failure.column,
+            message: malloc_copy(failure.message.as_bytes()),
+        };
+    }
+    failure.code
+}
+
+/// The input a caller passed, if the pointer is usable
+const unsafe fn input<'a>(buffer: *const c_char, length: usize) -> Option<&'a [u8]> {
+    if length == 0 {
+        Some(&[])
+    } else if buffer.is_null() {
+        None
+    } else {
+        Some(std::slice::from_raw_parts(buffer.cast(), length))
+    }
+}
+
+/// Run `f` over one input, and hand its output or failure to the caller
+unsafe fn call(
+    input: Option<&[u8]>,
+    out: *mut *mut c_char,
+    out_len: *mut usize,
+    error: *mut BashAstError,
+    f: impl FnOnce(&[u8]) -> Result<Vec<u8>, Failure>,
+) -> c_int {
+    let Some(out) = out.as_mut() else {
+        return report(error, &Failure::new(BASH_AST_E_ARGUMENT, "out is NULL"));
+    };
+    *out = std::ptr::null_mut();
+    if let Some(out_len) = out_len.as_mut() {
+        *out_len = 0;
+    }
+    let Some(input) = input else {
+        return report(error, &Failure::new(BASH_AST_E_ARGUMENT, "input is NULL"));
+    };
+
+    let result = catch_unwind(AssertUnwindSafe(|| f(input)))
+        .unwrap_or_else(|_| Err(Failure::new(BASH_AST_E_INTERNAL, "bash-ast panicked")));
+    let output = match result {
+        Ok(output) => output,
+        Err(failure) => return report(error, &failure),
+    };
+    let buffer = malloc_copy(&output);
+    if buffer.is_null() {
+        return report(error, &Failure::new(BASH_AST_E_INTERNAL, "out of memory"));
+    }
+    *out = buffer;
+    if let Some(out_len) = out_len.as_mut() {
+        *out_len = output.len();
+    }
+    if let Some(error) = error.as_mut() {
+        *error = BashAstError::NONE;
+    }
+    BASH_AST_OK
+}
+
+/// Run `f` over each of `count` inputs, writing a result for each
+unsafe fn call_batch(
+    inputs: *const *const c_char,
+    lengths: *const usize,
+    count: usize,
+    results: *mut BashAstResult,
+    mut f: impl FnMut(&[u8]) -> Result<Vec<u8>, Failure>,
+) -> usize {
+    if count > 0 && (inputs.is_null() || lengths.is_null() || results.is_null()) {
+        return usize::MAX;
+    }
+    let mut failed = 0;
+    for i in 0..count {
+        let result = &mut *results.add(i);
+        let input = input(*inputs.add(i), *lengths.add(i));
+        let code = call(
+            input,
+            &raw mut result.output,
+            &raw mut result.length,
+            &raw mut result.error,
+            &mut f,
+        );
+        if code != BASH_AST_OK {
+            failed += 1;
+        }
+    }
+    failed
+}
+
+/// `bash_ast_parse_json()`
+///
+/// # Safety
+///
+/// As `include/bash_ast.h` documents: `script` points to `length` bytes,
+/// and the other pointers are valid or, where allowed, null.
+#[no_mangle]
+pub unsafe extern "C" fn bash_ast_parse_json(
+    script: *const c_char,
+    length: usize,
+    flags: u32,
+    out: *mut *mut c_char,
+    out_len: *mut usize,
+    error: *mut BashAstError,
+) -> c_int {
+    if !known_flags(flags, BASH_AST_PRETTY) {
+        return report(error, &Failure::new(BASH_AST_E_ARGUMENT, "unknown flags"));
+    }
+    let pretty = flags & BASH_AST_PRETTY != 0;
+    call(input(script, length), out, out_len, error, |script| {
+        let _parser = PARSER.lock().unwrap_or_else(PoisonError::into_inner);
+        parse_json(script, pretty)
+    })
+}
+
+/// `bash_ast_to_bash()`
+///
+/// # Safety
+///
+/// As for [`bash_ast_parse_json()`].
+#[no_mangle]
+pub unsafe extern "C" fn bash_ast_to_bash(
+    json: *const c_char,
+    length: usize,
+    flags: u32,
+    out: *mut *mut c_char,
+    out_len: *mut usize,
+    error: *mut BashAstError,
+) -> c_int {
+    if !known_flags(flags, 0) {
+        return report(error, &Failure::new(BASH_AST_E_ARGUMENT, "unknown flags"));
+    }
+    call(input(json, length), out, out_len, error, json_to_bash)
+}
+
+/// `bash_ast_parse_json_batch()`
+///
+/// # Safety
+///
+/// `scripts` and `lengths` hold `count` items, each script as for
+/// [`bash_ast_parse_json()`], and `results` has room for `count`.
+#[no_mangle]
+pub unsafe extern "C" fn bash_ast_parse_json_batch(
+    scripts: *const *const c_char,
+    lengths: *const usize,
+    count: usize,
+    flags: u32,
+    results: *mut BashAstResult,
+) -> usize {
+    if !known_flags(flags, BASH_AST_PRETTY) {
+        return usize::MAX;
+    }
+    let pretty = flags & BASH_AST_PRETTY != 0;
+    let _parser = PARSER.lock().unwrap_or_else(PoisonError::into_inner);
+    call_batch(scripts, lengths, count, results, |script| {
+        parse_json(script, pretty)
+    })
+}
+
+/// `bash_ast_to_bash_batch()`
+///
+/// # Safety
+///
+/// As for [`bash_ast_parse_json_batch()`].
+#[no_mangle]
+pub unsafe extern "C" fn bash_ast_to_bash_batch(
+    jsons: *const *const c_char,
+    lengths: *const usize,
+    count: usize,
+    flags: u32,
+    results: *mut BashAstResult,
+) -> usize {
+    if !known_flags(flags, 0) {
+        return usize::MAX;
+    }
+    call_batch(jsons, lengths, count, results, json_to_bash)
+}
+
+/// `bash_ast_free()`
+///
+/// # Safety
+///
+/// `buffer` is null or came from this library, and isn't used again.
+#[no_mangle]
+pub unsafe extern "C" fn bash_ast_free(buffer: *mut c_char) {
+    free(buffer.cast());
+}
+
+/// `bash_ast_error_clear()`
+///
+/// # Safety
+///
+/// `error` is null or was set by this library.
+#[no_mangle]
+pub unsafe extern "C" fn bash_ast_error_clear(error: *mut BashAstError) {
+    if let Some(error) = error.as_mut() {
+        free(error.message.cast());
+        *error = BashAstError::NONE;
+    }
+}
+
+/// `bash_ast_result_clear()`
+///
+/// # Safety
+///
+/// `results` holds `count` results set by a batch call.
+#[no_mangle]
+pub unsafe extern "C" fn bash_ast_result_clear(results: *mut BashAstResult, count: usize) {
+    if results.is_null() {
+        return;
+    }
+    for i in 0..count {
+        let result = &mut *results.add(i);
+        free(result.output.cast());
+        result.output = std::ptr::null_mut();
+        result.length = 0;
+        bash_ast_error_clear(&raw mut result.error);
+    }
+}
+
+/// `bash_ast_version()`
+#[no_mangle]
+pub const extern "C" fn bash_ast_version() -> *const c_char {
+    concat!(env!("CARGO_PKG_VERSION"), "\0").as_ptr().cast()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{parse, to_json};
+    use std::ffi::CStr;
+    use std::ptr;
+
+    /// An unset error, as a C caller would zero it
+    const fn no_error() -> BashAstError {
+        BashAstError {
+            code: -1,
+            line: 0,
+            column: 0,
+            message: ptr::null_mut(),
+        }
+    }
+
+    /// Parse `script` through the C interface
+    fn parse_c(script: &[u8], flags: u32) -> (c_int, Option<String>, BashAstError) {
+        let mut out = ptr::null_mut();
+        let mut len = 0;
+        let mut error = no_error();
+        unsafe {
+            let code = bash_ast_parse_json(
+                script.as_ptr().cast(),
+                script.len(),
+                flags,
+                &raw mut out,
+                &raw mut len,
+                &raw mut error,
+            );
+            let output = (!out.is_null()).then(|| {
+                assert_eq!(CStr::from_ptr(out).count_bytes(), len);
+                CStr::from_ptr(out).to_string_lossy().into_owned()
+            });
+            bash_ast_free(out);
+            (code, output, error)
+        }
+    }
+
+    fn message(error: &mut BashAstError) -> String {
+        let text = unsafe { CStr::from_ptr(error.message).to_string_lossy().into_owned() };
+        unsafe { bash_ast_error_clear(error) };
+        assert!(error.message.is_null());
+        text
+    }
+
+    #[test]
+    fn test_parse_json() {
+        let script = "for i in a b; do echo \"$i\" > out; done";
+        let (code, json, error) = parse_c(script.as_bytes(), 0);
+        assert_eq!(code, BASH_AST_OK);
+        assert_eq!(error.code, BASH_AST_OK);
+        assert!(error.message.is_null());
+        assert_eq!(json.unwrap(), to_json(&parse(script).unwrap(), false));
+
+        let (code, json, _) = parse_c(script.as_bytes(), BASH_AST_PRETTY);
+        assert_eq!(code, BASH_AST_OK);
+        assert_eq!(json.unwrap(), to_json(&parse(script).unwrap(), true));
+    }
+
+    #[test]
+    fn test_parse_json_errors() {
+        let (code, json, mut error) = parse_c(b"echo ok\nif then fi", 0);
+        assert_eq!(code, BASH_AST_E_SYNTAX);
+        assert!(json.is_none());
+        assert_eq!(error.code, BASH_AST_E_SYNTAX);
+        // Only Linux records where syntax errors are
+        #[cfg(target_os = "linux")]
+        assert_eq!(error.line, 2);
+        assert!(message(&mut error).contains("Syntax error"));
+
+        let (code, _, _) = parse_c(b"  \n", 0);
+        assert_eq!(code, BASH_AST_E_EMPTY);
+        let (code, _, _) = parse_c(b"echo a\0b", 0);
+        assert_eq!(code, BASH_AST_E_INVALID);
+        let (code, _, mut error) = parse_c(b"echo", 0x80);
+        assert_eq!(code, BASH_AST_E_ARGUMENT);
+        assert_eq!(message(&mut error), "unknown flags");
+    }
+
+    #[test]
+    fn test_parse_json_not_utf8() {
+        let (code, json, _) = parse_c(b"echo caf\xe9", 0);
+        assert_eq!(code, BASH_AST_OK);
+        assert!(json.unwrap().contains("caf\u{fffd}"));
+    }
+
+    #[test]
+    fn test_null_arguments() {
+        let mut error = no_error();
+        let code = unsafe {
+            bash_ast_parse_json(
+                c"echo".as_ptr(),
+                4,
+                0,
+                ptr::null_mut(),
+                ptr::null_mut(),
+                &raw mut error,
+            )
+        };
+        assert_eq!(code, BASH_AST_E_ARGUMENT);
+        assert_eq!(message(&mut error), "out is NULL");
+
+        let mut out = ptr::null_mut();
+        let code = unsafe {
+            bash_ast_to_bash(
+                ptr::null(),
+                4,
+                0,
+                &raw mut out,
+                ptr::null_mut(),
+                ptr::null_mut(),
+            )
+        };
+        assert_eq!(code, BASH_AST_E_ARGUMENT);
+        assert!(out.is_null());
+    }
+
+    #[test]
+    fn test_to_bash() {
+        let json = r#"{"type":"simple","words":[{"word":"echo"},{"word":"hi"}],"redirects":[]}"#;
+        let mut out = ptr::null_mut();
+        let mut len = 0;
+        let code = unsafe {
+            bash_ast_to_bash(
+                json.as_ptr().cast(),
+                json.len(),
+                0,
+                &raw mut out,
+                &raw mut len,
+                ptr::null_mut(),
+            )
+        };
+        assert_eq!(code, BASH_AST_OK);
+        assert_eq!(unsafe { CStr::from_ptr(out) }.to_str(), Ok("echo hi"));
+        assert_eq!(len, 7);
+        unsafe { bash_ast_free(out) };
+
+        let json = "{\n\"type\": }";
+        let mut error = no_error();
+        let code = unsafe {
+            bash_ast_to_bash(
+                json.as_ptr().cast(),
+                json.len(),
+                0,
+                &raw mut out,
+                ptr::null_mut(),
+                &raw mut error,
+            )
+        };
+        assert_eq!(code, BASH_AST_E_INVALID);
+        assert_eq!(error.line, 2);
+        assert!(message(&mut error).starts_with("Invalid JSON AST"));
+    }
+
+    #[test]
+    fn test_batches() {
+        let scripts: [&[u8]; 3] = [b"echo one", b"if then fi", b"a | b"];
+        let pointers: Vec<_> = scripts
+            .iter()
+            .map(|s| s.as_ptr().cast::<c_char>())
+            .collect();
+        let lengths: Vec<_> = scripts.iter().map(|s| s.len()).collect();
+        let mut results: Vec<_> = (0..3)
+            .map(|_| BashAstResult {
+                output: ptr::null_mut(),
+                length: 0,
+                error: no_error(),
+            })
+            .collect();
+
+        let failed = unsafe {
+            bash_ast_parse_json_batch(
+                pointers.as_ptr(),
+                lengths.as_ptr(),
+                3,
+                0,
+                results.as_mut_ptr(),
+            )
+        };
+        assert_eq!(failed, 1);
+        assert_eq!(results[1].error.code, BASH_AST_E_SYNTAX);
+        assert!(results[1].output.is_null());
+        let json = unsafe { CStr::from_ptr(results[2].output) }
+            .to_str()
+            .unwrap()
+            .to_string();
+        assert_eq!(json, to_json(&parse("a | b").unwrap(), false));
+
+        let jsons = [json.as_ptr().cast::<c_char>()];
+        let mut printed = [BashAstResult {
+            output: ptr::null_mut(),
+            length: 0,
+            error: no_error(),
+        }];
+        let failed = unsafe {
+            bash_ast_to_bash_batch(
+                jsons.as_ptr(),
+                [json.len()].as_ptr(),
+                1,
+                0,
+                printed.as_mut_ptr(),
+            )
+        };
+        assert_eq!(failed, 0);
+        assert_eq!(
+            unsafe { CStr::from_ptr(printed[0].output) }.to_str(),
+            Ok("a | b")
+        );
+
+        unsafe {
+            bash_ast_result_clear(results.as_mut_ptr(), 3);
+            bash_ast_result_clear(printed.as_mut_ptr(), 1);
+        }
+        assert!(results
+            .iter()
+            .all(|r| r.output.is_null() && r.error.message.is_null()));
+        assert_eq!(
+            unsafe { bash_ast_parse_json_batch(ptr::null(), ptr::null(), 1, 0, ptr::null_mut()) },
+            usize::MAX
+        );
+    }
+
+    #[test]
+    fn test_version() {
+        let version = unsafe { CStr::from_ptr(bash_ast_version()) };
+        assert_eq!(version.to_str(), Ok(env!("CARGO_PKG_VERSION")));
+    }
+}
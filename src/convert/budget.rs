@@ -0,0 +1,223 @@
+//! Counting a conversion against its `ParseLimits`
+//!
+//! Each command is charged for itself and the words and redirects it holds
+//! directly as the converter reaches it, so a tree that goes over its budget
+//! is given up on at that point rather than converted in full first. A
+//! cancelled conversion stops the same way.
+
+use super::{patterns, redirects, words};
+use crate::cancel::Interrupt;
+use crate::{ffi, CancelToken, Limit, ParseError, ParseLimits};
+use std::ffi::CStr;
+use std::time::Instant;
+
+/// Commands charged between readings of the clock
+const CLOCK_INTERVAL: u32 = 256;
+
+/// Why a conversion stopped before it finished
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Stop {
+    Exceeded(Limit),
+    Cancelled,
+}
+
+impl From<Stop> for ParseError {
+    fn from(stop: Stop) -> Self {
+        match stop {
+            Stop::Exceeded(limit) => Self::LimitExceeded(limit),
+            Stop::Cancelled => Self::Cancelled,
+        }
+    }
+}
+
+/// What is left of a conversion's budget
+pub struct Budget {
+    nodes: usize,
+    words: usize,
+    word_bytes: usize,
+    heredoc_bytes: usize,
+    deadline: Option<Instant>,
+    cancel: Option<CancelToken>,
+    /// When the conversion is cancelled, unlike `deadline`
+    cancel_at: Option<Instant>,
+    /// Commands to charge before the clock and token are next read
+    until_clock: u32,
+}
+
+impl Budget {
+    /// No budget at all
+    pub const fn unlimited() -> Self {
+        Self {
+            nodes: usize::MAX,
+            words: usize::MAX,
+            word_bytes: usize::MAX,
+            heredoc_bytes: usize::MAX,
+            deadline: None,
+            cancel: None,
+            cancel_at: None,
+            until_clock: CLOCK_INTERVAL,
+        }
+    }
+
+    /// The budget of `limits` for a script, with its time counted from now
+    pub fn new(limits: &ParseLimits) -> Self {
+        Self {
+            // The group bash parses the script in isn't part of the AST
+            nodes: limits.max_nodes.saturating_add(1),
+            words: limits.max_words,
+            word_bytes: limits.max_word_bytes,
+            heredoc_bytes: limits.max_heredoc_bytes,
+            deadline: limits
+                .max_time
+                .and_then(|time| Instant::now().checked_add(time)),
+            cancel: None,
+            cancel_at: None,
+            until_clock: CLOCK_INTERVAL,
+        }
+    }
+
+    /// Also stop when `interrupt` says to
+    pub fn interrupt(&mut self, interrupt: &Interrupt<'_>) {
+        self.cancel = interrupt.token.cloned();
+        self.cancel_at = interrupt.deadline;
+    }
+
+    /// Charge a command for itself and the words and redirects it holds,
+    /// leaving its child commands to be charged when they are reached
+    ///
+    /// # Safety
+    ///
+    /// `cmd` must belong to a valid command tree.
+    pub unsafe fn charge(&mut self, cmd: &ffi::COMMAND) -> Result<(), Stop> {
+        self.tick()?;
+        take(&mut self.nodes, 1, Limit::Nodes)?;
+
+        match cmd.type_ {
+            ffi::command_type_cm_simple => {
+                let simple = &*cmd.value.Simple;
+                self.charge_words(simple.words)?;
+                self.charge_redirects(simple.redirects)?;
+            }
+            ffi::command_type_cm_for => {
+                let for_cmd = &*cmd.value.For;
+                self.charge_word(for_cmd.name.as_ref())?;
+                self.charge_words(for_cmd.map_list)?;
+            }
+            ffi::command_type_cm_select => {
+                let select_cmd = &*cmd.value.Select;
+                self.charge_word(select_cmd.name.as_ref())?;
+                self.charge_words(select_cmd.map_list)?;
+            }
+            ffi::command_type_cm_case => {
+                let case_cmd = &*cmd.value.Case;
+                self.charge_word(case_cmd.word.as_ref())?;
+                for pattern in patterns(case_cmd.clauses) {
+                    self.charge_words(pattern.patterns)?;
+                }
+            }
+            ffi::command_type_cm_function_def => {
+                self.charge_word((*cmd.value.Function_def).name.as_ref())?;
+            }
+            ffi::command_type_cm_arith => self.charge_words((*cmd.value.Arith).exp)?,
+            ffi::command_type_cm_arith_for => {
+                let arith_for = &*cmd.value.ArithFor;
+                for list in [arith_for.init, arith_for.test, arith_for.step] {
+                    self.charge_words(list)?;
+                }
+            }
+            ffi::command_type_cm_cond => self.charge_cond(cmd.value.Cond)?,
+            _ => {}
+        }
+        self.charge_redirects(cmd.redirects)
+    }
+
+    /// Give up once cancelled or past a deadline, reading the token and
+    /// the clock only every so many commands
+    fn tick(&mut self) -> Result<(), Stop> {
+        self.until_clock -= 1;
+        if self.until_clock > 0 {
+            return Ok(());
+        }
+        self.until_clock = CLOCK_INTERVAL;
+        if self.cancel.as_ref().is_some_and(CancelToken::is_cancelled) {
+            return Err(Stop::Cancelled);
+        }
+        if self.deadline.is_none() && self.cancel_at.is_none() {
+            return Ok(());
+        }
+        let now = Instant::now();
+        if self.cancel_at.is_some_and(|at| now > at) {
+            return Err(Stop::Cancelled);
+        }
+        match self.deadline {
+            Some(deadline) if now > deadline => Err(Stop::Exceeded(Limit::Time)),
+            _ => Ok(()),
+        }
+    }
+
+    unsafe fn charge_word(&mut self, word: Option<&ffi::WORD_DESC>) -> Result<(), Stop> {
+        let Some(word) = word else { return Ok(()) };
+        take(&mut self.nodes, 1, Limit::Nodes)?;
+        take(&mut self.words, 1, Limit::Words)?;
+        take(&mut self.word_bytes, text_len(word), Limit::WordBytes)
+    }
+
+    unsafe fn charge_words(&mut self, list: *mut ffi::WORD_LIST) -> Result<(), Stop> {
+        words(list).try_for_each(|word| self.charge_word(Some(word)))
+    }
+
+    /// Charge each redirect as a node, and its target as a word of word or
+    /// here-document text
+    unsafe fn charge_redirects(&mut self, list: *mut ffi::REDIRECT) -> Result<(), Stop> {
+        for redir in redirects(list) {
+            take(&mut self.nodes, 1, Limit::Nodes)?;
+            let target = match redir.instruction {
+                ffi::r_instruction_r_duplicating_input
+                | ffi::r_instruction_r_duplicating_output
+                | ffi::r_instruction_r_move_input
+                | ffi::r_instruction_r_move_output
+                | ffi::r_instruction_r_close_this => continue,
+                _ => match redir.redirectee.filename.as_ref() {
+                    Some(word) => text_len(word),
+                    None => continue,
+                },
+            };
+            take(&mut self.words, 1, Limit::Words)?;
+            match redir.instruction {
+                ffi::r_instruction_r_reading_until | ffi::r_instruction_r_deblank_reading_until => {
+                    take(&mut self.heredoc_bytes, target, Limit::HeredocBytes)?;
+                }
+                _ => take(&mut self.word_bytes, target, Limit::WordBytes)?,
+            }
+        }
+        Ok(())
+    }
+
+    /// Charge the words of a `[[ ]]` expression
+    unsafe fn charge_cond(&mut self, cond: *mut ffi::COND_COM) -> Result<(), Stop> {
+        let mut pending = vec![cond];
+        while let Some(cond) = pending.pop() {
+            let Some(cond) = cond.as_ref() else { continue };
+            // The operator of a test or the text of a term; `&&`, `||` and
+            // `( )` have none
+            self.charge_word(cond.op.as_ref())?;
+            pending.extend([cond.right, cond.left]);
+        }
+        Ok(())
+    }
+}
+
+/// Take `amount` from what is `left` of a limit
+fn take(left: &mut usize, amount: usize, limit: Limit) -> Result<(), Stop> {
+    *left = left.checked_sub(amount).ok_or(Stop::Exceeded(limit))?;
+    Ok(())
+}
+
+/// The length of a word's text
+const unsafe fn text_len(word: &ffi::WORD_DESC) -> usize {
+    if word.word.is_null() {
+        0
+    } else {
+        CStr::from_ptr(word.word).count_bytes()
+    }
+}
@@ -1,10 +1,12 @@
 //! Helper functions for C to Rust AST conversion
 
-use crate::ast::{Redirect, RedirectTarget, RedirectType, Word};
+use crate::ast::{Redirect, RedirectTarget, RedirectType};
 use crate::ffi;
+use crate::Symbol;
+use std::borrow::Cow;
 use std::ffi::{c_char, CStr};
 
-use super::MAX_LIST_LENGTH;
+use super::{Converter, MAX_LIST_LENGTH};
 
 /// Convert a C string pointer to a Rust String
 ///
@@ -17,138 +19,204 @@ pub(super) unsafe fn cstr_to_string(ptr: *const c_char) -> String {
     }
 }
 
-/// Convert a `WORD_LIST` linked list to a Vec of Words
-pub(super) unsafe fn convert_word_list(list: *mut ffi::WORD_LIST) -> Vec<Word> {
-    let mut words = Vec::new();
-    let mut current = list;
-    let mut count = 0;
+impl Converter<'_> {
+    /// Convert a C string pointer to a Symbol, interning it if the
+    /// converter has an interner
+    ///
+    /// Returns an empty symbol if the pointer is null.
+    pub(super) unsafe fn symbol(&mut self, ptr: *const c_char) -> Symbol {
+        let text = if ptr.is_null() {
+            Cow::Borrowed("")
+        } else {
+            CStr::from_ptr(ptr).to_string_lossy()
+        };
+        self.interner
+            .as_mut()
+            .map_or_else(|| Symbol::from(&*text), |interner| interner.intern(&text))
+    }
 
-    while !current.is_null() {
-        count += 1;
-        if count > MAX_LIST_LENGTH {
-            break; // Prevent infinite loop from cyclic list
+    /// Convert a `WORD_LIST` to a Vec of Symbols (word text only)
+    pub(super) unsafe fn convert_word_list_to_symbols(
+        &mut self,
+        list: *mut ffi::WORD_LIST,
+    ) -> Option<Vec<Symbol>> {
+        let count = words(list).count();
+        if count == 0 {
+            return None;
         }
+        let mut symbols = Vec::with_capacity(count);
+        symbols.extend(words(list).map(|word| self.symbol(word.word)));
+        Some(symbols)
+    }
+}
 
-        let word_desc = (*current).word;
-        if !word_desc.is_null() {
-            words.push(Word {
-                word: cstr_to_string((*word_desc).word),
-                flags: (*word_desc).flags as u32,
-            });
+/// Join the text of a `WORD_LIST` with spaces
+pub(super) unsafe fn join_words(list: *mut ffi::WORD_LIST) -> String {
+    let text = |word: &ffi::WORD_DESC| {
+        if word.word.is_null() {
+            c""
+        } else {
+            CStr::from_ptr(word.word)
         }
-        current = (*current).next;
+    };
+    let len = words(list)
+        .map(|word| text(word).count_bytes() + 1)
+        .sum::<usize>();
+
+    let mut joined = String::with_capacity(len.saturating_sub(1));
+    for (i, word) in words(list).enumerate() {
+        if i > 0 {
+            joined.push(' ');
+        }
+        joined.push_str(&text(word).to_string_lossy());
     }
+    joined
+}
+
+/// Iterate over the words of a `WORD_LIST`, skipping null entries
+pub unsafe fn words<'a>(list: *mut ffi::WORD_LIST) -> impl Iterator<Item = &'a ffi::WORD_DESC> {
+    let mut current = list;
+    std::iter::from_fn(move || {
+        let list = current.as_ref()?;
+        current = list.next;
+        Some(list.word)
+    })
+    .take(MAX_LIST_LENGTH)
+    .filter_map(|word| word.as_ref())
+}
+
+/// Iterate over a REDIRECT linked list
+pub unsafe fn redirects<'a>(list: *mut ffi::REDIRECT) -> impl Iterator<Item = &'a ffi::REDIRECT> {
+    let mut current = list;
+    std::iter::from_fn(move || {
+        let redir = current.as_ref()?;
+        current = redir.next;
+        Some(redir)
+    })
+    .take(MAX_LIST_LENGTH)
+}
 
-    words
+/// Iterate over the clauses of a case statement
+pub unsafe fn patterns<'a>(
+    list: *mut ffi::PATTERN_LIST,
+) -> impl Iterator<Item = &'a ffi::PATTERN_LIST> {
+    let mut current = list;
+    std::iter::from_fn(move || {
+        let pattern = current.as_ref()?;
+        current = pattern.next;
+        Some(pattern)
+    })
+    .take(MAX_LIST_LENGTH)
 }
 
-/// Convert a `WORD_LIST` to a Vec of Strings (word text only)
-pub(super) unsafe fn convert_word_list_to_strings(
-    list: *mut ffi::WORD_LIST,
-) -> Option<Vec<String>> {
-    if list.is_null() {
-        return None;
+/// Convert a REDIRECT linked list to a Vec of Redirects
+pub(super) unsafe fn convert_redirects(list: *mut ffi::REDIRECT) -> Vec<Redirect> {
+    convert_redirect_lists(&[list])
+}
+
+/// Convert several REDIRECT linked lists into one Vec, sized up front
+pub(super) unsafe fn convert_redirect_lists(lists: &[*mut ffi::REDIRECT]) -> Vec<Redirect> {
+    let len = lists.iter().map(|&list| redirects(list).count()).sum();
+    let mut result = Vec::with_capacity(len);
+    for &list in lists {
+        result.extend(redirects(list).map(|redir| convert_redirect(redir)));
     }
+    result
+}
+
+/// Convert one redirect
+unsafe fn convert_redirect(redir: &ffi::REDIRECT) -> Redirect {
+    let target = match redirect_target(redir) {
+        TargetRef::Fd(fd) => RedirectTarget::Fd(fd),
+        TargetRef::File(filename) => RedirectTarget::File(cstr_to_string(filename)),
+    };
 
-    let words = convert_word_list(list);
-    if words.is_empty() {
+    // Here-doc delimiter
+    let here_doc_eof = if redir.here_doc_eof.is_null() {
         None
     } else {
-        Some(words.into_iter().map(|w| w.word).collect())
+        Some(cstr_to_string(redir.here_doc_eof))
+    };
+
+    Redirect {
+        span: None,
+        direction: redirect_type(redir.instruction),
+        source_fd: source_fd(redir),
+        target,
+        here_doc_eof,
     }
 }
 
-/// Convert a REDIRECT linked list to a Vec of Redirects
-pub(super) unsafe fn convert_redirects(redirects: *mut ffi::REDIRECT) -> Vec<Redirect> {
-    let mut result = Vec::new();
-    let mut current = redirects;
-    let mut count = 0;
-
-    while !current.is_null() {
-        count += 1;
-        if count > MAX_LIST_LENGTH {
-            break; // Prevent infinite loop from cyclic list
+/// Map a redirect instruction to its direction
+#[allow(clippy::match_same_arms)] // Explicit output match + default fallback
+pub const fn redirect_type(instruction: ffi::r_instruction) -> RedirectType {
+    match instruction {
+        ffi::r_instruction_r_output_direction => RedirectType::Output,
+        ffi::r_instruction_r_input_direction | ffi::r_instruction_r_inputa_direction => {
+            RedirectType::Input
+        }
+        ffi::r_instruction_r_appending_to => RedirectType::Append,
+        ffi::r_instruction_r_reading_until | ffi::r_instruction_r_deblank_reading_until => {
+            RedirectType::HereDoc
+        }
+        ffi::r_instruction_r_reading_string => RedirectType::HereString,
+        ffi::r_instruction_r_duplicating_input | ffi::r_instruction_r_duplicating_input_word => {
+            RedirectType::DupInput
+        }
+        ffi::r_instruction_r_duplicating_output | ffi::r_instruction_r_duplicating_output_word => {
+            RedirectType::DupOutput
+        }
+        ffi::r_instruction_r_close_this => RedirectType::Close,
+        ffi::r_instruction_r_err_and_out => RedirectType::ErrAndOut,
+        ffi::r_instruction_r_input_output => RedirectType::InputOutput,
+        ffi::r_instruction_r_output_force => RedirectType::Clobber,
+        ffi::r_instruction_r_move_input | ffi::r_instruction_r_move_input_word => {
+            RedirectType::MoveInput
         }
+        ffi::r_instruction_r_move_output | ffi::r_instruction_r_move_output_word => {
+            RedirectType::MoveOutput
+        }
+        ffi::r_instruction_r_append_err_and_out => RedirectType::AppendErrAndOut,
+        _ => RedirectType::Output,
+    }
+}
 
-        let redir = &*current;
+/// The redirected file descriptor, if the redirect names one
+pub const unsafe fn source_fd(redir: &ffi::REDIRECT) -> Option<i32> {
+    let fd = redir.redirector.dest;
+    if fd >= 0 {
+        Some(fd)
+    } else {
+        None
+    }
+}
 
-        #[allow(clippy::match_same_arms)] // Explicit output match + default fallback
-        let direction = match redir.instruction {
-            ffi::r_instruction_r_output_direction => RedirectType::Output,
-            ffi::r_instruction_r_input_direction | ffi::r_instruction_r_inputa_direction => {
-                RedirectType::Input
-            }
-            ffi::r_instruction_r_appending_to => RedirectType::Append,
-            ffi::r_instruction_r_reading_until | ffi::r_instruction_r_deblank_reading_until => {
-                RedirectType::HereDoc
-            }
-            ffi::r_instruction_r_reading_string => RedirectType::HereString,
-            ffi::r_instruction_r_duplicating_input
-            | ffi::r_instruction_r_duplicating_input_word => RedirectType::DupInput,
-            ffi::r_instruction_r_duplicating_output
-            | ffi::r_instruction_r_duplicating_output_word => RedirectType::DupOutput,
-            ffi::r_instruction_r_close_this => RedirectType::Close,
-            ffi::r_instruction_r_err_and_out => RedirectType::ErrAndOut,
-            ffi::r_instruction_r_input_output => RedirectType::InputOutput,
-            ffi::r_instruction_r_output_force => RedirectType::Clobber,
-            ffi::r_instruction_r_move_input | ffi::r_instruction_r_move_input_word => {
-                RedirectType::MoveInput
-            }
-            ffi::r_instruction_r_move_output | ffi::r_instruction_r_move_output_word => {
-                RedirectType::MoveOutput
-            }
-            ffi::r_instruction_r_append_err_and_out => RedirectType::AppendErrAndOut,
-            _ => RedirectType::Output,
-        };
+/// A redirect target still pointing into bash's structures
+pub enum TargetRef {
+    /// A file descriptor number
+    Fd(i32),
+    /// The filename's text (null for an empty name)
+    File(*const c_char),
+}
 
-        // Get source fd from redirector
-        let source_fd = {
-            let fd = redir.redirector.dest;
-            if fd >= 0 {
-                Some(fd)
+/// Get the target of a redirect
+///
+/// For dup/close operations the target is a fd number; for file operations
+/// it's a filename.
+pub unsafe fn redirect_target(redir: &ffi::REDIRECT) -> TargetRef {
+    match redir.instruction {
+        ffi::r_instruction_r_duplicating_input
+        | ffi::r_instruction_r_duplicating_output
+        | ffi::r_instruction_r_move_input
+        | ffi::r_instruction_r_move_output => TargetRef::Fd(redir.redirectee.dest),
+        ffi::r_instruction_r_close_this => TargetRef::Fd(-1),
+        _ => {
+            let filename = redir.redirectee.filename;
+            if filename.is_null() {
+                TargetRef::File(std::ptr::null())
             } else {
-                None
+                TargetRef::File((*filename).word)
             }
-        };
-
-        // Get target
-        let target = {
-            // For dup/close operations, the target is a fd number
-            // For file operations, it's a filename
-            match redir.instruction {
-                ffi::r_instruction_r_duplicating_input
-                | ffi::r_instruction_r_duplicating_output
-                | ffi::r_instruction_r_move_input
-                | ffi::r_instruction_r_move_output => RedirectTarget::Fd(redir.redirectee.dest),
-                ffi::r_instruction_r_close_this => RedirectTarget::Fd(-1),
-                _ => {
-                    // File-based redirect
-                    let filename = redir.redirectee.filename;
-                    if filename.is_null() {
-                        RedirectTarget::File(String::new())
-                    } else {
-                        RedirectTarget::File(cstr_to_string((*filename).word))
-                    }
-                }
-            }
-        };
-
-        // Here-doc delimiter
-        let here_doc_eof = if redir.here_doc_eof.is_null() {
-            None
-        } else {
-            Some(cstr_to_string(redir.here_doc_eof))
-        };
-
-        result.push(Redirect {
-            direction,
-            source_fd,
-            target,
-            here_doc_eof,
-        });
-
-        current = redir.next;
+        }
     }
-
-    result
 }
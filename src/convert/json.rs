@@ -0,0 +1,906 @@
+//! C AST to JSON serialization
+//!
+//! Serializes bash's command structures straight to JSON, without building
+//! the Rust AST in between. Each serializer mirrors its converter in
+//! `convert_impl`, field for field and in the order and with the skip rules
+//! of the types in `ast.rs`, so the output is byte-identical to serializing
+//! what `convert_command` returns.
+
+use super::helpers::{redirect_target, redirect_type, redirects, source_fd, words, TargetRef};
+use super::{
+    effective_line, is_pipe, line_or_none, list_op, pipeline_stages, CASEPAT_FALLTHROUGH,
+    CASEPAT_TESTNEXT, CMD_INVERT_RETURN, COND_AND, COND_BINARY, COND_EXPR, COND_OR, COND_TERM,
+    COND_UNARY, MAX_DIRECT_DEPTH, MAX_LIST_LENGTH, W_ASSIGNMENT,
+};
+use crate::ast::ListOp;
+use crate::ffi;
+use serde::ser::{SerializeSeq, SerializeStruct};
+use serde::{Serialize, Serializer};
+use std::ffi::{c_char, CStr};
+use std::fmt;
+use std::io;
+
+/// Write the command `safe_parse_buffer` returned as JSON
+///
+/// The artificial group around the script is unwrapped, as `parse()` does.
+///
+/// # Errors
+///
+/// Fails past `MAX_DIRECT_DEPTH`, where `convert_command` would give up or
+/// would drop part of the tree, and when `writer` fails.
+/// Output written before the error is left in `writer`.
+///
+/// # Safety
+///
+/// `cmd` must be a valid COMMAND tree allocated by bash's parser, and must
+/// not be disposed until this returns.
+pub unsafe fn write_script_json<W: io::Write>(
+    cmd: *const ffi::COMMAND,
+    pretty: bool,
+    writer: W,
+) -> serde_json::Result<()> {
+    let root = if !cmd.is_null() && (*cmd).type_ == ffi::command_type_cm_group {
+        CommandJson {
+            cmd: (*(*cmd).value.Group).command,
+            depth: 1,
+        }
+    } else {
+        CommandJson { cmd, depth: 0 }
+    };
+
+    if pretty {
+        serde_json::to_writer_pretty(writer, &root)
+    } else {
+        serde_json::to_writer(writer, &root)
+    }
+}
+
+/// The error for a tree `convert_command` can't represent
+fn unconvertible<E: serde::ser::Error>() -> E {
+    E::custom("command cannot be converted")
+}
+
+// The wrappers below hold pointers into the tree being written. They are
+// only built from pointers reached from `write_script_json`'s `cmd`, which
+// outlives the serialization.
+
+/// A command, serialized like `Command`
+struct CommandJson {
+    cmd: *const ffi::COMMAND,
+    depth: usize,
+}
+
+impl Serialize for CommandJson {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        // SAFETY: see above
+        unsafe { serialize_command(s, self.cmd, self.depth) }
+    }
+}
+
+unsafe fn serialize_command<S: Serializer>(
+    s: S,
+    cmd: *const ffi::COMMAND,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    if depth > MAX_DIRECT_DEPTH || cmd.is_null() {
+        return Err(unconvertible());
+    }
+
+    let cmd = &*cmd;
+    let line = cmd.line as u32;
+    let negated = (cmd.flags & CMD_INVERT_RETURN) != 0;
+
+    match cmd.type_ {
+        ffi::command_type_cm_simple if negated => {
+            // `! cmd` becomes a negated pipeline of one command
+            let mut st = s.serialize_struct("Command", 3)?;
+            st.serialize_field("type", "pipeline")?;
+            st.serialize_field("commands", std::slice::from_ref(&SimpleJson(cmd)))?;
+            st.serialize_field("negated", &true)?;
+            st.end()
+        }
+        ffi::command_type_cm_simple => serialize_simple(s, cmd),
+        ffi::command_type_cm_connection => serialize_connection(s, cmd, negated, depth),
+        ffi::command_type_cm_for => serialize_for(s, cmd, line, depth),
+        ffi::command_type_cm_while => serialize_while(s, "while", cmd, depth),
+        ffi::command_type_cm_until => serialize_while(s, "until", cmd, depth),
+        ffi::command_type_cm_if => serialize_if(s, cmd, line, depth),
+        ffi::command_type_cm_case => serialize_case(s, cmd, line, depth),
+        ffi::command_type_cm_select => serialize_select(s, cmd, line, depth),
+        ffi::command_type_cm_group => serialize_group(s, cmd, line, depth),
+        ffi::command_type_cm_subshell => serialize_subshell(s, cmd, line, depth),
+        ffi::command_type_cm_function_def => serialize_function_def(s, cmd, line, depth),
+        ffi::command_type_cm_arith => serialize_arith(s, cmd, line),
+        ffi::command_type_cm_arith_for => serialize_arith_for(s, cmd, line, depth),
+        ffi::command_type_cm_cond => serialize_cond(s, cmd, line, depth),
+        ffi::command_type_cm_coproc => serialize_coproc(s, cmd, line, depth),
+        _ => Err(unconvertible()),
+    }
+}
+
+unsafe fn serialize_for<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let for_cmd = &*cmd.value.For;
+    let line = line_or_none(effective_line(for_cmd.line, line));
+    let words = has_words(for_cmd.map_list);
+    let mut st = s.serialize_struct(
+        "Command",
+        3 + usize::from(line.is_some())
+            + usize::from(words)
+            + usize::from(!cmd.redirects.is_null()),
+    )?;
+    st.serialize_field("type", "for")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("variable", &Text((*for_cmd.name).word))?;
+    if words {
+        st.serialize_field("words", &TextsJson::all(for_cmd.map_list))?;
+    }
+    st.serialize_field("body", &child(for_cmd.action, depth))?;
+    if !cmd.redirects.is_null() {
+        st.serialize_field("redirects", &RedirectsJson([cmd.redirects, NO_REDIRECTS]))?;
+    }
+    st.end()
+}
+
+unsafe fn serialize_if<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let if_cmd = &*cmd.value.If;
+    let line = line_or_none(line);
+    let has_else = !if_cmd.false_case.is_null();
+    let mut st = s.serialize_struct(
+        "Command",
+        3 + usize::from(line.is_some())
+            + usize::from(has_else)
+            + usize::from(!cmd.redirects.is_null()),
+    )?;
+    st.serialize_field("type", "if")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("condition", &child(if_cmd.test, depth))?;
+    st.serialize_field("then_branch", &child(if_cmd.true_case, depth))?;
+    if has_else {
+        st.serialize_field("else_branch", &child(if_cmd.false_case, depth))?;
+    }
+    if !cmd.redirects.is_null() {
+        st.serialize_field("redirects", &RedirectsJson([cmd.redirects, NO_REDIRECTS]))?;
+    }
+    st.end()
+}
+
+unsafe fn serialize_case<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let case_cmd = &*cmd.value.Case;
+    let line = line_or_none(effective_line(case_cmd.line, line));
+    let mut st = s.serialize_struct(
+        "Command",
+        3 + usize::from(line.is_some()) + usize::from(!cmd.redirects.is_null()),
+    )?;
+    st.serialize_field("type", "case")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("word", &Text((*case_cmd.word).word))?;
+    st.serialize_field(
+        "clauses",
+        &ClausesJson {
+            list: case_cmd.clauses,
+            depth,
+        },
+    )?;
+    if !cmd.redirects.is_null() {
+        st.serialize_field("redirects", &RedirectsJson([cmd.redirects, NO_REDIRECTS]))?;
+    }
+    st.end()
+}
+
+unsafe fn serialize_select<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let select_cmd = &*cmd.value.Select;
+    let line = line_or_none(effective_line(select_cmd.line, line));
+    let words = has_words(select_cmd.map_list);
+    let mut st = s.serialize_struct(
+        "Command",
+        3 + usize::from(line.is_some())
+            + usize::from(words)
+            + usize::from(!cmd.redirects.is_null()),
+    )?;
+    st.serialize_field("type", "select")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("variable", &Text((*select_cmd.name).word))?;
+    if words {
+        st.serialize_field("words", &TextsJson::all(select_cmd.map_list))?;
+    }
+    st.serialize_field("body", &child(select_cmd.action, depth))?;
+    if !cmd.redirects.is_null() {
+        st.serialize_field("redirects", &RedirectsJson([cmd.redirects, NO_REDIRECTS]))?;
+    }
+    st.end()
+}
+
+unsafe fn serialize_group<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let group_cmd = &*cmd.value.Group;
+    serialize_body(
+        s,
+        "group",
+        cmd,
+        line_or_none(line),
+        group_cmd.command,
+        depth,
+    )
+}
+
+unsafe fn serialize_subshell<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let subshell_cmd = &*cmd.value.Subshell;
+    let line = line_or_none(effective_line(subshell_cmd.line, line));
+    serialize_body(s, "subshell", cmd, line, subshell_cmd.command, depth)
+}
+
+unsafe fn serialize_function_def<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let func_def = &*cmd.value.Function_def;
+    let line = line_or_none(line);
+    let source_file = !func_def.source_file.is_null();
+    let mut st = s.serialize_struct(
+        "Command",
+        3 + usize::from(line.is_some()) + usize::from(source_file),
+    )?;
+    st.serialize_field("type", "function_def")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("name", &Text((*func_def.name).word))?;
+    st.serialize_field("body", &child(func_def.command, depth))?;
+    if source_file {
+        st.serialize_field("source_file", &Text(func_def.source_file))?;
+    }
+    st.end()
+}
+
+unsafe fn serialize_arith<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+) -> Result<S::Ok, S::Error> {
+    let arith_cmd = &*cmd.value.Arith;
+    let line = line_or_none(effective_line(arith_cmd.line, line));
+    let mut st = s.serialize_struct("Command", 2 + usize::from(line.is_some()))?;
+    st.serialize_field("type", "arithmetic")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("expression", &JoinedJson(arith_cmd.exp))?;
+    st.end()
+}
+
+unsafe fn serialize_arith_for<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let arith_for = &*cmd.value.ArithFor;
+    let line = line_or_none(effective_line(arith_for.line, line));
+    let mut st = s.serialize_struct("Command", 5 + usize::from(line.is_some()))?;
+    st.serialize_field("type", "arithmetic_for")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("init", &JoinedJson(arith_for.init))?;
+    st.serialize_field("test", &JoinedJson(arith_for.test))?;
+    st.serialize_field("step", &JoinedJson(arith_for.step))?;
+    st.serialize_field("body", &child(arith_for.action, depth))?;
+    st.end()
+}
+
+unsafe fn serialize_cond<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let cond_cmd: *const ffi::COND_COM = cmd.value.Cond;
+    let line = line_or_none(effective_line((*cond_cmd).line, line));
+    let mut st = s.serialize_struct("Command", 2 + usize::from(line.is_some()))?;
+    st.serialize_field("type", "conditional")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field(
+        "expr",
+        &CondJson {
+            cond: cond_cmd,
+            depth,
+        },
+    )?;
+    st.end()
+}
+
+unsafe fn serialize_coproc<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    line: u32,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let coproc_cmd = &*cmd.value.Coproc;
+    let line = line_or_none(line);
+    let name = !coproc_cmd.name.is_null();
+    let mut st = s.serialize_struct(
+        "Command",
+        2 + usize::from(line.is_some()) + usize::from(name),
+    )?;
+    st.serialize_field("type", "coproc")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    if name {
+        st.serialize_field("name", &Text(coproc_cmd.name))?;
+    }
+    st.serialize_field("body", &child(coproc_cmd.command, depth))?;
+    st.end()
+}
+
+/// A nested command, one level deeper than its parent
+const fn child(cmd: *const ffi::COMMAND, depth: usize) -> CommandJson {
+    CommandJson {
+        cmd,
+        depth: depth + 1,
+    }
+}
+
+/// A simple command, without the negation of its COMMAND
+struct SimpleJson<'a>(&'a ffi::COMMAND);
+
+impl Serialize for SimpleJson<'_> {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        // SAFETY: see above
+        unsafe { serialize_simple(s, self.0) }
+    }
+}
+
+unsafe fn serialize_simple<S: Serializer>(s: S, cmd: &ffi::COMMAND) -> Result<S::Ok, S::Error> {
+    let simple = &*cmd.value.Simple;
+    let line = line_or_none(effective_line(simple.line, cmd.line as u32));
+    let assignments = words(simple.words).any(is_assignment);
+
+    let mut st = s.serialize_struct(
+        "Command",
+        3 + usize::from(line.is_some()) + usize::from(assignments),
+    )?;
+    st.serialize_field("type", "simple")?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("words", &WordsJson(simple.words))?;
+    // Redirects from both the simple command and the parent command
+    st.serialize_field(
+        "redirects",
+        &RedirectsJson([simple.redirects, cmd.redirects]),
+    )?;
+    if assignments {
+        st.serialize_field(
+            "assignments",
+            &TextsJson {
+                list: simple.words,
+                keep: is_assignment,
+            },
+        )?;
+    }
+    st.end()
+}
+
+unsafe fn serialize_connection<S: Serializer>(
+    s: S,
+    cmd: &ffi::COMMAND,
+    negated: bool,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let conn = &*cmd.value.Connection;
+
+    if is_pipe(conn) {
+        // Pipelines have no line; see convert_connection
+        let mut st = s.serialize_struct("Command", 2 + usize::from(negated))?;
+        st.serialize_field("type", "pipeline")?;
+        st.serialize_field("commands", &PipelineJson { conn, depth })?;
+        if negated {
+            st.serialize_field("negated", &true)?;
+        }
+        return st.end();
+    }
+
+    // Only a background command may lack a second command
+    let op = list_op(conn.connector);
+    if conn.second.is_null() && op != ListOp::Amp {
+        return Err(unconvertible());
+    }
+
+    // Lists have no line either
+    let mut st = s.serialize_struct("Command", 4)?;
+    st.serialize_field("type", "list")?;
+    st.serialize_field("op", &op)?;
+    st.serialize_field("left", &child(conn.first, depth))?;
+    if conn.second.is_null() {
+        st.serialize_field("right", &EmptySimpleJson)?;
+    } else {
+        st.serialize_field("right", &child(conn.second, depth))?;
+    }
+    st.end()
+}
+
+unsafe fn serialize_while<S: Serializer>(
+    s: S,
+    kind: &'static str,
+    cmd: &ffi::COMMAND,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    // Until uses the same structure as while
+    let while_cmd = &*cmd.value.While;
+    let line = line_or_none(cmd.line as u32);
+    let mut st = s.serialize_struct(
+        "Command",
+        3 + usize::from(line.is_some()) + usize::from(!cmd.redirects.is_null()),
+    )?;
+    st.serialize_field("type", kind)?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("test", &child(while_cmd.test, depth))?;
+    st.serialize_field("body", &child(while_cmd.action, depth))?;
+    if !cmd.redirects.is_null() {
+        st.serialize_field("redirects", &RedirectsJson([cmd.redirects, NO_REDIRECTS]))?;
+    }
+    st.end()
+}
+
+/// A group or subshell: a body and the redirects around it
+unsafe fn serialize_body<S: Serializer>(
+    s: S,
+    kind: &'static str,
+    cmd: &ffi::COMMAND,
+    line: Option<u32>,
+    body: *const ffi::COMMAND,
+    depth: usize,
+) -> Result<S::Ok, S::Error> {
+    let mut st = s.serialize_struct(
+        "Command",
+        2 + usize::from(line.is_some()) + usize::from(!cmd.redirects.is_null()),
+    )?;
+    st.serialize_field("type", kind)?;
+    if let Some(line) = line {
+        st.serialize_field("line", &line)?;
+    }
+    st.serialize_field("body", &child(body, depth))?;
+    if !cmd.redirects.is_null() {
+        st.serialize_field("redirects", &RedirectsJson([cmd.redirects, NO_REDIRECTS]))?;
+    }
+    st.end()
+}
+
+/// The empty command on the right of a trailing `&`
+struct EmptySimpleJson;
+
+impl Serialize for EmptySimpleJson {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        let mut st = s.serialize_struct("Command", 3)?;
+        st.serialize_field("type", "simple")?;
+        st.serialize_field("words", &[] as &[()])?;
+        st.serialize_field("redirects", &[] as &[()])?;
+        st.end()
+    }
+}
+
+/// The commands of a pipeline, with nested pipelines flattened
+struct PipelineJson<'a> {
+    conn: &'a ffi::CONNECTION,
+    depth: usize,
+}
+
+impl Serialize for PipelineJson<'_> {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        let mut seq = s.serialize_seq(None)?;
+        // SAFETY: see above
+        unsafe { pipeline_elements(&mut seq, self.conn, self.depth)? };
+        seq.end()
+    }
+}
+
+/// Serialize the stages of a pipeline connection into `seq`
+///
+/// Like `convert_connection`, this inlines nested pipelines, including the
+/// one-command pipelines that negated simple commands become, dropping
+/// their negation.
+unsafe fn pipeline_elements<Q: SerializeSeq>(
+    seq: &mut Q,
+    conn: &ffi::CONNECTION,
+    depth: usize,
+) -> Result<(), Q::Error> {
+    let depth = depth + 1;
+    if depth > MAX_DIRECT_DEPTH {
+        return Err(unconvertible());
+    }
+    for cmd in pipeline_stages(conn) {
+        let Some(command) = cmd.as_ref() else {
+            return Err(unconvertible());
+        };
+        if command.type_ == ffi::command_type_cm_simple {
+            seq.serialize_element(&SimpleJson(command))?;
+        } else {
+            seq.serialize_element(&CommandJson { cmd, depth })?;
+        }
+    }
+    Ok(())
+}
+
+/// The clauses of a case statement
+struct ClausesJson {
+    list: *mut ffi::PATTERN_LIST,
+    depth: usize,
+}
+
+impl Serialize for ClausesJson {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        let mut seq = s.serialize_seq(None)?;
+        let mut current = self.list;
+        let mut count = 0;
+
+        while !current.is_null() {
+            count += 1;
+            if count > MAX_LIST_LENGTH {
+                break; // Prevent infinite loop from cyclic list
+            }
+
+            // SAFETY: see above
+            let pattern = unsafe { &*current };
+            seq.serialize_element(&ClauseJson {
+                pattern,
+                depth: self.depth,
+            })?;
+            current = pattern.next;
+        }
+
+        seq.end()
+    }
+}
+
+/// One case clause, serialized like `CaseClause`
+struct ClauseJson<'a> {
+    pattern: &'a ffi::PATTERN_LIST,
+    depth: usize,
+}
+
+impl Serialize for ClauseJson<'_> {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        let pattern = self.pattern;
+        let action = (!pattern.action.is_null()).then(|| child(pattern.action, self.depth));
+
+        let mut st = s.serialize_struct("CaseClause", 2 + usize::from(pattern.flags != 0))?;
+        st.serialize_field("patterns", &TextsJson::all(pattern.patterns))?;
+        st.serialize_field("action", &action)?;
+        if pattern.flags != 0 {
+            let fallthrough = (pattern.flags & CASEPAT_FALLTHROUGH) != 0;
+            let test_next = (pattern.flags & CASEPAT_TESTNEXT) != 0;
+            st.serialize_field(
+                "flags",
+                &CaseClauseFlagsJson {
+                    fallthrough,
+                    test_next,
+                },
+            )?;
+        }
+        st.end()
+    }
+}
+
+/// Serialized like `CaseClauseFlags`
+struct CaseClauseFlagsJson {
+    fallthrough: bool,
+    test_next: bool,
+}
+
+impl Serialize for CaseClauseFlagsJson {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        let mut st = s.serialize_struct(
+            "CaseClauseFlags",
+            usize::from(self.fallthrough) + usize::from(self.test_next),
+        )?;
+        if self.fallthrough {
+            st.serialize_field("fallthrough", &true)?;
+        }
+        if self.test_next {
+            st.serialize_field("test_next", &true)?;
+        }
+        st.end()
+    }
+}
+
+/// A `[[ ... ]]` expression, serialized like `ConditionalExpr`
+struct CondJson {
+    cond: *const ffi::COND_COM,
+    depth: usize,
+}
+
+impl Serialize for CondJson {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        if self.depth > MAX_DIRECT_DEPTH || self.cond.is_null() {
+            return Err(unconvertible());
+        }
+
+        // SAFETY: see above
+        let cond = unsafe { &*self.cond };
+        let node = CondNodeJson {
+            cond,
+            depth: self.depth,
+        };
+
+        // Wrap in Not if negated
+        if (cond.flags & CMD_INVERT_RETURN) != 0 {
+            let mut st = s.serialize_struct("ConditionalExpr", 2)?;
+            st.serialize_field("cond_type", "not")?;
+            st.serialize_field("expr", &node)?;
+            st.end()
+        } else {
+            node.serialize(s)
+        }
+    }
+}
+
+/// A `[[ ... ]]` expression without its negation
+struct CondNodeJson<'a> {
+    cond: &'a ffi::COND_COM,
+    depth: usize,
+}
+
+impl Serialize for CondNodeJson<'_> {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        let cond = self.cond;
+        let nested = |cond| CondJson {
+            cond,
+            depth: self.depth + 1,
+        };
+
+        // SAFETY: see above
+        unsafe {
+            match cond.type_ {
+                t if t == COND_AND || t == COND_OR => {
+                    let mut st = s.serialize_struct("ConditionalExpr", 3)?;
+                    st.serialize_field("cond_type", if t == COND_AND { "and" } else { "or" })?;
+                    st.serialize_field("left", &nested(cond.left))?;
+                    st.serialize_field("right", &nested(cond.right))?;
+                    st.end()
+                }
+                t if t == COND_UNARY => {
+                    // For unary, the argument is in left->op
+                    let mut st = s.serialize_struct("ConditionalExpr", 3)?;
+                    st.serialize_field("cond_type", "unary")?;
+                    st.serialize_field("op", &Text(word_text(cond.op)))?;
+                    st.serialize_field("arg", &Text(operand_text(cond.left)))?;
+                    st.end()
+                }
+                t if t == COND_BINARY => {
+                    let mut st = s.serialize_struct("ConditionalExpr", 4)?;
+                    st.serialize_field("cond_type", "binary")?;
+                    st.serialize_field("op", &Text(word_text(cond.op)))?;
+                    st.serialize_field("left", &Text(operand_text(cond.left)))?;
+                    st.serialize_field("right", &Text(operand_text(cond.right)))?;
+                    st.end()
+                }
+                t if t == COND_TERM => {
+                    let mut st = s.serialize_struct("ConditionalExpr", 2)?;
+                    st.serialize_field("cond_type", "term")?;
+                    st.serialize_field("word", &Text(word_text(cond.op)))?;
+                    st.end()
+                }
+                t if t == COND_EXPR => {
+                    let mut st = s.serialize_struct("ConditionalExpr", 2)?;
+                    st.serialize_field("cond_type", "expr")?;
+                    st.serialize_field("expr", &nested(cond.left))?;
+                    st.end()
+                }
+                _ => Err(unconvertible()),
+            }
+        }
+    }
+}
+
+/// The text of a word, or null for no word
+const unsafe fn word_text(word: *const ffi::WORD_DESC) -> *const c_char {
+    if word.is_null() {
+        std::ptr::null()
+    } else {
+        (*word).word
+    }
+}
+
+/// The text of a conditional operand, or null for none
+const unsafe fn operand_text(cond: *const ffi::COND_COM) -> *const c_char {
+    if cond.is_null() {
+        std::ptr::null()
+    } else {
+        word_text((*cond).op)
+    }
+}
+
+/// Text from bash, serialized like `cstr_to_string` converts it
+struct Text(*const c_char);
+
+impl Serialize for Text {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        if self.0.is_null() {
+            s.serialize_str("")
+        } else {
+            // SAFETY: see above
+            s.serialize_str(&unsafe { CStr::from_ptr(self.0) }.to_string_lossy())
+        }
+    }
+}
+
+/// Whether a list has any words; `convert_word_list_to_strings` is `None`
+/// otherwise
+unsafe fn has_words(list: *mut ffi::WORD_LIST) -> bool {
+    words(list).next().is_some()
+}
+
+const fn is_assignment(word: &ffi::WORD_DESC) -> bool {
+    (word.flags as u32 & W_ASSIGNMENT) != 0
+}
+
+/// The words of a simple command, serialized like `Vec<Word>`
+struct WordsJson(*mut ffi::WORD_LIST);
+
+impl Serialize for WordsJson {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        // SAFETY: see above
+        let words = unsafe { words(self.0) };
+        s.collect_seq(words.filter(|word| !is_assignment(word)).map(WordJson))
+    }
+}
+
+/// Serialized like `Word`
+struct WordJson<'a>(&'a ffi::WORD_DESC);
+
+impl Serialize for WordJson<'_> {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        let flags = self.0.flags as u32;
+        let mut st = s.serialize_struct("Word", 1 + usize::from(flags != 0))?;
+        st.serialize_field("word", &Text(self.0.word))?;
+        if flags != 0 {
+            st.serialize_field("flags", &flags)?;
+        }
+        st.end()
+    }
+}
+
+/// The text of some words of a list, serialized like `Vec<String>`
+struct TextsJson {
+    list: *mut ffi::WORD_LIST,
+    keep: fn(&ffi::WORD_DESC) -> bool,
+}
+
+impl TextsJson {
+    const fn all(list: *mut ffi::WORD_LIST) -> Self {
+        Self {
+            list,
+            keep: |_| true,
+        }
+    }
+}
+
+impl Serialize for TextsJson {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        // SAFETY: see above
+        let words = unsafe { words(self.list) };
+        s.collect_seq(
+            words
+                .filter(|word| (self.keep)(word))
+                .map(|word| Text(word.word)),
+        )
+    }
+}
+
+/// The words of a list joined with spaces, as in `(( ... ))`
+struct JoinedJson(*mut ffi::WORD_LIST);
+
+impl Serialize for JoinedJson {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        s.collect_str(self)
+    }
+}
+
+impl fmt::Display for JoinedJson {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        // SAFETY: see above
+        for (i, word) in unsafe { words(self.0) }.enumerate() {
+            if i > 0 {
+                f.write_str(" ")?;
+            }
+            if !word.word.is_null() {
+                // SAFETY: see above
+                f.write_str(&unsafe { CStr::from_ptr(word.word) }.to_string_lossy())?;
+            }
+        }
+        Ok(())
+    }
+}
+
+/// An absent redirect list
+const NO_REDIRECTS: *mut ffi::REDIRECT = std::ptr::null_mut();
+
+/// The redirects of two lists, one after the other, serialized like
+/// `Vec<Redirect>`
+struct RedirectsJson([*mut ffi::REDIRECT; 2]);
+
+impl Serialize for RedirectsJson {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        let mut seq = s.serialize_seq(None)?;
+        for list in self.0 {
+            // SAFETY: see above
+            for redir in unsafe { redirects(list) } {
+                seq.serialize_element(&RedirectJson(redir))?;
+            }
+        }
+        seq.end()
+    }
+}
+
+/// Serialized like `Redirect`
+struct RedirectJson<'a>(&'a ffi::REDIRECT);
+
+impl Serialize for RedirectJson<'_> {
+    fn serialize<S: Serializer>(&self, s: S) -> Result<S::Ok, S::Error> {
+        let redir = self.0;
+        // SAFETY: see above
+        let (source_fd, target) = unsafe { (source_fd(redir), redirect_target(redir)) };
+        let here_doc_eof = !redir.here_doc_eof.is_null();
+
+        let mut st = s.serialize_struct(
+            "Redirect",
+            2 + usize::from(source_fd.is_some()) + usize::from(here_doc_eof),
+        )?;
+        st.serialize_field("direction", &redirect_type(redir.instruction))?;
+        if let Some(fd) = source_fd {
+            st.serialize_field("source_fd", &fd)?;
+        }
+        match target {
+            TargetRef::Fd(fd) => st.serialize_field("target", &fd)?,
+            TargetRef::File(filename) => st.serialize_field("target", &Text(filename))?,
+        }
+        if here_doc_eof {
+            st.serialize_field("here_doc_eof", &Text(redir.here_doc_eof))?;
+        }
+        st.end()
+    }
+}
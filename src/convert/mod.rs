@@ -7,56 +7,168 @@
 #![allow(clippy::cast_sign_loss)]
 #![allow(clippy::cast_possible_truncation)]
 
+mod budget;
 mod helpers;
+mod json;
+mod spans;
+mod substitutions;
+
+use crate::ast::ListOp;
+use crate::cancel::Interrupt;
+use crate::ffi;
+use crate::{Interner, ParseLimits, MAX_DEPTH};
+use budget::{Budget, Stop};
+use helpers::{convert_redirect_lists, convert_redirects, cstr_to_string, join_words};
+use std::ffi::c_int;
+
+// Re-export the main entry points
+pub use self::convert_impl::{convert_command, Scratch};
+pub use self::json::write_script_json;
+pub use helpers::{
+    patterns, redirect_target, redirect_type, redirects, source_fd, words, TargetRef,
+};
+pub use spans::Spans;
+pub use substitutions::Substitutions;
+
+/// State shared by one conversion
+///
+/// Words, names and patterns are drawn from `interner` when there is one,
+/// so they share their strings with every other AST converted through it.
+/// Words take the trees of their command substitutions from
+/// `substitutions` when there are some, and nodes their source spans from
+/// `spans`. The stacks of the walk come from `scratch` when there is one.
+pub struct Converter<'a> {
+    interner: Option<&'a mut Interner>,
+    substitutions: Option<Substitutions<'a>>,
+    spans: Option<Spans<'a>>,
+    scratch: Option<&'a mut Scratch>,
+    max_depth: usize,
+    budget: Budget,
+    /// Why the conversion stopped early, if it did
+    stopped: Option<Stop>,
+    flat_lists: bool,
+}
+
+impl Default for Converter<'_> {
+    fn default() -> Self {
+        Self {
+            interner: None,
+            substitutions: None,
+            spans: None,
+            scratch: None,
+            max_depth: MAX_DEPTH,
+            budget: Budget::unlimited(),
+            stopped: None,
+            flat_lists: false,
+        }
+    }
+}
+
+impl<'a> Converter<'a> {
+    /// A converter that interns strings in `interner`
+    pub const fn with_interner(interner: &'a mut Interner) -> Self {
+        Self {
+            interner: Some(interner),
+            substitutions: None,
+            spans: None,
+            scratch: None,
+            max_depth: MAX_DEPTH,
+            budget: Budget::unlimited(),
+            stopped: None,
+            flat_lists: false,
+        }
+    }
+
+    /// Attach the trees in `substitutions` to the words they were written in
+    pub fn with_substitutions(mut self, substitutions: Substitutions<'a>) -> Self {
+        self.substitutions = Some(substitutions);
+        self
+    }
+
+    /// Give commands, words and redirects their spans in the source
+    pub fn with_spans(mut self, spans: Spans<'a>) -> Self {
+        self.spans = Some(spans);
+        self
+    }
+
+    /// Walk the tree with the stacks in `scratch`, which keep their
+    /// capacity for the next conversion
+    pub const fn with_scratch(mut self, scratch: &'a mut Scratch) -> Self {
+        self.scratch = Some(scratch);
+        self
+    }
+
+    /// Give up on scripts nested deeper than `limits.max_depth`, or going
+    /// over the rest of `limits`
+    pub fn with_limits(mut self, limits: &ParseLimits) -> Self {
+        self.max_depth = limits.max_depth;
+        self.budget = Budget::new(limits);
+        self
+    }
+
+    /// Also give up once `interrupt` says to
+    pub fn with_interrupt(mut self, interrupt: &Interrupt<'_>) -> Self {
+        self.budget.interrupt(interrupt);
+        self
+    }
 
-use crate::ast::Command;
-use helpers::{convert_redirects, convert_word_list, convert_word_list_to_strings, cstr_to_string};
+    /// Why the last conversion stopped early: the part of its budget it
+    /// went over, or cancellation
+    pub const fn stopped(&self) -> Option<Stop> {
+        self.stopped
+    }
 
-// Re-export the main entry point
-pub use self::convert_impl::convert_command;
+    /// Convert chains of list connections to `Command::Sequence`s rather
+    /// than nested `Command::List`s
+    pub const fn with_flat_lists(mut self) -> Self {
+        self.flat_lists = true;
+        self
+    }
+}
 
-/// Maximum recursion depth for AST conversion (256 levels)
+/// Deepest tree `write_script_json` accepts (256 levels)
 ///
-/// This prevents stack overflow from deeply nested bash scripts.
-const MAX_DEPTH: usize = 256;
+/// Its serializers recurse once per level of nesting, so deeper trees are
+/// converted first and written with `crate::write_json`, which doesn't.
+pub const MAX_DIRECT_DEPTH: usize = 256;
 
 /// Maximum linked list length (100,000 items)
 ///
 /// This prevents infinite loops from malformed/cyclic linked list data.
-const MAX_LIST_LENGTH: usize = 100_000;
+pub const MAX_LIST_LENGTH: usize = 100_000;
 
 // Constants that may not be exported by bindgen
 // These values come from bash's command.h
 
 /// `W_ASSIGNMENT` flag - word is a variable assignment
-const W_ASSIGNMENT: u32 = 1 << 2;
+pub const W_ASSIGNMENT: u32 = 1 << 2;
 
 /// `CASEPAT_FALLTHROUGH` - case clause falls through (;&)
-const CASEPAT_FALLTHROUGH: i32 = 0x01;
+pub const CASEPAT_FALLTHROUGH: i32 = 0x01;
 
 /// `CASEPAT_TESTNEXT` - case clause tests next pattern (;;&)
-const CASEPAT_TESTNEXT: i32 = 0x02;
+pub const CASEPAT_TESTNEXT: i32 = 0x02;
 
 /// `COND_AND` - conditional AND
-const COND_AND: i32 = 1;
+pub const COND_AND: i32 = 1;
 
 /// `COND_OR` - conditional OR
-const COND_OR: i32 = 2;
+pub const COND_OR: i32 = 2;
 
 /// `COND_UNARY` - unary conditional test
-const COND_UNARY: i32 = 3;
+pub const COND_UNARY: i32 = 3;
 
 /// `COND_BINARY` - binary conditional test
-const COND_BINARY: i32 = 4;
+pub const COND_BINARY: i32 = 4;
 
 /// `COND_TERM` - conditional term
-const COND_TERM: i32 = 5;
+pub const COND_TERM: i32 = 5;
 
 /// `COND_EXPR` - conditional expression (grouped)
-const COND_EXPR: i32 = 6;
+pub const COND_EXPR: i32 = 6;
 
 /// `CMD_INVERT_RETURN` flag
-const CMD_INVERT_RETURN: i32 = 0x04;
+pub const CMD_INVERT_RETURN: i32 = 0x04;
 
 /// Convert a line number to Option, filtering out invalid values
 ///
@@ -66,7 +178,7 @@ const CMD_INVERT_RETURN: i32 = 0x04;
 ///
 /// We consider line numbers > 1 million to be garbage since no reasonable
 /// script would have that many lines.
-const fn line_or_none(line: u32) -> Option<u32> {
+pub const fn line_or_none(line: u32) -> Option<u32> {
     // Filter out 0 (unknown) and garbage values (uninitialized memory on Linux)
     if line == 0 || line > 1_000_000 {
         None
@@ -79,7 +191,7 @@ const fn line_or_none(line: u32) -> Option<u32> {
 ///
 /// Many bash command structures have their own line field that may be more
 /// accurate than the parent COMMAND's line. This helper picks the best one.
-const fn effective_line(cmd_line: i32, fallback: u32) -> u32 {
+pub const fn effective_line(cmd_line: i32, fallback: u32) -> u32 {
     if cmd_line > 0 {
         cmd_line as u32
     } else {
@@ -87,30 +199,225 @@ const fn effective_line(cmd_line: i32, fallback: u32) -> u32 {
     }
 }
 
-/// Flatten nested pipelines into a single vector
-fn flatten_pipeline(cmd: &Command, commands: &mut Vec<Command>) {
-    if let Command::Pipeline {
-        commands: inner, ..
-    } = cmd
-    {
-        for c in inner {
-            flatten_pipeline(c, commands);
+/// The stages of a pipeline connection, in order
+///
+/// Bash nests the stages of `a | b | c` as pipe connections inside pipe
+/// connections. This walks them with an explicit stack and returns the
+/// commands that aren't pipes themselves, so a long pipeline costs neither
+/// recursion depth nor copies of converted stages.
+///
+/// # Safety
+///
+/// `conn` must belong to a valid command tree.
+pub unsafe fn pipeline_stages(conn: &ffi::CONNECTION) -> Vec<*const ffi::COMMAND> {
+    let mut stages = Vec::new();
+    // Subtrees still to visit, the next one last
+    let mut pending = vec![conn.second, conn.first];
+    while let Some(cmd) = pending.pop() {
+        match cmd.as_ref() {
+            Some(command)
+                if command.type_ == ffi::command_type_cm_connection
+                    && is_pipe(&*command.value.Connection) =>
+            {
+                let inner = &*command.value.Connection;
+                pending.extend([inner.second, inner.first]);
+            }
+            _ => stages.push(cmd.cast_const()),
+        }
+    }
+    stages
+}
+
+/// The commands of a list and the operators between them, in order
+///
+/// Bash nests `a; b; c` as the connection `(a; b); c`, one level deeper per
+/// command. This follows connections down their left side for as long as
+/// their operators have the precedence of `conn`'s, so the chain costs
+/// neither recursion depth nor a level per command. The last command is
+/// null when the list ends with `&`.
+///
+/// # Safety
+///
+/// `conn` must belong to a valid command tree.
+pub unsafe fn list_chain(conn: &ffi::CONNECTION) -> (Vec<*const ffi::COMMAND>, Vec<ListOp>) {
+    let and_or = list_op(conn.connector).is_and_or();
+    // Collected last to first
+    let mut commands = vec![conn.second.cast_const()];
+    let mut ops = vec![list_op(conn.connector)];
+    let mut first = conn.first;
+    while let Some(command) = first.as_ref() {
+        if command.type_ != ffi::command_type_cm_connection {
+            break;
+        }
+        let inner = &*command.value.Connection;
+        let op = list_op(inner.connector);
+        if is_pipe(inner) || op.is_and_or() != and_or {
+            break;
+        }
+        commands.push(inner.second);
+        ops.push(op);
+        first = inner.first;
+    }
+    commands.push(first);
+    commands.reverse();
+    ops.reverse();
+    (commands, ops)
+}
+
+/// Whether a connection joins the two sides of a pipeline
+///
+/// The connector determines the type of connection: '|' for pipeline,
+/// '&&' for and, '||' for or, ';' for semi, '&' for async.
+pub const fn is_pipe(conn: &ffi::CONNECTION) -> bool {
+    conn.connector as u8 == b'|'
+}
+
+/// How deeply a command tree nests, counted as the converter counts it,
+/// or `cap` if it nests deeper
+///
+/// # Safety
+///
+/// `cmd` must be null or point to a valid command tree.
+pub unsafe fn nesting_depth(cmd: *const ffi::COMMAND, cap: usize) -> usize {
+    /// A node still to visit
+    enum Node {
+        Command(*const ffi::COMMAND),
+        Cond(*const ffi::COND_COM),
+    }
+
+    let mut deepest = 0;
+    let mut pending = vec![(Node::Command(cmd), 0)];
+    while let Some((node, depth)) = pending.pop() {
+        let child = depth + 1;
+        match node {
+            Node::Command(cmd) => {
+                let Some(cmd) = cmd.as_ref() else { continue };
+                deepest = deepest.max(depth);
+                if deepest >= cap {
+                    return cap;
+                }
+                let nested = |cmd: *mut ffi::COMMAND| (Node::Command(cmd), child);
+                match cmd.type_ {
+                    ffi::command_type_cm_connection => {
+                        let conn = &*cmd.value.Connection;
+                        if is_pipe(conn) {
+                            let stages = pipeline_stages(conn);
+                            pending.extend(
+                                stages
+                                    .into_iter()
+                                    .map(|stage| (Node::Command(stage), child)),
+                            );
+                        } else {
+                            pending.extend([nested(conn.first), nested(conn.second)]);
+                        }
+                    }
+                    ffi::command_type_cm_for => pending.push(nested((*cmd.value.For).action)),
+                    ffi::command_type_cm_while | ffi::command_type_cm_until => {
+                        let while_cmd = &*cmd.value.While;
+                        pending.extend([nested(while_cmd.test), nested(while_cmd.action)]);
+                    }
+                    ffi::command_type_cm_if => {
+                        let if_cmd = &*cmd.value.If;
+                        pending.extend([
+                            nested(if_cmd.test),
+                            nested(if_cmd.true_case),
+                            nested(if_cmd.false_case),
+                        ]);
+                    }
+                    ffi::command_type_cm_case => pending.extend(
+                        patterns((*cmd.value.Case).clauses).map(|pattern| nested(pattern.action)),
+                    ),
+                    ffi::command_type_cm_select => {
+                        pending.push(nested((*cmd.value.Select).action));
+                    }
+                    ffi::command_type_cm_group => pending.push(nested((*cmd.value.Group).command)),
+                    ffi::command_type_cm_subshell => {
+                        pending.push(nested((*cmd.value.Subshell).command));
+                    }
+                    ffi::command_type_cm_function_def => {
+                        pending.push(nested((*cmd.value.Function_def).command));
+                    }
+                    ffi::command_type_cm_arith_for => {
+                        pending.push(nested((*cmd.value.ArithFor).action));
+                    }
+                    // The expression's root is at the command's own depth
+                    ffi::command_type_cm_cond => pending.push((Node::Cond(cmd.value.Cond), depth)),
+                    ffi::command_type_cm_coproc => {
+                        pending.push(nested((*cmd.value.Coproc).command));
+                    }
+                    _ => {}
+                }
+            }
+            Node::Cond(cond) => {
+                let Some(cond) = cond.as_ref() else { continue };
+                deepest = deepest.max(depth);
+                if deepest >= cap {
+                    return cap;
+                }
+                if cond.type_ == COND_AND || cond.type_ == COND_OR {
+                    pending.extend([
+                        (Node::Cond(cond.left), child),
+                        (Node::Cond(cond.right), child),
+                    ]);
+                } else if cond.type_ == COND_EXPR {
+                    pending.push((Node::Cond(cond.left), child));
+                }
+            }
+        }
+    }
+    deepest
+}
+
+/// The list operator of a connection that isn't a pipeline
+pub const fn list_op(connector: c_int) -> ListOp {
+    match connector as u8 as char {
+        '&' => {
+            // Check if this is '&&' or just '&'
+            // connector == '&' && next char is '&' means AND
+            // We need to check the actual connector value
+            if connector == ('&' as i32) << 8 | ('&' as i32) || connector == 288
+            // AND_AND token
+            {
+                ListOp::And
+            } else {
+                ListOp::Amp
+            }
+        }
+        '|' => ListOp::Or, // This is actually OR_OR
+        ';' => ListOp::Semi,
+        '\n' => ListOp::Newline,
+        _ => {
+            // Check token values
+            if connector == 289 {
+                // OR_OR token
+                ListOp::Or
+            } else if connector == 288 {
+                // AND_AND token
+                ListOp::And
+            } else {
+                ListOp::Semi
+            }
         }
-    } else {
-        commands.push(cmd.clone());
     }
 }
 
 // The actual conversion implementation
+//
+// Conversion walks the tree with explicit stacks rather than recursion, so
+// the nesting a script can have is limited by `Converter::max_depth`, not by
+// the size of the thread's stack.
 mod convert_impl {
     use super::{
-        convert_redirects, convert_word_list, convert_word_list_to_strings, cstr_to_string,
-        effective_line, flatten_pipeline, line_or_none, CASEPAT_FALLTHROUGH, CASEPAT_TESTNEXT,
-        CMD_INVERT_RETURN, COND_AND, COND_BINARY, COND_EXPR, COND_OR, COND_TERM, COND_UNARY,
-        MAX_DEPTH, MAX_LIST_LENGTH, W_ASSIGNMENT,
+        convert_redirect_lists, convert_redirects, cstr_to_string, effective_line, is_pipe,
+        join_words, line_or_none, list_chain, list_op, patterns, pipeline_stages, words, Converter,
+        CASEPAT_FALLTHROUGH, CASEPAT_TESTNEXT, CMD_INVERT_RETURN, COND_AND, COND_BINARY, COND_EXPR,
+        COND_OR, COND_TERM, COND_UNARY, W_ASSIGNMENT,
     };
-    use crate::ast::{CaseClause, CaseClauseFlags, Command, ConditionalExpr, ListOp};
-    use crate::ffi;
+    use crate::ast::{
+        CaseClause, CaseClauseFlags, Command, ConditionalExpr, ListOp, Nested, Redirect, Word,
+    };
+    use crate::{ffi, Symbol};
+    use std::ffi::{c_char, CStr};
 
     /// Convert a C COMMAND pointer to a Rust Command
     ///
@@ -119,466 +426,850 @@ mod convert_impl {
     /// The pointer must be valid and non-null, pointing to a valid
     /// COMMAND structure allocated by bash's parser.
     pub unsafe fn convert_command(cmd: *const ffi::COMMAND) -> Option<Command> {
-        convert_command_with_depth(cmd, 0)
+        Converter::default().convert(cmd)
     }
 
-    /// Internal function with depth tracking to prevent stack overflow
-    pub(super) unsafe fn convert_command_with_depth(
-        cmd: *const ffi::COMMAND,
-        depth: usize,
-    ) -> Option<Command> {
-        if depth > MAX_DEPTH {
-            return None; // Prevent stack overflow from deeply nested scripts
-        }
-
-        if cmd.is_null() {
-            return None;
-        }
-
-        let cmd = &*cmd;
-        let line = cmd.line as u32;
-
-        // Check if this command is negated (for pipelines)
-        let negated = (cmd.flags & CMD_INVERT_RETURN) != 0;
-
-        match cmd.type_ {
-            ffi::command_type_cm_simple => convert_simple(cmd, line),
-            ffi::command_type_cm_connection => convert_connection(cmd, line, negated, depth),
-            ffi::command_type_cm_for => convert_for(cmd, line, depth),
-            ffi::command_type_cm_while => convert_while(cmd, line, depth),
-            ffi::command_type_cm_until => convert_until(cmd, line, depth),
-            ffi::command_type_cm_if => convert_if(cmd, line, depth),
-            ffi::command_type_cm_case => convert_case(cmd, line, depth),
-            ffi::command_type_cm_select => convert_select(cmd, line, depth),
-            ffi::command_type_cm_group => convert_group(cmd, line, depth),
-            ffi::command_type_cm_subshell => convert_subshell(cmd, line, depth),
-            ffi::command_type_cm_function_def => convert_function_def(cmd, line, depth),
-            ffi::command_type_cm_arith => convert_arith(cmd, line),
-            ffi::command_type_cm_arith_for => convert_arith_for(cmd, line, depth),
-            ffi::command_type_cm_cond => convert_cond(cmd, line, depth),
-            ffi::command_type_cm_coproc => convert_coproc(cmd, line, depth),
-            _ => None,
-        }
+    /// The stacks of a conversion, kept for the next one
+    #[derive(Default)]
+    pub struct Scratch {
+        work: Vec<Work>,
+        done: Vec<Option<Command>>,
     }
 
-    #[allow(clippy::unnecessary_wraps)] // Consistent with other converters that may return None
-    unsafe fn convert_simple(cmd: &ffi::COMMAND, line: u32) -> Option<Command> {
-        let simple = &*cmd.value.Simple;
-        let eff_line = effective_line(simple.line, line);
-        let words = convert_word_list(simple.words);
-
-        // Also get redirects from both the simple command and the parent command
-        let mut redirects = convert_redirects(simple.redirects);
-        redirects.extend(convert_redirects(cmd.redirects));
+    // SAFETY: the stacks are emptied at the end of every conversion, so no
+    // pointer into bash's tree outlives the call that put it there
+    #[allow(clippy::non_send_fields_in_send_ty)]
+    unsafe impl Send for Scratch {}
+
+    /// The tree nests deeper than the converter's budget
+    struct TooDeep;
+
+    /// A step of a conversion
+    enum Work {
+        /// Convert the command at the given depth
+        Convert(*const ffi::COMMAND, usize),
+        /// Assemble a command from its converted children
+        Finish(Pending),
+        /// Fill in the spans of the command just converted from this one
+        Locate(*const ffi::COMMAND),
+    }
 
-        // Separate assignments from words
-        let (assignments, command_words): (Vec<_>, Vec<_>) = words
-            .into_iter()
-            .partition(|w| (w.flags & W_ASSIGNMENT) != 0);
+    /// A command whose child commands are still being converted
+    ///
+    /// Holds everything but the children, which `finish` takes from the
+    /// stack of converted commands.
+    enum Pending {
+        Pipeline {
+            stages: usize,
+            negated: bool,
+        },
+        List {
+            op: ListOp,
+        },
+        Sequence {
+            ops: Vec<ListOp>,
+        },
+        For {
+            line: Option<u32>,
+            variable: Symbol,
+            words: Option<Vec<Symbol>>,
+            redirects: Vec<Redirect>,
+        },
+        While {
+            line: Option<u32>,
+            redirects: Vec<Redirect>,
+        },
+        Until {
+            line: Option<u32>,
+            redirects: Vec<Redirect>,
+        },
+        If {
+            line: Option<u32>,
+            has_else: bool,
+            redirects: Vec<Redirect>,
+        },
+        Case {
+            line: Option<u32>,
+            word: Symbol,
+            clauses: Vec<CaseClause>,
+            /// The clause list, to tell which clauses have an action
+            list: *mut ffi::PATTERN_LIST,
+            actions: usize,
+            redirects: Vec<Redirect>,
+        },
+        Select {
+            line: Option<u32>,
+            variable: Symbol,
+            words: Option<Vec<Symbol>>,
+            redirects: Vec<Redirect>,
+        },
+        Group {
+            line: Option<u32>,
+            redirects: Vec<Redirect>,
+        },
+        Subshell {
+            line: Option<u32>,
+            redirects: Vec<Redirect>,
+        },
+        FunctionDef {
+            line: Option<u32>,
+            name: Symbol,
+            source_file: Option<String>,
+        },
+        ArithmeticFor {
+            line: Option<u32>,
+            init: String,
+            test: String,
+            step: String,
+        },
+        Coproc {
+            line: Option<u32>,
+            name: Option<String>,
+        },
+    }
 
-        let assignments = if assignments.is_empty() {
-            None
-        } else {
-            Some(assignments.into_iter().map(|w| w.word).collect())
-        };
+    impl Converter<'_> {
+        /// Convert a C COMMAND pointer to a Rust Command
+        ///
+        /// Returns None if the tree nests deeper than the converter's
+        /// budget, or has a part that can't be represented.
+        ///
+        /// # Safety
+        ///
+        /// As for [`convert_command`].
+        pub unsafe fn convert(&mut self, cmd: *const ffi::COMMAND) -> Option<Command> {
+            let mut scratch = self
+                .scratch
+                .as_deref_mut()
+                .map(std::mem::take)
+                .unwrap_or_default();
+            let result = self.walk(cmd, &mut scratch.work, &mut scratch.done);
+            // A conversion given up on leaves steps and commands behind
+            scratch.work.clear();
+            scratch.done.clear();
+            if let Some(kept) = self.scratch.as_deref_mut() {
+                *kept = scratch;
+            }
+            result
+        }
 
-        let simple_cmd = Command::Simple {
-            line: line_or_none(eff_line),
-            words: command_words,
-            redirects,
-            assignments,
-        };
+        /// Convert `cmd` with the given (empty) stacks: `work`, the steps
+        /// still to take, the next one last, and `done`, the converted
+        /// commands their parents haven't taken yet, with None for those
+        /// that failed to convert
+        unsafe fn walk(
+            &mut self,
+            cmd: *const ffi::COMMAND,
+            work: &mut Vec<Work>,
+            done: &mut Vec<Option<Command>>,
+        ) -> Option<Command> {
+            work.push(Work::Convert(cmd, 0));
+            while let Some(step) = work.pop() {
+                match step {
+                    Work::Convert(cmd, depth) => {
+                        if depth > self.max_depth {
+                            return None;
+                        }
+                        match cmd.as_ref() {
+                            Some(cmd) => {
+                                if let Err(stop) = self.budget.charge(cmd) {
+                                    self.stopped = Some(stop);
+                                    return None;
+                                }
+                                // Taken once the command and its children
+                                // are converted
+                                if self.spans.is_some() {
+                                    work.push(Work::Locate(cmd));
+                                }
+                                self.begin(cmd, depth, work, done).ok()?;
+                            }
+                            None => done.push(None),
+                        }
+                    }
+                    Work::Finish(pending) => {
+                        let cmd = pending.finish(done);
+                        done.push(cmd);
+                    }
+                    Work::Locate(cmd) => {
+                        if let (Some(spans), Some(Some(converted))) = (&self.spans, done.last_mut())
+                        {
+                            spans.locate(&*cmd, converted);
+                        }
+                    }
+                }
+            }
 
-        // Check if this command is negated with !
-        // If so, wrap it in a negated pipeline (since ! only applies to pipelines in bash)
-        let negated = (cmd.flags & CMD_INVERT_RETURN) != 0;
-        if negated {
-            Some(Command::Pipeline {
-                line: None,
-                commands: vec![simple_cmd],
-                negated: true,
-            })
-        } else {
-            Some(simple_cmd)
+            done.pop().flatten()
         }
-    }
 
-    unsafe fn convert_connection(
-        cmd: &ffi::COMMAND,
-        _line: u32,
-        negated: bool,
-        depth: usize,
-    ) -> Option<Command> {
-        let conn = &*cmd.value.Connection;
-
-        // Connector determines the type of connection
-        // '|' for pipeline, '&&' for and, '||' for or, ';' for semi, '&' for async
-        let connector = conn.connector as u8 as char;
-
-        if connector == '|' {
-            // Pipeline - collect all commands in the pipeline
-            let mut commands = Vec::new();
-
-            let first = convert_command_with_depth(conn.first, depth + 1)?;
-            let second = convert_command_with_depth(conn.second, depth + 1)?;
-
-            // Flatten nested pipelines
-            flatten_pipeline(&first, &mut commands);
-            flatten_pipeline(&second, &mut commands);
-
-            Some(Command::Pipeline {
-                // Don't include line for pipelines - the COMMAND.line field
-                // for CONNECTION types is unreliable (uninitialized on some
-                // platforms). Child commands have their own accurate line numbers.
-                line: None,
-                commands,
-                negated,
-            })
-        } else {
-            // List connection
-            let op = match connector {
-                '&' => {
-                    // Check if this is '&&' or just '&'
-                    // connector == '&' && next char is '&' means AND
-                    // We need to check the actual connector value
-                    if conn.connector == ('&' as i32) << 8 | ('&' as i32) || conn.connector == 288
-                    // AND_AND token
-                    {
-                        ListOp::And
+        /// Convert a command without child commands onto `done`, or queue
+        /// the steps that convert one with children onto `work`
+        #[allow(clippy::too_many_lines)] // One arm per command type
+        unsafe fn begin(
+            &mut self,
+            cmd: &ffi::COMMAND,
+            depth: usize,
+            work: &mut Vec<Work>,
+            done: &mut Vec<Option<Command>>,
+        ) -> Result<(), TooDeep> {
+            let line = cmd.line as u32;
+            let child = depth + 1;
+
+            // Check if this command is negated (for pipelines)
+            let negated = (cmd.flags & CMD_INVERT_RETURN) != 0;
+
+            match cmd.type_ {
+                ffi::command_type_cm_simple => done.push(self.convert_simple(cmd, line)),
+                ffi::command_type_cm_connection => {
+                    let conn = &*cmd.value.Connection;
+                    if is_pipe(conn) {
+                        // Pipeline - collect all commands in the pipeline
+                        let stages = pipeline_stages(conn);
+                        work.push(Work::Finish(Pending::Pipeline {
+                            stages: stages.len(),
+                            negated,
+                        }));
+                        work.extend(
+                            stages
+                                .iter()
+                                .rev()
+                                .map(|&stage| Work::Convert(stage, child)),
+                        );
+                    } else if self.flat_lists {
+                        // A whole chain of list connections at once
+                        let (commands, ops) = list_chain(conn);
+                        work.push(Work::Finish(Pending::Sequence { ops }));
+                        work.extend(commands.iter().rev().map(|&cmd| Work::Convert(cmd, child)));
                     } else {
-                        ListOp::Amp
+                        // List connection
+                        work.extend([
+                            Work::Finish(Pending::List {
+                                op: list_op(conn.connector),
+                            }),
+                            Work::Convert(conn.second, child),
+                            Work::Convert(conn.first, child),
+                        ]);
                     }
                 }
-                '|' => ListOp::Or, // This is actually OR_OR
-                ';' => ListOp::Semi,
-                '\n' => ListOp::Newline,
-                _ => {
-                    // Check token values
-                    if conn.connector == 289 {
-                        // OR_OR token
-                        ListOp::Or
-                    } else if conn.connector == 288 {
-                        // AND_AND token
-                        ListOp::And
+                ffi::command_type_cm_for => {
+                    let for_cmd = &*cmd.value.For;
+                    let eff_line = effective_line(for_cmd.line, line);
+                    work.extend([
+                        Work::Finish(Pending::For {
+                            line: line_or_none(eff_line),
+                            variable: self.symbol((*for_cmd.name).word),
+                            words: self.convert_word_list_to_symbols(for_cmd.map_list),
+                            redirects: convert_redirects(cmd.redirects),
+                        }),
+                        Work::Convert(for_cmd.action, child),
+                    ]);
+                }
+                ffi::command_type_cm_while | ffi::command_type_cm_until => {
+                    // Until uses the same structure as while
+                    let while_cmd = &*cmd.value.While;
+                    let line = line_or_none(line);
+                    let redirects = convert_redirects(cmd.redirects);
+                    let pending = if cmd.type_ == ffi::command_type_cm_while {
+                        Pending::While { line, redirects }
                     } else {
-                        ListOp::Semi
+                        Pending::Until { line, redirects }
+                    };
+                    work.extend([
+                        Work::Finish(pending),
+                        Work::Convert(while_cmd.action, child),
+                        Work::Convert(while_cmd.test, child),
+                    ]);
+                }
+                ffi::command_type_cm_if => {
+                    let if_cmd = &*cmd.value.If;
+                    let has_else = !if_cmd.false_case.is_null();
+                    work.push(Work::Finish(Pending::If {
+                        line: line_or_none(line),
+                        has_else,
+                        redirects: convert_redirects(cmd.redirects),
+                    }));
+                    if has_else {
+                        work.push(Work::Convert(if_cmd.false_case, child));
                     }
+                    work.extend([
+                        Work::Convert(if_cmd.true_case, child),
+                        Work::Convert(if_cmd.test, child),
+                    ]);
                 }
-            };
-
-            let left = convert_command_with_depth(conn.first, depth + 1)?;
-
-            // For background commands (cmd &), the second command may be null
-            let right = convert_command_with_depth(conn.second, depth + 1);
-
-            match right {
-                Some(right_cmd) => Some(Command::List {
-                    // Don't include line for list commands - it's unreliable
-                    // (uninitialized on some platforms) and the child commands
-                    // have their own accurate line numbers
-                    line: None,
-                    op,
-                    left: Box::new(left),
-                    right: Box::new(right_cmd),
-                }),
-                None if op == ListOp::Amp => {
-                    // Background command with no following command - wrap in a list
-                    // with an empty/noop right side isn't ideal. Instead, we'll
-                    // mark the left command as backgrounded by returning it as
-                    // a single-element list
-                    Some(Command::List {
-                        line: None,
-                        op: ListOp::Amp,
-                        left: Box::new(left),
-                        right: Box::new(Command::Simple {
-                            line: None,
-                            words: vec![],
-                            redirects: vec![],
-                            assignments: None,
+                ffi::command_type_cm_case => {
+                    let case_cmd = &*cmd.value.Case;
+                    let eff_line = effective_line(case_cmd.line, line);
+                    work.push(Work::Finish(Pending::Case {
+                        line: line_or_none(eff_line),
+                        word: self.symbol((*case_cmd.word).word),
+                        clauses: self.convert_pattern_list(case_cmd.clauses),
+                        list: case_cmd.clauses,
+                        actions: patterns(case_cmd.clauses)
+                            .filter(|pattern| !pattern.action.is_null())
+                            .count(),
+                        redirects: convert_redirects(cmd.redirects),
+                    }));
+                    let start = work.len();
+                    work.extend(
+                        patterns(case_cmd.clauses)
+                            .filter(|pattern| !pattern.action.is_null())
+                            .map(|pattern| Work::Convert(pattern.action, child)),
+                    );
+                    work[start..].reverse();
+                }
+                ffi::command_type_cm_select => {
+                    let select_cmd = &*cmd.value.Select;
+                    let eff_line = effective_line(select_cmd.line, line);
+                    work.extend([
+                        Work::Finish(Pending::Select {
+                            line: line_or_none(eff_line),
+                            variable: self.symbol((*select_cmd.name).word),
+                            words: self.convert_word_list_to_symbols(select_cmd.map_list),
+                            redirects: convert_redirects(cmd.redirects),
                         }),
-                    })
+                        Work::Convert(select_cmd.action, child),
+                    ]);
+                }
+                ffi::command_type_cm_group => {
+                    let group_cmd = &*cmd.value.Group;
+                    work.extend([
+                        Work::Finish(Pending::Group {
+                            line: line_or_none(line),
+                            redirects: convert_redirects(cmd.redirects),
+                        }),
+                        Work::Convert(group_cmd.command, child),
+                    ]);
+                }
+                ffi::command_type_cm_subshell => {
+                    let subshell_cmd = &*cmd.value.Subshell;
+                    let eff_line = effective_line(subshell_cmd.line, line);
+                    work.extend([
+                        Work::Finish(Pending::Subshell {
+                            line: line_or_none(eff_line),
+                            redirects: convert_redirects(cmd.redirects),
+                        }),
+                        Work::Convert(subshell_cmd.command, child),
+                    ]);
+                }
+                ffi::command_type_cm_function_def => {
+                    let func_def = &*cmd.value.Function_def;
+                    let source_file = if func_def.source_file.is_null() {
+                        None
+                    } else {
+                        Some(cstr_to_string(func_def.source_file))
+                    };
+                    work.extend([
+                        Work::Finish(Pending::FunctionDef {
+                            line: line_or_none(line),
+                            name: self.symbol((*func_def.name).word),
+                            source_file,
+                        }),
+                        Work::Convert(func_def.command, child),
+                    ]);
+                }
+                ffi::command_type_cm_arith => done.push(Some(convert_arith(cmd, line))),
+                ffi::command_type_cm_arith_for => {
+                    let arith_for = &*cmd.value.ArithFor;
+                    let eff_line = effective_line(arith_for.line, line);
+                    work.extend([
+                        Work::Finish(Pending::ArithmeticFor {
+                            line: line_or_none(eff_line),
+                            init: join_words(arith_for.init),
+                            test: join_words(arith_for.test),
+                            step: join_words(arith_for.step),
+                        }),
+                        Work::Convert(arith_for.action, child),
+                    ]);
+                }
+                ffi::command_type_cm_cond => {
+                    done.push(convert_cond(cmd, line, depth, self.max_depth)?);
+                }
+                ffi::command_type_cm_coproc => {
+                    let coproc_cmd = &*cmd.value.Coproc;
+                    let name = if coproc_cmd.name.is_null() {
+                        None
+                    } else {
+                        Some(cstr_to_string(coproc_cmd.name))
+                    };
+                    work.extend([
+                        Work::Finish(Pending::Coproc {
+                            line: line_or_none(line),
+                            name,
+                        }),
+                        Work::Convert(coproc_cmd.command, child),
+                    ]);
                 }
-                None => None, // Other cases require a second command
+                _ => done.push(None),
             }
+            Ok(())
         }
-    }
-
-    unsafe fn convert_for(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let for_cmd = &*cmd.value.For;
-        let eff_line = effective_line(for_cmd.line, line);
-        let variable = cstr_to_string((*for_cmd.name).word);
-        let words = convert_word_list_to_strings(for_cmd.map_list);
-        let body = convert_command_with_depth(for_cmd.action, depth + 1)?;
-        let redirects = convert_redirects(cmd.redirects);
-
-        Some(Command::For {
-            line: line_or_none(eff_line),
-            variable,
-            words,
-            body: Box::new(body),
-            redirects,
-        })
-    }
-
-    unsafe fn convert_while(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let while_cmd = &*cmd.value.While;
-
-        let test = convert_command_with_depth(while_cmd.test, depth + 1)?;
-        let body = convert_command_with_depth(while_cmd.action, depth + 1)?;
-        let redirects = convert_redirects(cmd.redirects);
-
-        Some(Command::While {
-            line: line_or_none(line),
-            test: Box::new(test),
-            body: Box::new(body),
-            redirects,
-        })
-    }
-
-    unsafe fn convert_until(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        // Until uses the same structure as while
-        let while_cmd = &*cmd.value.While;
-
-        let test = convert_command_with_depth(while_cmd.test, depth + 1)?;
-        let body = convert_command_with_depth(while_cmd.action, depth + 1)?;
-        let redirects = convert_redirects(cmd.redirects);
-
-        Some(Command::Until {
-            line: line_or_none(line),
-            test: Box::new(test),
-            body: Box::new(body),
-            redirects,
-        })
-    }
-
-    unsafe fn convert_if(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let if_cmd = &*cmd.value.If;
-
-        let condition = convert_command_with_depth(if_cmd.test, depth + 1)?;
-        let then_branch = convert_command_with_depth(if_cmd.true_case, depth + 1)?;
-        let else_branch = if if_cmd.false_case.is_null() {
-            None
-        } else {
-            Some(Box::new(convert_command_with_depth(
-                if_cmd.false_case,
-                depth + 1,
-            )?))
-        };
-        let redirects = convert_redirects(cmd.redirects);
-
-        Some(Command::If {
-            line: line_or_none(line),
-            condition: Box::new(condition),
-            then_branch: Box::new(then_branch),
-            else_branch,
-            redirects,
-        })
-    }
-
-    #[allow(clippy::unnecessary_wraps)] // Consistent with other converters that may return None
-    unsafe fn convert_case(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let case_cmd = &*cmd.value.Case;
-        let eff_line = effective_line(case_cmd.line, line);
-        let word = cstr_to_string((*case_cmd.word).word);
-        let clauses = convert_pattern_list(case_cmd.clauses, depth);
-        let redirects = convert_redirects(cmd.redirects);
-
-        Some(Command::Case {
-            line: line_or_none(eff_line),
-            word,
-            clauses,
-            redirects,
-        })
-    }
-
-    unsafe fn convert_pattern_list(list: *mut ffi::PATTERN_LIST, depth: usize) -> Vec<CaseClause> {
-        let mut clauses = Vec::new();
-        let mut current = list;
-        let mut count = 0;
 
-        while !current.is_null() {
-            count += 1;
-            if count > MAX_LIST_LENGTH {
-                break; // Prevent infinite loop from cyclic list
+        unsafe fn convert_simple(&mut self, cmd: &ffi::COMMAND, line: u32) -> Option<Command> {
+            let simple = &*cmd.value.Simple;
+            let eff_line = effective_line(simple.line, line);
+            // Also get redirects from both the simple command and the parent command
+            let redirects = convert_redirect_lists(&[simple.redirects, cmd.redirects]);
+
+            // Separate assignments from words; assignments are rarely
+            // repeated, so they are not interned
+            let (count, assignment_count) = words(simple.words).fold((0, 0), |(n, a), word| {
+                (
+                    n + 1,
+                    a + usize::from((word.flags as u32 & W_ASSIGNMENT) != 0),
+                )
+            });
+            let mut command_words = Vec::with_capacity(count - assignment_count);
+            let mut assignments = Vec::with_capacity(assignment_count);
+            for word in words(simple.words) {
+                if (word.flags as u32 & W_ASSIGNMENT) != 0 {
+                    assignments.push(cstr_to_string(word.word));
+                } else {
+                    command_words.push(Word {
+                        span: None,
+                        word: self.symbol(word.word),
+                        flags: word.flags as u32,
+                        substitutions: self.convert_substitutions(word.word)?,
+                    });
+                }
             }
 
-            let pattern = &*current;
-
-            let patterns = convert_word_list_to_strings(pattern.patterns).unwrap_or_default();
-            let action = if pattern.action.is_null() {
+            let assignments = if assignments.is_empty() {
                 None
             } else {
-                convert_command_with_depth(pattern.action, depth + 1).map(Box::new)
+                Some(assignments)
             };
 
-            let flags = if pattern.flags != 0 {
-                Some(CaseClauseFlags {
-                    fallthrough: (pattern.flags & CASEPAT_FALLTHROUGH) != 0,
-                    test_next: (pattern.flags & CASEPAT_TESTNEXT) != 0,
-                })
-            } else {
-                None
+            let simple_cmd = Command::Simple {
+                line: line_or_none(eff_line),
+                span: None,
+                words: command_words,
+                redirects,
+                assignments,
             };
 
-            clauses.push(CaseClause {
-                patterns,
-                action,
-                flags,
-            });
-
-            current = pattern.next;
+            // Check if this command is negated with !
+            // If so, wrap it in a negated pipeline (since ! only applies to pipelines in bash)
+            let negated = (cmd.flags & CMD_INVERT_RETURN) != 0;
+            Some(if negated {
+                Command::Pipeline {
+                    line: None,
+                    span: None,
+                    commands: vec![simple_cmd],
+                    negated: true,
+                }
+            } else {
+                simple_cmd
+            })
         }
 
-        clauses
-    }
-
-    unsafe fn convert_select(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let select_cmd = &*cmd.value.Select;
-        let eff_line = effective_line(select_cmd.line, line);
-        let variable = cstr_to_string((*select_cmd.name).word);
-        let words = convert_word_list_to_strings(select_cmd.map_list);
-        let body = convert_command_with_depth(select_cmd.action, depth + 1)?;
-        let redirects = convert_redirects(cmd.redirects);
-
-        Some(Command::Select {
-            line: line_or_none(eff_line),
-            variable,
-            words,
-            body: Box::new(body),
-            redirects,
-        })
-    }
+        /// Convert the trees of the substitutions written in a word
+        ///
+        /// Each is converted with a budget of its own; substitutions nest
+        /// only as deep as bash's own parser recursed to read them.
+        unsafe fn convert_substitutions(&mut self, word: *const c_char) -> Option<Vec<Command>> {
+            let trees = match &mut self.substitutions {
+                Some(substitutions) if !word.is_null() => {
+                    substitutions.take(CStr::from_ptr(word).to_bytes())
+                }
+                _ => return Some(Vec::new()),
+            };
+            // The trees are copies, so no position recorded is theirs
+            let spans = self.spans.take();
+            let trees = trees.into_iter().map(|tree| self.convert(tree)).collect();
+            self.spans = spans;
+            trees
+        }
 
-    unsafe fn convert_group(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let group_cmd = &*cmd.value.Group;
+        /// Convert the clauses of a case statement, leaving their actions
+        /// for `Pending::finish`
+        unsafe fn convert_pattern_list(&mut self, list: *mut ffi::PATTERN_LIST) -> Vec<CaseClause> {
+            let mut clauses = Vec::with_capacity(patterns(list).count());
+            for pattern in patterns(list) {
+                let patterns = self
+                    .convert_word_list_to_symbols(pattern.patterns)
+                    .unwrap_or_default();
+
+                let flags = if pattern.flags != 0 {
+                    Some(CaseClauseFlags {
+                        fallthrough: (pattern.flags & CASEPAT_FALLTHROUGH) != 0,
+                        test_next: (pattern.flags & CASEPAT_TESTNEXT) != 0,
+                    })
+                } else {
+                    None
+                };
 
-        let body = convert_command_with_depth(group_cmd.command, depth + 1)?;
-        let redirects = convert_redirects(cmd.redirects);
+                clauses.push(CaseClause {
+                    patterns,
+                    action: None,
+                    flags,
+                });
+            }
 
-        Some(Command::Group {
-            line: line_or_none(line),
-            body: Box::new(body),
-            redirects,
-        })
+            clauses
+        }
     }
 
-    unsafe fn convert_subshell(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let subshell_cmd = &*cmd.value.Subshell;
-        let eff_line = effective_line(subshell_cmd.line, line);
-        let body = convert_command_with_depth(subshell_cmd.command, depth + 1)?;
-        let redirects = convert_redirects(cmd.redirects);
+    impl Pending {
+        /// Assemble the command from its children, which are the last
+        /// entries of `done`
+        ///
+        /// The children are taken off `done` even when one of them failed
+        /// to convert, so that the entries below stay in step.
+        #[allow(clippy::too_many_lines)] // One arm per command type
+        unsafe fn finish(self, done: &mut Vec<Option<Command>>) -> Option<Command> {
+            let mut child = || done.pop().flatten().map(Nested::new);
+            let cmd = match self {
+                Self::Pipeline { stages, negated } => {
+                    let mut commands = Vec::with_capacity(stages);
+                    let mut complete = true;
+                    for stage in done.drain(done.len() - stages..) {
+                        match stage {
+                            // The one-command pipeline a negated simple
+                            // command becomes is inlined, dropping its negation
+                            Some(mut stage) => {
+                                if let Command::Pipeline {
+                                    commands: inner, ..
+                                } = &mut stage
+                                {
+                                    commands.append(inner);
+                                } else {
+                                    commands.push(stage);
+                                }
+                            }
+                            None => complete = false,
+                        }
+                    }
+                    if !complete {
+                        return None;
+                    }
 
-        Some(Command::Subshell {
-            line: line_or_none(eff_line),
-            body: Box::new(body),
-            redirects,
-        })
-    }
+                    Command::Pipeline {
+                        // Don't include line for pipelines - the COMMAND.line field
+                        // for CONNECTION types is unreliable (uninitialized on some
+                        // platforms). Child commands have their own accurate line numbers.
+                        line: None,
+                        span: None,
+                        commands,
+                        negated,
+                    }
+                }
+                Self::List { op } => {
+                    // For background commands (cmd &), the second command may be null
+                    let right = child();
+                    let left = child()?;
+
+                    let right = match right {
+                        Some(right) => right,
+                        // Background command with no following command - wrap in a list
+                        // with an empty/noop right side isn't ideal. Instead, we'll
+                        // mark the left command as backgrounded by returning it as
+                        // a single-element list
+                        None if op == ListOp::Amp => Nested::new(Command::Simple {
+                            line: None,
+                            span: None,
+                            words: vec![],
+                            redirects: vec![],
+                            assignments: None,
+                        }),
+                        None => return None, // Other cases require a second command
+                    };
 
-    unsafe fn convert_function_def(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let func_def = &*cmd.value.Function_def;
+                    Command::List {
+                        // Don't include line for list commands - it's unreliable
+                        // (uninitialized on some platforms) and the child commands
+                        // have their own accurate line numbers
+                        line: None,
+                        span: None,
+                        op,
+                        left,
+                        right,
+                    }
+                }
+                Self::Sequence { mut ops } => {
+                    let mut commands = done.split_off(done.len() - ops.len() - 1);
+                    // A background command with no following command
+                    // keeps its `&` and leaves no empty command behind
+                    if ops.last() == Some(&ListOp::Amp) && matches!(commands.last(), Some(None)) {
+                        commands.pop();
+                    } else {
+                        ops.push(ListOp::Semi);
+                    }
 
-        let name = cstr_to_string((*func_def.name).word);
-        let body = convert_command_with_depth(func_def.command, depth + 1)?;
-        let source_file = if func_def.source_file.is_null() {
-            None
-        } else {
-            Some(cstr_to_string(func_def.source_file))
-        };
+                    let items = commands
+                        .into_iter()
+                        .zip(ops)
+                        .map(|(cmd, op)| Some((cmd?, op)))
+                        .collect::<Option<_>>()?;
+                    Command::Sequence {
+                        // As for lists, the command's own line is unreliable
+                        line: None,
+                        span: None,
+                        items,
+                    }
+                }
+                Self::For {
+                    line,
+                    variable,
+                    words,
+                    redirects,
+                } => Command::For {
+                    line,
+                    span: None,
+                    variable,
+                    words,
+                    body: child()?,
+                    redirects,
+                },
+                Self::While { line, redirects } => {
+                    let body = child();
+                    let test = child();
+                    Command::While {
+                        line,
+                        span: None,
+                        test: test?,
+                        body: body?,
+                        redirects,
+                    }
+                }
+                Self::Until { line, redirects } => {
+                    let body = child();
+                    let test = child();
+                    Command::Until {
+                        line,
+                        span: None,
+                        test: test?,
+                        body: body?,
+                        redirects,
+                    }
+                }
+                Self::If {
+                    line,
+                    has_else,
+                    redirects,
+                } => {
+                    let else_branch = if has_else { Some(child()) } else { None };
+                    let then_branch = child();
+                    let condition = child();
+                    Command::If {
+                        line,
+                        span: None,
+                        condition: condition?,
+                        then_branch: then_branch?,
+                        else_branch: match else_branch {
+                            Some(else_branch) => Some(else_branch?),
+                            None => None,
+                        },
+                        redirects,
+                    }
+                }
+                Self::Case {
+                    line,
+                    word,
+                    mut clauses,
+                    list,
+                    actions,
+                    redirects,
+                } => {
+                    // An action that fails to convert is left out
+                    let mut actions = done.drain(done.len() - actions..);
+                    for (clause, pattern) in clauses.iter_mut().zip(patterns(list)) {
+                        if !pattern.action.is_null() {
+                            clause.action = actions.next().flatten().map(Nested::new);
+                        }
+                    }
 
-        Some(Command::FunctionDef {
-            line: line_or_none(line),
-            name,
-            body: Box::new(body),
-            source_file,
-        })
+                    Command::Case {
+                        line,
+                        span: None,
+                        word,
+                        clauses,
+                        redirects,
+                    }
+                }
+                Self::Select {
+                    line,
+                    variable,
+                    words,
+                    redirects,
+                } => Command::Select {
+                    line,
+                    span: None,
+                    variable,
+                    words,
+                    body: child()?,
+                    redirects,
+                },
+                Self::Group { line, redirects } => Command::Group {
+                    line,
+                    span: None,
+                    body: child()?,
+                    redirects,
+                },
+                Self::Subshell { line, redirects } => Command::Subshell {
+                    line,
+                    span: None,
+                    body: child()?,
+                    redirects,
+                },
+                Self::FunctionDef {
+                    line,
+                    name,
+                    source_file,
+                } => Command::FunctionDef {
+                    line,
+                    span: None,
+                    name,
+                    body: child()?,
+                    source_file,
+                },
+                Self::ArithmeticFor {
+                    line,
+                    init,
+                    test,
+                    step,
+                } => Command::ArithmeticFor {
+                    line,
+                    span: None,
+                    init,
+                    test,
+                    step,
+                    body: child()?,
+                },
+                Self::Coproc { line, name } => Command::Coproc {
+                    line,
+                    span: None,
+                    name,
+                    body: child()?,
+                },
+            };
+            Some(cmd)
+        }
     }
 
-    #[allow(clippy::unnecessary_wraps)] // Consistent with other converters that may return None
-    unsafe fn convert_arith(cmd: &ffi::COMMAND, line: u32) -> Option<Command> {
+    unsafe fn convert_arith(cmd: &ffi::COMMAND, line: u32) -> Command {
         let arith_cmd = &*cmd.value.Arith;
         let eff_line = effective_line(arith_cmd.line, line);
 
         // The expression is in the first word of the word list
-        let expression = if arith_cmd.exp.is_null() {
-            String::new()
-        } else {
-            let word_list = convert_word_list(arith_cmd.exp);
-            word_list
-                .into_iter()
-                .map(|w| w.word)
-                .collect::<Vec<_>>()
-                .join(" ")
-        };
+        let expression = join_words(arith_cmd.exp);
 
-        Some(Command::Arithmetic {
+        Command::Arithmetic {
             line: line_or_none(eff_line),
+            span: None,
             expression,
-        })
-    }
-
-    unsafe fn convert_arith_for(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let arith_for = &*cmd.value.ArithFor;
-        let eff_line = effective_line(arith_for.line, line);
-        let init = words_to_string(arith_for.init);
-        let test = words_to_string(arith_for.test);
-        let step = words_to_string(arith_for.step);
-        let body = convert_command_with_depth(arith_for.action, depth + 1)?;
-
-        Some(Command::ArithmeticFor {
-            line: line_or_none(eff_line),
-            init,
-            test,
-            step,
-            body: Box::new(body),
-        })
+        }
     }
 
-    unsafe fn convert_cond(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
+    unsafe fn convert_cond(
+        cmd: &ffi::COMMAND,
+        line: u32,
+        depth: usize,
+        max_depth: usize,
+    ) -> Result<Option<Command>, TooDeep> {
         let cond_cmd = &*cmd.value.Cond;
         let eff_line = effective_line(cond_cmd.line, line);
-        let expr = convert_cond_com(cond_cmd, depth)?;
+        let expr = convert_cond_com(cond_cmd, depth, max_depth)?;
 
-        Some(Command::Conditional {
+        Ok(expr.map(|expr| Command::Conditional {
             line: line_or_none(eff_line),
+            span: None,
             expr,
-        })
+        }))
+    }
+
+    /// A step of converting a conditional expression
+    enum CondWork {
+        /// Convert the node at the given depth
+        Convert(*const ffi::COND_COM, usize),
+        /// Assemble a node from its converted operands
+        Finish(CondPending),
+    }
+
+    /// A conditional node whose operands are still being converted
+    enum CondPending {
+        And { negated: bool },
+        Or { negated: bool },
+        Expr { negated: bool },
     }
 
     unsafe fn convert_cond_com(
         cond: *const ffi::COND_COM,
         depth: usize,
-    ) -> Option<ConditionalExpr> {
-        if depth > MAX_DEPTH {
-            return None; // Prevent stack overflow from deeply nested conditionals
-        }
-
-        if cond.is_null() {
-            return None;
+        max_depth: usize,
+    ) -> Result<Option<ConditionalExpr>, TooDeep> {
+        let mut work = vec![CondWork::Convert(cond, depth)];
+        let mut done: Vec<Option<ConditionalExpr>> = Vec::new();
+
+        while let Some(step) = work.pop() {
+            let expr = match step {
+                CondWork::Convert(cond, depth) => {
+                    if depth > max_depth {
+                        return Err(TooDeep);
+                    }
+                    let Some(cond) = cond.as_ref() else {
+                        done.push(None);
+                        continue;
+                    };
+
+                    // Check if this node is negated (! operator)
+                    let negated = (cond.flags & CMD_INVERT_RETURN) != 0;
+
+                    let pending = match cond.type_ {
+                        t if t == COND_AND => CondPending::And { negated },
+                        t if t == COND_OR => CondPending::Or { negated },
+                        t if t == COND_EXPR => CondPending::Expr { negated },
+                        _ => {
+                            done.push(convert_cond_leaf(cond).map(|expr| negate(expr, negated)));
+                            continue;
+                        }
+                    };
+                    work.push(CondWork::Finish(pending));
+                    if cond.type_ != COND_EXPR {
+                        work.push(CondWork::Convert(cond.right, depth + 1));
+                    }
+                    work.push(CondWork::Convert(cond.left, depth + 1));
+                    continue;
+                }
+                CondWork::Finish(CondPending::And { negated }) => {
+                    let right = done.pop().flatten();
+                    let left = done.pop().flatten();
+                    left.zip(right).map(|(left, right)| {
+                        let expr = ConditionalExpr::And {
+                            left: Nested::new(left),
+                            right: Nested::new(right),
+                        };
+                        negate(expr, negated)
+                    })
+                }
+                CondWork::Finish(CondPending::Or { negated }) => {
+                    let right = done.pop().flatten();
+                    let left = done.pop().flatten();
+                    left.zip(right).map(|(left, right)| {
+                        let expr = ConditionalExpr::Or {
+                            left: Nested::new(left),
+                            right: Nested::new(right),
+                        };
+                        negate(expr, negated)
+                    })
+                }
+                CondWork::Finish(CondPending::Expr { negated }) => {
+                    done.pop().flatten().map(|inner| {
+                        let expr = ConditionalExpr::Expr {
+                            expr: Nested::new(inner),
+                        };
+                        negate(expr, negated)
+                    })
+                }
+            };
+            done.push(expr);
         }
 
-        let cond = &*cond;
-
-        // Check if this node is negated (! operator)
-        let negated = (cond.flags & CMD_INVERT_RETURN) != 0;
+        Ok(done.pop().flatten())
+    }
 
+    /// Convert a conditional node without operand nodes
+    unsafe fn convert_cond_leaf(cond: &ffi::COND_COM) -> Option<ConditionalExpr> {
         let expr = match cond.type_ {
-            t if t == COND_AND => {
-                let left = convert_cond_com(cond.left, depth + 1)?;
-                let right = convert_cond_com(cond.right, depth + 1)?;
-                ConditionalExpr::And {
-                    left: Box::new(left),
-                    right: Box::new(right),
-                }
-            }
-            t if t == COND_OR => {
-                let left = convert_cond_com(cond.left, depth + 1)?;
-                let right = convert_cond_com(cond.right, depth + 1)?;
-                ConditionalExpr::Or {
-                    left: Box::new(left),
-                    right: Box::new(right),
-                }
-            }
             t if t == COND_UNARY => {
                 let op = if cond.op.is_null() {
                     String::new()
@@ -634,46 +1325,19 @@ mod convert_impl {
                 };
                 ConditionalExpr::Term { word }
             }
-            t if t == COND_EXPR => {
-                let inner = convert_cond_com(cond.left, depth + 1)?;
-                ConditionalExpr::Expr {
-                    expr: Box::new(inner),
-                }
-            }
             _ => return None,
         };
+        Some(expr)
+    }
 
-        // Wrap in Not if negated
+    /// Wrap in Not if negated
+    fn negate(expr: ConditionalExpr, negated: bool) -> ConditionalExpr {
         if negated {
-            Some(ConditionalExpr::Not {
-                expr: Box::new(expr),
-            })
+            ConditionalExpr::Not {
+                expr: Nested::new(expr),
+            }
         } else {
-            Some(expr)
+            expr
         }
     }
-
-    unsafe fn convert_coproc(cmd: &ffi::COMMAND, line: u32, depth: usize) -> Option<Command> {
-        let coproc_cmd = &*cmd.value.Coproc;
-
-        let name = if coproc_cmd.name.is_null() {
-            None
-        } else {
-            Some(cstr_to_string(coproc_cmd.name))
-        };
-        let body = convert_command_with_depth(coproc_cmd.command, depth + 1)?;
-
-        Some(Command::Coproc {
-            line: line_or_none(line),
-            name,
-            body: Box::new(body),
-        })
-    }
-
-    // Helper to convert word list to string
-    unsafe fn words_to_string(list: *mut ffi::WORD_LIST) -> String {
-        convert_word_list_to_strings(list)
-            .map(|v| v.join(" "))
-            .unwrap_or_default()
-    }
 }
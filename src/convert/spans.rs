@@ -0,0 +1,599 @@
+//! Source spans of the nodes of a parse
+//!
+//! Bash keeps no offsets in its trees. While recording is on, `safe_parse.c`
+//! notes where the lexer was in the script when each word, redirect and
+//! `case`, `((...))` and `[[ ... ]]` command was made (Linux only, see
+//! build.rs). A word is made just as its last byte is read, so that is its
+//! end; everything else is worked out from the script: a word's start by
+//! matching its text back from the end, a redirect's from its target, and a
+//! command's from its words, redirects, children and keywords. Where the
+//! script doesn't read as expected, the node is left without a span rather
+//! than given a wrong one.
+
+use super::helpers::{redirect_target, redirects, words, TargetRef};
+use super::{CMD_INVERT_RETURN, W_ASSIGNMENT};
+use crate::ast::{Command, Redirect, Span};
+use crate::ffi;
+use std::collections::HashMap;
+use std::ffi::{c_void, CStr};
+
+/// Kinds of position `safe_parse_position` reports
+const POSITION_WORD: i32 = 0;
+const POSITION_REDIRECT: i32 = 1;
+const POSITION_COMMAND: i32 = 2;
+
+/// The positions recorded by the last parse, and the script they are in
+pub struct Spans<'a> {
+    source: &'a [u8],
+    /// Offset of the start of each line
+    lines: Vec<usize>,
+    /// Each word's end, and the end of the word made before it, which its
+    /// start can't precede
+    words: HashMap<*const c_void, (usize, usize)>,
+    redirects: HashMap<*const c_void, usize>,
+    commands: HashMap<*const c_void, usize>,
+}
+
+impl<'a> Spans<'a> {
+    /// The positions recorded by the last parse, which read `source`
+    ///
+    /// # Safety
+    ///
+    /// Recording must have been on for the last parse, which must have
+    /// parsed `source`, and no other parse may start while the result is in
+    /// use.
+    pub unsafe fn captured(source: &'a [u8]) -> Self {
+        let mut lines = vec![0];
+        lines.extend(
+            source
+                .iter()
+                .enumerate()
+                .filter(|&(_, &byte)| byte == b'\n')
+                .map(|(i, _)| i + 1),
+        );
+        let mut spans = Self {
+            source,
+            lines,
+            words: HashMap::new(),
+            redirects: HashMap::new(),
+            commands: HashMap::new(),
+        };
+
+        // Nodes freed during the parse leave their address to later ones,
+        // so later records replace earlier ones
+        let mut floor = 0;
+        for index in 0..ffi::safe_parse_position_count() {
+            let mut node = std::ptr::null();
+            let mut end = 0;
+            match ffi::safe_parse_position(index, &raw mut node, &raw mut end) {
+                POSITION_WORD => {
+                    spans.words.insert(node, (end, floor.min(end)));
+                    floor = end;
+                }
+                POSITION_REDIRECT => {
+                    spans.redirects.insert(node, end);
+                }
+                POSITION_COMMAND => {
+                    spans.commands.insert(node, end);
+                }
+                _ => {}
+            }
+        }
+        spans
+    }
+
+    /// Fill in the spans of a converted command, its words and its
+    /// redirects; its children already have theirs
+    ///
+    /// # Safety
+    ///
+    /// `cmd` must be the command `converted` was converted from.
+    pub unsafe fn locate(&self, cmd: &ffi::COMMAND, converted: &mut Command) {
+        let span = match cmd.type_ {
+            ffi::command_type_cm_simple => {
+                if let Command::Pipeline { commands, .. } = converted {
+                    // A negated simple command, wrapped in a pipeline
+                    if let Some(simple) = commands.first_mut() {
+                        let span = self.simple(cmd, simple);
+                        *simple.span_mut() = span.map(Box::new);
+                    }
+                    commands
+                        .first()
+                        .and_then(Command::span)
+                        .and_then(|span| self.negation(span))
+                } else {
+                    self.simple(cmd, converted)
+                }
+            }
+            ffi::command_type_cm_connection => self.connection(cmd, converted),
+            _ => self.compound(cmd, converted),
+        };
+        *converted.span_mut() = span.map(Box::new);
+    }
+
+    /// The span of a simple command, filling in its words' and redirects'
+    unsafe fn simple(&self, cmd: &ffi::COMMAND, converted: &mut Command) -> Option<Span> {
+        let Command::Simple {
+            words: converted_words,
+            redirects: converted_redirects,
+            ..
+        } = converted
+        else {
+            return None;
+        };
+        let simple = &*cmd.value.Simple;
+
+        let mut hull = Hull::default();
+        let mut rest = converted_words.iter_mut();
+        for word in words(simple.words) {
+            let span = self.word(word);
+            hull.add(span);
+            if (word.flags as u32 & W_ASSIGNMENT) == 0 {
+                if let Some(converted) = rest.next() {
+                    converted.span = span.map(Box::new);
+                }
+            }
+        }
+        let mut done = 0;
+        for list in [simple.redirects, cmd.redirects] {
+            done += self.redirects(list, &mut converted_redirects[done..], &mut hull);
+        }
+        hull.span.map(|(start, end)| self.span(start, end))
+    }
+
+    /// The span of a pipeline or list, which covers its children
+    fn connection(&self, cmd: &ffi::COMMAND, converted: &Command) -> Option<Span> {
+        let mut hull = Hull::default();
+        match converted {
+            Command::Pipeline { commands, .. } => {
+                for stage in commands {
+                    hull.add(stage.span());
+                }
+            }
+            // The right side of `cmd &` is an empty command with no span
+            Command::List { left, right, .. } => {
+                hull.add(left.span());
+                if !is_empty(right) {
+                    hull.add(right.span());
+                }
+            }
+            Command::Sequence { items, .. } => {
+                for (item, _) in items {
+                    hull.add(item.span());
+                }
+            }
+            _ => return None,
+        }
+        let span = hull.span.map(|(start, end)| self.span(start, end))?;
+        if (cmd.flags & CMD_INVERT_RETURN) != 0 {
+            self.negation(span)
+        } else {
+            Some(span)
+        }
+    }
+
+    /// The span of a compound command, from its opening keyword to its
+    /// closing one and any redirects after that
+    #[allow(clippy::too_many_lines, clippy::cognitive_complexity)] // One arm per command type
+    unsafe fn compound(&self, cmd: &ffi::COMMAND, converted: &mut Command) -> Option<Span> {
+        let start_of = |cmd: &Command| cmd.span().map(|span| span.start);
+        let end_of = |cmd: &Command| cmd.span().map(|span| span.end);
+
+        let (start, end) = match (cmd.type_, &*converted) {
+            (
+                ffi::command_type_cm_if,
+                Command::If {
+                    condition,
+                    then_branch,
+                    else_branch,
+                    ..
+                },
+            ) => {
+                let last = else_branch.as_deref().unwrap_or(then_branch);
+                // An `elif` is an if nested in the else branch
+                let condition = start_of(condition)?;
+                let start = self
+                    .keyword_before(condition, b"if")
+                    .or_else(|| self.keyword_before(condition, b"elif"))?;
+                (start, self.keyword_after(end_of(last)?, &[b"fi"])?)
+            }
+            (ffi::command_type_cm_while, Command::While { test, body, .. }) => (
+                self.keyword_before(start_of(test)?, b"while")?,
+                self.keyword_after(end_of(body)?, &[b"done"])?,
+            ),
+            (ffi::command_type_cm_until, Command::Until { test, body, .. }) => (
+                self.keyword_before(start_of(test)?, b"until")?,
+                self.keyword_after(end_of(body)?, &[b"done"])?,
+            ),
+            (ffi::command_type_cm_for, Command::For { body, .. }) => {
+                let name = self.word((*cmd.value.For).name.as_ref()?)?;
+                (
+                    self.keyword_before(name.start, b"for")?,
+                    self.keyword_after(end_of(body)?, &[b"done", b"}"])?,
+                )
+            }
+            (ffi::command_type_cm_select, Command::Select { body, .. }) => {
+                let name = self.word((*cmd.value.Select).name.as_ref()?)?;
+                (
+                    self.keyword_before(name.start, b"select")?,
+                    self.keyword_after(end_of(body)?, &[b"done", b"}"])?,
+                )
+            }
+            (ffi::command_type_cm_case, Command::Case { .. }) => {
+                let word = self.word((*cmd.value.Case).word.as_ref()?)?;
+                let made = *self.commands.get(&std::ptr::from_ref(cmd).cast())?;
+                (
+                    self.keyword_before(word.start, b"case")?,
+                    self.last_keyword(made, b"esac")?,
+                )
+            }
+            (ffi::command_type_cm_group, Command::Group { body, .. }) => (
+                self.keyword_before(start_of(body)?, b"{")?,
+                self.keyword_after(end_of(body)?, &[b"}"])?,
+            ),
+            (ffi::command_type_cm_subshell, Command::Subshell { body, .. }) => (
+                self.keyword_before(start_of(body)?, b"(")?,
+                self.keyword_after(end_of(body)?, &[b")"])?,
+            ),
+            (ffi::command_type_cm_function_def, Command::FunctionDef { body, .. }) => {
+                let name = self.word((*cmd.value.Function_def).name.as_ref()?)?;
+                let start = self
+                    .keyword_before(name.start, b"function")
+                    .unwrap_or(name.start);
+                (start, end_of(body)?)
+            }
+            (ffi::command_type_cm_arith, Command::Arithmetic { .. }) => {
+                let made = *self.commands.get(&std::ptr::from_ref(cmd).cast())?;
+                let end = self.last_keyword(made, b"))")?;
+                (self.arithmetic_start(end)?, end)
+            }
+            (ffi::command_type_cm_arith_for, Command::ArithmeticFor { body, .. }) => {
+                let body_start = start_of(body)?;
+                let open = self
+                    .keyword_before(body_start, b"do")
+                    .or_else(|| self.keyword_before(body_start, b"{"))?;
+                let header = self.skip_back(open, b" \t\n;");
+                if !self.source[..header].ends_with(b"))") {
+                    return None;
+                }
+                (
+                    self.keyword_before(self.arithmetic_start(header)?, b"for")?,
+                    self.keyword_after(end_of(body)?, &[b"done", b"}"])?,
+                )
+            }
+            (ffi::command_type_cm_cond, Command::Conditional { .. }) => {
+                let made = *self.commands.get(&std::ptr::from_ref(cmd).cast())?;
+                let end = self.last_keyword(made, b"]]")?;
+                let start = (0..end - 2)
+                    .rev()
+                    .find(|&i| self.source[i..].starts_with(b"[[") && self.at_token_start(i))?;
+                (start, end)
+            }
+            (ffi::command_type_cm_coproc, Command::Coproc { name, body, .. }) => {
+                let mut before = self.skip_back(start_of(body)?, b" \t");
+                if let Some(name) = name {
+                    let name = name.as_bytes();
+                    if self.source[..before].ends_with(name)
+                        && self.at_token_start(before - name.len())
+                    {
+                        before -= name.len();
+                    }
+                }
+                (self.keyword_before(before, b"coproc")?, end_of(body)?)
+            }
+            _ => return None,
+        };
+
+        let mut hull = Hull::default();
+        hull.add(Some(self.span(start, end)));
+        if let Some(converted_redirects) = command_redirects(converted) {
+            self.redirects(cmd.redirects, converted_redirects, &mut hull);
+        }
+        hull.span.map(|(start, end)| self.span(start, end))
+    }
+
+    /// Fill in the spans of the redirects converted from `list`, adding
+    /// them to `hull`, and return how many there were
+    unsafe fn redirects(
+        &self,
+        list: *mut ffi::REDIRECT,
+        converted: &mut [Redirect],
+        hull: &mut Hull,
+    ) -> usize {
+        let mut count = 0;
+        for (redir, converted) in redirects(list).zip(converted) {
+            let span = self.redirect(redir);
+            hull.add(span);
+            converted.span = span.map(Box::new);
+            count += 1;
+        }
+        count
+    }
+
+    /// The span of a word the parser made
+    pub unsafe fn word(&self, word: &ffi::WORD_DESC) -> Option<Span> {
+        let &(end, floor) = self.words.get(&std::ptr::from_ref(word).cast())?;
+        if word.word.is_null() {
+            return None;
+        }
+        let text = CStr::from_ptr(word.word).to_bytes();
+
+        // Nearly always the text as written, unless a line continuation
+        // or alias changed it
+        let start = end.checked_sub(text.len());
+        if let Some(start) = start.filter(|&start| {
+            start >= floor && self.source[start..end] == *text && self.at_token_start(start)
+        }) {
+            return Some(self.span(start, end));
+        }
+        let start = (floor..end)
+            .find(|&start| self.at_token_start(start) && self.word_end(start) == end)?;
+        Some(self.span(start, end))
+    }
+
+    /// The span of a redirect, from its file descriptor or operator to the
+    /// end of its target
+    unsafe fn redirect(&self, redir: &ffi::REDIRECT) -> Option<Span> {
+        let filename = match redirect_target(redir) {
+            TargetRef::File(_) => redir.redirectee.filename.as_ref(),
+            TargetRef::Fd(_) => None,
+        };
+        let (target, end) = if let Some(filename) = filename {
+            let span = self.word(filename)?;
+            (span.start, span.end)
+        } else {
+            // A number or `-`, which the parser may have read past
+            let made = *self.redirects.get(&std::ptr::from_ref(redir).cast())?;
+            let end = (0..made)
+                .rev()
+                .find(|&i| self.source[i].is_ascii_digit() || self.source[i] == b'-')?
+                + 1;
+            (self.skip_back(end, b"0123456789-"), end)
+        };
+
+        let operator = self.skip_back(target, b" \t");
+        let start = self.skip_back(operator, b"<>&|-");
+        if !self.source[start..operator]
+            .iter()
+            .any(|&byte| byte == b'<' || byte == b'>')
+        {
+            return None;
+        }
+        // The redirected descriptor, as a number or `{name}`
+        let digits = self.skip_back(start, b"0123456789");
+        let start = if digits < start && self.at_token_start(digits) {
+            digits
+        } else if start > 0 && self.source[start - 1] == b'}' {
+            self.source[..start]
+                .iter()
+                .rposition(|&byte| byte == b'{')
+                .filter(|&open| self.at_token_start(open))
+                .unwrap_or(start)
+        } else {
+            start
+        };
+        Some(self.span(start, end))
+    }
+
+    /// Extend a pipeline's span back to its `!`
+    fn negation(&self, span: Span) -> Option<Span> {
+        let start = self.keyword_before(span.start, b"!")?;
+        Some(self.span(start, span.end))
+    }
+
+    /// Where `keyword` starts, if it is the last token before `pos`
+    fn keyword_before(&self, pos: usize, keyword: &[u8]) -> Option<usize> {
+        let end = self.skip_back(pos, b" \t\n");
+        let start = end.checked_sub(keyword.len())?;
+        (self.source[start..end] == *keyword && self.at_token_start(start)).then_some(start)
+    }
+
+    /// Where the first of `keywords` after `pos` ends, skipping blanks,
+    /// separators and comments on the way
+    fn keyword_after(&self, pos: usize, keywords: &[&[u8]]) -> Option<usize> {
+        let mut i = pos;
+        while i < self.source.len() {
+            match self.source[i] {
+                b' ' | b'\t' | b'\n' | b';' | b'&' => i += 1,
+                b'#' => {
+                    i = self.source[i..]
+                        .iter()
+                        .position(|&byte| byte == b'\n')
+                        .map_or(self.source.len(), |n| i + n);
+                }
+                _ => break,
+            }
+        }
+        keywords.iter().find_map(|keyword| {
+            let end = i + keyword.len();
+            (self.source[i..].starts_with(keyword)
+                && self.source.get(end).is_none_or(|&byte| is_boundary(byte)))
+            .then_some(end)
+        })
+    }
+
+    /// Where the last `keyword` that ends by `pos` ends
+    ///
+    /// `pos` is where the lexer was when the command was made, which may be
+    /// past the token after it.
+    fn last_keyword(&self, pos: usize, keyword: &[u8]) -> Option<usize> {
+        (keyword.len()..=pos)
+            .rev()
+            .find(|&end| self.source[..end].ends_with(keyword))
+    }
+
+    /// Where the `((` matching the `))` that ends at `end` starts
+    fn arithmetic_start(&self, end: usize) -> Option<usize> {
+        let mut depth = 0usize;
+        for i in (0..end).rev() {
+            match self.source[i] {
+                b')' => depth += 1,
+                b'(' => {
+                    depth = depth.checked_sub(1)?;
+                    if depth == 0 {
+                        return (self.source.get(i + 1) == Some(&b'(')).then_some(i);
+                    }
+                }
+                _ => {}
+            }
+        }
+        None
+    }
+
+    /// Step back from `pos` over any of `bytes`
+    fn skip_back(&self, pos: usize, bytes: &[u8]) -> usize {
+        self.source[..pos]
+            .iter()
+            .rposition(|byte| !bytes.contains(byte))
+            .map_or(0, |i| i + 1)
+    }
+
+    /// Could a token start at `pos`?
+    fn at_token_start(&self, pos: usize) -> bool {
+        pos == 0 || is_boundary(self.source[pos - 1])
+    }
+
+    /// Where a word starting at `start` ends, reading it as the lexer does
+    fn word_end(&self, start: usize) -> usize {
+        let source = self.source;
+        let mut i = start;
+        // A process substitution is a word of its own
+        if matches!(source.get(i), Some(b'<' | b'>')) && source.get(i + 1) == Some(&b'(') {
+            i = self.closing(i + 1, b'(', b')');
+        }
+        while let Some(&byte) = source.get(i) {
+            match byte {
+                // Array assignments and extended globs
+                b'(' if i > start && b"=@?*+!".contains(&source[i - 1]) => {
+                    i = self.closing(i, b'(', b')');
+                }
+                b' ' | b'\t' | b'\n' | b';' | b'&' | b'|' | b'<' | b'>' | b'(' | b')' => break,
+                b'\\' => i += 2,
+                b'\'' => i = self.quoted(i + 1, b'\''),
+                b'"' => i = self.quoted(i + 1, b'"'),
+                b'`' => i = self.quoted(i + 1, b'`'),
+                b'$' => match source.get(i + 1) {
+                    Some(b'(') => i = self.closing(i + 1, b'(', b')'),
+                    Some(b'{') => i = self.closing(i + 1, b'{', b'}'),
+                    Some(b'\'') => i = self.quoted(i + 2, b'\''),
+                    _ => i += 1,
+                },
+                _ => i += 1,
+            }
+        }
+        i.min(source.len())
+    }
+
+    /// Just past the `quote` that closes a quoted string starting at `pos`
+    fn quoted(&self, pos: usize, quote: u8) -> usize {
+        let mut i = pos;
+        while let Some(&byte) = self.source.get(i) {
+            i += 1;
+            match byte {
+                b'\\' if quote != b'\'' => i += 1,
+                b'$' if quote == b'"' && self.source.get(i) == Some(&b'(') => {
+                    i = self.closing(i, b'(', b')');
+                }
+                byte if byte == quote => return i,
+                _ => {}
+            }
+        }
+        self.source.len()
+    }
+
+    /// Just past the `close` that matches the `open` at `pos`
+    fn closing(&self, pos: usize, open: u8, close: u8) -> usize {
+        let mut depth = 0;
+        let mut i = pos;
+        while let Some(&byte) = self.source.get(i) {
+            i += 1;
+            match byte {
+                b'\\' => i += 1,
+                b'\'' => i = self.quoted(i, b'\''),
+                b'"' => i = self.quoted(i, b'"'),
+                byte if byte == open => depth += 1,
+                byte if byte == close => {
+                    depth -= 1;
+                    if depth == 0 {
+                        return i;
+                    }
+                }
+                _ => {}
+            }
+        }
+        self.source.len()
+    }
+
+    /// The span from `start` to `end`, with their lines and columns
+    fn span(&self, start: usize, end: usize) -> Span {
+        let (line, column) = self.line_and_column(start);
+        let (end_line, end_column) = self.line_and_column(end);
+        Span {
+            start,
+            end,
+            line,
+            column,
+            end_line,
+            end_column,
+        }
+    }
+
+    fn line_and_column(&self, pos: usize) -> (u32, u32) {
+        let line = self.lines.partition_point(|&start| start <= pos);
+        let column = pos - self.lines[line - 1] + 1;
+        (line as u32, column as u32)
+    }
+}
+
+/// The smallest range covering the spans added to it, if any
+#[derive(Default)]
+struct Hull {
+    span: Option<(usize, usize)>,
+    unknown: bool,
+}
+
+impl Hull {
+    /// Cover `span` too; a node without one leaves the whole hull unknown
+    fn add(&mut self, span: Option<Span>) {
+        if self.unknown {
+            return;
+        }
+        if let Some(span) = span {
+            self.span = Some(self.span.map_or((span.start, span.end), |(start, end)| {
+                (start.min(span.start), end.max(span.end))
+            }));
+        } else {
+            self.unknown = true;
+            self.span = None;
+        }
+    }
+}
+
+/// Bytes a token can start after
+const fn is_boundary(byte: u8) -> bool {
+    matches!(
+        byte,
+        b' ' | b'\t' | b'\n' | b';' | b'&' | b'|' | b'(' | b')' | b'<' | b'>' | b'{'
+    )
+}
+
+/// Is `cmd` the empty command a trailing `&` leaves on the right?
+const fn is_empty(cmd: &Command) -> bool {
+    matches!(cmd, Command::Simple { words, redirects, assignments: None, .. }
+        if words.is_empty() && redirects.is_empty())
+}
+
+/// The redirects of a compound command
+const fn command_redirects(cmd: &mut Command) -> Option<&mut Vec<Redirect>> {
+    match cmd {
+        Command::For { redirects, .. }
+        | Command::While { redirects, .. }
+        | Command::Until { redirects, .. }
+        | Command::If { redirects, .. }
+        | Command::Case { redirects, .. }
+        | Command::Select { redirects, .. }
+        | Command::Group { redirects, .. }
+        | Command::Subshell { redirects, .. } => Some(redirects),
+        _ => None,
+    }
+}
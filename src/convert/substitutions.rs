@@ -0,0 +1,94 @@
+//! Command substitution trees captured during a parse
+//!
+//! Bash parses the command of each `$(...)`, `<(...)` and `>(...)` in full
+//! while it reads the word, then keeps only the text. `safe_parse.c` can keep
+//! a copy of each of those trees with its text (Linux only, see build.rs);
+//! this module hands them to the words they were written in.
+
+use crate::ffi;
+use std::ffi::CStr;
+
+/// The substitutions bash parsed during the last parse
+///
+/// They are in the order bash finished parsing them, so nested ones come
+/// before the substitution they are written in. Bash writes each back into
+/// its word as `$(` + text + `)`, so a word takes the captures whose text
+/// it contains. Each capture is taken once: a word takes only its own
+/// substitutions, and the words inside a substitution's tree take the ones
+/// nested in it.
+pub struct Substitutions<'a> {
+    captures: Vec<(*const ffi::COMMAND, &'a [u8])>,
+    taken: Vec<bool>,
+}
+
+impl Substitutions<'_> {
+    /// The substitutions captured by the last parse
+    ///
+    /// # Safety
+    ///
+    /// Capture must have been on for the last parse, and no other parse may
+    /// start while the result is in use.
+    pub unsafe fn captured() -> Self {
+        let count = ffi::safe_parse_substitution_count();
+        let mut captures = Vec::with_capacity(count);
+        for index in 0..count {
+            let mut text = std::ptr::null();
+            let command = ffi::safe_parse_substitution(index, &raw mut text);
+            if !command.is_null() && !text.is_null() {
+                captures.push((command.cast_const(), CStr::from_ptr(text).to_bytes()));
+            }
+        }
+        Self {
+            taken: vec![false; captures.len()],
+            captures,
+        }
+    }
+
+    /// Take the trees of the substitutions written in `word`, in order
+    ///
+    /// Quoted and escaped text is skipped, as bash doesn't parse it.
+    pub fn take(&mut self, word: &[u8]) -> Vec<*const ffi::COMMAND> {
+        let mut found = Vec::new();
+        let (mut single, mut double) = (false, false);
+        let mut i = 0;
+        while i < word.len() {
+            let byte = word[i];
+            i += 1;
+            if single {
+                single = byte != b'\'';
+                continue;
+            }
+            match byte {
+                b'\\' => i += 1,
+                b'\'' if !double => single = true,
+                b'"' => double = !double,
+                b'$' | b'<' | b'>' if word.get(i) == Some(&b'(') => {
+                    if let Some((index, len)) = self.find(&word[i + 1..]) {
+                        self.taken[index] = true;
+                        found.push(self.captures[index].0);
+                        i += 1 + len;
+                    }
+                }
+                _ => {}
+            }
+        }
+        found
+    }
+
+    /// The first capture not yet taken that `rest` starts with, followed by
+    /// its closing `)`, and the length of both
+    fn find(&self, rest: &[u8]) -> Option<(usize, usize)> {
+        self.captures
+            .iter()
+            .enumerate()
+            .filter(|&(index, _)| !self.taken[index])
+            .find_map(|(index, &(_, text))| {
+                // Bash adds a space before text starting with `(`, so the
+                // word doesn't read as an arithmetic expansion
+                let space = usize::from(text.first() == Some(&b'('));
+                let body = rest.get(space..)?;
+                (body.starts_with(text) && body.get(text.len()) == Some(&b')'))
+                    .then_some((index, space + text.len() + 1))
+            })
+    }
+}
@@ -0,0 +1,213 @@
+//! Structured syntax errors
+//!
+//! Bash reports syntax errors by printing them with `parser_error()`. On
+//! Linux, `safe_parse.c` wraps that function and records the first error of
+//! each parse as it is reported: its line, message, unexpected token and
+//! offending line, and where the lexer was in the script at the time. This
+//! module turns the record into a
+//! [`SyntaxErrorDetail`]. Other platforms report syntax errors without
+//! details.
+
+use serde::{Deserialize, Serialize};
+use std::fmt;
+
+/// Where and why a script failed to parse
+#[derive(Debug, Clone, PartialEq, Eq, Serialize, Deserialize)]
+pub struct SyntaxErrorDetail {
+    /// Bash's message, e.g. ``syntax error near unexpected token `fi'``
+    pub message: String,
+    /// Line of the error, counted from 1 at the start of the script
+    #[serde(skip_serializing_if = "Option::is_none", default)]
+    pub line: Option<u32>,
+    /// Byte column of the offending token in its line, counted from 1
+    ///
+    /// Bash doesn't report columns; this is where the unexpected token
+    /// starts, found from where the lexer stopped after reading it. Errors
+    /// that aren't about a token, or whose token isn't written as reported
+    /// (bash calls a line break `newline`), have none.
+    #[serde(skip_serializing_if = "Option::is_none", default)]
+    pub column: Option<u32>,
+    /// The token the parser didn't expect
+    #[serde(skip_serializing_if = "Option::is_none", default)]
+    pub token: Option<String>,
+    /// What the parser was looking for instead, e.g. `"` for an unclosed
+    /// string or `)` inside `[[ ( ... ]]`
+    #[serde(skip_serializing_if = "Option::is_none", default)]
+    pub expected: Option<String>,
+    /// The text of the offending line
+    #[serde(skip_serializing_if = "Option::is_none", default)]
+    pub source_line: Option<String>,
+}
+
+impl fmt::Display for SyntaxErrorDetail {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match (self.line, self.column) {
+            (Some(line), Some(column)) => write!(f, "line {line}, column {column}: ")?,
+            (Some(line), None) => write!(f, "line {line}: ")?,
+            _ => {}
+        }
+        f.write_str(&self.message)
+    }
+}
+
+impl SyntaxErrorDetail {
+    /// Build the detail of an error from what the parser recorded, with no
+    /// column until [`at_offset()`](Self::at_offset) places it
+    pub(crate) const fn new(
+        message: String,
+        line: Option<u32>,
+        token: Option<String>,
+        expected: Option<String>,
+        source_line: Option<String>,
+    ) -> Self {
+        Self {
+            message,
+            line,
+            column: None,
+            token,
+            expected,
+            source_line,
+        }
+    }
+
+    /// Set `column` from `offset`, where the lexer was in `script` when the
+    /// error was reported
+    ///
+    /// The lexer stops just past the token it hands the parser, so the
+    /// token is the one ending at `offset`. If the script doesn't read as
+    /// the token there, there is no column.
+    pub(crate) fn at_offset(mut self, script: &[u8], offset: Option<usize>) -> Self {
+        self.column = offset.zip(self.token.as_deref()).and_then(|(end, token)| {
+            let start = end.checked_sub(token.len())?;
+            if script.get(start..end)? != token.as_bytes() {
+                return None;
+            }
+            let line_start = script[..start]
+                .iter()
+                .rposition(|&byte| byte == b'\n')
+                .map_or(0, |newline| newline + 1);
+            u32::try_from(start - line_start + 1).ok()
+        });
+        self
+    }
+
+    /// Map an error from a `parse()` of `script` back onto the script
+    ///
+    /// `parse()` reads the script as `{ <script>\n}`, so the first source
+    /// line carries the `{ ` prefix, and running out of input shows up as
+    /// an unexpected `}` on the line after the script.
+    pub(crate) fn unwrap_script_group(mut self, script: &[u8]) -> Self {
+        // Lines as str::lines() counts them, without needing UTF-8
+        let script_lines = if script.is_empty() {
+            0
+        } else {
+            let script = script.strip_suffix(b"\n").unwrap_or(script);
+            script.split(|&byte| byte == b'\n').count()
+        };
+        if self
+            .line
+            .is_some_and(|line| usize::try_from(line).unwrap_or(usize::MAX) > script_lines)
+        {
+            return Self {
+                message: "syntax error: unexpected end of file".to_string(),
+                line: u32::try_from(script_lines).ok(),
+                column: None,
+                token: None,
+                expected: None,
+                source_line: None,
+            };
+        }
+
+        if self.line == Some(1) {
+            if let Some(source) = &mut self.source_line {
+                if let Some(stripped) = source.strip_prefix("{ ") {
+                    *source = stripped.to_string();
+                }
+            }
+        }
+        self
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A `SyntaxErrorDetail` for an unexpected `token`
+    fn unexpected(line: u32, token: &str, source_line: &str) -> SyntaxErrorDetail {
+        SyntaxErrorDetail::new(
+            format!("syntax error near unexpected token `{token}'"),
+            Some(line),
+            Some(token.to_string()),
+            None,
+            Some(source_line.to_string()),
+        )
+    }
+
+    #[test]
+    fn test_unexpected_token() {
+        let script = b"if true\nthen\n  echo x; fi";
+        let detail = unexpected(3, "fi", "  echo x; fi").at_offset(script, Some(script.len()));
+
+        assert_eq!(detail.message, "syntax error near unexpected token `fi'");
+        assert_eq!(detail.line, Some(3));
+        assert_eq!(detail.token.as_deref(), Some("fi"));
+        assert_eq!(detail.source_line.as_deref(), Some("  echo x; fi"));
+        assert_eq!(detail.column, Some(11));
+        assert_eq!(detail.expected, None);
+        assert_eq!(
+            detail.to_string(),
+            "line 3, column 11: syntax error near unexpected token `fi'"
+        );
+    }
+
+    #[test]
+    fn test_column_comes_from_offset() {
+        // The first `fi` is an argument; the parser choked on the second
+        let detail = unexpected(1, "fi", "echo fi; fi").at_offset(b"echo fi; fi", Some(11));
+        assert_eq!(detail.column, Some(10));
+    }
+
+    #[test]
+    fn test_no_column_where_token_isnt_written() {
+        let detail = unexpected(1, "newline", "echo >").at_offset(b"echo >\n", Some(7));
+        assert_eq!(detail.column, None);
+
+        let detail = unexpected(1, "fi", "fi").at_offset(b"fi", None);
+        assert_eq!(detail.column, None);
+    }
+
+    #[test]
+    fn test_no_column_without_source_line() {
+        let detail = SyntaxErrorDetail::new(
+            "unexpected EOF while looking for matching `\"'".to_string(),
+            Some(2),
+            None,
+            Some("\"".to_string()),
+            None,
+        );
+        assert_eq!(detail.column, None);
+        assert_eq!(
+            detail.to_string(),
+            "line 2: unexpected EOF while looking for matching `\"'"
+        );
+    }
+
+    #[test]
+    fn test_unwrap_script_group() {
+        let script = b"if then fi";
+        let first_line = unexpected(1, "then", "{ if then fi")
+            .at_offset(script, Some(7))
+            .unwrap_script_group(script);
+        assert_eq!(first_line.source_line.as_deref(), Some("if then fi"));
+        assert_eq!(first_line.column, Some(4));
+
+        let closing_brace = unexpected(3, "}", "}").unwrap_script_group(b"if true; then\n  echo\n");
+        assert_eq!(
+            closing_brace.message,
+            "syntax error: unexpected end of file"
+        );
+        assert_eq!(closing_brace.line, Some(2));
+        assert_eq!(closing_brace.token, None);
+    }
+}
@@ -0,0 +1,398 @@
+//! Building the AST of simple command lines without bash
+//!
+//! Most shell history and one-liners are plain words joined by pipes and
+//! `&&`. For those, [`parse()`] builds the [`Command`] directly, exactly as
+//! converting bash's tree would, and skips the parser, its input wrapper
+//! and the conversion. Anything outside the subset it knows bash's answer
+//! for gives `None`, and the caller parses with bash as usual.
+//!
+//! The subset is one line of:
+//!
+//! - words of ASCII letters, digits and `_ . / - + , : @ % ^ =`, with
+//!   `'...'` and `"..."` runs in them; double-quoted runs hold no `$`,
+//!   backquote, backslash or `!`
+//! - `|`, `&&`, `||` and `;` between commands, and a `;` after the last
+//! - blanks around them, and newlines at the end
+//!
+//! A reserved word in command position, or a word that bash would take as
+//! an assignment, is left to bash.
+
+use crate::ast::{Command, ListOp, Nested, Word};
+use crate::{ParseLimits, Symbol};
+
+/// `W_QUOTED` flag - word contains quotes
+const W_QUOTED: u32 = 1 << 1;
+
+/// Words bash reads as reserved words in command position, apart from
+/// those made of characters the subset excludes (`{`, `!`, `[[`, ...)
+const RESERVED_WORDS: [&str; 17] = [
+    "if", "then", "else", "elif", "fi", "case", "esac", "for", "select", "while", "until", "do",
+    "done", "in", "function", "time", "coproc",
+];
+
+/// A token of the subset
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Token<'a> {
+    Word { text: &'a str, quoted: bool },
+    Pipe,
+    And,
+    Or,
+    Semi,
+}
+
+/// The AST of `script`, if it is in the subset and within `limits`
+pub fn parse(script: &str, limits: &ParseLimits) -> Option<Command> {
+    if script.len() > limits.max_script_size {
+        return None;
+    }
+    let tokens = tokenize(script.trim_end_matches(['\n', ' ', '\t']))?;
+    let cmd = Parser { tokens, next: 0 }.script()?;
+    // Left to bash, so the error is the one it would give
+    Size::of(&cmd).within(limits).then_some(cmd)
+}
+
+/// Split one line of the subset into tokens
+fn tokenize(line: &str) -> Option<Vec<Token<'_>>> {
+    let bytes = line.as_bytes();
+    let mut tokens = Vec::new();
+    let mut i = 0;
+    while i < bytes.len() {
+        let token = match bytes[i] {
+            b' ' | b'\t' => {
+                i += 1;
+                continue;
+            }
+            b'|' if bytes.get(i + 1) == Some(&b'|') => Token::Or,
+            b'|' if bytes.get(i + 1) == Some(&b'&') => return None,
+            b'|' => Token::Pipe,
+            b'&' if bytes.get(i + 1) == Some(&b'&') => Token::And,
+            b'&' => return None,
+            b';' if bytes.get(i + 1) == Some(&b';') => return None,
+            b';' => Token::Semi,
+            _ => {
+                let (len, quoted) = word_len(&bytes[i..])?;
+                let text = &line[i..i + len];
+                i += len;
+                tokens.push(Token::Word { text, quoted });
+                continue;
+            }
+        };
+        i += if matches!(token, Token::And | Token::Or) {
+            2
+        } else {
+            1
+        };
+        tokens.push(token);
+    }
+    Some(tokens)
+}
+
+/// The length of the word `bytes` starts with, and whether it has quotes
+fn word_len(bytes: &[u8]) -> Option<(usize, bool)> {
+    let mut len = 0;
+    let mut quoted = false;
+    while let Some(&byte) = bytes.get(len) {
+        match byte {
+            b'A'..=b'Z'
+            | b'a'..=b'z'
+            | b'0'..=b'9'
+            | b'_'
+            | b'.'
+            | b'/'
+            | b'-'
+            | b'+'
+            | b','
+            | b':'
+            | b'@'
+            | b'%'
+            | b'^'
+            | b'=' => len += 1,
+            b'\'' | b'"' => {
+                let close = bytes[len + 1..].iter().position(|&b| b == byte)?;
+                let inside = &bytes[len + 1..len + 1 + close];
+                let plain = |b: &u8| matches!(b, b' '..=b'~' | b'\t');
+                let expands = |b: &u8| matches!(b, b'$' | b'`' | b'\\' | b'!');
+                if !inside.iter().all(plain) || (byte == b'"' && inside.iter().any(expands)) {
+                    return None;
+                }
+                len += close + 2;
+                quoted = true;
+            }
+            b' ' | b'\t' | b'|' | b'&' | b';' => break,
+            _ => return None,
+        }
+    }
+    (len > 0).then_some((len, quoted))
+}
+
+/// Whether bash would take `word` as an assignment (`name=`, `name+=`)
+/// in a position where one is allowed
+fn is_assignment(word: &str) -> bool {
+    word.split_once('=').is_some_and(|(name, _)| {
+        let name = name.strip_suffix('+').unwrap_or(name);
+        name.starts_with(|c: char| c.is_ascii_alphabetic() || c == '_')
+            && name.bytes().all(|b| b.is_ascii_alphanumeric() || b == b'_')
+    })
+}
+
+/// Recursive descent over the tokens, with bash's precedence: `|` binds
+/// tightest, then `&&` and `||`, then `;`, each to the left
+struct Parser<'a> {
+    tokens: Vec<Token<'a>>,
+    next: usize,
+}
+
+impl<'a> Parser<'a> {
+    fn peek(&self) -> Option<Token<'a>> {
+        self.tokens.get(self.next).copied()
+    }
+
+    /// The whole line
+    fn script(mut self) -> Option<Command> {
+        let mut cmd = self.and_or()?;
+        while self.peek() == Some(Token::Semi) {
+            self.next += 1;
+            if self.peek().is_none() {
+                break;
+            }
+            cmd = list(cmd, ListOp::Semi, self.and_or()?);
+        }
+        self.peek().is_none().then_some(cmd)
+    }
+
+    fn and_or(&mut self) -> Option<Command> {
+        let mut cmd = self.pipeline()?;
+        while let Some(op @ (Token::And | Token::Or)) = self.peek() {
+            self.next += 1;
+            let op = if op == Token::And {
+                ListOp::And
+            } else {
+                ListOp::Or
+            };
+            cmd = list(cmd, op, self.pipeline()?);
+        }
+        Some(cmd)
+    }
+
+    fn pipeline(&mut self) -> Option<Command> {
+        let first = self.simple()?;
+        if self.peek() != Some(Token::Pipe) {
+            return Some(first);
+        }
+        let mut commands = vec![first];
+        while self.peek() == Some(Token::Pipe) {
+            self.next += 1;
+            commands.push(self.simple()?);
+        }
+        Some(Command::Pipeline {
+            line: None,
+            span: None,
+            commands,
+            negated: false,
+        })
+    }
+
+    fn simple(&mut self) -> Option<Command> {
+        let mut words = Vec::new();
+        while let Some(Token::Word { text, quoted }) = self.peek() {
+            if is_assignment(text) || (words.is_empty() && RESERVED_WORDS.contains(&text)) {
+                return None;
+            }
+            self.next += 1;
+            words.push(Word {
+                word: Symbol::from(text),
+                flags: if quoted { W_QUOTED } else { 0 },
+                substitutions: Vec::new(),
+                span: None,
+            });
+        }
+        if words.is_empty() {
+            return None;
+        }
+        Some(Command::Simple {
+            line: Some(1),
+            span: None,
+            words,
+            redirects: Vec::new(),
+            assignments: None,
+        })
+    }
+}
+
+fn list(left: Command, op: ListOp, right: Command) -> Command {
+    Command::List {
+        line: None,
+        span: None,
+        op,
+        left: Nested::new(left),
+        right: Nested::new(right),
+    }
+}
+
+/// What a tree of the subset counts for against a budget
+#[derive(Default)]
+struct Size {
+    /// How deeply it nests, counted as the converter counts it from the
+    /// script's own command
+    depth: usize,
+    nodes: usize,
+    words: usize,
+    word_bytes: usize,
+}
+
+impl Size {
+    fn of(cmd: &Command) -> Self {
+        let mut size = Self::default();
+        let mut pending = vec![(cmd, 1)];
+        while let Some((cmd, depth)) = pending.pop() {
+            size.depth = size.depth.max(depth);
+            size.nodes += 1;
+            match cmd {
+                Command::List { left, right, .. } => {
+                    pending.extend([(&**left, depth + 1), (&**right, depth + 1)]);
+                }
+                Command::Pipeline { commands, .. } => {
+                    // Bash joins the commands two at a time
+                    size.nodes += commands.len().saturating_sub(2);
+                    pending.extend(commands.iter().map(|cmd| (cmd, depth + 1)));
+                }
+                Command::Simple { words, .. } => {
+                    size.nodes += words.len();
+                    size.words += words.len();
+                    size.word_bytes += words.iter().map(|word| word.word.len()).sum::<usize>();
+                }
+                _ => {}
+            }
+        }
+        size
+    }
+
+    const fn within(&self, limits: &ParseLimits) -> bool {
+        self.depth <= limits.max_depth
+            && self.nodes <= limits.max_nodes
+            && self.words <= limits.max_words
+            && self.word_bytes <= limits.max_word_bytes
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{init, parse_with_limits};
+    use proptest::prelude::*;
+
+    /// Pieces the generated scripts are glued together from, in and out of
+    /// the subset
+    const FRAGMENTS: &[&str] = &[
+        " ", " ", " ", "\t", "echo", "ls", "git", "-la", "--all", "a.txt", "src/", "'a b'",
+        "\"x y\"", "''", "\"\"", "a'b'c", "--x=y", "a=b", "x+=1", "=", "if", "then", "do", "in",
+        "time", "{", "}", "|", "|", "&&", "||", ";", ";", "&", ";;", "|&", ">", "$x", "\"$x\"",
+        "#", "!", "*", "~", "\\", "(", "\n", "'", "\"",
+    ];
+
+    /// Parse `script` both ways, and check they agree if the fast path
+    /// took it
+    fn check_same(script: &str) -> bool {
+        let limits = ParseLimits::default();
+        let Some(fast) = parse(script, &limits) else {
+            return false;
+        };
+        init();
+        let bash = parse_with_limits(script, &limits)
+            .unwrap_or_else(|e| panic!("fast path took {script:?}, which bash rejects: {e}"));
+        assert_eq!(
+            serde_json::to_string(&fast).unwrap(),
+            serde_json::to_string(&bash).unwrap(),
+            "for {script:?}"
+        );
+        true
+    }
+
+    #[test]
+    fn test_one_liners() {
+        for script in [
+            "ls -la",
+            "git commit -m 'fix: handle \"quoted\" names'",
+            "cat access.log | grep 404 | sort | uniq -c | head -10",
+            "make && make install || echo \"install failed\"",
+            "cd build; cmake ..; make -j8;",
+            "a && b | c ; d || e\n",
+            "  printf '%s\\n' a\t b  ",
+            "grep -rn --color=never TODO src",
+            "echo a'b'\"c\" if",
+        ] {
+            assert!(check_same(script), "fast path rejected {script:?}");
+        }
+    }
+
+    #[test]
+    fn test_left_to_bash() {
+        let limits = ParseLimits::default();
+        for script in [
+            "",
+            "  \n",
+            "FOO=1 make",
+            "make CC+=x",
+            "if true; then :; fi",
+            "time ls",
+            "echo $HOME",
+            "echo \"$HOME\"",
+            "echo a > out",
+            "sleep 1 &",
+            "a |& b",
+            "! a",
+            "a;; b",
+            "a; ; b",
+            "a |",
+            "echo 'unterminated",
+            "echo a\necho b",
+            "echo ~",
+            "echo *.rs",
+            "echo # comment",
+            "echo caf\u{e9}",
+        ] {
+            assert!(
+                parse(script, &limits).is_none(),
+                "fast path took {script:?}"
+            );
+        }
+
+        assert!(parse("a && b", &ParseLimits::default().with_max_depth(1)).is_none());
+        assert!(parse("a && b", &ParseLimits::default().with_max_depth(2)).is_some());
+        assert!(parse("a && b", &ParseLimits::default().with_max_script_size(5)).is_none());
+        assert!(parse("a b | c", &ParseLimits::default().with_max_nodes(5)).is_none());
+        assert!(parse("a b | c", &ParseLimits::default().with_max_nodes(6)).is_some());
+        assert!(parse("a b c", &ParseLimits::default().with_max_words(2)).is_none());
+        assert!(parse("ab cd", &ParseLimits::default().with_max_word_bytes(3)).is_none());
+        assert!(parse("ab cd", &ParseLimits::default().with_max_word_bytes(4)).is_some());
+    }
+
+    #[test]
+    fn test_snapshot_corpus() {
+        let dir = concat!(env!("CARGO_MANIFEST_DIR"), "/tests/snapshots");
+        let mut taken = 0;
+        for entry in std::fs::read_dir(dir).unwrap() {
+            let path = entry.unwrap().path();
+            if path.extension().is_some_and(|ext| ext == "sh") {
+                let script = std::fs::read_to_string(&path).unwrap();
+                taken += usize::from(check_same(&script));
+                // Each line as a one-liner of its own
+                for line in script.lines() {
+                    taken += usize::from(check_same(line));
+                }
+            }
+        }
+        assert!(taken > 0, "the fast path took nothing from the corpus");
+    }
+
+    proptest! {
+        #![proptest_config(ProptestConfig::with_cases(2000))]
+
+        #[test]
+        fn prop_fast_path_matches_bash(
+            pieces in prop::collection::vec(prop::sample::select(FRAGMENTS), 1..16)
+        ) {
+            check_same(&pieces.concat());
+        }
+    }
+}
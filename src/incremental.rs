@@ -0,0 +1,509 @@
+//! Incremental re-parsing of edited documents
+//!
+//! Top-level commands are independent in bash's grammar: each one starts on
+//! a fresh line and is parsed without looking at its neighbours. An
+//! [`IncrementalDocument`] keeps every top-level command together with the
+//! byte range it was parsed from, so an edit only has to re-parse the
+//! commands whose ranges it touches. Everything else is reused as-is, with
+//! its line numbers moved if the edit added or removed lines.
+//!
+//! Here-documents are the exception: their bodies follow the command line,
+//! so an edit near one can change where a later command starts. Edits that
+//! touch a command with a here-document, or that leave an unbalanced
+//! construct, fall back to parsing the whole document.
+
+use crate::{parse_iter, Command, ParseError, RedirectType};
+use std::ops::Range;
+
+/// A script kept parsed across edits
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, IncrementalDocument};
+///
+/// init();
+///
+/// let mut doc = IncrementalDocument::new("echo one\necho two\n").unwrap();
+/// let changed = doc.edit(5..8, "three").unwrap();
+///
+/// assert_eq!(changed, 0..1);
+/// assert_eq!(doc.text(), "echo three\necho two\n");
+/// ```
+#[derive(Debug, Clone)]
+pub struct IncrementalDocument {
+    text: String,
+    segments: Vec<Segment>,
+    /// The last full parse failed; no commands are available
+    broken: bool,
+}
+
+/// A top-level command and the end of the text it was parsed from
+///
+/// Segments tile the text: each starts where the previous one ended. Any
+/// text after the last segment holds only blank lines and comments.
+#[derive(Debug, Clone)]
+struct Segment {
+    end: usize,
+    command: Command,
+}
+
+impl IncrementalDocument {
+    /// Parse a document
+    ///
+    /// Unlike [`parse()`](crate::parse), an empty document is not an error;
+    /// it simply has no commands.
+    ///
+    /// # Errors
+    ///
+    /// Returns the first error [`parse_iter()`] reports for the text.
+    pub fn new(text: impl Into<String>) -> Result<Self, ParseError> {
+        let text = text.into();
+        let segments = parse_segments(&text)?;
+        Ok(Self {
+            text,
+            segments,
+            broken: false,
+        })
+    }
+
+    /// The current text of the document
+    #[must_use]
+    pub fn text(&self) -> &str {
+        &self.text
+    }
+
+    /// Number of top-level commands
+    #[must_use]
+    pub const fn len(&self) -> usize {
+        self.segments.len()
+    }
+
+    /// True if the document has no commands
+    #[must_use]
+    pub const fn is_empty(&self) -> bool {
+        self.segments.is_empty()
+    }
+
+    /// True if the last edit left the document unparseable
+    ///
+    /// A broken document has no commands. Every further edit re-parses the
+    /// whole text until it parses again.
+    #[must_use]
+    pub const fn is_broken(&self) -> bool {
+        self.broken
+    }
+
+    /// The top-level commands, in order
+    #[must_use]
+    pub fn commands(&self) -> impl ExactSizeIterator<Item = &Command> + '_ {
+        self.segments.iter().map(|segment| &segment.command)
+    }
+
+    /// The top-level commands with the byte range of the text each was
+    /// parsed from, including any blank lines and comments before it
+    #[must_use]
+    pub fn spans(&self) -> impl ExactSizeIterator<Item = (Range<usize>, &Command)> + '_ {
+        self.segments
+            .iter()
+            .enumerate()
+            .map(|(i, segment)| (self.start_of(i)..segment.end, &segment.command))
+    }
+
+    /// Replace `range` of the text with `replacement` and update the commands
+    ///
+    /// Returns the indices (into [`commands()`](Self::commands)) of the
+    /// commands that were re-parsed; all others are the same values as
+    /// before the edit. After a full re-parse this is every command.
+    ///
+    /// # Errors
+    ///
+    /// Returns the parse error if the edited text doesn't parse. The edit is
+    /// still applied and the document is left [broken](Self::is_broken).
+    ///
+    /// # Panics
+    ///
+    /// Panics if `range` is out of bounds or not on `char` boundaries, like
+    /// [`String::replace_range`].
+    pub fn edit(
+        &mut self,
+        range: Range<usize>,
+        replacement: &str,
+    ) -> Result<Range<usize>, ParseError> {
+        let removed = &self.text[range.clone()];
+        let line_delta = count_lines(replacement) - count_lines(removed);
+        let Range { start, end } = range;
+
+        // The segments overlapping the edit, extended through the one that
+        // starts at `end` so that joining lines is noticed
+        let mut first = self.segments.partition_point(|s| s.end <= start);
+        let last = self.segments.partition_point(|s| s.end <= end);
+        if first > 0 && !self.text[..self.start_of(first)].ends_with('\n') {
+            // Appending to a final line without a newline extends its command
+            first -= 1;
+        }
+        let region_start = self.start_of(first);
+        let region_end = self.end_of(last) - (end - start) + replacement.len();
+
+        self.text.replace_range(range, replacement);
+
+        if !self.broken {
+            if let Some(changed) = self.reparse_region(first..last, region_start..region_end) {
+                for segment in &mut self.segments[changed.end..] {
+                    segment.end = segment.end - (end - start) + replacement.len();
+                    if line_delta != 0 {
+                        shift_lines(&mut segment.command, line_delta);
+                    }
+                }
+                return Ok(changed);
+            }
+        }
+
+        self.reparse_all()
+    }
+
+    /// Re-parse `region` of the (already edited) text in place of the
+    /// segments `replaced`, returning the range of new segments, or `None`
+    /// if the region can't be parsed on its own
+    fn reparse_region(
+        &mut self,
+        replaced: Range<usize>,
+        region: Range<usize>,
+    ) -> Option<Range<usize>> {
+        let replaced = replaced.start..replaced.end.min(self.segments.len());
+        if self.segments[replaced.clone()]
+            .iter()
+            .any(|segment| has_heredoc(&segment.command))
+        {
+            return None;
+        }
+
+        // A backslash-newline at the end would join the region to the next
+        // command
+        let text = &self.text[region.clone()];
+        if region.end < self.text.len() {
+            let line = text.strip_suffix('\n')?;
+            let backslashes = line.len() - line.trim_end_matches('\\').len();
+            if backslashes % 2 == 1 {
+                return None;
+            }
+        }
+
+        let mut segments = parse_segments(text).ok()?;
+        if segments.iter().any(|segment| has_heredoc(&segment.command)) {
+            return None;
+        }
+
+        let line_base = count_lines(&self.text[..region.start]);
+        for segment in &mut segments {
+            segment.end += region.start;
+            if line_base != 0 {
+                shift_lines(&mut segment.command, line_base);
+            }
+        }
+
+        let changed = replaced.start..replaced.start + segments.len();
+        self.segments.splice(replaced, segments);
+        Some(changed)
+    }
+
+    fn reparse_all(&mut self) -> Result<Range<usize>, ParseError> {
+        match parse_segments(&self.text) {
+            Ok(segments) => {
+                self.segments = segments;
+                self.broken = false;
+                Ok(0..self.segments.len())
+            }
+            Err(e) => {
+                self.segments.clear();
+                self.broken = true;
+                Err(e)
+            }
+        }
+    }
+
+    fn start_of(&self, index: usize) -> usize {
+        index.checked_sub(1).map_or(0, |i| self.segments[i].end)
+    }
+
+    fn end_of(&self, index: usize) -> usize {
+        self.segments
+            .get(index)
+            .map_or(self.text.len(), |segment| segment.end)
+    }
+}
+
+/// Split `text` into segments with [`parse_iter()`]
+fn parse_segments(text: &str) -> Result<Vec<Segment>, ParseError> {
+    if text.trim().is_empty() {
+        return Ok(Vec::new());
+    }
+
+    let mut segments = Vec::new();
+    let mut commands = parse_iter(text);
+    while let Some(command) = commands.next() {
+        segments.push(Segment {
+            end: commands.offset(),
+            command: command?,
+        });
+    }
+    Ok(segments)
+}
+
+#[allow(clippy::cast_possible_wrap)]
+fn count_lines(text: &str) -> i64 {
+    text.bytes().filter(|&b| b == b'\n').count() as i64
+}
+
+/// Move the line numbers of `command` and everything nested in it
+fn shift_lines(command: &mut Command, delta: i64) {
+    let line = command.line_mut();
+    *line = line.and_then(|l| u32::try_from(i64::from(l) + delta).ok());
+
+    match command {
+        Command::Pipeline { commands, .. } => {
+            for cmd in commands {
+                shift_lines(cmd, delta);
+            }
+        }
+        Command::List { left, right, .. } => {
+            shift_lines(left, delta);
+            shift_lines(right, delta);
+        }
+        Command::Sequence { items, .. } => {
+            for (cmd, _) in items {
+                shift_lines(cmd, delta);
+            }
+        }
+        Command::While { test, body, .. } | Command::Until { test, body, .. } => {
+            shift_lines(test, delta);
+            shift_lines(body, delta);
+        }
+        Command::If {
+            condition,
+            then_branch,
+            else_branch,
+            ..
+        } => {
+            shift_lines(condition, delta);
+            shift_lines(then_branch, delta);
+            if let Some(else_branch) = else_branch {
+                shift_lines(else_branch, delta);
+            }
+        }
+        Command::Case { clauses, .. } => {
+            for action in clauses.iter_mut().filter_map(|c| c.action.as_mut()) {
+                shift_lines(action, delta);
+            }
+        }
+        Command::For { body, .. }
+        | Command::Select { body, .. }
+        | Command::Group { body, .. }
+        | Command::Subshell { body, .. }
+        | Command::FunctionDef { body, .. }
+        | Command::ArithmeticFor { body, .. }
+        | Command::Coproc { body, .. } => shift_lines(body, delta),
+        Command::Simple { .. } | Command::Arithmetic { .. } | Command::Conditional { .. } => {}
+    }
+}
+
+/// True if `command` or anything nested in it reads a here-document
+fn has_heredoc(command: &Command) -> bool {
+    let own = command
+        .redirects()
+        .is_some_and(|r| r.iter().any(|r| r.direction == RedirectType::HereDoc));
+
+    own || match command {
+        Command::Pipeline { commands, .. } => commands.iter().any(has_heredoc),
+        Command::List { left, right, .. } => has_heredoc(left) || has_heredoc(right),
+        Command::Sequence { items, .. } => items.iter().any(|(cmd, _)| has_heredoc(cmd)),
+        Command::While { test, body, .. } | Command::Until { test, body, .. } => {
+            has_heredoc(test) || has_heredoc(body)
+        }
+        Command::If {
+            condition,
+            then_branch,
+            else_branch,
+            ..
+        } => {
+            has_heredoc(condition)
+                || has_heredoc(then_branch)
+                || else_branch.as_deref().is_some_and(has_heredoc)
+        }
+        Command::Case { clauses, .. } => clauses
+            .iter()
+            .filter_map(|c| c.action.as_deref())
+            .any(has_heredoc),
+        Command::For { body, .. }
+        | Command::Select { body, .. }
+        | Command::Group { body, .. }
+        | Command::Subshell { body, .. }
+        | Command::FunctionDef { body, .. }
+        | Command::ArithmeticFor { body, .. }
+        | Command::Coproc { body, .. } => has_heredoc(body),
+        Command::Simple { .. } | Command::Arithmetic { .. } | Command::Conditional { .. } => false,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::init;
+
+    fn setup() {
+        init();
+    }
+
+    /// Check the document against a from-scratch parse of its text
+    fn assert_consistent(doc: &IncrementalDocument) {
+        let fresh = IncrementalDocument::new(doc.text()).unwrap();
+        let json = |d: &IncrementalDocument| {
+            let spans: Vec<_> = d.spans().collect();
+            serde_json::to_string(&spans).unwrap()
+        };
+        assert_eq!(json(doc), json(&fresh), "text: {:?}", doc.text());
+    }
+
+    fn words(doc: &IncrementalDocument) -> Vec<&str> {
+        doc.commands()
+            .map(|cmd| match cmd {
+                Command::Simple { words, .. } => words[0].word.as_str(),
+                _ => "",
+            })
+            .collect()
+    }
+
+    #[test]
+    fn test_segments_tile_the_text() {
+        setup();
+        let doc = IncrementalDocument::new("# header\necho one\n\nls -l\n# trailer\n").unwrap();
+
+        let spans: Vec<_> = doc.spans().map(|(range, _)| range).collect();
+        assert_eq!(spans, [0..18, 18..25]);
+        assert_eq!(words(&doc), ["echo", "ls"]);
+    }
+
+    #[test]
+    fn test_empty_document() {
+        setup();
+        let mut doc = IncrementalDocument::new("").unwrap();
+        assert!(doc.is_empty());
+
+        assert_eq!(doc.edit(0..0, "pwd").unwrap(), 0..1);
+        assert_eq!(words(&doc), ["pwd"]);
+    }
+
+    #[test]
+    fn test_edit_reparses_only_touched_command() {
+        setup();
+        let mut doc = IncrementalDocument::new("echo one\necho two\necho three\n").unwrap();
+
+        assert_eq!(doc.edit(9..13, "cat").unwrap(), 1..2);
+        assert_eq!(doc.text(), "echo one\ncat two\necho three\n");
+        assert_eq!(words(&doc), ["echo", "cat", "echo"]);
+        assert_consistent(&doc);
+    }
+
+    #[test]
+    fn test_new_lines_shift_later_commands() {
+        setup();
+        let mut doc = IncrementalDocument::new("a\nfor i in x; do\n  b\ndone\nc\n").unwrap();
+
+        assert_eq!(doc.edit(2..2, "x=1\ny=2\n").unwrap(), 1..4);
+        assert_eq!(doc.len(), 5);
+        assert!(matches!(
+            doc.commands().nth(3),
+            Some(Command::For { line: Some(4), .. })
+        ));
+        assert_consistent(&doc);
+
+        doc.edit(2..10, "").unwrap();
+        assert_consistent(&doc);
+    }
+
+    #[test]
+    fn test_joining_and_splitting_lines() {
+        setup();
+        let mut doc = IncrementalDocument::new("echo a\necho b\n").unwrap();
+
+        // Deleting the newline makes one command of two
+        doc.edit(6..7, " ").unwrap();
+        assert_eq!(doc.len(), 1);
+        assert_consistent(&doc);
+
+        doc.edit(6..7, "\n").unwrap();
+        assert_eq!(doc.len(), 2);
+        assert_consistent(&doc);
+
+        // So does a line continuation
+        doc.edit(6..6, " \\").unwrap();
+        assert_eq!(doc.len(), 1);
+        assert_consistent(&doc);
+    }
+
+    #[test]
+    fn test_append_to_last_line_without_newline() {
+        setup();
+        let mut doc = IncrementalDocument::new("echo a\necho b").unwrap();
+
+        assert_eq!(doc.edit(13..13, " c").unwrap(), 1..2);
+        assert_consistent(&doc);
+    }
+
+    #[test]
+    fn test_unbalanced_edit_breaks_and_recovers() {
+        setup();
+        let mut doc = IncrementalDocument::new("echo a\necho b\n").unwrap();
+
+        assert!(matches!(
+            doc.edit(0..0, "if true; then\n"),
+            Err(ParseError::SyntaxError(_))
+        ));
+        assert!(doc.is_broken());
+        assert!(doc.is_empty());
+
+        let end = doc.text().len();
+        assert_eq!(doc.edit(end..end, "fi\n").unwrap(), 0..1);
+        assert!(!doc.is_broken());
+        assert!(matches!(doc.commands().next(), Some(Command::If { .. })));
+    }
+
+    #[test]
+    fn test_heredoc_falls_back_to_full_parse() {
+        setup();
+        let mut doc = IncrementalDocument::new("cat <<EOF\nbody\nEOF\necho after\n").unwrap();
+
+        // Removing the delimiter turns the rest of the text into the body
+        assert_eq!(doc.edit(15..18, "END").unwrap(), 0..1);
+        assert_eq!(doc.len(), 1);
+        assert_consistent(&doc);
+
+        assert_eq!(doc.edit(15..18, "EOF").unwrap(), 0..2);
+        assert_consistent(&doc);
+    }
+
+    #[test]
+    fn test_typing_session_matches_full_parse() {
+        setup();
+        let mut doc =
+            IncrementalDocument::new("x=1\nif [ $x ]; then\n  echo yes\nfi\necho done\n").unwrap();
+
+        // Open a line in the if body and type into it one keystroke at a
+        // time, then delete it again
+        doc.edit(30..30, "\n").unwrap();
+        let line = "  grep -c x log";
+        let at = 31;
+        for (i, c) in line.char_indices() {
+            doc.edit(at + i..at + i, &c.to_string()).unwrap();
+            assert_consistent(&doc);
+        }
+        for i in (0..=line.len()).rev() {
+            doc.edit(at + i - 1..at + i, "").unwrap();
+            assert_consistent(&doc);
+        }
+        assert_eq!(
+            doc.text(),
+            "x=1\nif [ $x ]; then\n  echo yes\nfi\necho done\n"
+        );
+    }
+}
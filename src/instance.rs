@@ -0,0 +1,314 @@
+//! Independent in-process parser instances
+//!
+//! The statically linked parser has a single copy of bash's globals, so only
+//! one parse can run at a time per process. On Linux, build.rs also links the
+//! parser into a shared object (`libbash_parser.so`). Loading that with
+//! `dlmopen(LM_ID_NEWLM, ...)` puts it in a fresh link-map namespace with its
+//! own copy of every global, including its own libc, so each loaded copy is
+//! a fully independent parser.
+//!
+//! A [`ParserInstance`] owns one such namespace. It is `Send` but not `Sync`:
+//! move one into each thread to parse in parallel without forking.
+//!
+//! glibc supports 16 link-map namespaces per process, one of which is the
+//! main program, so at most 15 instances can be alive at once.
+
+use crate::bash_init::PARSER_GLOBALS;
+use crate::{ffi, parse_with, Command, ParseError, ParseLimits, ParserApi, SyntaxErrorFn};
+use std::cell::Cell;
+use std::ffi::{c_char, c_int, c_long, c_void, CStr, CString};
+use std::io;
+use std::marker::PhantomData;
+use std::ptr::NonNull;
+
+/// Runtime override for the location of the shared parser library
+pub const PARSER_SO_ENV: &str = "BASH_AST_PARSER_SO";
+
+const LM_ID_NEWLM: c_long = -1;
+const RTLD_NOW: c_int = 2;
+
+#[link(name = "dl")]
+extern "C" {
+    fn dlmopen(lmid: c_long, filename: *const c_char, flags: c_int) -> *mut c_void;
+    fn dlsym(handle: *mut c_void, symbol: *const c_char) -> *mut c_void;
+    fn dlclose(handle: *mut c_void) -> c_int;
+    fn dlerror() -> *mut c_char;
+}
+
+/// An independent copy of the bash parser, loaded in its own namespace
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::ParserInstance;
+/// use std::thread;
+///
+/// let handles: Vec<_> = (0..4)
+///     .map(|i| {
+///         let mut parser = ParserInstance::new().unwrap();
+///         thread::spawn(move || parser.parse(&format!("echo {i}")).unwrap())
+///     })
+///     .collect();
+///
+/// for handle in handles {
+///     handle.join().unwrap();
+/// }
+/// ```
+pub struct ParserInstance {
+    handle: NonNull<c_void>,
+    api: ParserApi,
+    /// Bash's globals may only be touched by one thread at a time
+    _not_sync: PhantomData<Cell<()>>,
+}
+
+// SAFETY: the namespace's state is only reached through this handle, and
+// `Cell` keeps it from being shared between threads
+unsafe impl Send for ParserInstance {}
+
+impl ParserInstance {
+    /// Load a new parser instance
+    ///
+    /// Uses the shared object named by `BASH_AST_PARSER_SO` if set, otherwise
+    /// the one build.rs produced.
+    ///
+    /// # Errors
+    ///
+    /// Fails if the shared object is missing or cannot be loaded (including
+    /// when all link-map namespaces are in use).
+    pub fn new() -> io::Result<Self> {
+        let path = std::env::var_os(PARSER_SO_ENV)
+            .map(std::path::PathBuf::from)
+            .or_else(|| option_env!("BASH_AST_PARSER_SO").map(Into::into))
+            .ok_or_else(|| {
+                io::Error::new(
+                    io::ErrorKind::NotFound,
+                    "shared parser library was not built; set BASH_AST_PARSER_SO",
+                )
+            })?;
+        Self::load(&path)
+    }
+
+    /// Load a new parser instance from a specific shared object
+    ///
+    /// # Errors
+    ///
+    /// Fails if the shared object cannot be loaded or lacks the parser
+    /// entry points.
+    pub fn load(path: &std::path::Path) -> io::Result<Self> {
+        use std::os::unix::ffi::OsStrExt;
+
+        let path = CString::new(path.as_os_str().as_bytes())?;
+
+        // SAFETY: path is a valid C string; dlmopen reports failure as NULL
+        let handle = NonNull::new(unsafe { dlmopen(LM_ID_NEWLM, path.as_ptr(), RTLD_NOW) })
+            .ok_or_else(last_dl_error)?;
+
+        // SAFETY: handle was just opened and nothing else uses it yet
+        match unsafe { resolve(handle) } {
+            Ok(api) => Ok(Self {
+                handle,
+                api,
+                _not_sync: PhantomData,
+            }),
+            Err(err) => {
+                // SAFETY: handle is live and owned by nobody else
+                unsafe {
+                    dlclose(handle.as_ptr());
+                }
+                Err(err)
+            }
+        }
+    }
+
+    /// Parse a bash script with this instance
+    ///
+    /// Behaves exactly like [`crate::parse()`], but only touches this
+    /// instance's copy of the parser, so it can run concurrently with other
+    /// instances and with `parse()` itself.
+    ///
+    /// # Errors
+    ///
+    /// Returns the same errors as [`crate::parse()`].
+    pub fn parse(&mut self, script: &str) -> Result<Command, ParseError> {
+        self.parse_with_limits(script, &ParseLimits::default())
+    }
+
+    /// Parse a bash script with this instance and a custom resource budget
+    ///
+    /// Behaves exactly like [`crate::parse_with_limits()`], on this
+    /// instance's copy of the parser.
+    ///
+    /// # Errors
+    ///
+    /// Returns the same errors as [`crate::parse_with_limits()`].
+    pub fn parse_with_limits(
+        &mut self,
+        script: &str,
+        limits: &ParseLimits,
+    ) -> Result<Command, ParseError> {
+        // SAFETY: &mut self plus !Sync guarantees exclusive use of this
+        // namespace, which was initialized in load()
+        unsafe { parse_with(&self.api, script, limits) }
+    }
+}
+
+impl Drop for ParserInstance {
+    fn drop(&mut self) {
+        // SAFETY: no pointers into the namespace outlive the instance; parse
+        // results are converted to owned Rust values before returning
+        unsafe {
+            dlclose(self.handle.as_ptr());
+        }
+    }
+}
+
+/// Look up the parser entry points in a freshly loaded namespace and apply
+/// the same global setup that `init()` performs for the linked parser
+///
+/// # Safety
+///
+/// `handle` must be a live `dlmopen` handle for a bash-ast parser library.
+unsafe fn resolve(handle: NonNull<c_void>) -> io::Result<ParserApi> {
+    let symbol = |name: &CStr| {
+        let sym = dlsym(handle.as_ptr(), name.as_ptr());
+        if sym.is_null() {
+            Err(last_dl_error())
+        } else {
+            Ok(sym)
+        }
+    };
+
+    // The symbols come from our own safe_parse.c and bash objects, so they
+    // have exactly these signatures
+    let api = ParserApi {
+        parse_buffer: std::mem::transmute::<
+            *mut c_void,
+            unsafe extern "C" fn(*const c_char, usize) -> *mut ffi::COMMAND,
+        >(symbol(c"safe_parse_buffer")?),
+        input_had_nul: std::mem::transmute::<*mut c_void, unsafe extern "C" fn() -> c_int>(symbol(
+            c"safe_parse_input_had_nul",
+        )?),
+        syntax_error: std::mem::transmute::<*mut c_void, SyntaxErrorFn>(symbol(
+            c"safe_parse_error",
+        )?),
+        dispose_command: std::mem::transmute::<*mut c_void, unsafe extern "C" fn(*mut ffi::COMMAND)>(
+            symbol(c"dispose_command")?,
+        ),
+        set_budget: std::mem::transmute::<*mut c_void, unsafe extern "C" fn(usize, u64)>(symbol(
+            c"safe_parse_set_budget",
+        )?),
+        budget_exceeded: std::mem::transmute::<*mut c_void, unsafe extern "C" fn() -> c_int>(
+            symbol(c"safe_parse_budget_exceeded")?,
+        ),
+        set_cancel: std::mem::transmute::<*mut c_void, unsafe extern "C" fn(*const c_int)>(symbol(
+            c"safe_parse_set_cancel",
+        )?),
+    };
+
+    for (name, value) in PARSER_GLOBALS {
+        let name = CString::new(name)?;
+        symbol(&name)?.cast::<c_int>().write(value);
+    }
+
+    Ok(api)
+}
+
+fn last_dl_error() -> io::Error {
+    // SAFETY: dlerror returns NULL or a valid C string
+    let message = unsafe {
+        let err = dlerror();
+        if err.is_null() {
+            "unknown dynamic loader error".to_string()
+        } else {
+            CStr::from_ptr(err).to_string_lossy().into_owned()
+        }
+    };
+    io::Error::other(message)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::thread;
+
+    /// Instances need the shared object, which is only built when the bash
+    /// objects are position independent; build.rs sets `bash_ast_parser_so`
+    /// when it is, and the tests that load it are ignored otherwise
+    fn instance() -> ParserInstance {
+        ParserInstance::new().expect("failed to load the shared parser library")
+    }
+
+    #[test]
+    #[cfg_attr(not(bash_ast_parser_so), ignore = "libbash_parser.so was not built")]
+    fn test_instance_parses_script() {
+        let mut parser = instance();
+        let cmd = parser.parse("echo hello world").unwrap();
+
+        if let Command::Simple { words, .. } = cmd {
+            assert_eq!(words.len(), 3);
+            assert_eq!(words[0].word, "echo");
+        } else {
+            panic!("Expected Simple command");
+        }
+    }
+
+    #[test]
+    #[cfg_attr(not(bash_ast_parser_so), ignore = "libbash_parser.so was not built")]
+    fn test_instance_reports_errors() {
+        let mut parser = instance();
+
+        assert!(matches!(
+            parser.parse("if then fi"),
+            Err(ParseError::SyntaxError(_))
+        ));
+        assert!(matches!(parser.parse(""), Err(ParseError::EmptyInput)));
+        assert!(parser.parse("echo ok").is_ok());
+    }
+
+    #[test]
+    #[cfg_attr(not(bash_ast_parser_so), ignore = "libbash_parser.so was not built")]
+    fn test_instance_applies_limits() {
+        let mut parser = instance();
+        let limits = ParseLimits::default().with_max_script_size(8);
+        assert!(matches!(
+            parser.parse_with_limits("echo hello", &limits),
+            Err(ParseError::InputTooLarge)
+        ));
+        let limits = ParseLimits::default().with_max_nodes(2);
+        assert!(matches!(
+            parser.parse_with_limits("echo a | cat | wc", &limits),
+            Err(ParseError::LimitExceeded(crate::Limit::Nodes))
+        ));
+        assert!(parser.parse("echo a | cat | wc").is_ok());
+    }
+
+    #[test]
+    #[cfg_attr(not(bash_ast_parser_so), ignore = "libbash_parser.so was not built")]
+    fn test_instances_parse_in_parallel() {
+        let handles: Vec<_> = (0..4)
+            .map(|_| instance())
+            .enumerate()
+            .map(|(t, mut parser)| {
+                thread::spawn(move || {
+                    for i in 0..50 {
+                        let script = format!("for x in t{t} i{i}; do echo $x; done");
+                        let Command::For { words, .. } = parser.parse(&script).unwrap() else {
+                            panic!("Expected For command");
+                        };
+                        assert_eq!(words.unwrap()[0], format!("t{t}"));
+                    }
+                })
+            })
+            .collect();
+
+        for handle in handles {
+            handle.join().unwrap();
+        }
+    }
+
+    #[test]
+    fn test_load_missing_library() {
+        let err = ParserInstance::load(std::path::Path::new("/nonexistent/libbash_parser.so"));
+        assert!(err.is_err());
+    }
+}
@@ -0,0 +1,309 @@
+//! Shared strings for words, names and patterns
+//!
+//! A handful of strings - `echo`, `"$@"`, `-f`, `$HOME` - make up most of
+//! the words in any corpus of scripts. The AST keeps them as [`Symbol`]s,
+//! reference-counted strings, and an [`Interner`] hands out one `Symbol`
+//! per distinct text. Every AST converted through the same interner then
+//! shares one allocation per string, however many scripts it keeps.
+
+use schemars::JsonSchema;
+use serde::{Deserialize, Serialize};
+use std::borrow::{Borrow, Cow};
+use std::collections::HashSet;
+use std::fmt;
+use std::ops::Deref;
+use std::sync::Arc;
+
+/// An immutable, cheaply cloned string
+///
+/// Serializes as a plain JSON string and compares equal to `str` and
+/// `String`, so most code can treat it as a string.
+#[derive(Clone, PartialEq, Eq, PartialOrd, Ord, Hash, Serialize, Deserialize, JsonSchema)]
+#[serde(transparent)]
+pub struct Symbol(#[schemars(with = "String")] Arc<str>);
+
+impl Symbol {
+    /// The text of the symbol
+    #[must_use]
+    pub fn as_str(&self) -> &str {
+        &self.0
+    }
+
+    /// Whether both symbols share one allocation, as symbols from the same
+    /// interner do
+    #[must_use]
+    pub fn ptr_eq(this: &Self, other: &Self) -> bool {
+        Arc::ptr_eq(&this.0, &other.0)
+    }
+}
+
+impl Default for Symbol {
+    fn default() -> Self {
+        Self::from("")
+    }
+}
+
+impl Deref for Symbol {
+    type Target = str;
+
+    fn deref(&self) -> &str {
+        &self.0
+    }
+}
+
+impl AsRef<str> for Symbol {
+    fn as_ref(&self) -> &str {
+        &self.0
+    }
+}
+
+impl Borrow<str> for Symbol {
+    fn borrow(&self) -> &str {
+        &self.0
+    }
+}
+
+impl fmt::Debug for Symbol {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        self.as_str().fmt(f)
+    }
+}
+
+impl fmt::Display for Symbol {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        self.as_str().fmt(f)
+    }
+}
+
+impl From<&str> for Symbol {
+    fn from(text: &str) -> Self {
+        Self(Arc::from(text))
+    }
+}
+
+impl From<String> for Symbol {
+    fn from(text: String) -> Self {
+        Self(Arc::from(text))
+    }
+}
+
+impl From<Cow<'_, str>> for Symbol {
+    fn from(text: Cow<'_, str>) -> Self {
+        Self(Arc::from(text))
+    }
+}
+
+impl From<Symbol> for String {
+    fn from(symbol: Symbol) -> Self {
+        symbol.as_str().to_string()
+    }
+}
+
+impl PartialEq<str> for Symbol {
+    fn eq(&self, other: &str) -> bool {
+        self.as_str() == other
+    }
+}
+
+impl PartialEq<&str> for Symbol {
+    fn eq(&self, other: &&str) -> bool {
+        self.as_str() == *other
+    }
+}
+
+impl PartialEq<String> for Symbol {
+    fn eq(&self, other: &String) -> bool {
+        self.as_str() == other
+    }
+}
+
+impl PartialEq<Symbol> for str {
+    fn eq(&self, other: &Symbol) -> bool {
+        self == other.as_str()
+    }
+}
+
+impl PartialEq<Symbol> for &str {
+    fn eq(&self, other: &Symbol) -> bool {
+        *self == other.as_str()
+    }
+}
+
+impl PartialEq<Symbol> for String {
+    fn eq(&self, other: &Symbol) -> bool {
+        self == other.as_str()
+    }
+}
+
+/// A table of [`Symbol`]s, one per distinct text
+///
+/// Pass the same interner to every parse whose results are kept together,
+/// for example with [`parse_interned()`](crate::parse_interned). Symbols stay
+/// in the table until [`release_unused()`](Self::release_unused) or
+/// [`clear()`](Self::clear), so a long-lived interner keeps the strings of
+/// scripts that have already been dropped.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_interned, Interner, ParseLimits};
+///
+/// init();
+///
+/// let mut interner = Interner::new();
+/// let limits = ParseLimits::default();
+/// let scripts: Vec<_> = ["echo one", "echo two"]
+///     .iter()
+///     .map(|script| parse_interned(script, &limits, &mut interner).unwrap())
+///     .collect();
+///
+/// // Both `echo`s share one string
+/// let stats = interner.stats();
+/// assert_eq!((stats.lookups, stats.hits), (4, 1));
+/// # drop(scripts);
+/// ```
+#[derive(Debug, Default)]
+pub struct Interner {
+    table: HashSet<Symbol>,
+    lookups: u64,
+    hits: u64,
+}
+
+/// How well an [`Interner`] has been doing
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct InternStats {
+    /// Strings looked up
+    pub lookups: u64,
+    /// Lookups that found their string already in the table
+    pub hits: u64,
+    /// Distinct strings in the table
+    pub symbols: usize,
+    /// Total length of the strings in the table
+    pub bytes: usize,
+}
+
+impl InternStats {
+    /// Fraction of lookups that were hits, from 0 to 1
+    #[must_use]
+    #[allow(clippy::cast_precision_loss)] // Counts stay far below 2^52
+    pub fn hit_rate(&self) -> f64 {
+        if self.lookups == 0 {
+            0.0
+        } else {
+            self.hits as f64 / self.lookups as f64
+        }
+    }
+}
+
+impl Interner {
+    /// Create an empty interner
+    #[must_use]
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The symbol for `text`, adding it to the table if needed
+    pub fn intern(&mut self, text: &str) -> Symbol {
+        self.lookups += 1;
+        if let Some(symbol) = self.table.get(text) {
+            self.hits += 1;
+            return symbol.clone();
+        }
+        let symbol = Symbol::from(text);
+        self.table.insert(symbol.clone());
+        symbol
+    }
+
+    /// Lookup counts and table size
+    #[must_use]
+    pub fn stats(&self) -> InternStats {
+        InternStats {
+            lookups: self.lookups,
+            hits: self.hits,
+            symbols: self.table.len(),
+            bytes: self.table.iter().map(|symbol| symbol.len()).sum(),
+        }
+    }
+
+    /// Number of distinct strings in the table
+    #[must_use]
+    pub fn len(&self) -> usize {
+        self.table.len()
+    }
+
+    /// Whether the table is empty
+    #[must_use]
+    pub fn is_empty(&self) -> bool {
+        self.table.is_empty()
+    }
+
+    /// Drop the strings that only the table still holds
+    ///
+    /// Returns how many were dropped. Symbols in live ASTs are kept.
+    pub fn release_unused(&mut self) -> usize {
+        let before = self.table.len();
+        self.table.retain(|symbol| Arc::strong_count(&symbol.0) > 1);
+        before - self.table.len()
+    }
+
+    /// Empty the table and reset the counts
+    ///
+    /// Symbols already handed out stay valid, but are no longer shared
+    /// with later ones.
+    pub fn clear(&mut self) {
+        self.table.clear();
+        self.lookups = 0;
+        self.hits = 0;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_intern_shares_strings() {
+        let mut interner = Interner::new();
+        let a = interner.intern("echo");
+        let b = interner.intern("echo");
+        let c = interner.intern("grep");
+
+        assert!(Symbol::ptr_eq(&a, &b));
+        assert!(!Symbol::ptr_eq(&a, &c));
+        assert_eq!(
+            interner.stats(),
+            InternStats {
+                lookups: 3,
+                hits: 1,
+                symbols: 2,
+                bytes: 8,
+            }
+        );
+        assert!((interner.stats().hit_rate() - 1.0 / 3.0).abs() < f64::EPSILON);
+    }
+
+    #[test]
+    fn test_release_unused() {
+        let mut interner = Interner::new();
+        let kept = interner.intern("kept");
+        interner.intern("dropped");
+
+        assert_eq!(interner.release_unused(), 1);
+        assert_eq!(interner.len(), 1);
+        assert!(Symbol::ptr_eq(&kept, &interner.intern("kept")));
+    }
+
+    #[test]
+    fn test_symbol_is_a_string() {
+        let symbol = Symbol::from("$HOME");
+        assert_eq!(symbol, "$HOME");
+        assert_eq!("$HOME", symbol);
+        assert_eq!(symbol.len(), 5);
+        assert_eq!(format!("{symbol} {symbol:?}"), r#"$HOME "$HOME""#);
+
+        let json = serde_json::to_string(&symbol).unwrap();
+        assert_eq!(json, r#""$HOME""#);
+        let back: Symbol = serde_json::from_str(&json).unwrap();
+        assert_eq!(back, symbol);
+    }
+}
@@ -0,0 +1,1858 @@
+//! JSON serialization of `Command` without recursion
+//!
+//! serde's derived implementations recurse once per level of nesting, which
+//! overflows the stack on deep trees, and `serde_json` refuses input nested
+//! more than 128 levels deep. The functions here walk the AST and the JSON
+//! with explicit stacks instead, so depth is limited only by
+//! `ParseLimits::max_depth` when reading, and not at all when writing.
+//!
+//! The JSON is the same as `serde_json` gives and accepts for `Command`:
+//! the writer's output is byte-identical, and the reader follows the same
+//! field rules. Fields that hold no commands (redirects, names, words
+//! without substitutions and so on) go through serde as usual.
+
+use crate::ast::sealed::Dismantle;
+use crate::ast::{
+    CaseClause, CaseClauseFlags, Command, ConditionalExpr, ListOp, Nested, Redirect, Span, Word,
+};
+use crate::{ParseLimits, Symbol};
+use serde::de::{DeserializeOwned, Error as _, Unexpected};
+use serde::Serialize;
+use serde_json::ser::{CompactFormatter, Formatter};
+use std::borrow::Cow;
+use std::io;
+
+/// Write a command as JSON
+///
+/// The output is byte-for-byte what `serde_json::to_writer` (or
+/// `to_writer_pretty`) gives, but the AST may nest to any depth.
+///
+/// # Errors
+///
+/// Returns an error if `writer` fails.
+pub fn write_json<W: io::Write>(cmd: &Command, pretty: bool, writer: W) -> serde_json::Result<()> {
+    let result = if pretty {
+        Emitter::new(writer, Pretty::default()).write(cmd)
+    } else {
+        Emitter::new(writer, CompactFormatter).write(cmd)
+    };
+    result.map_err(serde_json::Error::io)
+}
+
+/// Convert a command to a JSON string
+///
+/// See [`write_json()`].
+#[must_use]
+pub fn to_json(cmd: &Command, pretty: bool) -> String {
+    let mut json = Vec::new();
+    write_json(cmd, pretty, &mut json).expect("writing to a Vec cannot fail");
+    String::from_utf8(json).expect("serde_json writes UTF-8")
+}
+
+/// Read a command from JSON, nested at most `MAX_DEPTH` levels deep
+///
+/// Accepts what `serde_json::from_str::<Command>` accepts, but without its
+/// limit of 128 levels of nesting.
+///
+/// # Errors
+///
+/// Returns an error if `json` is not valid JSON, does not describe a
+/// command, or nests deeper than `MAX_DEPTH`.
+pub fn from_json(json: &str) -> serde_json::Result<Command> {
+    from_json_with_limits(json, &ParseLimits::default())
+}
+
+/// Read a command from JSON, nested at most `limits.max_depth` levels deep
+///
+/// Depth is counted as [`parse_with_limits()`](crate::parse_with_limits)
+/// counts it, except that the `not` expressions and one-command pipelines
+/// that `!` becomes are a level of their own here. The other limits don't
+/// apply.
+///
+/// # Errors
+///
+/// As [`from_json()`], with `limits.max_depth` as the deepest nesting.
+pub fn from_json_with_limits(json: &str, limits: &ParseLimits) -> serde_json::Result<Command> {
+    let doc = Document::parse(json)?;
+    Builder {
+        doc: &doc,
+        max_depth: limits.max_depth,
+    }
+    .build()
+}
+
+// ---------------------------------------------------------------------------
+// Writing
+// ---------------------------------------------------------------------------
+
+/// `serde_json`'s `PrettyFormatter`, copied so that a field's value can be
+/// written by a separate serializer that starts at the current indentation
+#[derive(Clone, Default)]
+struct Pretty {
+    current_indent: usize,
+    has_value: bool,
+}
+
+impl Pretty {
+    fn indent<W: ?Sized + io::Write>(&self, writer: &mut W) -> io::Result<()> {
+        for _ in 0..self.current_indent {
+            writer.write_all(b"  ")?;
+        }
+        Ok(())
+    }
+}
+
+impl Formatter for Pretty {
+    fn begin_array<W: ?Sized + io::Write>(&mut self, writer: &mut W) -> io::Result<()> {
+        self.current_indent += 1;
+        self.has_value = false;
+        writer.write_all(b"[")
+    }
+
+    fn end_array<W: ?Sized + io::Write>(&mut self, writer: &mut W) -> io::Result<()> {
+        self.current_indent -= 1;
+        if self.has_value {
+            writer.write_all(b"\n")?;
+            self.indent(writer)?;
+        }
+        writer.write_all(b"]")
+    }
+
+    fn begin_array_value<W: ?Sized + io::Write>(
+        &mut self,
+        writer: &mut W,
+        first: bool,
+    ) -> io::Result<()> {
+        writer.write_all(if first { b"\n" } else { b",\n" })?;
+        self.indent(writer)
+    }
+
+    fn end_array_value<W: ?Sized + io::Write>(&mut self, _writer: &mut W) -> io::Result<()> {
+        self.has_value = true;
+        Ok(())
+    }
+
+    fn begin_object<W: ?Sized + io::Write>(&mut self, writer: &mut W) -> io::Result<()> {
+        self.current_indent += 1;
+        self.has_value = false;
+        writer.write_all(b"{")
+    }
+
+    fn end_object<W: ?Sized + io::Write>(&mut self, writer: &mut W) -> io::Result<()> {
+        self.current_indent -= 1;
+        if self.has_value {
+            writer.write_all(b"\n")?;
+            self.indent(writer)?;
+        }
+        writer.write_all(b"}")
+    }
+
+    fn begin_object_key<W: ?Sized + io::Write>(
+        &mut self,
+        writer: &mut W,
+        first: bool,
+    ) -> io::Result<()> {
+        writer.write_all(if first { b"\n" } else { b",\n" })?;
+        self.indent(writer)
+    }
+
+    fn begin_object_value<W: ?Sized + io::Write>(&mut self, writer: &mut W) -> io::Result<()> {
+        writer.write_all(b": ")
+    }
+
+    fn end_object_value<W: ?Sized + io::Write>(&mut self, _writer: &mut W) -> io::Result<()> {
+        self.has_value = true;
+        Ok(())
+    }
+}
+
+/// A value still to be written
+#[derive(Clone, Copy)]
+enum Value<'a> {
+    Command(&'a Command),
+    Commands(&'a [Command]),
+    Item(&'a (Command, ListOp)),
+    Items(&'a [(Command, ListOp)]),
+    Clause(&'a CaseClause),
+    Clauses(&'a [CaseClause]),
+    Cond(&'a ConditionalExpr),
+    Null,
+    True,
+    Line(u32),
+    Span(Span),
+    Str(&'a str),
+    Op(ListOp),
+    Words(&'a [Word]),
+    Word(&'a Word),
+    Symbols(&'a [Symbol]),
+    Strings(&'a [String]),
+    Redirects(&'a [Redirect]),
+    Flags(&'a CaseClauseFlags),
+}
+
+/// A piece of JSON still to be written
+#[derive(Clone, Copy)]
+enum Step<'a> {
+    /// A field of the object being written, after its first
+    Field(&'static str, Value<'a>),
+    /// An element of the array being written, and whether it is the first
+    Element(bool, Value<'a>),
+    /// The end of a field's value
+    EndField,
+    /// The end of an element
+    EndElement,
+    EndObject,
+    EndArray,
+}
+
+/// Writes JSON by taking steps off a stack
+///
+/// Each value writes its start straight away and plans the rest as further
+/// steps, which are pushed in reverse so the first is taken next.
+struct Emitter<W, F> {
+    writer: W,
+    formatter: F,
+}
+
+impl<W: io::Write, F: Formatter + Clone> Emitter<W, F> {
+    const fn new(writer: W, formatter: F) -> Self {
+        Self { writer, formatter }
+    }
+
+    fn write(&mut self, cmd: &Command) -> io::Result<()> {
+        let mut steps = Vec::new();
+        self.command(cmd, &mut steps)?;
+        steps.reverse();
+
+        let mut plan = Vec::new();
+        while let Some(step) = steps.pop() {
+            match step {
+                Step::Field(key, value) => {
+                    self.key(false, key)?;
+                    self.value(value, &mut plan)?;
+                    plan.push(Step::EndField);
+                }
+                Step::Element(first, value) => {
+                    self.formatter.begin_array_value(&mut self.writer, first)?;
+                    self.value(value, &mut plan)?;
+                    plan.push(Step::EndElement);
+                }
+                Step::EndField => self.formatter.end_object_value(&mut self.writer)?,
+                Step::EndElement => self.formatter.end_array_value(&mut self.writer)?,
+                Step::EndObject => self.formatter.end_object(&mut self.writer)?,
+                Step::EndArray => self.formatter.end_array(&mut self.writer)?,
+            }
+            plan.reverse();
+            steps.append(&mut plan);
+        }
+        Ok(())
+    }
+
+    /// Write an object key, up to its value
+    fn key(&mut self, first: bool, key: &str) -> io::Result<()> {
+        let (writer, formatter) = (&mut self.writer, &mut self.formatter);
+        formatter.begin_object_key(writer, first)?;
+        formatter.begin_string(writer)?;
+        formatter.write_string_fragment(writer, key)?;
+        formatter.end_string(writer)?;
+        formatter.begin_object_value(writer)
+    }
+
+    /// Write the first field of an object, which holds no commands
+    fn first_field<T: Serialize + ?Sized>(&mut self, key: &str, value: &T) -> io::Result<()> {
+        self.formatter.begin_object(&mut self.writer)?;
+        self.key(true, key)?;
+        self.leaf(value)?;
+        self.formatter.end_object_value(&mut self.writer)
+    }
+
+    /// Write a value that holds no commands through serde
+    fn leaf<T: Serialize + ?Sized>(&mut self, value: &T) -> io::Result<()> {
+        let mut serializer =
+            serde_json::Serializer::with_formatter(&mut self.writer, self.formatter.clone());
+        value.serialize(&mut serializer).map_err(io::Error::from)
+    }
+
+    fn value<'a>(&mut self, value: Value<'a>, plan: &mut Vec<Step<'a>>) -> io::Result<()> {
+        match value {
+            Value::Command(cmd) => self.command(cmd, plan),
+            Value::Commands(commands) => {
+                self.formatter.begin_array(&mut self.writer)?;
+                plan.extend(
+                    commands
+                        .iter()
+                        .enumerate()
+                        .map(|(i, cmd)| Step::Element(i == 0, Value::Command(cmd))),
+                );
+                plan.push(Step::EndArray);
+                Ok(())
+            }
+            Value::Item((cmd, op)) => {
+                self.formatter.begin_array(&mut self.writer)?;
+                plan.extend([
+                    Step::Element(true, Value::Command(cmd)),
+                    Step::Element(false, Value::Op(*op)),
+                    Step::EndArray,
+                ]);
+                Ok(())
+            }
+            Value::Items(items) => {
+                self.formatter.begin_array(&mut self.writer)?;
+                plan.extend(
+                    items
+                        .iter()
+                        .enumerate()
+                        .map(|(i, item)| Step::Element(i == 0, Value::Item(item))),
+                );
+                plan.push(Step::EndArray);
+                Ok(())
+            }
+            Value::Clause(clause) => {
+                self.first_field("patterns", &clause.patterns)?;
+                let action = clause.action.as_deref().map_or(Value::Null, Value::Command);
+                plan.push(Step::Field("action", action));
+                if let Some(flags) = &clause.flags {
+                    plan.push(Step::Field("flags", Value::Flags(flags)));
+                }
+                plan.push(Step::EndObject);
+                Ok(())
+            }
+            Value::Clauses(clauses) => {
+                self.formatter.begin_array(&mut self.writer)?;
+                plan.extend(
+                    clauses
+                        .iter()
+                        .enumerate()
+                        .map(|(i, clause)| Step::Element(i == 0, Value::Clause(clause))),
+                );
+                plan.push(Step::EndArray);
+                Ok(())
+            }
+            Value::Cond(expr) => self.cond(expr, plan),
+            Value::Null => self.leaf(&()),
+            Value::True => self.leaf(&true),
+            Value::Line(line) => self.leaf(&line),
+            Value::Span(span) => self.leaf(&span),
+            Value::Str(text) => self.leaf(text),
+            Value::Op(op) => self.leaf(&op),
+            // Words written in full unless they hold commands
+            Value::Words(words) if words.iter().all(|w| w.substitutions.is_empty()) => {
+                self.leaf(words)
+            }
+            Value::Words(words) => {
+                self.formatter.begin_array(&mut self.writer)?;
+                plan.extend(
+                    words
+                        .iter()
+                        .enumerate()
+                        .map(|(i, word)| Step::Element(i == 0, Value::Word(word))),
+                );
+                plan.push(Step::EndArray);
+                Ok(())
+            }
+            Value::Word(word) if word.substitutions.is_empty() => self.leaf(word),
+            Value::Word(word) => {
+                self.first_field("word", &word.word)?;
+                if word.flags != 0 {
+                    self.key(false, "flags")?;
+                    self.leaf(&word.flags)?;
+                    self.formatter.end_object_value(&mut self.writer)?;
+                }
+                plan.push(Step::Field(
+                    "substitutions",
+                    Value::Commands(&word.substitutions),
+                ));
+                if let Some(&span) = word.span.as_deref() {
+                    plan.push(Step::Field("span", Value::Span(span)));
+                }
+                plan.push(Step::EndObject);
+                Ok(())
+            }
+            Value::Symbols(symbols) => self.leaf(symbols),
+            Value::Strings(strings) => self.leaf(strings),
+            Value::Redirects(redirects) => self.leaf(redirects),
+            Value::Flags(flags) => self.leaf(flags),
+        }
+    }
+
+    /// Write a command's tag and plan its other fields, in the order and
+    /// with the skip rules of `Command`'s serde attributes
+    #[allow(clippy::too_many_lines)] // One arm per command type
+    fn command<'a>(&mut self, cmd: &'a Command, plan: &mut Vec<Step<'a>>) -> io::Result<()> {
+        let field = Step::Field;
+        let push_redirects = |plan: &mut Vec<Step<'a>>, redirects: &'a [Redirect]| {
+            if !redirects.is_empty() {
+                plan.push(field("redirects", Value::Redirects(redirects)));
+            }
+        };
+
+        self.first_field("type", command_tag(cmd))?;
+        if let Some(line) = cmd.line() {
+            plan.push(field("line", Value::Line(line)));
+        }
+        if let Some(span) = cmd.span() {
+            plan.push(field("span", Value::Span(span)));
+        }
+        match cmd {
+            Command::Simple {
+                words,
+                redirects,
+                assignments,
+                ..
+            } => {
+                plan.extend([
+                    field("words", Value::Words(words)),
+                    field("redirects", Value::Redirects(redirects)),
+                ]);
+                if let Some(assignments) = assignments {
+                    plan.push(field("assignments", Value::Strings(assignments)));
+                }
+            }
+            Command::Pipeline {
+                commands, negated, ..
+            } => {
+                plan.push(field("commands", Value::Commands(commands)));
+                if *negated {
+                    plan.push(field("negated", Value::True));
+                }
+            }
+            Command::List {
+                op, left, right, ..
+            } => plan.extend([
+                field("op", Value::Op(*op)),
+                field("left", Value::Command(left)),
+                field("right", Value::Command(right)),
+            ]),
+            Command::Sequence { items, .. } => plan.push(field("items", Value::Items(items))),
+            Command::For {
+                variable,
+                words,
+                body,
+                redirects,
+                ..
+            }
+            | Command::Select {
+                variable,
+                words,
+                body,
+                redirects,
+                ..
+            } => {
+                plan.push(field("variable", Value::Str(variable)));
+                if let Some(words) = words {
+                    plan.push(field("words", Value::Symbols(words)));
+                }
+                plan.push(field("body", Value::Command(body)));
+                push_redirects(plan, redirects);
+            }
+            Command::While {
+                test,
+                body,
+                redirects,
+                ..
+            }
+            | Command::Until {
+                test,
+                body,
+                redirects,
+                ..
+            } => {
+                plan.extend([
+                    field("test", Value::Command(test)),
+                    field("body", Value::Command(body)),
+                ]);
+                push_redirects(plan, redirects);
+            }
+            Command::If {
+                condition,
+                then_branch,
+                else_branch,
+                redirects,
+                ..
+            } => {
+                plan.extend([
+                    field("condition", Value::Command(condition)),
+                    field("then_branch", Value::Command(then_branch)),
+                ]);
+                if let Some(else_branch) = else_branch {
+                    plan.push(field("else_branch", Value::Command(else_branch)));
+                }
+                push_redirects(plan, redirects);
+            }
+            Command::Case {
+                word,
+                clauses,
+                redirects,
+                ..
+            } => {
+                plan.extend([
+                    field("word", Value::Str(word)),
+                    field("clauses", Value::Clauses(clauses)),
+                ]);
+                push_redirects(plan, redirects);
+            }
+            Command::Group {
+                body, redirects, ..
+            }
+            | Command::Subshell {
+                body, redirects, ..
+            } => {
+                plan.push(field("body", Value::Command(body)));
+                push_redirects(plan, redirects);
+            }
+            Command::FunctionDef {
+                name,
+                body,
+                source_file,
+                ..
+            } => {
+                plan.extend([
+                    field("name", Value::Str(name)),
+                    field("body", Value::Command(body)),
+                ]);
+                if let Some(source_file) = source_file {
+                    plan.push(field("source_file", Value::Str(source_file)));
+                }
+            }
+            Command::Arithmetic { expression, .. } => {
+                plan.push(field("expression", Value::Str(expression)));
+            }
+            Command::ArithmeticFor {
+                init,
+                test,
+                step,
+                body,
+                ..
+            } => plan.extend([
+                field("init", Value::Str(init)),
+                field("test", Value::Str(test)),
+                field("step", Value::Str(step)),
+                field("body", Value::Command(body)),
+            ]),
+            Command::Conditional { expr, .. } => plan.push(field("expr", Value::Cond(expr))),
+            Command::Coproc { name, body, .. } => {
+                if let Some(name) = name {
+                    plan.push(field("name", Value::Str(name)));
+                }
+                plan.push(field("body", Value::Command(body)));
+            }
+        }
+        plan.push(Step::EndObject);
+        Ok(())
+    }
+
+    /// Write a conditional expression's tag and plan its other fields
+    fn cond<'a>(&mut self, expr: &'a ConditionalExpr, plan: &mut Vec<Step<'a>>) -> io::Result<()> {
+        let field = Step::Field;
+        self.first_field("cond_type", cond_tag(expr))?;
+        match expr {
+            ConditionalExpr::Unary { op, arg } => {
+                plan.extend([field("op", Value::Str(op)), field("arg", Value::Str(arg))]);
+            }
+            ConditionalExpr::Binary { op, left, right } => plan.extend([
+                field("op", Value::Str(op)),
+                field("left", Value::Str(left)),
+                field("right", Value::Str(right)),
+            ]),
+            ConditionalExpr::And { left, right } | ConditionalExpr::Or { left, right } => {
+                plan.extend([
+                    field("left", Value::Cond(left)),
+                    field("right", Value::Cond(right)),
+                ]);
+            }
+            ConditionalExpr::Not { expr } | ConditionalExpr::Expr { expr } => {
+                plan.push(field("expr", Value::Cond(expr)));
+            }
+            ConditionalExpr::Term { word } => plan.push(field("word", Value::Str(word))),
+        }
+        plan.push(Step::EndObject);
+        Ok(())
+    }
+}
+
+/// The serde tags of `Command`'s variants
+const COMMAND_VARIANTS: &[&str] = &[
+    "simple",
+    "pipeline",
+    "list",
+    "sequence",
+    "for",
+    "while",
+    "until",
+    "if",
+    "case",
+    "select",
+    "group",
+    "subshell",
+    "function_def",
+    "arithmetic",
+    "arithmetic_for",
+    "conditional",
+    "coproc",
+];
+
+/// The serde tags of `ConditionalExpr`'s variants
+const COND_VARIANTS: &[&str] = &["unary", "binary", "and", "or", "not", "term", "expr"];
+
+const fn command_tag(cmd: &Command) -> &'static str {
+    let index = match cmd {
+        Command::Simple { .. } => 0,
+        Command::Pipeline { .. } => 1,
+        Command::List { .. } => 2,
+        Command::Sequence { .. } => 3,
+        Command::For { .. } => 4,
+        Command::While { .. } => 5,
+        Command::Until { .. } => 6,
+        Command::If { .. } => 7,
+        Command::Case { .. } => 8,
+        Command::Select { .. } => 9,
+        Command::Group { .. } => 10,
+        Command::Subshell { .. } => 11,
+        Command::FunctionDef { .. } => 12,
+        Command::Arithmetic { .. } => 13,
+        Command::ArithmeticFor { .. } => 14,
+        Command::Conditional { .. } => 15,
+        Command::Coproc { .. } => 16,
+    };
+    COMMAND_VARIANTS[index]
+}
+
+const fn cond_tag(expr: &ConditionalExpr) -> &'static str {
+    let index = match expr {
+        ConditionalExpr::Unary { .. } => 0,
+        ConditionalExpr::Binary { .. } => 1,
+        ConditionalExpr::And { .. } => 2,
+        ConditionalExpr::Or { .. } => 3,
+        ConditionalExpr::Not { .. } => 4,
+        ConditionalExpr::Term { .. } => 5,
+        ConditionalExpr::Expr { .. } => 6,
+    };
+    COND_VARIANTS[index]
+}
+
+// ---------------------------------------------------------------------------
+// Reading
+// ---------------------------------------------------------------------------
+
+/// The kind of a JSON value
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum Kind {
+    Object,
+    Array,
+    String,
+    Number,
+    Bool(bool),
+    Null,
+}
+
+/// A JSON value, located in the text
+#[derive(Clone, Copy)]
+struct Node {
+    kind: Kind,
+    start: usize,
+    end: usize,
+    /// The range of `Document::members` holding an object's members or an
+    /// array's elements
+    members: (usize, usize),
+}
+
+/// A member of an object, or an element of an array
+#[derive(Clone, Copy)]
+struct Member {
+    /// The span of the key, quotes included (empty in arrays)
+    key: (usize, usize),
+    value: usize,
+}
+
+/// A JSON text parsed into flat lists of values, without recursion
+struct Document<'a> {
+    json: &'a str,
+    nodes: Vec<Node>,
+    /// The members of every container, each container's contiguous
+    members: Vec<Member>,
+}
+
+/// A container still being parsed
+struct Open {
+    node: usize,
+    /// Where its members start on the scratch stack
+    start: usize,
+    /// The key of the member being parsed, in an object
+    key: (usize, usize),
+}
+
+impl<'a> Document<'a> {
+    #[allow(clippy::too_many_lines)] // One loop over every value
+    fn parse(json: &'a str) -> serde_json::Result<Self> {
+        let mut doc = Self {
+            json,
+            nodes: Vec::new(),
+            members: Vec::new(),
+        };
+        let bytes = json.as_bytes();
+        let mut pos = 0;
+        let mut open: Vec<Open> = Vec::new();
+        // Members of the open containers, innermost last
+        let mut scratch: Vec<Member> = Vec::new();
+
+        loop {
+            // A value starts here
+            pos = skip_whitespace(bytes, pos);
+            let start = pos;
+            let kind = match bytes.get(pos) {
+                Some(b'{') => Kind::Object,
+                Some(b'[') => Kind::Array,
+                Some(b'"') => {
+                    pos = doc.scan_string(pos)?;
+                    Kind::String
+                }
+                Some(b'-' | b'0'..=b'9') => {
+                    pos = doc.scan_number(pos)?;
+                    Kind::Number
+                }
+                Some(b't') => {
+                    pos = doc.scan_literal(pos, "true")?;
+                    Kind::Bool(true)
+                }
+                Some(b'f') => {
+                    pos = doc.scan_literal(pos, "false")?;
+                    Kind::Bool(false)
+                }
+                Some(b'n') => {
+                    pos = doc.scan_literal(pos, "null")?;
+                    Kind::Null
+                }
+                Some(_) => return Err(doc.error(pos, "expected value")),
+                None => return Err(doc.error(pos, "EOF while parsing a value")),
+            };
+            let mut value = doc.nodes.len();
+            doc.nodes.push(Node {
+                kind,
+                start,
+                end: pos,
+                members: (0, 0),
+            });
+
+            if matches!(kind, Kind::Object | Kind::Array) {
+                pos = skip_whitespace(bytes, pos + 1);
+                let close = if kind == Kind::Object { b'}' } else { b']' };
+                if bytes.get(pos) == Some(&close) {
+                    // Empty; it ends here
+                    pos += 1;
+                    doc.nodes[value].end = pos;
+                } else {
+                    let key = if kind == Kind::Object {
+                        let key;
+                        (key, pos) = doc.scan_key(pos)?;
+                        key
+                    } else {
+                        (0, 0)
+                    };
+                    open.push(Open {
+                        node: value,
+                        start: scratch.len(),
+                        key,
+                    });
+                    continue;
+                }
+            }
+
+            // A value has ended: add it to its container, then end every
+            // container it completes
+            loop {
+                let Some(top) = open.last_mut() else {
+                    pos = skip_whitespace(bytes, pos);
+                    if pos < bytes.len() {
+                        return Err(doc.error(pos, "trailing characters"));
+                    }
+                    return Ok(doc);
+                };
+                scratch.push(Member {
+                    key: top.key,
+                    value,
+                });
+
+                pos = skip_whitespace(bytes, pos);
+                let is_object = doc.nodes[top.node].kind == Kind::Object;
+                match bytes.get(pos) {
+                    Some(b',') => {
+                        if is_object {
+                            (top.key, pos) = doc.scan_key(pos + 1)?;
+                        } else {
+                            pos += 1;
+                        }
+                        break;
+                    }
+                    Some(b'}') if is_object => {}
+                    Some(b']') if !is_object => {}
+                    Some(_) if is_object => {
+                        return Err(doc.error(pos, "expected `,` or `}`"));
+                    }
+                    Some(_) => return Err(doc.error(pos, "expected `,` or `]`")),
+                    None => return Err(doc.error(pos, "EOF while parsing a value")),
+                }
+
+                pos += 1;
+                let top = open.pop().expect("a container is open");
+                let start = doc.members.len();
+                doc.members.extend(scratch.drain(top.start..));
+                let node = &mut doc.nodes[top.node];
+                node.end = pos;
+                node.members = (start, doc.members.len());
+                value = top.node;
+            }
+        }
+    }
+
+    /// Scan an object key and its colon, starting at or before its quote
+    fn scan_key(&self, pos: usize) -> serde_json::Result<((usize, usize), usize)> {
+        let bytes = self.json.as_bytes();
+        let start = skip_whitespace(bytes, pos);
+        if bytes.get(start) != Some(&b'"') {
+            return Err(self.error(start, "key must be a string"));
+        }
+        let end = self.scan_string(start)?;
+        let colon = skip_whitespace(bytes, end);
+        if bytes.get(colon) != Some(&b':') {
+            return Err(self.error(colon, "expected `:`"));
+        }
+        Ok(((start, end), colon + 1))
+    }
+
+    /// Scan a string starting at its opening quote, returning where it ends
+    fn scan_string(&self, pos: usize) -> serde_json::Result<usize> {
+        let bytes = self.json.as_bytes();
+        let mut i = pos + 1;
+        loop {
+            match bytes.get(i) {
+                None => return Err(self.error(i, "EOF while parsing a string")),
+                Some(b'"') => return Ok(i + 1),
+                Some(b'\\') => match bytes.get(i + 1) {
+                    Some(b'"' | b'\\' | b'/' | b'b' | b'f' | b'n' | b'r' | b't') => i += 2,
+                    Some(b'u')
+                        if bytes
+                            .get(i + 2..i + 6)
+                            .is_some_and(|hex| hex.iter().all(u8::is_ascii_hexdigit)) =>
+                    {
+                        i += 6;
+                    }
+                    _ => return Err(self.error(i, "invalid escape")),
+                },
+                Some(0..=0x1f) => {
+                    return Err(self.error(
+                        i,
+                        "control character (\\u0000-\\u001F) found while parsing a string",
+                    ));
+                }
+                Some(_) => i += 1,
+            }
+        }
+    }
+
+    /// Scan a number, returning where it ends
+    fn scan_number(&self, pos: usize) -> serde_json::Result<usize> {
+        let bytes = self.json.as_bytes();
+        let digits = |mut i: usize| {
+            while bytes.get(i).is_some_and(u8::is_ascii_digit) {
+                i += 1;
+            }
+            i
+        };
+        let mut i = pos + usize::from(bytes[pos] == b'-');
+        i = match bytes.get(i) {
+            Some(b'0') => i + 1,
+            Some(b'1'..=b'9') => digits(i + 1),
+            _ => return Err(self.error(i, "invalid number")),
+        };
+        if bytes.get(i) == Some(&b'.') {
+            let end = digits(i + 1);
+            if end == i + 1 {
+                return Err(self.error(end, "invalid number"));
+            }
+            i = end;
+        }
+        if matches!(bytes.get(i), Some(b'e' | b'E')) {
+            i += 1;
+            if matches!(bytes.get(i), Some(b'+' | b'-')) {
+                i += 1;
+            }
+            let end = digits(i);
+            if end == i {
+                return Err(self.error(end, "invalid number"));
+            }
+            i = end;
+        }
+        Ok(i)
+    }
+
+    fn scan_literal(&self, pos: usize, literal: &str) -> serde_json::Result<usize> {
+        let end = pos + literal.len();
+        if self.json.as_bytes().get(pos..end) == Some(literal.as_bytes()) {
+            Ok(end)
+        } else {
+            Err(self.error(pos, "expected value"))
+        }
+    }
+
+    /// An error at a byte offset, located the way `serde_json` locates its
+    /// errors
+    fn error(&self, pos: usize, msg: &str) -> serde_json::Error {
+        let before = &self.json.as_bytes()[..pos.min(self.json.len())];
+        let line = before.split(|&b| b == b'\n').count();
+        let column = before.rsplit(|&b| b == b'\n').next().map_or(0, <[u8]>::len) + 1;
+        serde_json::Error::custom(format!("{msg} at line {line} column {column}"))
+    }
+
+    fn text(&self, node: usize) -> &'a str {
+        let node = self.nodes[node];
+        &self.json[node.start..node.end]
+    }
+
+    /// The text of a string, quotes included, without its escapes
+    fn unescape(&self, (start, end): (usize, usize)) -> serde_json::Result<Cow<'a, str>> {
+        let quoted = &self.json[start..end];
+        if quoted.contains('\\') {
+            serde_json::from_str::<String>(quoted).map(Cow::Owned)
+        } else {
+            Ok(Cow::Borrowed(&quoted[1..quoted.len() - 1]))
+        }
+    }
+
+    fn members(&self, node: usize) -> &[Member] {
+        let (start, end) = self.nodes[node].members;
+        &self.members[start..end]
+    }
+}
+
+fn skip_whitespace(bytes: &[u8], mut pos: usize) -> usize {
+    while matches!(bytes.get(pos), Some(b' ' | b'\t' | b'\n' | b'\r')) {
+        pos += 1;
+    }
+    pos
+}
+
+/// The fields of an object
+struct Fields<'d> {
+    doc: &'d Document<'d>,
+    members: &'d [Member],
+}
+
+impl Fields<'_> {
+    /// The value of a field, if present
+    fn get(&self, name: &'static str) -> serde_json::Result<Option<usize>> {
+        let mut found = None;
+        for member in self.members {
+            if self.doc.unescape(member.key)? == name {
+                if found.is_some() {
+                    return Err(serde_json::Error::duplicate_field(name));
+                }
+                found = Some(member.value);
+            }
+        }
+        Ok(found)
+    }
+
+    fn required(&self, name: &'static str) -> serde_json::Result<usize> {
+        self.get(name)?
+            .ok_or_else(|| serde_json::Error::missing_field(name))
+    }
+
+    /// The value of a field, unless absent or null
+    fn non_null(&self, name: &'static str) -> serde_json::Result<Option<usize>> {
+        Ok(self
+            .get(name)?
+            .filter(|&node| self.doc.nodes[node].kind != Kind::Null))
+    }
+}
+
+/// One step of building the AST
+enum Work {
+    /// Build the command at a node, at the given depth
+    Command(usize, usize),
+    /// Build the conditional expression at a node, at the given depth
+    Cond(usize, usize),
+    /// Assemble a node from its built children
+    Finish(Pending),
+    /// Give the command just built its span
+    Span(Span),
+}
+
+/// How many substitutions each word with any has, by word index
+type WordSubstitutions = Vec<(usize, usize)>;
+
+/// A node whose children are still being built
+enum Pending {
+    /// A simple command, and how many substitutions each of its words has,
+    /// by word index
+    Simple {
+        cmd: Command,
+        substitutions: WordSubstitutions,
+    },
+    Pipeline {
+        line: Option<u32>,
+        stages: usize,
+        negated: bool,
+    },
+    List {
+        line: Option<u32>,
+        op: ListOp,
+    },
+    Sequence {
+        line: Option<u32>,
+        ops: Vec<ListOp>,
+    },
+    For {
+        line: Option<u32>,
+        variable: Symbol,
+        words: Option<Vec<Symbol>>,
+        redirects: Vec<Redirect>,
+    },
+    While {
+        line: Option<u32>,
+        redirects: Vec<Redirect>,
+    },
+    Until {
+        line: Option<u32>,
+        redirects: Vec<Redirect>,
+    },
+    If {
+        line: Option<u32>,
+        has_else: bool,
+        redirects: Vec<Redirect>,
+    },
+    Case {
+        line: Option<u32>,
+        word: Symbol,
+        /// The clauses, with their actions still missing
+        clauses: Vec<CaseClause>,
+        /// Which clauses have an action
+        has_action: Vec<bool>,
+        redirects: Vec<Redirect>,
+    },
+    Select {
+        line: Option<u32>,
+        variable: Symbol,
+        words: Option<Vec<Symbol>>,
+        redirects: Vec<Redirect>,
+    },
+    Group {
+        line: Option<u32>,
+        redirects: Vec<Redirect>,
+    },
+    Subshell {
+        line: Option<u32>,
+        redirects: Vec<Redirect>,
+    },
+    FunctionDef {
+        line: Option<u32>,
+        name: Symbol,
+        source_file: Option<String>,
+    },
+    ArithmeticFor {
+        line: Option<u32>,
+        init: String,
+        test: String,
+        step: String,
+    },
+    Conditional {
+        line: Option<u32>,
+    },
+    Coproc {
+        line: Option<u32>,
+        name: Option<String>,
+    },
+    And,
+    Or,
+    Not,
+    Expr,
+}
+
+/// Builds the AST from a parsed document, from explicit stacks
+struct Builder<'d> {
+    doc: &'d Document<'d>,
+    max_depth: usize,
+}
+
+impl<'d> Builder<'d> {
+    fn build(&self) -> serde_json::Result<Command> {
+        self.walk(&mut Vec::new(), &mut Vec::new())
+    }
+
+    /// Build the AST with the given (empty) stacks of built commands and
+    /// expressions that their parents haven't taken yet
+    fn walk(
+        &self,
+        commands: &mut Vec<Command>,
+        conds: &mut Vec<ConditionalExpr>,
+    ) -> serde_json::Result<Command> {
+        let mut work = vec![Work::Command(0, 0)];
+        while let Some(item) = work.pop() {
+            match item {
+                Work::Command(node, depth) => {
+                    let start = work.len();
+                    let span = self.begin_command(node, depth, &mut work, commands)?;
+                    // Children were added in order; take them first to last
+                    if let Some(children) = work.get_mut(start + 1..) {
+                        children.reverse();
+                    }
+                    // Taken once the command is built
+                    if let Some(span) = span {
+                        work.insert(start, Work::Span(span));
+                    }
+                }
+                Work::Cond(node, depth) => {
+                    let start = work.len();
+                    self.begin_cond(node, depth, &mut work, conds)?;
+                    if let Some(children) = work.get_mut(start + 1..) {
+                        children.reverse();
+                    }
+                }
+                Work::Finish(pending) => pending.finish(commands, conds),
+                Work::Span(span) => {
+                    if let Some(cmd) = commands.last_mut() {
+                        *cmd.span_mut() = Some(Box::new(span));
+                    }
+                }
+            }
+        }
+
+        Ok(commands.pop().expect("the root was built"))
+    }
+
+    fn check_depth(&self, depth: usize) -> serde_json::Result<()> {
+        if depth > self.max_depth {
+            Err(serde_json::Error::custom(format!(
+                "AST nests deeper than {} levels",
+                self.max_depth
+            )))
+        } else {
+            Ok(())
+        }
+    }
+
+    /// The fields of an object, or an error naming what was expected
+    fn object(&self, node: usize, expected: &'static str) -> serde_json::Result<Fields<'d>> {
+        if self.doc.nodes[node].kind == Kind::Object {
+            Ok(Fields {
+                doc: self.doc,
+                members: self.doc.members(node),
+            })
+        } else {
+            Err(self.invalid_type(node, expected))
+        }
+    }
+
+    /// The elements of an array
+    fn array(&self, node: usize) -> serde_json::Result<impl Iterator<Item = usize> + 'd> {
+        if self.doc.nodes[node].kind == Kind::Array {
+            Ok(self.doc.members(node).iter().map(|member| member.value))
+        } else {
+            Err(self.invalid_type(node, "a sequence"))
+        }
+    }
+
+    fn invalid_type(&self, node: usize, expected: &'static str) -> serde_json::Error {
+        let unexpected = match self.doc.nodes[node].kind {
+            Kind::Object => Unexpected::Map,
+            Kind::Array => Unexpected::Seq,
+            Kind::String => Unexpected::Other("string"),
+            Kind::Number => Unexpected::Other("number"),
+            Kind::Bool(b) => Unexpected::Bool(b),
+            Kind::Null => Unexpected::Unit,
+        };
+        serde_json::Error::invalid_type(unexpected, &expected)
+    }
+
+    /// Decode the words of a simple command
+    ///
+    /// Words with substitutions are decoded field by field, and their
+    /// substitutions queued on `work` in order. Returns how many each such
+    /// word has, by word index.
+    fn words(
+        &self,
+        node: usize,
+        depth: usize,
+        work: &mut Vec<Work>,
+    ) -> serde_json::Result<(Vec<Word>, WordSubstitutions)> {
+        // Malformed words count too, so the loop below reports them
+        let has_substitutions = |word| {
+            !matches!(
+                self.object(word, "struct Word")
+                    .and_then(|fields| fields.get("substitutions")),
+                Ok(None)
+            )
+        };
+        if !self.array(node)?.any(has_substitutions) {
+            return Ok((self.leaf(node)?, Vec::new()));
+        }
+
+        let mut words = Vec::new();
+        let mut substitutions = Vec::new();
+        for (index, node) in self.array(node)?.enumerate() {
+            let fields = self.object(node, "struct Word")?;
+            let Some(list) = fields.get("substitutions")? else {
+                words.push(self.leaf(node)?);
+                continue;
+            };
+            let before = work.len();
+            work.extend(
+                self.array(list)?
+                    .map(|substitution| Work::Command(substitution, depth + 1)),
+            );
+            substitutions.push((index, work.len() - before));
+            words.push(Word {
+                span: self.optional(&fields, "span")?,
+                word: self.required(&fields, "word")?,
+                flags: self.or_default(&fields, "flags")?,
+                substitutions: Vec::new(),
+            });
+        }
+        Ok((words, substitutions))
+    }
+
+    /// Decode a value that holds no commands through serde
+    fn leaf<T: DeserializeOwned>(&self, node: usize) -> serde_json::Result<T> {
+        serde_json::from_str(self.doc.text(node))
+    }
+
+    fn required<T: DeserializeOwned>(
+        &self,
+        fields: &Fields,
+        name: &'static str,
+    ) -> serde_json::Result<T> {
+        self.leaf(fields.required(name)?)
+    }
+
+    /// Decode an optional field, which is None when absent
+    fn optional<T: DeserializeOwned>(
+        &self,
+        fields: &Fields,
+        name: &'static str,
+    ) -> serde_json::Result<Option<T>> {
+        fields
+            .get(name)?
+            .map_or(Ok(None), |node| self.leaf::<Option<T>>(node))
+    }
+
+    /// Decode a field that defaults when absent
+    fn or_default<T: DeserializeOwned + Default>(
+        &self,
+        fields: &Fields,
+        name: &'static str,
+    ) -> serde_json::Result<T> {
+        fields
+            .get(name)?
+            .map_or_else(|| Ok(T::default()), |node| self.leaf(node))
+    }
+
+    /// The tag of an internally tagged enum
+    fn tag(
+        &self,
+        fields: &Fields,
+        name: &'static str,
+        variants: &'static [&'static str],
+    ) -> serde_json::Result<usize> {
+        let node = fields.required(name)?;
+        if self.doc.nodes[node].kind != Kind::String {
+            return Err(self.invalid_type(node, "a string"));
+        }
+        let node = self.doc.nodes[node];
+        let tag = self.doc.unescape((node.start, node.end))?;
+        variants
+            .iter()
+            .position(|&variant| variant == tag)
+            .ok_or_else(|| serde_json::Error::unknown_variant(&tag, variants))
+    }
+
+    /// Decode a command's own fields and plan its children
+    ///
+    /// Pushes a `Finish` followed by the children in order. Returns the
+    /// command's span, for the caller to apply once it is built.
+    #[allow(clippy::too_many_lines, clippy::cognitive_complexity)] // One arm per command type
+    fn begin_command(
+        &self,
+        node: usize,
+        depth: usize,
+        work: &mut Vec<Work>,
+        commands: &mut Vec<Command>,
+    ) -> serde_json::Result<Option<Span>> {
+        self.check_depth(depth)?;
+        let fields = self.object(node, "internally tagged enum Command")?;
+        let tag = self.tag(&fields, "type", COMMAND_VARIANTS)?;
+        let line = self.optional(&fields, "line")?;
+        let span = self.optional(&fields, "span")?;
+        let child = |name| -> serde_json::Result<Work> {
+            Ok(Work::Command(fields.required(name)?, depth + 1))
+        };
+
+        let pending = match COMMAND_VARIANTS[tag] {
+            "simple" => {
+                let (words, substitutions) = self.words(fields.required("words")?, depth, work)?;
+                let cmd = Command::Simple {
+                    line,
+                    span: None,
+                    words,
+                    redirects: self.required(&fields, "redirects")?,
+                    assignments: self.optional(&fields, "assignments")?,
+                };
+                if substitutions.is_empty() {
+                    commands.push(cmd);
+                } else {
+                    // Queued before the substitutions that were just added
+                    let start = work.len() - substitutions.iter().map(|&(_, n)| n).sum::<usize>();
+                    work.insert(start, Work::Finish(Pending::Simple { cmd, substitutions }));
+                }
+                return Ok(span);
+            }
+            "pipeline" => {
+                let stages: Vec<usize> = self.array(fields.required("commands")?)?.collect();
+                work.push(Work::Finish(Pending::Pipeline {
+                    line,
+                    stages: stages.len(),
+                    negated: self.or_default(&fields, "negated")?,
+                }));
+                work.extend(
+                    stages
+                        .into_iter()
+                        .map(|stage| Work::Command(stage, depth + 1)),
+                );
+                return Ok(span);
+            }
+            "list" => {
+                let pending = Pending::List {
+                    line,
+                    op: self.required(&fields, "op")?,
+                };
+                work.extend([Work::Finish(pending), child("left")?, child("right")?]);
+                return Ok(span);
+            }
+            "sequence" => {
+                let mut ops = Vec::new();
+                let mut items = Vec::new();
+                for item in self.array(fields.required("items")?)? {
+                    let mut parts = self.array(item)?;
+                    let (Some(cmd), Some(op), None) = (parts.next(), parts.next(), parts.next())
+                    else {
+                        let len = self.array(item)?.count();
+                        return Err(serde_json::Error::invalid_length(len, &"a tuple of size 2"));
+                    };
+                    ops.push(self.leaf(op)?);
+                    items.push(Work::Command(cmd, depth + 1));
+                }
+                work.push(Work::Finish(Pending::Sequence { line, ops }));
+                work.extend(items);
+                return Ok(span);
+            }
+            "for" | "select" => {
+                let variable = self.required(&fields, "variable")?;
+                let words = self.optional(&fields, "words")?;
+                let redirects = self.or_default(&fields, "redirects")?;
+                if COMMAND_VARIANTS[tag] == "for" {
+                    Pending::For {
+                        line,
+                        variable,
+                        words,
+                        redirects,
+                    }
+                } else {
+                    Pending::Select {
+                        line,
+                        variable,
+                        words,
+                        redirects,
+                    }
+                }
+            }
+            "while" | "until" => {
+                let redirects = self.or_default(&fields, "redirects")?;
+                let pending = if COMMAND_VARIANTS[tag] == "while" {
+                    Pending::While { line, redirects }
+                } else {
+                    Pending::Until { line, redirects }
+                };
+                work.extend([Work::Finish(pending), child("test")?, child("body")?]);
+                return Ok(span);
+            }
+            "if" => {
+                let else_branch = fields.non_null("else_branch")?;
+                work.extend([
+                    Work::Finish(Pending::If {
+                        line,
+                        has_else: else_branch.is_some(),
+                        redirects: self.or_default(&fields, "redirects")?,
+                    }),
+                    child("condition")?,
+                    child("then_branch")?,
+                ]);
+                work.extend(else_branch.map(|node| Work::Command(node, depth + 1)));
+                return Ok(span);
+            }
+            "case" => {
+                let subject = self.required(&fields, "word")?;
+                let mut clauses = Vec::new();
+                let mut has_action = Vec::new();
+                let mut actions = Vec::new();
+                for clause in self.array(fields.required("clauses")?)? {
+                    let clause_fields = self.object(clause, "struct CaseClause")?;
+                    let action = clause_fields.non_null("action")?;
+                    clauses.push(CaseClause {
+                        patterns: self.required(&clause_fields, "patterns")?,
+                        action: None,
+                        flags: self.optional(&clause_fields, "flags")?,
+                    });
+                    has_action.push(action.is_some());
+                    actions.extend(action);
+                }
+                work.push(Work::Finish(Pending::Case {
+                    line,
+                    word: subject,
+                    clauses,
+                    has_action,
+                    redirects: self.or_default(&fields, "redirects")?,
+                }));
+                work.extend(
+                    actions
+                        .into_iter()
+                        .map(|node| Work::Command(node, depth + 1)),
+                );
+                return Ok(span);
+            }
+            "group" => Pending::Group {
+                line,
+                redirects: self.or_default(&fields, "redirects")?,
+            },
+            "subshell" => Pending::Subshell {
+                line,
+                redirects: self.or_default(&fields, "redirects")?,
+            },
+            "function_def" => Pending::FunctionDef {
+                line,
+                name: self.required(&fields, "name")?,
+                source_file: self.optional(&fields, "source_file")?,
+            },
+            "arithmetic" => {
+                commands.push(Command::Arithmetic {
+                    line,
+                    span: None,
+                    expression: self.required(&fields, "expression")?,
+                });
+                return Ok(span);
+            }
+            "arithmetic_for" => Pending::ArithmeticFor {
+                line,
+                init: self.required(&fields, "init")?,
+                test: self.required(&fields, "test")?,
+                step: self.required(&fields, "step")?,
+            },
+            "conditional" => {
+                work.extend([
+                    Work::Finish(Pending::Conditional { line }),
+                    // The expression's root is at the command's depth, as
+                    // in the converter
+                    Work::Cond(fields.required("expr")?, depth),
+                ]);
+                return Ok(span);
+            }
+            "coproc" => Pending::Coproc {
+                line,
+                name: self.optional(&fields, "name")?,
+            },
+            _ => unreachable!("every variant is handled"),
+        };
+
+        // The rest have just a body
+        work.extend([Work::Finish(pending), child("body")?]);
+        Ok(span)
+    }
+
+    /// Decode a conditional expression's own fields and plan its operands
+    fn begin_cond(
+        &self,
+        node: usize,
+        depth: usize,
+        work: &mut Vec<Work>,
+        conds: &mut Vec<ConditionalExpr>,
+    ) -> serde_json::Result<()> {
+        self.check_depth(depth)?;
+        let fields = self.object(node, "internally tagged enum ConditionalExpr")?;
+        let tag = self.tag(&fields, "cond_type", COND_VARIANTS)?;
+        let operand = |name| -> serde_json::Result<Work> {
+            Ok(Work::Cond(fields.required(name)?, depth + 1))
+        };
+
+        let (pending, operands): (_, &[&'static str]) = match COND_VARIANTS[tag] {
+            "unary" => {
+                conds.push(ConditionalExpr::Unary {
+                    op: self.required(&fields, "op")?,
+                    arg: self.required(&fields, "arg")?,
+                });
+                return Ok(());
+            }
+            "binary" => {
+                conds.push(ConditionalExpr::Binary {
+                    op: self.required(&fields, "op")?,
+                    left: self.required(&fields, "left")?,
+                    right: self.required(&fields, "right")?,
+                });
+                return Ok(());
+            }
+            "term" => {
+                conds.push(ConditionalExpr::Term {
+                    word: self.required(&fields, "word")?,
+                });
+                return Ok(());
+            }
+            "and" => (Pending::And, &["left", "right"]),
+            "or" => (Pending::Or, &["left", "right"]),
+            "not" => (Pending::Not, &["expr"]),
+            "expr" => (Pending::Expr, &["expr"]),
+            _ => unreachable!("every variant is handled"),
+        };
+        work.push(Work::Finish(pending));
+        for &name in operands {
+            work.push(operand(name)?);
+        }
+        Ok(())
+    }
+}
+
+impl Pending {
+    /// Assemble the node from the children on top of the stacks
+    #[allow(clippy::too_many_lines)] // One arm per node type
+    fn finish(self, commands: &mut Vec<Command>, conds: &mut Vec<ConditionalExpr>) {
+        fn pop<T: Dismantle>(built: &mut Vec<T>) -> Nested<T> {
+            Nested::new(built.pop().expect("child was built"))
+        }
+
+        let cmd = match self {
+            Self::Simple {
+                mut cmd,
+                substitutions,
+            } => {
+                let total = substitutions.iter().map(|&(_, n)| n).sum::<usize>();
+                let mut built = commands.split_off(commands.len() - total).into_iter();
+                if let Command::Simple { words, .. } = &mut cmd {
+                    for (index, n) in substitutions {
+                        words[index].substitutions = built.by_ref().take(n).collect();
+                    }
+                }
+                cmd
+            }
+            Self::Pipeline {
+                line,
+                stages,
+                negated,
+            } => Command::Pipeline {
+                line,
+                span: None,
+                commands: commands.split_off(commands.len() - stages),
+                negated,
+            },
+            Self::List { line, op } => {
+                let right = pop(commands);
+                let left = pop(commands);
+                Command::List {
+                    line,
+                    span: None,
+                    op,
+                    left,
+                    right,
+                }
+            }
+            Self::Sequence { line, ops } => Command::Sequence {
+                line,
+                span: None,
+                items: commands
+                    .split_off(commands.len() - ops.len())
+                    .into_iter()
+                    .zip(ops)
+                    .collect(),
+            },
+            Self::For {
+                line,
+                variable,
+                words,
+                redirects,
+            } => Command::For {
+                line,
+                span: None,
+                variable,
+                words,
+                body: pop(commands),
+                redirects,
+            },
+            Self::While { line, redirects } => {
+                let body = pop(commands);
+                let test = pop(commands);
+                Command::While {
+                    line,
+                    span: None,
+                    test,
+                    body,
+                    redirects,
+                }
+            }
+            Self::Until { line, redirects } => {
+                let body = pop(commands);
+                let test = pop(commands);
+                Command::Until {
+                    line,
+                    span: None,
+                    test,
+                    body,
+                    redirects,
+                }
+            }
+            Self::If {
+                line,
+                has_else,
+                redirects,
+            } => {
+                let else_branch = has_else.then(|| pop(commands));
+                let then_branch = pop(commands);
+                let condition = pop(commands);
+                Command::If {
+                    line,
+                    span: None,
+                    condition,
+                    then_branch,
+                    else_branch,
+                    redirects,
+                }
+            }
+            Self::Case {
+                line,
+                word,
+                mut clauses,
+                has_action,
+                redirects,
+            } => {
+                let actions = has_action.iter().filter(|&&has| has).count();
+                let mut actions = commands.split_off(commands.len() - actions).into_iter();
+                for (clause, has_action) in clauses.iter_mut().zip(has_action) {
+                    if has_action {
+                        clause.action = actions.next().map(Nested::new);
+                    }
+                }
+                Command::Case {
+                    line,
+                    span: None,
+                    word,
+                    clauses,
+                    redirects,
+                }
+            }
+            Self::Select {
+                line,
+                variable,
+                words,
+                redirects,
+            } => Command::Select {
+                line,
+                span: None,
+                variable,
+                words,
+                body: pop(commands),
+                redirects,
+            },
+            Self::Group { line, redirects } => Command::Group {
+                line,
+                span: None,
+                body: pop(commands),
+                redirects,
+            },
+            Self::Subshell { line, redirects } => Command::Subshell {
+                line,
+                span: None,
+                body: pop(commands),
+                redirects,
+            },
+            Self::FunctionDef {
+                line,
+                name,
+                source_file,
+            } => Command::FunctionDef {
+                line,
+                span: None,
+                name,
+                body: pop(commands),
+                source_file,
+            },
+            Self::ArithmeticFor {
+                line,
+                init,
+                test,
+                step,
+            } => Command::ArithmeticFor {
+                line,
+                span: None,
+                init,
+                test,
+                step,
+                body: pop(commands),
+            },
+            Self::Conditional { line } => Command::Conditional {
+                line,
+                span: None,
+                expr: conds.pop().expect("child was built"),
+            },
+            Self::Coproc { line, name } => Command::Coproc {
+                line,
+                span: None,
+                name,
+                body: pop(commands),
+            },
+            Self::And => {
+                let right = pop(conds);
+                let left = pop(conds);
+                conds.push(ConditionalExpr::And { left, right });
+                return;
+            }
+            Self::Or => {
+                let right = pop(conds);
+                let left = pop(conds);
+                conds.push(ConditionalExpr::Or { left, right });
+                return;
+            }
+            Self::Not => {
+                let expr = pop(conds);
+                conds.push(ConditionalExpr::Not { expr });
+                return;
+            }
+            Self::Expr => {
+                let expr = pop(conds);
+                conds.push(ConditionalExpr::Expr { expr });
+                return;
+            }
+        };
+        commands.push(cmd);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A tree using every kind of node and the optional fields of each
+    const EVERY_KIND: &str = r#"{"type":"list","op":"semi",
+        "left":{"type":"function_def","line":1,"span":{"start":0,"end":40,"line":1,
+          "column":1,"end_line":3,"end_column":2},"name":"f","source_file":"x.sh",
+          "body":{"type":"group","redirects":[{"direction":"output","source_fd":2,
+            "target":"/dev/null"}],
+          "body":{"type":"if",
+            "condition":{"type":"conditional","expr":{"cond_type":"and",
+              "left":{"cond_type":"unary","op":"-f","arg":"a"},
+              "right":{"cond_type":"not","expr":{"cond_type":"expr","expr":
+                {"cond_type":"or","left":{"cond_type":"term","word":"b\\\"c"},
+                  "right":{"cond_type":"binary","op":"==","left":"c","right":"d"}}}}}},
+            "then_branch":{"type":"pipeline","negated":true,"commands":[
+              {"type":"simple","words":[{"word":"cat","flags":0},{"word":"$x","flags":1}],
+                "redirects":[{"direction":"here_doc","source_fd":0,"target":"hi\\n",
+                  "here_doc_eof":"EOF","span":{"start":9,"end":15,"line":2,"column":5,
+                  "end_line":2,"end_column":11}}],"assignments":["a=1"]},
+              {"type":"subshell","body":{"type":"arithmetic","span":{"start":20,"end":27,
+                "line":2,"column":16,"end_line":2,"end_column":23},"expression":"i++"},
+                "redirects":[]}]},
+            "else_branch":{"type":"case","word":"$1","redirects":[],"clauses":[
+              {"patterns":["a","b"],"action":{"type":"simple","words":[],
+                "redirects":[{"direction":"dup_output","source_fd":1,"target":2}]},
+                "flags":{"fallthrough":true}},
+              {"patterns":["*"],"action":null}]},
+            "redirects":[]}}},
+        "right":{"type":"list","op":"and",
+          "left":{"type":"for","variable":"i","words":["1","2"],
+            "body":{"type":"while","test":{"type":"simple","words":[{"word":"true"}],
+              "redirects":[]},"body":{"type":"until","test":{"type":"simple",
+              "words":[],"redirects":[]},"body":{"type":"select","variable":"s",
+              "body":{"type":"arithmetic_for","init":"i=0","test":"i<3","step":"i++",
+              "body":{"type":"coproc","name":"w","body":{"type":"simple",
+              "words":[],"redirects":[]}}}}}}},
+          "right":{"type":"pipeline","commands":[{"type":"simple","words":[],
+            "redirects":[]},{"type":"simple","words":[{"word":"wc","span":{"start":50,
+              "end":52,"line":4,"column":1,"end_line":4,"end_column":3}},
+              {"word":"$(ls $(pwd))","flags":1,"substitutions":[{"type":"simple",
+              "span":{"start":55,"end":66,"line":4,"column":6,"end_line":4,"end_column":17},
+              "words":[{"word":"ls"},{"word":"$(pwd)","substitutions":[{"type":"simple",
+              "words":[{"word":"pwd"}],"redirects":[]}],"span":{"start":58,"end":65,"line":4,
+              "column":9,"end_line":4,"end_column":16}}],"redirects":[]}]}],
+              "redirects":[]}]}}}"#;
+
+    /// `depth` subshells around a simple command
+    fn nested(depth: usize) -> Command {
+        let mut cmd = Command::Simple {
+            line: Some(1),
+            span: None,
+            words: vec![Word {
+                span: None,
+                word: "true".into(),
+                flags: 0,
+                substitutions: Vec::new(),
+            }],
+            redirects: Vec::new(),
+            assignments: None,
+        };
+        for _ in 0..depth {
+            cmd = Command::Subshell {
+                line: None,
+                span: None,
+                body: Nested::new(cmd),
+                redirects: Vec::new(),
+            };
+        }
+        cmd
+    }
+
+    #[test]
+    fn test_matches_serde() {
+        let cmd: Command = serde_json::from_str(EVERY_KIND).unwrap();
+        assert_eq!(to_json(&cmd, false), serde_json::to_string(&cmd).unwrap());
+        assert_eq!(
+            to_json(&cmd, true),
+            serde_json::to_string_pretty(&cmd).unwrap()
+        );
+
+        let read = from_json(EVERY_KIND).unwrap();
+        assert_eq!(to_json(&read, false), to_json(&cmd, false));
+    }
+
+    #[test]
+    fn test_deeply_nested_round_trip() {
+        let depth = 10_000;
+        let cmd = nested(depth);
+
+        let json = to_json(&cmd, false);
+        assert!(serde_json::from_str::<Command>(&json).is_err());
+
+        assert!(from_json(&json).is_err());
+        let limits = ParseLimits::default().with_max_depth(depth);
+        let read = from_json_with_limits(&json, &limits).unwrap();
+        assert_eq!(to_json(&read, true), to_json(&cmd, true));
+    }
+
+    #[test]
+    fn test_depth_limit() {
+        let json = to_json(&nested(100), false);
+        assert!(from_json_with_limits(&json, &ParseLimits::default().with_max_depth(100)).is_ok());
+
+        let err =
+            from_json_with_limits(&json, &ParseLimits::default().with_max_depth(99)).unwrap_err();
+        assert!(err.to_string().contains("deeper than 99"));
+    }
+
+    #[test]
+    fn test_invalid_json() {
+        for json in [
+            "",
+            "not json",
+            r#"{"type":"simple","words":[]"#,
+            r#"{"type":"simple","words":[],"redirects":[]} extra"#,
+            r#"{"type":"simple","redirects":[]}"#,
+            r#"{"type":"nope"}"#,
+            r#"{"type":"list","op":"and","left":{"type":"arithmetic","expression":"x"}}"#,
+            r#"["type"]"#,
+        ] {
+            assert!(from_json(json).is_err(), "{json}");
+            assert!(serde_json::from_str::<Command>(json).is_err(), "{json}");
+        }
+    }
+}
@@ -37,35 +37,274 @@
 //! The [`init()`] function uses `std::sync::Once` internally, making it safe
 //! to call multiple times (subsequent calls are no-ops).
 //!
+//! To parse on several cores at once, use a [`ParserPool`] (Unix only). It
+//! forks worker processes that each own a copy of bash's parser state, and
+//! can be shared freely between threads once created (create it before
+//! starting other threads). On Linux, a [`ParserInstance`]
+//! loads a private copy of the parser into the current process instead; each
+//! instance can be moved to its own thread.
+//!
 //! # License
 //!
 //! This crate is licensed under GPL-3.0 due to its linkage with GNU Bash.
 
+pub mod arena;
 mod ast;
 mod bash_init;
+mod cancel;
+mod capi;
 mod convert;
+mod diagnostics;
+mod fast_path;
 mod ffi;
+mod incremental;
+#[cfg(target_os = "linux")]
+mod instance;
+mod intern;
+mod json;
+mod lines;
+mod options;
+#[cfg(unix)]
+mod pool;
+#[cfg(unix)]
+mod script_file;
 pub mod server;
+mod session;
+mod stream;
 mod to_bash;
+pub mod view;
+pub mod visit;
 
+pub use arena::{ArenaTooLarge, AstArena, NodeId};
 pub use ast::*;
+pub use cancel::{parse_cancellable, parse_with_deadline, CancelToken};
+pub use diagnostics::SyntaxErrorDetail;
+pub use incremental::IncrementalDocument;
+#[cfg(target_os = "linux")]
+pub use instance::{ParserInstance, PARSER_SO_ENV};
+pub use intern::{InternStats, Interner, Symbol};
+pub use json::{from_json, from_json_with_limits, to_json, write_json};
+pub use lines::{parse_lines, Record, Records};
+pub use options::{parse_with_options, ParseOptions};
+#[cfg(unix)]
+pub use pool::ParserPool;
+#[cfg(unix)]
+pub use script_file::{parse_fd, parse_file, ScriptFile};
+pub use session::ParseSession;
+pub use stream::{
+    parse_iter, parse_iter_with_limits, parse_recover, RecoveredScript, TopLevelCommands,
+};
 pub use to_bash::to_bash;
+pub use view::{CommandRef, ParsedScript};
+pub use visit::{Flow, Node, Visitor, VisitorMut, Walk};
 
-use std::ffi::CString;
+use cancel::Interrupt;
+use serde::{Deserialize, Serialize};
+use std::ffi::{c_char, c_int, CStr, CString};
+use std::ptr;
+use std::time::Duration;
 use thiserror::Error;
 
-/// Maximum script size in bytes (10MB)
+/// Default maximum script size in bytes (10MB)
 ///
 /// Scripts larger than this will be rejected with `ParseError::InputTooLarge`
-/// to prevent resource exhaustion attacks.
+/// to prevent resource exhaustion attacks. Use [`ParseLimits`] with
+/// [`parse_with_limits()`] or [`parse_file()`] to choose a different budget.
 pub const MAX_SCRIPT_SIZE: usize = 10 * 1024 * 1024;
 
+/// Default maximum nesting depth of an AST (256 levels)
+///
+/// Each command nested in another, each command of a list after the first,
+/// and each term of a `[[ ]]` expression is one level deeper. Scripts nested
+/// deeper than this fail with `ParseError::ConversionError`.
+///
+/// Conversion, [`to_bash()`], [`to_json()`], [`write_json()`] and
+/// [`from_json()`] walk the AST with a heap-allocated stack, and dropping
+/// it takes every [`Nested`] command or `[[ ]]` expression apart one level
+/// at a time, so deeper trees can be allowed with
+/// [`ParseLimits::with_max_depth`]. The exception to dropping is a chain
+/// of commands reached only through pipeline stages, sequence items and
+/// command substitutions, which is dropped by recursion; substitutions
+/// nest only as deeply as bash's parser recursed to read them. Cloning,
+/// formatting with `{:?}` and serializing or deserializing with serde
+/// recurse once per level, as do [`AstArena`] and [`IncrementalDocument`],
+/// so keep those within this depth.
+pub const MAX_DEPTH: usize = 256;
+
+/// Resource budget for a parse
+///
+/// The size and depth limits have defaults; the rest are off unless set.
+/// Words and time are checked while bash parses, on Linux, and everything
+/// as the AST is converted, so a parse that goes over its budget stops
+/// there with `ParseError::LimitExceeded` rather than being finished first.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_file, parse_with_limits, ParseLimits};
+/// use std::time::Duration;
+///
+/// init();
+///
+/// // A 200MB generated installer
+/// let limits = ParseLimits::default().with_max_script_size(256 * 1024 * 1024);
+/// // SAFETY: nothing writes to the installer while it is parsed
+/// let ast = unsafe { parse_file("installer.sh", &limits) }.unwrap();
+///
+/// // Untrusted scripts sent to a shared service
+/// let limits = ParseLimits::default()
+///     .with_max_script_size(1 << 20)
+///     .with_max_nodes(100_000)
+///     .with_max_time(Duration::from_millis(200));
+/// let ast = parse_with_limits("echo hello", &limits).unwrap();
+/// ```
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[non_exhaustive]
+pub struct ParseLimits {
+    /// Largest accepted script, in bytes
+    pub max_script_size: usize,
+    /// Deepest accepted nesting of commands
+    pub max_depth: usize,
+    /// Most commands, words and redirects in the AST
+    pub max_nodes: usize,
+    /// Most words, counting assignments, `for` and `select` lists, `case`
+    /// words and patterns, and the words of `(( ))` and `[[ ]]`
+    pub max_words: usize,
+    /// Most bytes of word text in all, redirect targets included
+    pub max_word_bytes: usize,
+    /// Most bytes of here-document text in all
+    pub max_heredoc_bytes: usize,
+    /// Longest bash's parser, and then the conversion, may each take
+    pub max_time: Option<Duration>,
+}
+
+impl ParseLimits {
+    /// No limits at all; only use with trusted input
+    #[must_use]
+    pub const fn unlimited() -> Self {
+        Self {
+            max_script_size: usize::MAX,
+            max_depth: usize::MAX,
+            max_nodes: usize::MAX,
+            max_words: usize::MAX,
+            max_word_bytes: usize::MAX,
+            max_heredoc_bytes: usize::MAX,
+            max_time: None,
+        }
+    }
+
+    /// Set the largest accepted script, in bytes
+    #[must_use]
+    pub const fn with_max_script_size(mut self, bytes: usize) -> Self {
+        self.max_script_size = bytes;
+        self
+    }
+
+    /// Set the deepest accepted nesting of commands
+    ///
+    /// Past [`MAX_DEPTH`], see there for what can safely be done with the
+    /// AST.
+    #[must_use]
+    pub const fn with_max_depth(mut self, depth: usize) -> Self {
+        self.max_depth = depth;
+        self
+    }
+
+    /// Set the most commands, words and redirects in the AST
+    ///
+    /// Commands are counted as bash builds them, one per `|`, `&&`, `||`,
+    /// `;` or `&` joining two, so a pipeline of three counts twice.
+    #[must_use]
+    pub const fn with_max_nodes(mut self, nodes: usize) -> Self {
+        self.max_nodes = nodes;
+        self
+    }
+
+    /// Set the most words
+    ///
+    /// Redirect targets count as words. While bash parses, its words are
+    /// counted as it makes them, so those of command substitutions count too.
+    #[must_use]
+    pub const fn with_max_words(mut self, words: usize) -> Self {
+        self.max_words = words;
+        self
+    }
+
+    /// Set the most bytes of word text
+    #[must_use]
+    pub const fn with_max_word_bytes(mut self, bytes: usize) -> Self {
+        self.max_word_bytes = bytes;
+        self
+    }
+
+    /// Set the most bytes of here-document text
+    #[must_use]
+    pub const fn with_max_heredoc_bytes(mut self, bytes: usize) -> Self {
+        self.max_heredoc_bytes = bytes;
+        self
+    }
+
+    /// Set the longest bash's parser, and then the conversion, may each take
+    #[must_use]
+    pub const fn with_max_time(mut self, time: Duration) -> Self {
+        self.max_time = Some(time);
+        self
+    }
+
+    /// Whether the AST's contents are budgeted, and so must be counted
+    const fn counts_contents(&self) -> bool {
+        self.max_nodes != usize::MAX
+            || self.max_words != usize::MAX
+            || self.max_word_bytes != usize::MAX
+            || self.max_heredoc_bytes != usize::MAX
+            || self.max_time.is_some()
+    }
+}
+
+impl Default for ParseLimits {
+    fn default() -> Self {
+        Self {
+            max_script_size: MAX_SCRIPT_SIZE,
+            max_depth: MAX_DEPTH,
+            ..Self::unlimited()
+        }
+    }
+}
+
+/// A part of a [`ParseLimits`] budget that a parse went over
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[non_exhaustive]
+pub enum Limit {
+    /// `max_nodes`
+    Nodes,
+    /// `max_words`
+    Words,
+    /// `max_word_bytes`
+    WordBytes,
+    /// `max_heredoc_bytes`
+    HeredocBytes,
+    /// `max_time`
+    Time,
+}
+
+impl std::fmt::Display for Limit {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str(match self {
+            Self::Nodes => "too many nodes",
+            Self::Words => "too many words",
+            Self::WordBytes => "too much word text",
+            Self::HeredocBytes => "too much here-document text",
+            Self::Time => "took too long",
+        })
+    }
+}
+
 /// Errors that can occur during parsing
 #[derive(Debug, Error)]
 pub enum ParseError {
-    /// The input contained a syntax error
+    /// The input contained a syntax error, with bash's report of where
     #[error("Syntax error in script{}", .0.as_ref().map(|d| format!(": {d}")).unwrap_or_default())]
-    SyntaxError(Option<String>),
+    SyntaxError(Option<Box<SyntaxErrorDetail>>),
 
     /// Failed to convert the parsed AST
     #[error("Failed to convert AST to Rust types{}", .0.as_ref().map(|d| format!(": {d}")).unwrap_or_default())]
@@ -80,8 +319,29 @@ pub enum ParseError {
     EmptyInput,
 
     /// The input exceeded the maximum allowed size
-    #[error("Input too large (max {} bytes)", MAX_SCRIPT_SIZE)]
+    #[error("Input too large (exceeds the script size limit)")]
     InputTooLarge,
+
+    /// The parse went over a part of its [`ParseLimits`] budget
+    #[error("Parse limit exceeded: {0}")]
+    LimitExceeded(Limit),
+
+    /// The parse was cancelled through its [`CancelToken`], or its deadline
+    /// passed
+    #[error("Parse cancelled")]
+    Cancelled,
+
+    /// The script file or descriptor could not be read
+    #[error("Failed to read script: {0}")]
+    Io(#[from] std::io::Error),
+
+    /// A `ParserPool` worker process exited while parsing
+    #[error("Parser worker process exited unexpectedly")]
+    WorkerCrashed,
+
+    /// Another `parse_iter()` stream is still active
+    #[error("Another parse_iter() stream is already active")]
+    StreamBusy,
 }
 
 /// Initialize bash internals for parsing
@@ -187,8 +447,201 @@ pub mod test_utils {
 /// Returns `ParseError::SyntaxError` if the script contains invalid bash syntax.
 /// Returns `ParseError::InvalidString` if the script contains NUL bytes.
 /// Returns `ParseError::EmptyInput` if the script is empty.
+/// Returns `ParseError::ConversionError` if the script nests deeper than `MAX_DEPTH`.
 pub fn parse(script: &str) -> Result<Command, ParseError> {
-    parse_internal(script, false)
+    parse_internal(script, false, ParseLimits::default())
+}
+
+/// Parse a bash script with a custom resource budget
+///
+/// Like [`parse()`], but rejects the script with `ParseError::InputTooLarge`
+/// according to `limits` rather than `MAX_SCRIPT_SIZE`, and fails with
+/// `ParseError::ConversionError` past `limits.max_depth` rather than
+/// `MAX_DEPTH`, and with `ParseError::LimitExceeded` past the rest of
+/// `limits`.
+pub fn parse_with_limits(script: &str, limits: &ParseLimits) -> Result<Command, ParseError> {
+    parse_internal(script, false, *limits)
+}
+
+/// Parse a bash script, sharing strings with earlier parses
+///
+/// Like [`parse_with_limits()`], but takes word, name and pattern text from
+/// `interner`, so every AST parsed with the same interner shares one
+/// allocation per distinct string. Worth it when many ASTs stay in memory at
+/// once; a one-off parse gains nothing.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_interned, Interner, ParseLimits};
+///
+/// init();
+///
+/// let mut interner = Interner::new();
+/// let limits = ParseLimits::default();
+/// let first = parse_interned("echo one", &limits, &mut interner).unwrap();
+/// let second = parse_interned("echo two", &limits, &mut interner).unwrap();
+/// assert_eq!(interner.stats().hits, 1);
+/// # drop((first, second));
+/// ```
+pub fn parse_interned(
+    script: &str,
+    limits: &ParseLimits,
+    interner: &mut Interner,
+) -> Result<Command, ParseError> {
+    parse_with_options(
+        script,
+        ParseOptions::new()
+            .with_limits(limits)
+            .with_interner(interner),
+    )
+}
+
+/// Parse a bash script, flattening lists into sequences
+///
+/// Like [`parse_with_limits()`], but each chain of commands joined by
+/// operators of equal precedence becomes one [`Command::Sequence`] rather
+/// than a `Command::List` per operator. A script of many statements is then
+/// one node with a child per statement instead of a tree nested a level
+/// deeper per statement, which saves a box per statement and keeps walks
+/// over the AST shallow.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_flat, Command, ParseLimits};
+///
+/// init();
+///
+/// let script = "cd /tmp\nmake\nmake install";
+/// let cmd = parse_flat(script, &ParseLimits::default()).unwrap();
+/// match cmd {
+///     Command::Sequence { items, .. } => assert_eq!(items.len(), 3),
+///     _ => panic!("Expected sequence"),
+/// }
+/// ```
+///
+/// # Errors
+///
+/// Returns the same errors as [`parse_with_limits()`].
+pub fn parse_flat(script: &str, limits: &ParseLimits) -> Result<Command, ParseError> {
+    parse_with_options(
+        script,
+        ParseOptions::new().with_limits(limits).with_flat_lists(),
+    )
+}
+
+/// Parse a bash script, building simple command lines without bash
+///
+/// Like [`parse_with_limits()`], and returns the same AST, but a script of
+/// one line of plain words and quoted strings joined by `|`, `&&`, `||` and
+/// `;` - most shell history and one-liners - is turned into a [`Command`]
+/// directly, without going through bash's parser. Anything else, from a
+/// `$` or a redirect to a second line, is parsed by bash as usual; call
+/// [`init()`] first as for [`parse()`].
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_fast, Command, ListOp, ParseLimits};
+///
+/// init();
+///
+/// let limits = ParseLimits::default();
+/// let cmd = parse_fast("make && make install", &limits).unwrap();
+/// assert!(matches!(cmd, Command::List { op: ListOp::And, .. }));
+///
+/// // Parsed by bash
+/// let cmd = parse_fast("for f in *.sh; do shellcheck \"$f\"; done", &limits).unwrap();
+/// assert!(matches!(cmd, Command::For { .. }));
+/// ```
+///
+/// # Errors
+///
+/// Returns the same errors as [`parse_with_limits()`].
+pub fn parse_fast(script: &str, limits: &ParseLimits) -> Result<Command, ParseError> {
+    fast_path::parse(script, limits).map_or_else(|| parse_with_limits(script, limits), Ok)
+}
+
+/// Parse a bash script, keeping the trees of its command substitutions
+///
+/// Like [`parse_with_limits()`], but each [`Word`] of a simple command
+/// also holds the commands of the `$(...)`, `<(...)` and `>(...)`
+/// substitutions written in it, in [`Word::substitutions`]. Bash parses
+/// every substitution in full while reading the word and then keeps only
+/// its text; these are the trees it built then, so a whole script,
+/// substitutions included, is analysed from one parse rather than by
+/// parsing each substitution's text again. Substitutions nest: words inside
+/// a substitution hold the substitutions written in them.
+///
+/// Substitutions in assignments, redirect targets, `for` and `select`
+/// lists and `case` words stay text only.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_with_substitutions, Command, ParseLimits};
+///
+/// init();
+///
+/// let cmd = parse_with_substitutions("echo $(date +%s)", &ParseLimits::default()).unwrap();
+/// if let Command::Simple { words, .. } = cmd {
+///     assert!(matches!(words[1].substitutions[0], Command::Simple { .. }));
+/// }
+/// ```
+///
+/// # Errors
+///
+/// Returns the same errors as [`parse_with_limits()`].
+#[cfg(target_os = "linux")]
+pub fn parse_with_substitutions(script: &str, limits: &ParseLimits) -> Result<Command, ParseError> {
+    parse_with_options(
+        script,
+        ParseOptions::new().with_limits(limits).with_substitutions(),
+    )
+}
+
+/// Parse a bash script, recording where each node is in it
+///
+/// Like [`parse_with_limits()`], but commands, [`Word`]s and
+/// [`Redirect`]s also get a [`Span`] where one can be placed: byte
+/// offsets into `script`, and the lines and columns they fall on.
+///
+/// Bash keeps no positions itself. All that is recorded is where its lexer
+/// was when it made each word and redirect and each `case`, `(( ))` and
+/// `[[ ]]` command, which is a word's end and at or past the others' ends.
+/// Starts, and the extents of everything else, are found by reading the
+/// script back from there: a word's text, a redirect's operator, and a
+/// compound command's keywords around its children. Where the script
+/// doesn't read as expected, say because an alias or a line continuation
+/// changed a word's text, the node has no span rather than a wrong one.
+///
+/// A here-document's body is not part of its redirect's span, the commands
+/// of substitutions have no spans (see [`parse_with_substitutions()`]), and
+/// [`parse_to_json_writer()`] doesn't write spans; convert with this
+/// function and write with [`to_json()`] or [`write_json()`] instead.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_with_spans, Command, ParseLimits};
+///
+/// init();
+///
+/// let cmd = parse_with_spans("echo hi > out", &ParseLimits::default()).unwrap();
+/// if let Command::Simple { words, redirects, span, .. } = cmd {
+///     assert_eq!(span.map(|span| span.end), Some(13));
+///     assert_eq!(words[1].span.as_ref().map(|span| span.start), Some(5));
+///     assert_eq!(redirects[0].span.as_ref().map(|span| span.start), Some(8));
+/// }
+/// ```
+///
+/// # Errors
+///
+/// Returns the same errors as [`parse_with_limits()`].
+#[cfg(target_os = "linux")]
+pub fn parse_with_spans(script: &str, limits: &ParseLimits) -> Result<Command, ParseError> {
+    parse_with_options(script, ParseOptions::new().with_limits(limits).with_spans())
 }
 
 /// Parse a bash script with error messages printed to stderr
@@ -218,56 +671,297 @@ pub fn parse(script: &str) -> Result<Command, ParseError> {
 /// assert!(result.is_err());
 /// ```
 pub fn parse_verbose(script: &str) -> Result<Command, ParseError> {
-    parse_internal(script, true)
+    parse_internal(script, true, ParseLimits::default())
+}
+
+/// `safe_parse_error()`: the message of the last parse's first syntax error,
+/// with its line, token, expected token, offending line and lexer offset
+type SyntaxErrorFn = unsafe extern "C" fn(
+    *mut c_int,
+    *mut *const c_char,
+    *mut *const c_char,
+    *mut *const c_char,
+    *mut usize,
+) -> *const c_char;
+
+/// C entry points of one copy of bash's parser
+///
+/// The statically linked parser uses the bindgen functions directly; each
+/// `ParserInstance` resolves its own copies from a private namespace.
+#[derive(Clone, Copy)]
+struct ParserApi {
+    parse_buffer: unsafe extern "C" fn(*const c_char, usize) -> *mut ffi::COMMAND,
+    input_had_nul: unsafe extern "C" fn() -> c_int,
+    syntax_error: SyntaxErrorFn,
+    dispose_command: unsafe extern "C" fn(*mut ffi::COMMAND),
+    set_budget: unsafe extern "C" fn(usize, u64),
+    budget_exceeded: unsafe extern "C" fn() -> c_int,
+    set_cancel: unsafe extern "C" fn(*const c_int),
+}
+
+/// The statically linked parser's entry points
+fn static_api(verbose: bool) -> ParserApi {
+    ParserApi {
+        parse_buffer: if verbose {
+            ffi::safe_parse_buffer_verbose
+        } else {
+            ffi::safe_parse_buffer
+        },
+        input_had_nul: ffi::safe_parse_input_had_nul,
+        syntax_error: ffi::safe_parse_error,
+        dispose_command: ffi::dispose_command,
+        set_budget: ffi::safe_parse_set_budget,
+        budget_exceeded: ffi::safe_parse_budget_exceeded,
+        set_cancel: ffi::safe_parse_set_cancel,
+    }
 }
 
 /// Internal parse implementation shared by `parse()` and `parse_verbose()`
-fn parse_internal(script: &str, verbose: bool) -> Result<Command, ParseError> {
-    if script.len() > MAX_SCRIPT_SIZE {
+fn parse_internal(script: &str, verbose: bool, limits: ParseLimits) -> Result<Command, ParseError> {
+    // SAFETY: these are the statically linked parser's own entry points
+    unsafe { parse_with(&static_api(verbose), script, &limits) }
+}
+
+/// Parse a script with the given copy of the parser
+///
+/// # Safety
+///
+/// `api` must point into an initialized parser that no other thread is
+/// using for the duration of the call.
+unsafe fn parse_with(
+    api: &ParserApi,
+    script: &str,
+    limits: &ParseLimits,
+) -> Result<Command, ParseError> {
+    with_parsed(api, script, limits, |cmd_ptr| {
+        // Unwrap the artificial group that safe_parse_buffer adds
+        convert_script(convert::Converter::default().with_limits(limits), cmd_ptr)
+    })
+}
+
+/// Parse a script and hand bash's command tree to `f`
+///
+/// The tree is disposed once `f` returns.
+///
+/// # Safety
+///
+/// As for `parse_with`.
+unsafe fn with_parsed<T>(
+    api: &ParserApi,
+    script: &str,
+    limits: &ParseLimits,
+    f: impl FnOnce(*mut ffi::COMMAND) -> Result<T, ParseError>,
+) -> Result<T, ParseError> {
+    let cmd_ptr = parse_tree(api, script, limits, &Interrupt::NONE)?;
+    let result = f(cmd_ptr);
+
+    // Clean up the parsed command
+    (api.dispose_command)(cmd_ptr);
+
+    result
+}
+
+/// Parse a script into bash's command tree, which the caller must dispose
+///
+/// The returned pointer is never null.
+///
+/// # Safety
+///
+/// As for `parse_with`.
+unsafe fn parse_tree(
+    api: &ParserApi,
+    script: &str,
+    limits: &ParseLimits,
+    interrupt: &Interrupt<'_>,
+) -> Result<*mut ffi::COMMAND, ParseError> {
+    // Bash only skips ASCII blanks, but text that is all Unicode whitespace
+    // has always been rejected as empty
+    if script.len() <= limits.max_script_size && script.trim().is_empty() {
+        return Err(ParseError::EmptyInput);
+    }
+    parse_tree_bytes(api, script.as_bytes(), limits, interrupt)
+}
+
+/// Parse a script of arbitrary bytes into bash's command tree, which the
+/// caller must dispose
+///
+/// The returned pointer is never null.
+///
+/// # Safety
+///
+/// As for `parse_with`.
+unsafe fn parse_tree_bytes(
+    api: &ParserApi,
+    bytes: &[u8],
+    limits: &ParseLimits,
+    interrupt: &Interrupt<'_>,
+) -> Result<*mut ffi::COMMAND, ParseError> {
+    if bytes.len() > limits.max_script_size {
         return Err(ParseError::InputTooLarge);
     }
 
-    if script.trim().is_empty() {
+    if bytes.trim_ascii().is_empty() {
         return Err(ParseError::EmptyInput);
     }
 
-    let c_script = CString::new(script)?;
+    if interrupt.is_due() {
+        return Err(ParseError::Cancelled);
+    }
 
-    // SAFETY: safe_parse_script/safe_parse_verbose are C wrappers that use
-    // setjmp/longjmp to safely catch parser errors. The CString is valid for
-    // the duration of the call.
-    unsafe {
-        let cmd_ptr = if verbose {
-            ffi::safe_parse_verbose(c_script.as_ptr().cast_mut(), 0)
-        } else {
-            ffi::safe_parse_script(c_script.as_ptr().cast_mut(), 0)
-        };
+    // Bash's parser stops early once it has made too many words, run out of
+    // time or been cancelled. A deadline sooner than `max_time` takes its
+    // place.
+    let time_left = interrupt.time_left();
+    let by_deadline = time_left.is_some_and(|left| limits.max_time.is_none_or(|max| left < max));
+    let time = if by_deadline {
+        time_left
+    } else {
+        limits.max_time
+    };
+    (api.set_budget)(limits.max_words.min(limits.max_nodes), budget_micros(time));
+    (api.set_cancel)(interrupt.flag());
 
-        if cmd_ptr.is_null() {
-            return Err(ParseError::SyntaxError(None));
+    // The parse_buffer functions are C wrappers that catch parser errors.
+    // They read the script straight from the borrowed buffer (no CString
+    // copy, no NUL terminator needed), which stays valid for the duration of
+    // the call.
+    let cmd_ptr = (api.parse_buffer)(bytes.as_ptr().cast(), bytes.len());
+
+    if cmd_ptr.is_null() {
+        if let Some(e) = budget_error((api.budget_exceeded)(), limits, by_deadline) {
+            return Err(e);
         }
+        // The lexer may have stopped before reaching a NUL byte, so check
+        // the whole script on this (cold) path
+        return Err(nul_error(bytes).unwrap_or_else(|| {
+            let detail = syntax_error_detail(api.syntax_error, bytes)
+                .map(|detail| Box::new(detail.unwrap_script_group(bytes)));
+            ParseError::SyntaxError(detail)
+        }));
+    }
 
-        let result = convert::convert_command(cmd_ptr).ok_or(ParseError::ConversionError(None));
+    // Bash's lexer drops NUL bytes silently; reject them like CString would
+    if (api.input_had_nul)() != 0 {
+        (api.dispose_command)(cmd_ptr);
+        return Err(nul_error(bytes).unwrap_or(ParseError::SyntaxError(None)));
+    }
 
-        // Clean up the parsed command
-        ffi::dispose_command(cmd_ptr);
+    Ok(cmd_ptr)
+}
 
-        // Unwrap the artificial group that safe_parse_script adds (not for verbose)
-        if verbose {
-            result
-        } else {
-            result.map(unwrap_script_group)
+/// `safe_parse_budget_exceeded()`: the parse made more words than allowed
+const BUDGET_WORDS: c_int = 1;
+/// `safe_parse_budget_exceeded()`: the parse ran out of time
+const BUDGET_TIME: c_int = 2;
+/// `safe_parse_budget_exceeded()`: the parse was cancelled
+const BUDGET_CANCELLED: c_int = 3;
+
+/// A parse time limit as `safe_parse_set_budget()` takes it: whole
+/// microseconds, and 0 for none
+fn budget_micros(time: Option<Duration>) -> u64 {
+    time.map_or(0, |time| {
+        u64::try_from(time.as_micros()).unwrap_or(u64::MAX).max(1)
+    })
+}
+
+/// The error for the budget `safe_parse_budget_exceeded()` says ran out,
+/// if any; `by_deadline` if the time limit was a caller's deadline
+const fn budget_error(
+    exceeded: c_int,
+    limits: &ParseLimits,
+    by_deadline: bool,
+) -> Option<ParseError> {
+    match exceeded {
+        BUDGET_WORDS if limits.max_nodes < limits.max_words => {
+            Some(ParseError::LimitExceeded(Limit::Nodes))
         }
+        BUDGET_WORDS => Some(ParseError::LimitExceeded(Limit::Words)),
+        BUDGET_TIME if by_deadline => Some(ParseError::Cancelled),
+        BUDGET_TIME => Some(ParseError::LimitExceeded(Limit::Time)),
+        BUDGET_CANCELLED => Some(ParseError::Cancelled),
+        _ => None,
+    }
+}
+
+/// The first syntax error the parser reported during its last parse, of
+/// `script`
+///
+/// # Safety
+///
+/// `syntax_error` must belong to the parser that just ran, and no other
+/// parse may have started since.
+unsafe fn syntax_error_detail(
+    syntax_error: SyntaxErrorFn,
+    script: &[u8],
+) -> Option<SyntaxErrorDetail> {
+    let mut line = 0;
+    let mut token = ptr::null();
+    let mut expected = ptr::null();
+    let mut source_line = ptr::null();
+    let mut offset = usize::MAX;
+    let message = syntax_error(
+        &raw mut line,
+        &raw mut token,
+        &raw mut expected,
+        &raw mut source_line,
+        &raw mut offset,
+    );
+
+    // The strings quote the script, which may not be UTF-8, and a token may
+    // cut a multi-byte character short
+    let text = |text: *const c_char| {
+        (!text.is_null()).then(|| CStr::from_ptr(text).to_string_lossy().into_owned())
+    };
+    Some(
+        SyntaxErrorDetail::new(
+            text(message)?,
+            u32::try_from(line).ok().filter(|&line| line > 0),
+            text(token),
+            text(expected),
+            text(source_line),
+        )
+        .at_offset(script, (offset != usize::MAX).then_some(offset)),
+    )
+}
+
+/// Build an `InvalidString` error if the script contains a NUL byte
+///
+/// Only called on error paths, so the copy `CString::new` makes is fine.
+fn nul_error(script: &[u8]) -> Option<ParseError> {
+    if script.contains(&0) {
+        CString::new(script).err().map(ParseError::InvalidString)
+    } else {
+        None
     }
 }
 
-/// Unwrap the group that `safe_parse_script` adds around scripts
+/// Convert a script's tree with `converter`, unwrapping the group it was
+/// parsed in
+///
+/// # Safety
+///
+/// `cmd_ptr` must point to a valid command tree.
+unsafe fn convert_script(
+    mut converter: convert::Converter<'_>,
+    cmd_ptr: *const ffi::COMMAND,
+) -> Result<Command, ParseError> {
+    converter
+        .convert(cmd_ptr)
+        .map(unwrap_script_group)
+        .ok_or_else(|| {
+            converter
+                .stopped()
+                .map_or(ParseError::ConversionError(None), ParseError::from)
+        })
+}
+
+/// Unwrap the group that `safe_parse_buffer` adds around scripts
 ///
 /// Since we wrap scripts in `{ ... }` to parse them as a single command,
 /// we need to unwrap that group to return the actual script content.
 fn unwrap_script_group(cmd: Command) -> Command {
     match cmd {
-        Command::Group { body, .. } => *body,
+        Command::Group { body, .. } => body.into_inner(),
         other => other,
     }
 }
@@ -297,22 +991,82 @@ fn unwrap_script_group(cmd: Command) -> Command {
 /// println!("{}", json);
 /// ```
 pub fn parse_to_json(script: &str, pretty: bool) -> Result<String, Box<dyn std::error::Error>> {
-    let ast = parse(script)?;
+    let mut json = Vec::new();
+    parse_to_json_writer(script, &ParseLimits::default(), pretty, &mut json)?;
+    Ok(String::from_utf8(json)?)
+}
 
-    let json = if pretty {
-        serde_json::to_string_pretty(&ast)?
-    } else {
-        serde_json::to_string(&ast)?
-    };
+/// Parse a bash script and write its AST as JSON to `writer`
+///
+/// The JSON is written straight from bash's parse tree, without building
+/// a [`Command`] first, which saves an allocation per node. Trees nested
+/// more than a few hundred levels deep are converted first and written with
+/// [`write_json()`], so any depth within `limits` is accepted. The output is
+/// byte-for-byte what serializing the result of [`parse_with_limits()`]
+/// with `serde_json` gives.
+///
+/// Wrap unbuffered writers such as files in a `BufWriter`.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_to_json_writer, ParseLimits};
+///
+/// init();
+///
+/// let stdout = std::io::stdout().lock();
+/// parse_to_json_writer("echo hello", &ParseLimits::default(), false, stdout).unwrap();
+/// ```
+///
+/// # Errors
+///
+/// Returns the same errors as [`parse_with_limits()`], and
+/// `ParseError::Io` if `writer` fails. Syntax errors are found before
+/// anything is written, but after other errors `writer` may hold
+/// partial output.
+pub fn parse_to_json_writer<W: std::io::Write>(
+    script: &str,
+    limits: &ParseLimits,
+    pretty: bool,
+    writer: W,
+) -> Result<(), ParseError> {
+    // SAFETY: these are the statically linked parser's own entry points,
+    // and the tree outlives the write
+    unsafe {
+        with_parsed(&static_api(false), script, limits, |cmd_ptr| {
+            let json_error = |e: serde_json::Error| {
+                if e.is_io() {
+                    ParseError::Io(e.into())
+                } else {
+                    ParseError::ConversionError(None)
+                }
+            };
+
+            let depth = convert::nesting_depth(
+                cmd_ptr,
+                limits.max_depth.min(convert::MAX_DIRECT_DEPTH) + 1,
+            );
+            if depth > limits.max_depth {
+                return Err(ParseError::ConversionError(None));
+            }
+            if depth <= convert::MAX_DIRECT_DEPTH && !limits.counts_contents() {
+                return convert::write_script_json(cmd_ptr, pretty, writer).map_err(json_error);
+            }
 
-    Ok(json)
+            // Too deep to write by recursion, or budgeted: build the AST,
+            // counting it, then write it from an explicit stack
+            let cmd = convert_script(convert::Converter::default().with_limits(limits), cmd_ptr)?;
+            write_json(&cmd, pretty, writer).map_err(json_error)
+        })
+    }
 }
 
 /// Generate JSON Schema for the Command AST
 ///
 /// Returns a JSON Schema (draft-07) describing the structure of the AST
-/// that `parse_to_json` outputs. This is useful for validation and
-/// documentation.
+/// that `parse_to_json` outputs, and the `sequence` commands that
+/// [`parse_flat()`] gives in place of lists. This is useful for validation
+/// and documentation.
 ///
 /// # Example
 ///
@@ -381,10 +1135,7 @@ mod tests {
         } = cmd
         {
             assert_eq!(variable, "i");
-            assert_eq!(
-                words,
-                Some(vec!["a".to_string(), "b".to_string(), "c".to_string()])
-            );
+            assert_eq!(words, Some(vec!["a".into(), "b".into(), "c".into()]));
         } else {
             panic!("Expected For command");
         }
@@ -423,6 +1174,35 @@ mod tests {
         assert!(matches!(result, Err(ParseError::SyntaxError(_))));
     }
 
+    // Details are recorded by wrapping parser_error(), which needs --wrap
+    #[cfg(target_os = "linux")]
+    #[test]
+    fn test_syntax_error_detail() {
+        setup();
+        let Err(ParseError::SyntaxError(Some(detail))) = parse("echo ok\nif then fi\n") else {
+            panic!("Expected a syntax error with details");
+        };
+        assert_eq!(detail.line, Some(2));
+        assert_eq!(detail.token.as_deref(), Some("then"));
+        assert_eq!(detail.column, Some(4));
+        assert_eq!(detail.source_line.as_deref(), Some("if then fi"));
+
+        // Running out of input is reported on the script's last line, not
+        // on the closing brace parse() adds
+        let Err(ParseError::SyntaxError(Some(detail))) = parse("while true; do\n  echo") else {
+            panic!("Expected a syntax error with details");
+        };
+        assert_eq!(detail.message, "syntax error: unexpected end of file");
+        assert_eq!(detail.line, Some(2));
+
+        let Err(ParseError::SyntaxError(Some(detail))) = parse("echo \"unterminated\n") else {
+            panic!("Expected a syntax error with details");
+        };
+        assert_eq!(detail.line, Some(1));
+        assert_eq!(detail.expected.as_deref(), Some("\""));
+        assert_eq!(detail.token, None);
+    }
+
     #[test]
     fn test_empty_input() {
         setup();
@@ -430,6 +1210,31 @@ mod tests {
         assert!(matches!(result, Err(ParseError::EmptyInput)));
     }
 
+    #[test]
+    fn test_parse_interned() {
+        setup();
+        let mut interner = Interner::new();
+        let limits = ParseLimits::default();
+        let script = "for f in *.sh; do echo \"$f\"; done";
+        let first = parse_interned(script, &limits, &mut interner).unwrap();
+        let second = parse_interned(script, &limits, &mut interner).unwrap();
+        assert_eq!(
+            serde_json::to_string(&first).unwrap(),
+            serde_json::to_string(&parse(script).unwrap()).unwrap()
+        );
+
+        let (Command::For { variable: a, .. }, Command::For { variable: b, .. }) =
+            (&first, &second)
+        else {
+            panic!("Expected For commands");
+        };
+        assert!(Symbol::ptr_eq(a, b));
+
+        // f, *.sh, echo, "$f" the first time; all hits the second
+        let stats = interner.stats();
+        assert_eq!((stats.lookups, stats.hits, stats.symbols), (8, 4, 4));
+    }
+
     #[test]
     fn test_json_output() {
         setup();
@@ -438,4 +1243,74 @@ mod tests {
         assert!(json.contains("echo"));
         assert!(json.contains("hello"));
     }
+
+    #[test]
+    fn test_json_writer_matches_ast() {
+        setup();
+        for script in [
+            "! true",
+            "a | ! b | c && ! d | e",
+            "sleep 1 &",
+            "x=1 y=2 cmd 2>&1 >out <<<\"$z\"",
+            "[[ ! -f a && ( b == c || d ) ]]",
+            "case $x in a|b) ;& c) echo ;;& *) ;; esac",
+            "for ((i=0; i<3; i++)); do (( j += i )); done",
+            "coproc worker { cat; } 2>/dev/null",
+            "f() { select s in; do :; done; }",
+            "echo caf\u{e9} \"\\\"\" $'\\t'",
+        ] {
+            let ast = parse(script).unwrap();
+            let mut json = Vec::new();
+            parse_to_json_writer(script, &ParseLimits::default(), false, &mut json).unwrap();
+            assert_eq!(
+                String::from_utf8(json).unwrap(),
+                serde_json::to_string(&ast).unwrap(),
+                "{script}"
+            );
+        }
+    }
+
+    #[test]
+    fn test_json_writer_errors() {
+        setup();
+        let mut json = Vec::new();
+        let result = parse_to_json_writer("if then fi", &ParseLimits::default(), true, &mut json);
+        assert!(matches!(result, Err(ParseError::SyntaxError(_))));
+        assert!(json.is_empty());
+
+        let limits = ParseLimits::default().with_max_script_size(4);
+        let result = parse_to_json_writer("echo hello", &limits, true, &mut json);
+        assert!(matches!(result, Err(ParseError::InputTooLarge)));
+    }
+
+    #[test]
+    fn test_content_limits() {
+        setup();
+        let script = "for f in *.txt; do cat \"$f\" > /dev/null; done\ncat <<EOF\nhello\nEOF";
+        assert!(parse_with_limits(script, &ParseLimits::default()).is_ok());
+
+        let exceeded = |limits: ParseLimits| match parse_with_limits(script, &limits) {
+            Err(ParseError::LimitExceeded(limit)) => Some(limit),
+            _ => None,
+        };
+        let limits = ParseLimits::default();
+        assert_eq!(exceeded(limits.with_max_nodes(5)), Some(Limit::Nodes));
+        assert_eq!(exceeded(limits.with_max_words(4)), Some(Limit::Words));
+        assert_eq!(
+            exceeded(limits.with_max_word_bytes(8)),
+            Some(Limit::WordBytes)
+        );
+        assert_eq!(
+            exceeded(limits.with_max_heredoc_bytes(3)),
+            Some(Limit::HeredocBytes)
+        );
+        assert_eq!(exceeded(limits.with_max_heredoc_bytes(6)), None);
+
+        let mut json = Vec::new();
+        let result = parse_to_json_writer(script, &limits.with_max_nodes(5), false, &mut json);
+        assert!(matches!(
+            result,
+            Err(ParseError::LimitExceeded(Limit::Nodes))
+        ));
+    }
 }
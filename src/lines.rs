@@ -0,0 +1,357 @@
+//! Parsing many small scripts, one per record
+//!
+//! Shell history and audit logs hold a command line per line. Parsing each
+//! line with [`parse()`](crate::parse) works, but [`parse_lines()`] reads
+//! such input a record at a time into one reused buffer, parses each
+//! record as a script of its own and yields it with the record's index, so
+//! a bad record costs only itself. Records that
+//! [`parse_fast()`](crate::parse_fast) can build skip bash altogether, and
+//! the rest go from the buffer to bash's parser as bytes, without being
+//! validated or copied first.
+
+use crate::cancel::Interrupt;
+use crate::{convert, fast_path, Command, ParseError, ParseLimits};
+use std::io::{self, BufRead, Read};
+use std::iter::FusedIterator;
+use std::marker::PhantomData;
+
+/// Parse each line of `reader` as a script of its own
+///
+/// A line ending in an unescaped backslash continues on the next line, as
+/// in a shell, so a record is one logical line. Use
+/// [`nul_delimited()`](Records::nul_delimited) for records that end with
+/// NUL bytes instead, such as multi-line scripts.
+///
+/// Records that are blank or hold only comments (like the timestamps in
+/// `.bash_history`) produce no items, but are still counted in the indices
+/// of those after them. A record that isn't UTF-8 is parsed as it is and
+/// converted as [`ParsedScript::to_owned()`](crate::ParsedScript::to_owned)
+/// converts it. Limits apply to each record on its own, and a record
+/// larger than `max_script_size` is skipped without being read into
+/// memory, yielding `ParseError::InputTooLarge`.
+///
+/// Iteration stops after an error reading `reader`, which is yielded as
+/// `ParseError::Io`.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_lines};
+///
+/// init();
+///
+/// let history = "ls -la\nif then fi\n#1700000000\ngit push\n";
+/// for record in parse_lines(history.as_bytes()) {
+///     match record.result {
+///         Ok(cmd) => println!("{}: {cmd:?}", record.index),
+///         Err(e) => eprintln!("{}: {e}", record.index), // 1: Syntax error...
+///     }
+/// }
+/// ```
+pub fn parse_lines<R: BufRead>(reader: R) -> Records<R> {
+    Records {
+        reader,
+        delimiter: b'\n',
+        limits: ParseLimits::default(),
+        record: Vec::new(),
+        index: 0,
+        done: false,
+        _not_send: PhantomData,
+    }
+}
+
+/// Iterator over the parsed records of an input, from [`parse_lines()`]
+pub struct Records<R> {
+    reader: R,
+    delimiter: u8,
+    limits: ParseLimits,
+    /// The current record, reused from one to the next
+    record: Vec<u8>,
+    /// Index of the next record
+    index: usize,
+    done: bool,
+    /// Records are parsed with bash's global parser state
+    _not_send: PhantomData<*const ()>,
+}
+
+/// What [`Records::read_record()`] found
+enum Found {
+    Record,
+    /// A record over the size limit, now skipped
+    TooLarge,
+    End,
+}
+
+/// One parsed record, from [`parse_lines()`]
+#[derive(Debug)]
+pub struct Record {
+    /// Index of the record in the input, counting from 0
+    pub index: usize,
+    /// The record's AST, or why it has none
+    pub result: Result<Command, ParseError>,
+}
+
+impl<R: BufRead> Records<R> {
+    /// End records with NUL bytes rather than newlines
+    ///
+    /// Backslashes before a NUL don't join records.
+    #[must_use]
+    pub const fn nul_delimited(mut self) -> Self {
+        self.delimiter = 0;
+        self
+    }
+
+    /// Check each record against `limits` rather than the defaults
+    #[must_use]
+    pub const fn with_limits(mut self, limits: &ParseLimits) -> Self {
+        self.limits = *limits;
+        self
+    }
+
+    /// Read the next record into `self.record`, without its delimiter
+    ///
+    /// Reads at most a byte more than `max_script_size`, and skips the rest
+    /// of a record that turns out larger.
+    fn read_record(&mut self) -> io::Result<Found> {
+        self.record.clear();
+        let max = self.limits.max_script_size;
+        let mut read = false;
+        loop {
+            let room = max.saturating_add(1) - self.record.len();
+            let room = u64::try_from(room).unwrap_or(u64::MAX);
+            let n = (&mut self.reader)
+                .take(room)
+                .read_until(self.delimiter, &mut self.record)?;
+            if n == 0 {
+                break;
+            }
+            read = true;
+            let complete = self.record.last() == Some(&self.delimiter);
+            let continued =
+                complete && self.delimiter == b'\n' && ends_in_continuation(&self.record);
+            if complete && !continued {
+                self.record.pop();
+            }
+            if self.record.len() > max {
+                self.skip_record()?;
+                return Ok(Found::TooLarge);
+            }
+            if !continued {
+                break;
+            }
+        }
+        Ok(if read { Found::Record } else { Found::End })
+    }
+
+    /// Skip the rest of the record begun in `self.record`, through its
+    /// delimiter
+    fn skip_record(&mut self) -> io::Result<()> {
+        let delimiter = self.delimiter;
+        let mut backslashes = if self.record.last() == Some(&delimiter) {
+            0
+        } else {
+            self.record
+                .iter()
+                .rev()
+                .take_while(|&&byte| byte == b'\\')
+                .count()
+        };
+        loop {
+            let buf = self.reader.fill_buf()?;
+            if buf.is_empty() {
+                return Ok(());
+            }
+            let end = buf.iter().position(|&byte| {
+                let ends = byte == delimiter && (delimiter != b'\n' || backslashes % 2 == 0);
+                backslashes = if byte == b'\\' { backslashes + 1 } else { 0 };
+                ends
+            });
+            let used = end.map_or(buf.len(), |i| i + 1);
+            self.reader.consume(used);
+            if end.is_some() {
+                return Ok(());
+            }
+        }
+    }
+}
+
+impl<R: BufRead> Iterator for Records<R> {
+    type Item = Record;
+
+    fn next(&mut self) -> Option<Record> {
+        while !self.done {
+            let index = self.index;
+            match self.read_record() {
+                Ok(Found::Record) => self.index += 1,
+                Ok(Found::TooLarge) => {
+                    self.index += 1;
+                    return Some(Record {
+                        index,
+                        result: Err(ParseError::InputTooLarge),
+                    });
+                }
+                Ok(Found::End) => self.done = true,
+                Err(e) => {
+                    self.done = true;
+                    return Some(Record {
+                        index,
+                        result: Err(ParseError::Io(e)),
+                    });
+                }
+            }
+            if !self.done && !is_blank(&self.record) {
+                return Some(Record {
+                    index,
+                    result: parse_record(&self.record, &self.limits),
+                });
+            }
+        }
+        None
+    }
+}
+
+impl<R: BufRead> FusedIterator for Records<R> {}
+
+/// Whether a line, newline included, ends in an unescaped backslash
+fn ends_in_continuation(line: &[u8]) -> bool {
+    let backslashes = line[..line.len() - 1]
+        .iter()
+        .rev()
+        .take_while(|&&byte| byte == b'\\')
+        .count();
+    backslashes % 2 == 1
+}
+
+/// Whether a record holds nothing but blanks and comments
+fn is_blank(record: &[u8]) -> bool {
+    record
+        .split(|&byte| byte == b'\n')
+        .all(|line| matches!(line.trim_ascii_start().first(), None | Some(b'#')))
+}
+
+/// Parse one record, as `parse_with_limits()` would if it took bytes
+fn parse_record(record: &[u8], limits: &ParseLimits) -> Result<Command, ParseError> {
+    let fast = std::str::from_utf8(record)
+        .ok()
+        .and_then(|script| fast_path::parse(script, limits));
+    if let Some(cmd) = fast {
+        return Ok(cmd);
+    }
+
+    let api = crate::static_api(false);
+    // SAFETY: these are the statically linked parser's own entry points
+    unsafe {
+        let cmd_ptr = crate::parse_tree_bytes(&api, record, limits, &Interrupt::NONE)?;
+        let result =
+            crate::convert_script(convert::Converter::default().with_limits(limits), cmd_ptr);
+        (api.dispose_command)(cmd_ptr);
+        result
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{init, parse};
+
+    fn setup() {
+        init();
+    }
+
+    /// Index and outcome of every record of `input`
+    fn outcomes(records: Records<&[u8]>) -> Vec<(usize, Result<String, String>)> {
+        records
+            .map(|record| {
+                let result = record
+                    .result
+                    .map(|cmd| crate::to_json(&cmd, false))
+                    .map_err(|e| e.to_string());
+                (record.index, result)
+            })
+            .collect()
+    }
+
+    #[test]
+    fn test_each_line_is_a_script() {
+        setup();
+        let input = b"ls -la\n\n#1700000000\nif then fi\necho $HOME | wc -c\n";
+        let outcomes = outcomes(parse_lines(&input[..]));
+
+        let indices: Vec<_> = outcomes.iter().map(|(index, _)| *index).collect();
+        assert_eq!(indices, [0, 3, 4]);
+        assert_eq!(
+            outcomes[0].1.as_deref(),
+            Ok(crate::to_json(&parse("ls -la").unwrap(), false).as_str())
+        );
+        assert!(outcomes[1].1.as_ref().unwrap_err().contains("Syntax error"));
+        assert_eq!(
+            outcomes[2].1.as_deref(),
+            Ok(crate::to_json(&parse("echo $HOME | wc -c").unwrap(), false).as_str())
+        );
+    }
+
+    #[test]
+    fn test_backslash_continues_line() {
+        setup();
+        let input = b"echo a \\\n  b\necho c\\\\\necho d";
+        let records: Vec<_> = parse_lines(&input[..])
+            .map(|record| (record.index, record.result.unwrap()))
+            .collect();
+        assert_eq!(records.len(), 3);
+        assert_eq!(
+            crate::to_json(&records[0].1, false),
+            crate::to_json(&parse("echo a \\\n  b").unwrap(), false)
+        );
+        assert_eq!(records[1].0, 1);
+        assert_eq!(records[2].0, 2);
+    }
+
+    #[test]
+    fn test_nul_delimited_records() {
+        setup();
+        let input = b"for i in 1 2\ndo echo $i\ndone\0\0# only a comment\n\0echo caf\xe9";
+        let outcomes = outcomes(parse_lines(&input[..]).nul_delimited());
+
+        let indices: Vec<_> = outcomes.iter().map(|(index, _)| *index).collect();
+        assert_eq!(indices, [0, 3]);
+        let (for_loop, non_utf8) = (&outcomes[0].1, &outcomes[1].1);
+        assert!(for_loop.as_ref().unwrap().starts_with(r#"{"type":"for""#));
+        assert!(non_utf8.as_ref().unwrap().contains("caf\u{fffd}"));
+    }
+
+    #[test]
+    fn test_limits_apply_per_record() {
+        setup();
+        let limits = ParseLimits::default().with_max_script_size(8);
+        let outcomes = outcomes(parse_lines(&b"echo hi\necho hello\n"[..]).with_limits(&limits));
+        assert!(outcomes[0].1.is_ok());
+        assert_eq!(outcomes[1].1, Err(ParseError::InputTooLarge.to_string()));
+    }
+
+    #[test]
+    fn test_oversized_record_is_skipped() {
+        setup();
+        let limits = ParseLimits::default().with_max_script_size(8);
+        let too_large = || Err::<String, _>(ParseError::InputTooLarge.to_string());
+        let ok = |script| Ok::<_, String>(crate::to_json(&parse(script).unwrap(), false));
+
+        // The continued lines go with the record; one of exactly the limit
+        // is read whole
+        let input = b"echo a \\\n  b c d e\\\n  f\necho hi\necho hello\necho hey\n";
+        assert_eq!(
+            outcomes(parse_lines(&input[..]).with_limits(&limits)),
+            [
+                (0, too_large()),
+                (1, ok("echo hi")),
+                (2, too_large()),
+                (3, ok("echo hey"))
+            ]
+        );
+
+        let input = b"echo hello\0echo hi";
+        assert_eq!(
+            outcomes(parse_lines(&input[..]).nul_delimited().with_limits(&limits)),
+            [(0, too_large()), (1, ok("echo hi"))]
+        );
+    }
+}
@@ -2,11 +2,18 @@
 //!
 //! Parses bash scripts and outputs JSON AST.
 
+#[cfg(target_os = "linux")]
+use bash_ast::parse_with_spans;
 use bash_ast::server::{default_socket_path, Server};
-use bash_ast::{init, parse_to_json, schema_json, to_bash, Command};
+#[cfg(unix)]
+use bash_ast::ScriptFile;
+use bash_ast::{
+    from_json_with_limits, init, parse_iter_with_limits, parse_lines, parse_to_json_writer,
+    schema_json, to_bash, to_json, write_json, ParseError, ParseLimits,
+};
 use std::env;
-use std::fs;
-use std::io::{self, BufRead, IsTerminal, Write};
+use std::fs::File;
+use std::io::{self, BufRead, BufReader, BufWriter, IsTerminal, Write};
 use std::process::ExitCode;
 
 const VERSION: &str = env!("CARGO_PKG_VERSION");
@@ -25,12 +32,22 @@ DESCRIPTION:
 
 ARGUMENTS:
     [FILE]    Bash script file to parse (or JSON AST with --to-bash).
-              Use '-' to read from stdin explicitly.
+              Use '-' to read from stdin explicitly. The file is mapped
+              into memory, so it must not change while bash-ast runs.
 
 OPTIONS:
     -h, --help             Print this help message and exit
     -V, --version          Print version information and exit
     -c, --compact          Output compact JSON (default: pretty-printed)
+    -n, --ndjson           Output one compact JSON line per top-level command,
+                           printed as soon as each command is parsed
+    -l, --lines            Parse each line as a script of its own, and output a
+                           compact JSON line for each: {"index":N,"ast":...} or
+                           {"index":N,"error":"..."}
+    -z, --null             Like --lines, for records that end in NUL bytes
+    -m, --max-size BYTES   Largest script to accept (default: 10485760, 0 = no limit)
+    -p, --spans            Include the source span (byte offsets, lines and
+                           columns) of each node that can be placed; Linux only
     -s, --schema           Print JSON Schema for the AST and exit
     -b, --to-bash          Convert JSON AST back to bash script
     -S, --server [PATH]    Start Unix socket server (default: $XDG_RUNTIME_DIR/bash-ast.sock)
@@ -51,6 +68,21 @@ EXAMPLES:
     # Compact output for piping
     bash-ast -c script.sh | jq '.commands[]'
 
+    # Stream top-level commands of a large script as NDJSON
+    bash-ast --ndjson big-script.sh | jq -c 'select(.type == "function")'
+
+    # Parse each command of a shell history, and list those bash rejects
+    bash-ast --lines ~/.bash_history | jq -c 'select(.error)'
+
+    # Parse multi-line scripts, one per NUL-terminated record
+    printf 'echo a\0if true\nthen :\nfi\0' | bash-ast --null
+
+    # Show where each command, word and redirect is in the script
+    bash-ast --spans script.sh
+
+    # Parse a generated installer larger than the default 10MB limit
+    bash-ast --max-size 0 installer.sh
+
     # Print JSON Schema for the AST output
     bash-ast --schema > schema.json
 
@@ -121,6 +153,11 @@ struct Config {
     help: bool,
     version: bool,
     compact: bool,
+    ndjson: bool,
+    lines: bool,
+    null: bool,
+    max_size: Option<usize>,
+    spans: bool,
     schema: bool,
     to_bash: bool,
     server: bool,
@@ -138,6 +175,22 @@ fn parse_args(args: &[String]) -> Result<Config, String> {
             "-h" | "--help" => config.help = true,
             "-V" | "--version" => config.version = true,
             "-c" | "--compact" => config.compact = true,
+            "-n" | "--ndjson" => config.ndjson = true,
+            "-l" | "--lines" => config.lines = true,
+            "-z" | "--null" => {
+                config.lines = true;
+                config.null = true;
+            }
+            "-m" | "--max-size" => {
+                let value = args_iter.next().ok_or_else(|| {
+                    format!("{arg} requires a value\nTry 'bash-ast --help' for usage.")
+                })?;
+                let bytes = value.parse::<usize>().map_err(|_| {
+                    format!("Invalid size for {arg}: {value}\nTry 'bash-ast --help' for usage.")
+                })?;
+                config.max_size = Some(if bytes == 0 { usize::MAX } else { bytes });
+            }
+            "-p" | "--spans" => config.spans = true,
             "-s" | "--schema" => config.schema = true,
             "-b" | "--to-bash" => config.to_bash = true,
             "-S" | "--server" => {
@@ -166,6 +219,19 @@ fn parse_args(args: &[String]) -> Result<Config, String> {
         );
     }
 
+    if config.lines && (config.to_bash || config.spans) {
+        return Err(
+            "Cannot combine --lines with --to-bash or --spans.\nTry 'bash-ast --help' for usage."
+                .to_string(),
+        );
+    }
+
+    if config.ndjson && config.spans {
+        return Err(
+            "Cannot combine --ndjson with --spans.\nTry 'bash-ast --help' for usage.".to_string(),
+        );
+    }
+
     if positional.len() > 1 {
         return Err(
             "Too many arguments. Expected at most one file.\nTry 'bash-ast --help' for usage."
@@ -231,18 +297,35 @@ where
         return ExitCode::SUCCESS;
     }
 
-    // Read content from file or stdin (use "-" to explicitly read from stdin)
-    let content = match config.file.as_deref() {
+    let limits = config.max_size.map_or_else(ParseLimits::default, |bytes| {
+        ParseLimits::default().with_max_script_size(bytes)
+    });
+
+    // Handle --lines: records are read and parsed one at a time
+    if config.lines {
+        init();
+        return run_lines(&config, input, &limits, &mut output, &mut error);
+    }
+
+    // Read content from file or stdin (use "-" to explicitly read from stdin).
+    // On Unix, files are memory-mapped rather than read into a String.
+    let script_file;
+    let stdin_content;
+    let content: &str = match config.file.as_deref() {
         Some("-") | None => {
             let mut content = String::new();
             if let Err(e) = input.read_to_string(&mut content) {
                 let _ = writeln!(error, "Error reading stdin: {e}");
                 return ExitCode::from(1);
             }
-            content
+            stdin_content = content;
+            &stdin_content
         }
-        Some(path) => match fs::read_to_string(path) {
-            Ok(content) => content,
+        Some(path) => match read_script(path) {
+            Ok(file) => {
+                script_file = file;
+                &script_file
+            }
             Err(e) => {
                 let _ = writeln!(error, "Error reading '{path}': {e}");
                 return ExitCode::from(1);
@@ -250,9 +333,10 @@ where
         },
     };
 
-    // Handle --to-bash: convert JSON AST to bash script
+    // Handle --to-bash: convert JSON AST to bash script. Reading and
+    // printing don't recurse, so the AST may nest to any depth.
     if config.to_bash {
-        let ast: Command = match serde_json::from_str(&content) {
+        let ast = match from_json_with_limits(content, &ParseLimits::unlimited()) {
             Ok(ast) => ast,
             Err(e) => {
                 let _ = writeln!(error, "Error parsing JSON: {e}");
@@ -266,11 +350,24 @@ where
     // Initialize bash parser
     init();
 
+    // Stream one JSON line per top-level command
+    if config.ndjson {
+        return write_ndjson(content, &limits, &mut output, &mut error);
+    }
+
     // Parse and output JSON
-    let pretty = !config.compact;
-    match parse_to_json(&content, pretty) {
-        Ok(json) => {
-            let _ = writeln!(output, "{json}");
+    // Buffered, so a script that fails to convert prints nothing
+    let mut json = Vec::new();
+    let written = if config.spans {
+        write_with_spans(content, &limits, !config.compact, &mut json)
+    } else {
+        parse_to_json_writer(content, &limits, !config.compact, &mut json)
+            .map_err(|e| e.to_string())
+    };
+    match written {
+        Ok(()) => {
+            json.push(b'\n');
+            let _ = output.write_all(&json);
             ExitCode::SUCCESS
         }
         Err(e) => {
@@ -280,9 +377,148 @@ where
     }
 }
 
+/// Map a script file
+#[cfg(unix)]
+fn read_script(path: &str) -> io::Result<ScriptFile> {
+    // SAFETY: as with other tools that map their input, FILE must not be
+    // changed while bash-ast runs (see --help)
+    unsafe { ScriptFile::open(path) }
+}
+
+/// Read a script file
+#[cfg(not(unix))]
+fn read_script(path: &str) -> io::Result<String> {
+    std::fs::read_to_string(path)
+}
+
+/// Write the AST of `content` as JSON with the span of each node
+///
+/// The AST is converted first, as spans are worked out during conversion.
+#[cfg(target_os = "linux")]
+fn write_with_spans(
+    content: &str,
+    limits: &ParseLimits,
+    pretty: bool,
+    json: &mut Vec<u8>,
+) -> Result<(), String> {
+    let cmd = parse_with_spans(content, limits).map_err(|e| e.to_string())?;
+    write_json(&cmd, pretty, json).map_err(|e| e.to_string())
+}
+
+#[cfg(not(target_os = "linux"))]
+fn write_with_spans(
+    _content: &str,
+    _limits: &ParseLimits,
+    _pretty: bool,
+    _json: &mut Vec<u8>,
+) -> Result<(), String> {
+    Err("--spans is only supported on Linux".to_string())
+}
+
+/// Write each top-level command of `content` as a compact JSON line
+///
+/// Lines are written as commands are parsed, so output for a large script
+/// starts immediately. Commands before a syntax error are still written.
+/// Each command is checked against `limits` on its own.
+fn write_ndjson<W: Write, E: Write>(
+    content: &str,
+    limits: &ParseLimits,
+    output: &mut W,
+    error: &mut E,
+) -> ExitCode {
+    for cmd in parse_iter_with_limits(content, limits) {
+        let written = cmd.map_err(|e| e.to_string()).and_then(|cmd| {
+            writeln!(output, "{}", to_json(&cmd, false)).map_err(|e| e.to_string())
+        });
+
+        if let Err(e) = written {
+            let _ = writeln!(error, "Error: {e}");
+            return ExitCode::from(1);
+        }
+    }
+    ExitCode::SUCCESS
+}
+
+/// Parse the records of the input file, or of stdin if there is none
+fn run_lines<R: BufRead, W: Write, E: Write>(
+    config: &Config,
+    input: R,
+    limits: &ParseLimits,
+    output: &mut W,
+    error: &mut E,
+) -> ExitCode {
+    match config.file.as_deref() {
+        Some("-") | None => write_records(input, config.null, limits, output, error),
+        Some(path) => match File::open(path) {
+            Ok(file) => write_records(BufReader::new(file), config.null, limits, output, error),
+            Err(e) => {
+                let _ = writeln!(error, "Error reading '{path}': {e}");
+                ExitCode::from(1)
+            }
+        },
+    }
+}
+
+/// Write a compact JSON line for each record of `input`, holding its index
+/// and either its AST or why it has none
+///
+/// A record that fails to parse doesn't stop the rest; only failing to read
+/// `input` or write `output` does.
+fn write_records<R: BufRead, W: Write, E: Write>(
+    input: R,
+    null: bool,
+    limits: &ParseLimits,
+    output: &mut W,
+    error: &mut E,
+) -> ExitCode {
+    let records = parse_lines(input).with_limits(limits);
+    let records = if null {
+        records.nul_delimited()
+    } else {
+        records
+    };
+
+    let mut output = BufWriter::new(output);
+    let mut line = Vec::new();
+    for record in records {
+        line.clear();
+        let _ = write!(line, "{{\"index\":{},", record.index);
+        let written = match record.result {
+            Ok(cmd) => {
+                line.extend_from_slice(b"\"ast\":");
+                write_json(&cmd, false, &mut line)
+            }
+            Err(ParseError::Io(e)) => {
+                let _ = writeln!(error, "Error reading input: {e}");
+                return ExitCode::from(1);
+            }
+            Err(e) => {
+                line.extend_from_slice(b"\"error\":");
+                serde_json::to_writer(&mut line, &e.to_string())
+            }
+        };
+        line.extend_from_slice(b"}\n");
+
+        let written = written
+            .map_err(|e| e.to_string())
+            .and_then(|()| output.write_all(&line).map_err(|e| e.to_string()));
+        if let Err(e) = written {
+            let _ = writeln!(error, "Error: {e}");
+            return ExitCode::from(1);
+        }
+    }
+
+    if let Err(e) = output.flush() {
+        let _ = writeln!(error, "Error: {e}");
+        return ExitCode::from(1);
+    }
+    ExitCode::SUCCESS
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
+    use bash_ast::Command;
     use std::io::Cursor;
 
     /// Test helper that captures output and runs the CLI
@@ -407,6 +643,121 @@ mod tests {
         assert_eq!(t.stdout.lines().count(), 1);
     }
 
+    #[test]
+    #[cfg(target_os = "linux")]
+    fn test_spans() {
+        let t = TestRun::new(&["-c", "--spans"], "echo hello");
+        assert!(t.success());
+        assert!(t.stdout.starts_with(
+            "{\"type\":\"simple\",\"line\":1,\"span\":{\"start\":0,\"end\":10,\"line\":1,"
+        ));
+        assert!(t.stdout.contains(
+            "{\"word\":\"hello\",\"span\":{\"start\":5,\"end\":10,\"line\":1,\"column\":6,"
+        ));
+    }
+
+    #[test]
+    fn test_ndjson_one_line_per_command() {
+        let t = TestRun::new(
+            &["--ndjson"],
+            "echo one\n\nfor i in a; do echo $i; done\npwd\n",
+        );
+        assert!(t.success());
+        let lines: Vec<_> = t.stdout.lines().collect();
+        assert_eq!(lines.len(), 3);
+        assert!(lines[0].starts_with("{\"type\":\"simple\""));
+        assert!(lines[1].starts_with("{\"type\":\"for\""));
+        assert!(t.stderr.is_empty());
+    }
+
+    #[test]
+    fn test_ndjson_syntax_error_keeps_earlier_commands() {
+        let t = TestRun::new(&["-n"], "echo one\nif then fi\n");
+        assert_eq!(t.exit_code, ExitCode::from(1));
+        assert_eq!(t.stdout.lines().count(), 1);
+        assert!(t.stderr.contains("Syntax error"));
+    }
+
+    #[test]
+    fn test_ndjson_max_size_applies_per_command() {
+        let t = TestRun::new(&["-n", "-m", "10"], "echo one\necho two\necho 0123456789\n");
+        assert_eq!(t.exit_code, ExitCode::from(1));
+        assert_eq!(t.stdout.lines().count(), 2);
+        assert!(t.stderr.contains("Input too large"));
+    }
+
+    #[test]
+    fn test_lines_one_record_per_line() {
+        let t = TestRun::new(
+            &["--lines"],
+            "echo one\n\nif then fi\ngrep -c x \\\n  file | wc -l\n",
+        );
+        assert!(t.success());
+        let lines: Vec<_> = t.stdout.lines().collect();
+        assert_eq!(lines.len(), 3);
+        assert!(lines[0].starts_with("{\"index\":0,\"ast\":{\"type\":\"simple\""));
+        assert!(lines[1].starts_with("{\"index\":2,\"error\":\"Syntax error"));
+        assert!(lines[2].starts_with("{\"index\":3,\"ast\":{\"type\":\"pipeline\""));
+        assert!(t.stderr.is_empty());
+    }
+
+    #[test]
+    fn test_null_records() {
+        let t = TestRun::new(&["-z", "-m", "14"], "if a\nthen :\nfi\0echo 0123456789\0");
+        assert!(t.success());
+        let lines: Vec<_> = t.stdout.lines().collect();
+        assert_eq!(lines.len(), 2);
+        assert!(lines[0].starts_with("{\"index\":0,\"ast\":{\"type\":\"if\""));
+        assert!(lines[1].starts_with("{\"index\":1,\"error\":\"Input too large"));
+    }
+
+    #[test]
+    fn test_lines_conflicts() {
+        let t = TestRun::new(&["--lines", "--to-bash"], "");
+        assert_eq!(t.exit_code, ExitCode::from(2));
+        assert!(t.stderr.contains("Cannot combine --lines"));
+    }
+
+    #[test]
+    fn test_ndjson_conflicts_with_spans() {
+        let t = TestRun::new(&["--ndjson", "--spans"], "echo hello");
+        assert_eq!(t.exit_code, ExitCode::from(2));
+        assert!(t.stderr.contains("Cannot combine --ndjson with --spans"));
+        assert!(t.stdout.is_empty());
+    }
+
+    #[test]
+    fn test_max_size_rejects_large_input() {
+        let t = TestRun::new(&["--max-size", "8"], "echo 0123456789");
+        assert_eq!(t.exit_code, ExitCode::from(1));
+        assert!(t.stderr.contains("Input too large"));
+
+        let t = TestRun::new(&["-m", "0"], "echo 0123456789");
+        assert!(t.success());
+    }
+
+    #[test]
+    fn test_max_size_requires_number() {
+        let t = TestRun::new(&["--max-size", "lots"], "echo hi");
+        assert_eq!(t.exit_code, ExitCode::from(2));
+        assert!(t.stderr.contains("Invalid size"));
+
+        let t = TestRun::new(&["--max-size"], "echo hi");
+        assert_eq!(t.exit_code, ExitCode::from(2));
+        assert!(t.stderr.contains("requires a value"));
+    }
+
+    #[test]
+    fn test_parse_file_argument() {
+        let path = std::env::temp_dir().join(format!("bash-ast-cli-{}.sh", std::process::id()));
+        std::fs::write(&path, "echo from file\n").unwrap();
+
+        let t = TestRun::new(&["-c", path.to_str().unwrap()], "");
+        let _ = std::fs::remove_file(&path);
+        assert!(t.success());
+        assert!(t.stdout.contains("\"from\""));
+    }
+
     #[test]
     fn test_syntax_error() {
         let t = TestRun::new(&[], "if then fi");
@@ -508,6 +859,20 @@ mod tests {
         assert!(t.stdout.contains("for i in a b c; do echo $i; done"));
     }
 
+    #[test]
+    fn test_to_bash_deeply_nested() {
+        // Far deeper than serde_json's own recursion limit of 128
+        let depth = 10_000;
+        let json = format!(
+            r#"{}{{"type":"simple","words":[{{"word":"true"}}],"redirects":[]}}{}"#,
+            r#"{"type":"group","body":"#.repeat(depth),
+            "}".repeat(depth)
+        );
+        let t = TestRun::new(&["--to-bash"], &json);
+        assert!(t.success(), "{}", t.stderr);
+        assert_eq!(t.stdout.matches("{ ").count(), depth);
+    }
+
     fn normalize_command(command: &Command) -> serde_json::Value {
         let mut value = serde_json::to_value(command).unwrap();
         normalize_value(&mut value);
@@ -0,0 +1,280 @@
+//! Choosing how one parse is done
+//!
+//! Each mode the crate offers - limits, flat lists, substitutions, spans,
+//! interning, cancellation and deadlines - is a setting of [`ParseOptions`],
+//! and [`parse_with_options()`] parses with any combination of them. The
+//! single-mode functions such as [`parse_flat()`](crate::parse_flat) and
+//! [`parse_with_spans()`](crate::parse_with_spans) are shorthands for it.
+
+use crate::cancel::Interrupt;
+#[cfg(target_os = "linux")]
+use crate::ffi;
+use crate::{convert, CancelToken, Command, Interner, ParseError, ParseLimits};
+use std::time::Instant;
+
+/// How to parse a script with [`parse_with_options()`]
+///
+/// Starts out as a plain [`parse_with_limits()`](crate::parse_with_limits)
+/// under the default limits; each `with_` method turns one more mode on.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_with_options, Command, ParseLimits, ParseOptions};
+///
+/// init();
+///
+/// let limits = ParseLimits::default().with_max_nodes(10_000);
+/// let options = ParseOptions::new().with_limits(&limits).with_flat_lists();
+/// let cmd = parse_with_options("cd /tmp\nmake\nmake install", options).unwrap();
+/// assert!(matches!(cmd, Command::Sequence { .. }));
+/// ```
+#[derive(Default)]
+#[must_use]
+pub struct ParseOptions<'a> {
+    limits: ParseLimits,
+    flat_lists: bool,
+    #[cfg(target_os = "linux")]
+    substitutions: bool,
+    #[cfg(target_os = "linux")]
+    spans: bool,
+    interner: Option<&'a mut Interner>,
+    token: Option<&'a CancelToken>,
+    deadline: Option<Instant>,
+}
+
+impl<'a> ParseOptions<'a> {
+    /// A plain parse under the default limits
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Parse under `limits`, as [`parse_with_limits()`](crate::parse_with_limits)
+    pub const fn with_limits(mut self, limits: &ParseLimits) -> Self {
+        self.limits = *limits;
+        self
+    }
+
+    /// Flatten lists into sequences, as [`parse_flat()`](crate::parse_flat)
+    pub const fn with_flat_lists(mut self) -> Self {
+        self.flat_lists = true;
+        self
+    }
+
+    /// Keep the trees of command substitutions, as
+    /// [`parse_with_substitutions()`](crate::parse_with_substitutions)
+    #[cfg(target_os = "linux")]
+    pub const fn with_substitutions(mut self) -> Self {
+        self.substitutions = true;
+        self
+    }
+
+    /// Record where each node is in the script, as
+    /// [`parse_with_spans()`](crate::parse_with_spans)
+    #[cfg(target_os = "linux")]
+    pub const fn with_spans(mut self) -> Self {
+        self.spans = true;
+        self
+    }
+
+    /// Share strings through `interner`, as
+    /// [`parse_interned()`](crate::parse_interned)
+    pub const fn with_interner(mut self, interner: &'a mut Interner) -> Self {
+        self.interner = Some(interner);
+        self
+    }
+
+    /// Give up once `token` is cancelled, as
+    /// [`parse_cancellable()`](crate::parse_cancellable)
+    pub const fn with_cancel(mut self, token: &'a CancelToken) -> Self {
+        self.token = Some(token);
+        self
+    }
+
+    /// Give up at `deadline`, as
+    /// [`parse_with_deadline()`](crate::parse_with_deadline)
+    pub const fn with_deadline(mut self, deadline: Instant) -> Self {
+        self.deadline = Some(deadline);
+        self
+    }
+}
+
+/// Parse a bash script in the modes `options` turns on
+///
+/// Any combination works: say spans over a flattened tree, or substitutions
+/// interned and bounded by a deadline. Each mode behaves as its own
+/// function documents.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_with_options, CancelToken, Command, Interner, ParseOptions};
+///
+/// init();
+///
+/// let mut interner = Interner::new();
+/// let token = CancelToken::new();
+/// let options = ParseOptions::new()
+///     .with_flat_lists()
+///     .with_interner(&mut interner)
+///     .with_cancel(&token);
+/// let cmd = parse_with_options("make\nmake install", options).unwrap();
+/// assert!(matches!(cmd, Command::Sequence { .. }));
+/// ```
+///
+/// # Errors
+///
+/// Returns the same errors as [`parse_with_limits()`](crate::parse_with_limits),
+/// and `ParseError::Cancelled` once the token is cancelled or the deadline
+/// has passed.
+pub fn parse_with_options(script: &str, options: ParseOptions<'_>) -> Result<Command, ParseError> {
+    let interrupt = Interrupt {
+        token: options.token,
+        deadline: options.deadline,
+    };
+    let api = crate::static_api(false);
+    // SAFETY: these are the statically linked parser's own entry points, and
+    // the captures and positions are read before anything else can parse
+    unsafe {
+        #[cfg(target_os = "linux")]
+        {
+            if options.substitutions {
+                ffi::safe_parse_capture_substitutions(1);
+            }
+            if options.spans {
+                ffi::safe_parse_record_positions(1);
+            }
+        }
+        let result =
+            crate::parse_tree(&api, script, &options.limits, &interrupt).and_then(|cmd_ptr| {
+                let mut converter = options
+                    .interner
+                    .map_or_else(
+                        convert::Converter::default,
+                        convert::Converter::with_interner,
+                    )
+                    .with_limits(&options.limits)
+                    .with_interrupt(&interrupt);
+                if options.flat_lists {
+                    converter = converter.with_flat_lists();
+                }
+                #[cfg(target_os = "linux")]
+                {
+                    if options.substitutions {
+                        converter =
+                            converter.with_substitutions(convert::Substitutions::captured());
+                    }
+                    if options.spans {
+                        converter =
+                            converter.with_spans(convert::Spans::captured(script.as_bytes()));
+                    }
+                }
+                let result = crate::convert_script(converter, cmd_ptr);
+                (api.dispose_command)(cmd_ptr);
+                result
+            });
+        #[cfg(target_os = "linux")]
+        {
+            // Stop capturing, which also frees the captured trees
+            if options.substitutions {
+                ffi::safe_parse_capture_substitutions(0);
+            }
+            if options.spans {
+                ffi::safe_parse_record_positions(0);
+            }
+        }
+        result
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{init, parse_flat, parse_interned, to_json};
+
+    fn setup() {
+        init();
+    }
+
+    #[test]
+    fn test_default_options_match_parse() {
+        setup();
+        let script = "for f in *.sh; do shellcheck \"$f\" || exit 1; done";
+        let cmd = parse_with_options(script, ParseOptions::new()).unwrap();
+        assert_eq!(
+            to_json(&cmd, false),
+            to_json(&crate::parse(script).unwrap(), false)
+        );
+    }
+
+    #[test]
+    fn test_flat_and_interned_combine() {
+        setup();
+        let script = "cd /tmp\nmake\nmake install";
+        let limits = ParseLimits::default();
+        let mut interner = Interner::new();
+        let options = ParseOptions::new()
+            .with_limits(&limits)
+            .with_flat_lists()
+            .with_interner(&mut interner);
+        let cmd = parse_with_options(script, options).unwrap();
+        assert!(matches!(&cmd, Command::Sequence { items, .. } if items.len() == 3));
+        assert_eq!(
+            to_json(&cmd, false),
+            to_json(&parse_flat(script, &limits).unwrap(), false)
+        );
+        // Both `make`s came from the interner
+        assert!(interner.stats().hits > 0);
+
+        let mut fresh = Interner::new();
+        let nested = parse_interned(script, &limits, &mut fresh).unwrap();
+        assert!(matches!(nested, Command::List { .. }));
+    }
+
+    #[test]
+    fn test_cancel_applies_with_other_modes() {
+        setup();
+        let token = CancelToken::new();
+        token.cancel();
+        let options = ParseOptions::new().with_flat_lists().with_cancel(&token);
+        assert!(matches!(
+            parse_with_options("echo a; echo b", options),
+            Err(ParseError::Cancelled)
+        ));
+        assert!(parse_with_options("echo a; echo b", ParseOptions::new()).is_ok());
+    }
+
+    #[cfg(target_os = "linux")]
+    #[test]
+    fn test_spans_over_flat_lists_and_substitutions() {
+        setup();
+        let script = "echo $(date)\nls -l > out";
+        let options = ParseOptions::new()
+            .with_flat_lists()
+            .with_substitutions()
+            .with_spans();
+        let cmd = parse_with_options(script, options).unwrap();
+        let Command::Sequence { items, .. } = cmd else {
+            panic!("Expected sequence");
+        };
+        let (Command::Simple { words, .. }, _) = &items[0] else {
+            panic!("Expected simple command");
+        };
+        assert!(matches!(words[1].substitutions[0], Command::Simple { .. }));
+        assert_eq!(words[1].span.as_deref().map(|span| span.start), Some(5));
+        let (Command::Simple { redirects, .. }, _) = &items[1] else {
+            panic!("Expected simple command");
+        };
+        assert_eq!(
+            redirects[0].span.as_deref().map(|span| span.start),
+            Some(19)
+        );
+
+        // Neither mode carries over to the next parse
+        let Command::Simple { words, .. } = crate::parse("echo $(date)").unwrap() else {
+            panic!("Expected simple command");
+        };
+        assert!(words[1].substitutions.is_empty());
+        assert!(words[1].span.is_none());
+    }
+}
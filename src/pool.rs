@@ -0,0 +1,1002 @@
+//! Multi-process parser pool
+//!
+//! Bash's parser keeps its state in C globals, so a single process can only
+//! run one parse at a time. `ParserPool` works around that with a set of
+//! worker processes: each worker owns a private copy of the parser state
+//! (shared copy-on-write with the parent until it is touched) and serves
+//! parse requests over a socket.
+//!
+//! Workers are not forked by the parent, whose other threads may hold locks
+//! (the allocator's among them) that a forked child would inherit held.
+//! Instead the pool forks a single-threaded spawner process once, when it
+//! is created, and the spawner forks every worker, including the
+//! replacements for workers that crash. It passes each worker's socket back
+//! over its control socket.
+//!
+//! Any number of threads can call [`ParserPool::parse`] concurrently; each
+//! call checks out an idle worker, so up to `workers` parses run in parallel.
+//! If a worker dies mid-parse the call fails with
+//! [`ParseError::WorkerCrashed`] and a replacement worker is spawned.
+//!
+//! # Protocol
+//!
+//! Every message is a little-endian `u32` length followed by that many bytes.
+//! Requests carry the parse's [`ParseLimits`] as [`LIMITS_LEN`] bytes (see
+//! [`encode_limits`]), then the UTF-8 script. A reply to a successful parse is
+//! [`COMMAND_REPLY`] followed by the command's JSON, written and read
+//! without recursion so any depth gets through; other replies carry a
+//! JSON-encoded [`Reply`].
+
+use crate::{
+    from_json_with_limits, nul_error, parse, parse_with_limits, write_json, Command, Limit,
+    ParseError, ParseLimits, SyntaxErrorDetail,
+};
+use serde::{Deserialize, Serialize};
+use std::ffi::c_void;
+use std::io::{self, Read, Write};
+use std::mem::size_of;
+use std::net::Shutdown;
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+use std::os::unix::net::UnixStream;
+use std::panic::{self, AssertUnwindSafe};
+use std::sync::{Arc, Condvar, Mutex, MutexGuard, PoisonError};
+use std::time::Duration;
+
+/// First byte of a reply carrying a command, which no JSON text starts with
+const COMMAND_REPLY: u8 = b'!';
+
+/// Bytes of the limits at the start of a request: seven little-endian
+/// `u64`s
+const LIMITS_LEN: usize = 7 * 8;
+
+/// Spawner request: fork a worker. The reply is its pid (or a negated
+/// `errno`) as a little-endian `i32`, with the parent's end of its socket
+/// attached.
+const SPAWN: u8 = b's';
+
+/// Spawner request: kill and reap the worker whose pid follows. No reply.
+const RETIRE: u8 = b'r';
+
+/// Signal used to tear down workers (same value on Linux and macOS)
+const SIGKILL: i32 = 9;
+
+/// `fcntl()` command and flag to close a descriptor on exec (same values on
+/// Linux and macOS)
+const F_SETFD: i32 = 2;
+const FD_CLOEXEC: i32 = 1;
+
+/// Socket option level and control message type for passing descriptors
+#[cfg(target_os = "linux")]
+const SOL_SOCKET: i32 = 1;
+#[cfg(not(target_os = "linux"))]
+const SOL_SOCKET: i32 = 0xffff;
+const SCM_RIGHTS: i32 = 1;
+
+/// Flags for `send()`: fail with `EPIPE` rather than raise `SIGPIPE`
+#[cfg(target_os = "linux")]
+const SEND_FLAGS: i32 = 0x4000; // MSG_NOSIGNAL
+#[cfg(not(target_os = "linux"))]
+const SEND_FLAGS: i32 = 0;
+
+/// macOS has no `MSG_NOSIGNAL`; the socket option does the same
+#[cfg(not(target_os = "linux"))]
+const SO_NOSIGPIPE: i32 = 0x1022;
+
+/// `struct iovec`
+#[repr(C)]
+struct IoVec {
+    base: *mut c_void,
+    len: usize,
+}
+
+/// Type of the control message sizes in `msghdr` and `cmsghdr`
+#[cfg(target_os = "linux")]
+type CmsgSize = usize;
+#[cfg(not(target_os = "linux"))]
+type CmsgSize = u32;
+
+/// `struct msghdr`
+#[cfg(target_os = "linux")]
+#[repr(C)]
+struct MsgHdr {
+    name: *mut c_void,
+    namelen: u32,
+    iov: *mut IoVec,
+    iovlen: usize,
+    control: *mut c_void,
+    controllen: CmsgSize,
+    flags: i32,
+}
+
+#[cfg(not(target_os = "linux"))]
+#[repr(C)]
+struct MsgHdr {
+    name: *mut c_void,
+    namelen: u32,
+    iov: *mut IoVec,
+    iovlen: i32,
+    control: *mut c_void,
+    controllen: CmsgSize,
+    flags: i32,
+}
+
+/// `struct cmsghdr`
+#[repr(C)]
+struct CmsgHdr {
+    len: CmsgSize,
+    level: i32,
+    kind: i32,
+}
+
+/// Alignment of control messages and their data (`CMSG_ALIGN`)
+#[cfg(target_os = "linux")]
+const CMSG_ALIGN: usize = size_of::<usize>();
+#[cfg(not(target_os = "linux"))]
+const CMSG_ALIGN: usize = 4;
+
+/// Offset of a control message's data (`CMSG_DATA`)
+const CMSG_DATA: usize = size_of::<CmsgHdr>().next_multiple_of(CMSG_ALIGN);
+
+/// Length and size of a control message carrying one descriptor
+/// (`CMSG_LEN` and `CMSG_SPACE`)
+#[allow(clippy::cast_possible_truncation, clippy::unnecessary_cast)]
+const CMSG_LEN: CmsgSize = (CMSG_DATA + size_of::<RawFd>()) as CmsgSize;
+#[allow(clippy::cast_possible_truncation, clippy::unnecessary_cast)]
+const CMSG_SPACE: CmsgSize =
+    (CMSG_DATA + size_of::<RawFd>()).next_multiple_of(CMSG_ALIGN) as CmsgSize;
+
+// Process primitives from libc - declared here to avoid a libc dependency
+extern "C" {
+    fn fork() -> i32;
+    fn waitpid(pid: i32, status: *mut i32, options: i32) -> i32;
+    fn kill(pid: i32, sig: i32) -> i32;
+    fn close(fd: i32) -> i32;
+    fn fcntl(fd: i32, cmd: i32, ...) -> i32;
+    fn send(fd: i32, buf: *const c_void, len: usize, flags: i32) -> isize;
+    fn sendmsg(fd: i32, msg: *const MsgHdr, flags: i32) -> isize;
+    fn recvmsg(fd: i32, msg: *mut MsgHdr, flags: i32) -> isize;
+    #[cfg(not(target_os = "linux"))]
+    fn setsockopt(fd: i32, level: i32, name: i32, value: *const c_void, len: u32) -> i32;
+    fn _exit(status: i32) -> !;
+}
+
+/// Parent-side sockets of every live spawner and worker, across all pools
+///
+/// A freshly forked spawner inherits all of these and closes them straight
+/// away; otherwise it would hold the other end of another pool's worker
+/// sockets, and that pool would stop seeing EOF when the worker crashes.
+/// The lock is held across `fork()` so the child gets a consistent copy,
+/// and while a worker's socket is received, so no spawner forks with it
+/// unlisted.
+static WORKER_FDS: Mutex<Vec<RawFd>> = Mutex::new(Vec::new());
+
+/// A pool of forked parser processes that can be shared between threads
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::ParserPool;
+/// use std::thread;
+///
+/// let pool = ParserPool::new(4).unwrap();
+///
+/// thread::scope(|s| {
+///     for script in ["echo one", "echo two", "echo three"] {
+///         let pool = &pool;
+///         s.spawn(move || pool.parse(script).unwrap());
+///     }
+/// });
+/// ```
+pub struct ParserPool {
+    state: Mutex<PoolState>,
+    available: Condvar,
+    spawner: Arc<Spawner>,
+}
+
+struct PoolState {
+    idle: Vec<Worker>,
+    /// Workers that exist, whether idle or checked out
+    live: usize,
+}
+
+impl ParserPool {
+    /// Start a pool with `workers` parser processes
+    ///
+    /// Initializes bash in the calling process first, so the workers start
+    /// with a ready parser and no per-worker setup cost.
+    ///
+    /// Call this early at startup, before the program starts other threads:
+    /// the pool's spawner process is forked from the calling thread, and a
+    /// child forked while another thread holds a lock inherits it held. The
+    /// spawner, and through it the workers, also inherit the caller's open
+    /// file descriptors (other than those of existing pools).
+    pub fn new(workers: usize) -> io::Result<Self> {
+        crate::init();
+        // Run bash's lazy initialization once here rather than in each worker
+        let _ = parse("true");
+
+        let spawner = Arc::new(Spawner::start()?);
+        let idle = (0..workers.max(1))
+            .map(|_| spawner.spawn())
+            .collect::<io::Result<Vec<_>>>()?;
+
+        Ok(Self {
+            state: Mutex::new(PoolState {
+                live: idle.len(),
+                idle,
+            }),
+            available: Condvar::new(),
+            spawner,
+        })
+    }
+
+    /// Number of live worker processes
+    #[must_use]
+    pub fn workers(&self) -> usize {
+        self.lock().live
+    }
+
+    /// Parse a bash script in one of the worker processes
+    ///
+    /// Behaves like [`crate::parse()`], and may be called from any thread.
+    /// Blocks until a worker is free.
+    ///
+    /// # Errors
+    ///
+    /// Returns the same errors as [`crate::parse()`], plus
+    /// `ParseError::WorkerCrashed` if the worker died while parsing (or no
+    /// worker could be started).
+    pub fn parse(&self, script: &str) -> Result<Command, ParseError> {
+        self.parse_with_limits(script, &ParseLimits::default())
+    }
+
+    /// Parse a bash script in one of the worker processes, with a custom
+    /// resource budget
+    ///
+    /// Behaves like [`crate::parse_with_limits()`]; the worker applies
+    /// `limits`, timing its own parse. Scripts too large for a request
+    /// frame (4 GiB) are rejected as too large whatever the limits.
+    ///
+    /// # Errors
+    ///
+    /// Returns the same errors as [`crate::parse_with_limits()`], plus
+    /// `ParseError::WorkerCrashed` if the worker died while parsing (or no
+    /// worker could be started).
+    pub fn parse_with_limits(
+        &self,
+        script: &str,
+        limits: &ParseLimits,
+    ) -> Result<Command, ParseError> {
+        // Cheap rejections don't need a round trip
+        if script.len() > limits.max_script_size
+            || u32::try_from(LIMITS_LEN + script.len()).is_err()
+        {
+            return Err(ParseError::InputTooLarge);
+        }
+        if script.trim().is_empty() {
+            return Err(ParseError::EmptyInput);
+        }
+
+        let mut worker = self.checkout()?;
+        if let Ok(reply) = worker.request(script, limits) {
+            self.checkin(worker);
+            return reply.into_result(script);
+        }
+
+        // Reap the dead worker before forking its replacement
+        drop(worker);
+        let replacement = self.spawner.spawn();
+        let mut state = self.lock();
+        match replacement {
+            Ok(worker) => state.idle.push(worker),
+            Err(_) => state.live -= 1,
+        }
+        drop(state);
+        // Wake a waiter either way: it gets the new worker, or notices there
+        // are none left
+        self.available.notify_one();
+        Err(ParseError::WorkerCrashed)
+    }
+
+    fn lock(&self) -> MutexGuard<'_, PoolState> {
+        self.state.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+
+    fn checkout(&self) -> Result<Worker, ParseError> {
+        let mut state = self.lock();
+        loop {
+            if let Some(worker) = state.idle.pop() {
+                return Ok(worker);
+            }
+            if state.live == 0 {
+                return Err(ParseError::WorkerCrashed);
+            }
+            state = self
+                .available
+                .wait(state)
+                .unwrap_or_else(PoisonError::into_inner);
+        }
+    }
+
+    fn checkin(&self, worker: Worker) {
+        self.lock().idle.push(worker);
+        self.available.notify_one();
+    }
+}
+
+/// Parent-side handle to a pool's spawner process
+struct Spawner {
+    pid: i32,
+    control: Mutex<Channel>,
+}
+
+impl Spawner {
+    /// Fork the spawner process
+    fn start() -> io::Result<Self> {
+        let mut fds = WORKER_FDS.lock().unwrap_or_else(PoisonError::into_inner);
+        let (parent_end, spawner_end) = UnixStream::pair()?;
+        let control = Channel::new(parent_end)?;
+
+        // SAFETY: the child only closes descriptors and runs the spawner
+        // loop, which leaves via _exit() without returning into the
+        // caller's stack frames
+        let pid = unsafe { fork() };
+        if pid < 0 {
+            return Err(io::Error::last_os_error());
+        }
+
+        if pid == 0 {
+            for &fd in fds.iter() {
+                // SAFETY: these are the parent's ends of other pools'
+                // sockets, which this process never uses
+                unsafe {
+                    close(fd);
+                }
+            }
+            drop(control);
+            run_spawner(&spawner_end);
+        }
+
+        drop(spawner_end);
+        fds.push(control.0.as_raw_fd());
+        Ok(Self {
+            pid,
+            control: Mutex::new(control),
+        })
+    }
+
+    /// Have the spawner fork a new worker
+    fn spawn(self: &Arc<Self>) -> io::Result<Worker> {
+        let mut fds = WORKER_FDS.lock().unwrap_or_else(PoisonError::into_inner);
+        let mut control = self.lock();
+        control.write_all(&[SPAWN, 0, 0, 0, 0])?;
+        let (pid, fd) = recv_fd(&control.0)?;
+        drop(control);
+
+        let fd = match fd {
+            Some(fd) if pid > 0 => fd,
+            _ if pid < 0 => return Err(io::Error::from_raw_os_error(-pid)),
+            _ => return Err(io::Error::other("the spawner sent no worker socket")),
+        };
+        let channel = Channel::new(UnixStream::from(fd))?;
+        fds.push(channel.0.as_raw_fd());
+        drop(fds);
+
+        Ok(Worker {
+            pid,
+            channel,
+            spawner: Arc::clone(self),
+        })
+    }
+
+    /// Have the spawner kill and reap a worker it forked
+    fn retire(&self, pid: i32) {
+        let mut request = [RETIRE, 0, 0, 0, 0];
+        request[1..].copy_from_slice(&pid.to_le_bytes());
+        // If the spawner is gone, so are its workers
+        let _ = self.lock().write_all(&request);
+    }
+
+    fn lock(&self) -> MutexGuard<'_, Channel> {
+        self.control.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+}
+
+impl Drop for Spawner {
+    fn drop(&mut self) {
+        let control = self
+            .control
+            .get_mut()
+            .unwrap_or_else(PoisonError::into_inner);
+        let fd = control.0.as_raw_fd();
+        WORKER_FDS
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner)
+            .retain(|&other| other != fd);
+
+        // The spawner exits once it reads EOF
+        let _ = control.0.shutdown(Shutdown::Both);
+        // SAFETY: pid is our own child, which has not been reaped yet
+        unsafe {
+            waitpid(self.pid, std::ptr::null_mut(), 0);
+        }
+    }
+}
+
+/// Spawner main loop: fork and reap workers until the parent closes the
+/// control socket
+///
+/// Each worker is forked from this process's only thread, so it may
+/// allocate and take locks freely. The loop itself does neither, as this
+/// process was forked from one that may have other threads.
+fn run_spawner(control: &UnixStream) -> ! {
+    let mut request = [0u8; 5];
+    let mut reader = control;
+    while reader.read_exact(&mut request).is_ok() {
+        let pid = i32::from_le_bytes([request[1], request[2], request[3], request[4]]);
+        match request[0] {
+            SPAWN => {
+                let sent = match fork_worker(control) {
+                    Ok((pid, stream)) => {
+                        let sent = send_fd(control, pid, Some(stream.as_raw_fd()));
+                        if sent.is_err() {
+                            retire(pid);
+                        }
+                        sent
+                    }
+                    Err(e) => send_fd(control, -e.raw_os_error().unwrap_or(1), None),
+                };
+                if sent.is_err() {
+                    break;
+                }
+            }
+            RETIRE => retire(pid),
+            _ => break,
+        }
+    }
+    // SAFETY: terminates the spawner without running the parent's atexit
+    // handlers or destructors
+    unsafe { _exit(0) }
+}
+
+/// Fork a worker from the spawner, returning its pid and the parent's end
+/// of its socket
+fn fork_worker(control: &UnixStream) -> io::Result<(i32, UnixStream)> {
+    let (parent_end, worker_end) = UnixStream::pair()?;
+
+    // SAFETY: the spawner has a single thread; the child only closes the
+    // spawner's descriptors, runs the parse loop and leaves via _exit()
+    let pid = unsafe { fork() };
+    if pid < 0 {
+        return Err(io::Error::last_os_error());
+    }
+
+    if pid == 0 {
+        // SAFETY: the control socket is the spawner's, which this process
+        // never uses
+        unsafe {
+            close(control.as_raw_fd());
+        }
+        drop(parent_end);
+
+        let status = match panic::catch_unwind(AssertUnwindSafe(|| serve(worker_end))) {
+            Ok(()) => 0,
+            Err(_) => 1,
+        };
+        // SAFETY: terminates the child without running the parent's
+        // atexit handlers or destructors
+        unsafe { _exit(status) }
+    }
+
+    Ok((pid, parent_end))
+}
+
+/// Kill and reap a worker of the spawner
+fn retire(pid: i32) {
+    // SAFETY: pid is a child of this process, which has not been reaped yet
+    // (the parent only retires each worker once)
+    unsafe {
+        kill(pid, SIGKILL);
+        waitpid(pid, std::ptr::null_mut(), 0);
+    }
+}
+
+/// Send `status` over `socket`, with `fd` attached if there is one
+fn send_fd(socket: &UnixStream, status: i32, fd: Option<RawFd>) -> io::Result<()> {
+    let mut payload = status.to_le_bytes();
+    let mut iov = IoVec {
+        base: payload.as_mut_ptr().cast(),
+        len: payload.len(),
+    };
+    let mut control = [0u64; 4];
+    // SAFETY: all-zero is a valid msghdr (null pointers, zero lengths)
+    let mut msg: MsgHdr = unsafe { std::mem::zeroed() };
+    msg.iov = &raw mut iov;
+    msg.iovlen = 1;
+
+    if let Some(fd) = fd {
+        let buffer = control.as_mut_ptr().cast::<u8>();
+        // SAFETY: `control` is 8-aligned and has room for CMSG_SPACE bytes
+        unsafe {
+            buffer.cast::<CmsgHdr>().write(CmsgHdr {
+                len: CMSG_LEN,
+                level: SOL_SOCKET,
+                kind: SCM_RIGHTS,
+            });
+            buffer.add(CMSG_DATA).cast::<RawFd>().write_unaligned(fd);
+        }
+        msg.control = buffer.cast();
+        msg.controllen = CMSG_SPACE;
+    }
+
+    loop {
+        // SAFETY: msg and everything it points to outlive the call
+        let sent = unsafe { sendmsg(socket.as_raw_fd(), &raw const msg, 0) };
+        match usize::try_from(sent) {
+            Ok(sent) if sent == payload.len() => return Ok(()),
+            Ok(_) => return Err(io::ErrorKind::WriteZero.into()),
+            Err(_) => {
+                let e = io::Error::last_os_error();
+                if e.kind() != io::ErrorKind::Interrupted {
+                    return Err(e);
+                }
+            }
+        }
+    }
+}
+
+/// Receive what [`send_fd`] sent: the status, and the descriptor if one was
+/// attached
+fn recv_fd(socket: &UnixStream) -> io::Result<(i32, Option<OwnedFd>)> {
+    let mut payload = [0u8; 4];
+    let mut iov = IoVec {
+        base: payload.as_mut_ptr().cast(),
+        len: payload.len(),
+    };
+    let mut control = [0u64; 4];
+    let buffer = control.as_mut_ptr().cast::<u8>();
+    // SAFETY: all-zero is a valid msghdr (null pointers, zero lengths)
+    let mut msg: MsgHdr = unsafe { std::mem::zeroed() };
+    msg.iov = &raw mut iov;
+    msg.iovlen = 1;
+    msg.control = buffer.cast();
+    msg.controllen = CMSG_SPACE;
+
+    let received = loop {
+        // SAFETY: msg and everything it points to outlive the call
+        let received = unsafe { recvmsg(socket.as_raw_fd(), &raw mut msg, 0) };
+        match usize::try_from(received) {
+            Ok(received) => break received,
+            Err(_) => {
+                let e = io::Error::last_os_error();
+                if e.kind() != io::ErrorKind::Interrupted {
+                    return Err(e);
+                }
+            }
+        }
+    };
+
+    // SAFETY: the kernel filled in `control` as far as msg.controllen says,
+    // and a descriptor it passed is ours to own
+    let fd = unsafe {
+        let header = buffer.cast::<CmsgHdr>().read();
+        if msg.controllen >= CMSG_LEN && header.level == SOL_SOCKET && header.kind == SCM_RIGHTS {
+            let fd = buffer.add(CMSG_DATA).cast::<RawFd>().read_unaligned();
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            Some(OwnedFd::from_raw_fd(fd))
+        } else {
+            None
+        }
+    };
+
+    if received != payload.len() {
+        return Err(io::ErrorKind::UnexpectedEof.into());
+    }
+    Ok((i32::from_le_bytes(payload), fd))
+}
+
+/// The parent's end of a socket to a spawner or worker
+///
+/// Writing to a socket whose other end is gone raises `SIGPIPE`, which
+/// kills the process unless it ignores the signal. Rust programs do, but C
+/// programs and other hosts of the library may not, so writes here fail
+/// with `EPIPE` instead and a dead worker shows up as
+/// `ParseError::WorkerCrashed`.
+struct Channel(UnixStream);
+
+impl Channel {
+    fn new(stream: UnixStream) -> io::Result<Self> {
+        #[cfg(not(target_os = "linux"))]
+        {
+            let on: i32 = 1;
+            // SAFETY: `on` is an int, as the option takes
+            let set = unsafe {
+                setsockopt(
+                    stream.as_raw_fd(),
+                    SOL_SOCKET,
+                    SO_NOSIGPIPE,
+                    (&raw const on).cast(),
+                    4,
+                )
+            };
+            if set != 0 {
+                return Err(io::Error::last_os_error());
+            }
+        }
+        Ok(Self(stream))
+    }
+}
+
+impl Read for Channel {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        self.0.read(buf)
+    }
+}
+
+impl Write for Channel {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        // SAFETY: buf is valid for buf.len() bytes
+        let sent = unsafe {
+            send(
+                self.0.as_raw_fd(),
+                buf.as_ptr().cast(),
+                buf.len(),
+                SEND_FLAGS,
+            )
+        };
+        usize::try_from(sent).map_err(|_| io::Error::last_os_error())
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        Ok(())
+    }
+}
+
+/// Parent-side handle to one worker process
+struct Worker {
+    pid: i32,
+    channel: Channel,
+    spawner: Arc<Spawner>,
+}
+
+impl Worker {
+    /// Send a script and the limits to parse it with, and wait for the
+    /// reply
+    ///
+    /// Any I/O error means the worker is gone (EOF or `EPIPE`).
+    fn request(&mut self, script: &str, limits: &ParseLimits) -> io::Result<Reply> {
+        let limits = encode_limits(limits);
+        let len = u32::try_from(limits.len() + script.len()).map_err(io::Error::other)?;
+        self.channel.write_all(&len.to_le_bytes())?;
+        self.channel.write_all(&limits)?;
+        self.channel.write_all(script.as_bytes())?;
+
+        let mut payload = Vec::new();
+        read_frame(&mut self.channel, &mut payload)?;
+        if let Some((&COMMAND_REPLY, json)) = payload.split_first() {
+            // The worker already enforced the depth budget
+            let json = std::str::from_utf8(json).map_err(io::Error::other)?;
+            return from_json_with_limits(json, &ParseLimits::unlimited())
+                .map(Reply::Ok)
+                .map_err(io::Error::other);
+        }
+        serde_json::from_slice(&payload).map_err(io::Error::other)
+    }
+}
+
+impl Drop for Worker {
+    fn drop(&mut self) {
+        let fd = self.channel.0.as_raw_fd();
+        WORKER_FDS
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner)
+            .retain(|&other| other != fd);
+
+        self.spawner.retire(self.pid);
+    }
+}
+
+/// Worker-side result of one parse, as sent back to the parent
+#[derive(Serialize, Deserialize)]
+enum Reply {
+    /// Sent as a [`COMMAND_REPLY`] rather than through serde
+    #[serde(skip)]
+    Ok(Command),
+    SyntaxError(Option<Box<SyntaxErrorDetail>>),
+    ConversionError(Option<String>),
+    InvalidString,
+    EmptyInput,
+    InputTooLarge,
+    LimitExceeded(Limit),
+    Cancelled,
+    Io(String),
+    WorkerCrashed,
+    StreamBusy,
+}
+
+impl From<Result<Command, ParseError>> for Reply {
+    fn from(result: Result<Command, ParseError>) -> Self {
+        match result {
+            Ok(cmd) => Self::Ok(cmd),
+            Err(ParseError::SyntaxError(detail)) => Self::SyntaxError(detail),
+            Err(ParseError::ConversionError(detail)) => Self::ConversionError(detail),
+            Err(ParseError::InvalidString(_)) => Self::InvalidString,
+            Err(ParseError::EmptyInput) => Self::EmptyInput,
+            Err(ParseError::InputTooLarge) => Self::InputTooLarge,
+            Err(ParseError::LimitExceeded(limit)) => Self::LimitExceeded(limit),
+            Err(ParseError::Cancelled) => Self::Cancelled,
+            Err(ParseError::Io(e)) => Self::Io(e.to_string()),
+            Err(ParseError::WorkerCrashed) => Self::WorkerCrashed,
+            Err(ParseError::StreamBusy) => Self::StreamBusy,
+        }
+    }
+}
+
+impl Reply {
+    fn into_result(self, script: &str) -> Result<Command, ParseError> {
+        match self {
+            Self::Ok(cmd) => Ok(cmd),
+            Self::SyntaxError(detail) => Err(ParseError::SyntaxError(detail)),
+            Self::ConversionError(detail) => Err(ParseError::ConversionError(detail)),
+            // NulError can't cross the pipe; rebuild it from the script
+            Self::InvalidString => {
+                Err(nul_error(script.as_bytes()).unwrap_or(ParseError::SyntaxError(None)))
+            }
+            Self::EmptyInput => Err(ParseError::EmptyInput),
+            Self::InputTooLarge => Err(ParseError::InputTooLarge),
+            Self::LimitExceeded(limit) => Err(ParseError::LimitExceeded(limit)),
+            Self::Cancelled => Err(ParseError::Cancelled),
+            Self::Io(message) => Err(ParseError::Io(io::Error::other(message))),
+            Self::WorkerCrashed => Err(ParseError::WorkerCrashed),
+            Self::StreamBusy => Err(ParseError::StreamBusy),
+        }
+    }
+}
+
+/// Worker main loop: parse scripts until the parent closes the socket
+fn serve(mut stream: UnixStream) {
+    let mut request = Vec::new();
+    let mut payload = Vec::new();
+    while read_frame(&mut stream, &mut request).is_ok() {
+        let Some((limits, script)) = request.split_first_chunk::<LIMITS_LEN>() else {
+            return;
+        };
+        let Ok(text) = std::str::from_utf8(script) else {
+            return;
+        };
+        payload.clear();
+        let encoded = match parse_with_limits(text, &decode_limits(limits)) {
+            Ok(cmd) => {
+                payload.push(COMMAND_REPLY);
+                write_json(&cmd, false, &mut payload)
+            }
+            Err(e) => serde_json::to_writer(&mut payload, &Reply::from(Err(e))),
+        };
+        if encoded.is_err() || write_frame(&mut stream, &payload).is_err() {
+            return;
+        }
+    }
+}
+
+/// The limits as sent at the start of a request
+///
+/// Sizes and counts go as they are, and `max_time` in nanoseconds, with
+/// `u64::MAX` for none.
+fn encode_limits(limits: &ParseLimits) -> [u8; LIMITS_LEN] {
+    let count = |n: usize| u64::try_from(n).unwrap_or(u64::MAX);
+    let time = limits.max_time.map_or(u64::MAX, |time| {
+        u64::try_from(time.as_nanos()).map_or(u64::MAX - 1, |nanos| nanos.min(u64::MAX - 1))
+    });
+    let fields = [
+        count(limits.max_script_size),
+        count(limits.max_depth),
+        count(limits.max_nodes),
+        count(limits.max_words),
+        count(limits.max_word_bytes),
+        count(limits.max_heredoc_bytes),
+        time,
+    ];
+    let mut bytes = [0u8; LIMITS_LEN];
+    for (chunk, field) in bytes.chunks_exact_mut(8).zip(fields) {
+        chunk.copy_from_slice(&field.to_le_bytes());
+    }
+    bytes
+}
+
+/// The limits [`encode_limits`] sent
+fn decode_limits(bytes: &[u8; LIMITS_LEN]) -> ParseLimits {
+    let mut fields = bytes
+        .chunks_exact(8)
+        .map(|chunk| u64::from_le_bytes(chunk.try_into().expect("chunks are 8 bytes")));
+    let mut count = || usize::try_from(fields.next().unwrap_or(0)).unwrap_or(usize::MAX);
+    let mut limits = ParseLimits::unlimited();
+    limits.max_script_size = count();
+    limits.max_depth = count();
+    limits.max_nodes = count();
+    limits.max_words = count();
+    limits.max_word_bytes = count();
+    limits.max_heredoc_bytes = count();
+    let time = fields.next().unwrap_or(u64::MAX);
+    limits.max_time = (time != u64::MAX).then(|| Duration::from_nanos(time));
+    limits
+}
+
+fn write_frame(writer: &mut impl Write, payload: &[u8]) -> io::Result<()> {
+    let len = u32::try_from(payload.len()).map_err(io::Error::other)?;
+    writer.write_all(&len.to_le_bytes())?;
+    writer.write_all(payload)
+}
+
+fn read_frame(reader: &mut impl Read, payload: &mut Vec<u8>) -> io::Result<()> {
+    let mut len = [0u8; 4];
+    reader.read_exact(&mut len)?;
+    payload.clear();
+    payload.resize(u32::from_le_bytes(len) as usize, 0);
+    reader.read_exact(payload)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::thread;
+
+    #[test]
+    fn test_pool_parses_script() {
+        let pool = ParserPool::new(2).unwrap();
+        let cmd = pool.parse("echo hello world").unwrap();
+
+        if let Command::Simple { words, .. } = cmd {
+            assert_eq!(words.len(), 3);
+            assert_eq!(words[2].word, "world");
+        } else {
+            panic!("Expected Simple command");
+        }
+    }
+
+    #[test]
+    fn test_pool_matches_in_process_parse() {
+        let pool = ParserPool::new(1).unwrap();
+        let script = "for i in a b c; do echo $i; done | grep a > out.txt";
+
+        let local = serde_json::to_string(&parse(script).unwrap()).unwrap();
+        let pooled = serde_json::to_string(&pool.parse(script).unwrap()).unwrap();
+        assert_eq!(local, pooled);
+    }
+
+    #[test]
+    fn test_pool_reports_errors() {
+        let pool = ParserPool::new(1).unwrap();
+
+        assert!(matches!(
+            pool.parse("if then fi"),
+            Err(ParseError::SyntaxError(_))
+        ));
+        assert!(matches!(pool.parse("   "), Err(ParseError::EmptyInput)));
+        assert!(matches!(
+            pool.parse("echo \0"),
+            Err(ParseError::InvalidString(_))
+        ));
+        // The worker is still usable after errors
+        assert!(pool.parse("echo ok").is_ok());
+    }
+
+    #[test]
+    fn test_pool_applies_limits() {
+        let pool = ParserPool::new(1).unwrap();
+
+        let limits = ParseLimits::default().with_max_script_size(8);
+        assert!(matches!(
+            pool.parse_with_limits("echo hello", &limits),
+            Err(ParseError::InputTooLarge)
+        ));
+        // Checked by the worker
+        let limits = ParseLimits::default().with_max_nodes(2);
+        assert!(matches!(
+            pool.parse_with_limits("echo a | cat | wc", &limits),
+            Err(ParseError::LimitExceeded(Limit::Nodes))
+        ));
+        let limits = ParseLimits::default().with_max_depth(1);
+        assert!(matches!(
+            pool.parse_with_limits("{ { { echo deep; }; }; }", &limits),
+            Err(ParseError::ConversionError(_))
+        ));
+
+        // Deeper than the default allows, and back whole
+        let script = "echo x\n".repeat(crate::MAX_DEPTH * 2);
+        let limits = ParseLimits::default().with_max_depth(usize::MAX);
+        let local = crate::to_json(&parse_with_limits(&script, &limits).unwrap(), false);
+        let pooled = crate::to_json(&pool.parse_with_limits(&script, &limits).unwrap(), false);
+        assert_eq!(local, pooled);
+        assert!(pool.parse(&script).is_err());
+    }
+
+    #[test]
+    fn test_limits_round_trip() {
+        let limits = ParseLimits::unlimited()
+            .with_max_script_size(1)
+            .with_max_depth(2)
+            .with_max_nodes(3)
+            .with_max_words(4)
+            .with_max_word_bytes(5)
+            .with_max_heredoc_bytes(6)
+            .with_max_time(Duration::from_millis(7));
+        for limits in [limits, ParseLimits::default(), ParseLimits::unlimited()] {
+            assert_eq!(decode_limits(&encode_limits(&limits)), limits);
+        }
+    }
+
+    #[test]
+    fn test_pool_concurrent_parses() {
+        let pool = ParserPool::new(4).unwrap();
+
+        thread::scope(|s| {
+            for t in 0..8 {
+                let pool = &pool;
+                s.spawn(move || {
+                    for i in 0..25 {
+                        let script = format!("echo thread{t} item{i}");
+                        let Command::Simple { words, .. } = pool.parse(&script).unwrap() else {
+                            panic!("Expected Simple command");
+                        };
+                        assert_eq!(words[1].word, format!("thread{t}"));
+                        assert_eq!(words[2].word, format!("item{i}"));
+                    }
+                });
+            }
+        });
+
+        assert_eq!(pool.workers(), 4);
+    }
+
+    #[test]
+    fn test_pool_respawns_crashed_worker() {
+        let pool = ParserPool::new(1).unwrap();
+        let pid = pool.lock().idle[0].pid;
+
+        // SAFETY: pid is a worker of this pool
+        unsafe {
+            kill(pid, SIGKILL);
+        }
+
+        assert!(matches!(
+            pool.parse("echo hello"),
+            Err(ParseError::WorkerCrashed)
+        ));
+        assert_eq!(pool.workers(), 1);
+        assert_ne!(pool.lock().idle[0].pid, pid);
+        assert!(pool.parse("echo hello").is_ok());
+    }
+
+    #[test]
+    fn test_dead_worker_does_not_raise_sigpipe() {
+        extern "C" {
+            fn signal(sig: i32, handler: usize) -> usize;
+        }
+        const SIGPIPE: i32 = 13;
+        const SIG_DFL: usize = 0;
+
+        let pool = ParserPool::new(1).unwrap();
+        let pid = pool.lock().idle[0].pid;
+
+        // SAFETY: pid is a worker of this pool
+        unsafe {
+            kill(pid, SIGKILL);
+        }
+        // Wait for the worker's end of the socket to close, so the request
+        // is written to a socket with no reader
+        let mut byte = [0u8; 1];
+        assert_eq!((&pool.lock().idle[0].channel.0).read(&mut byte).unwrap(), 0);
+
+        // Rust programs ignore SIGPIPE; hosts that don't would be killed by it
+        // SAFETY: restored below; tests run on a single thread
+        let previous = unsafe { signal(SIGPIPE, SIG_DFL) };
+        let result = pool.parse("echo hello");
+        // SAFETY: as above
+        unsafe {
+            signal(SIGPIPE, previous);
+        }
+
+        assert!(matches!(result, Err(ParseError::WorkerCrashed)));
+        assert!(pool.parse("echo hello").is_ok());
+    }
+}
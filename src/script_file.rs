@@ -0,0 +1,400 @@
+//! Parsing straight from files and file descriptors
+//!
+//! Regular files are memory-mapped read-only and handed to the parser in
+//! place: bash reads the mapping through the same borrowed-buffer input as
+//! [`parse()`](crate::parse), so no terminator or guard page is needed and
+//! the script is never copied onto the heap. Memory use is bounded by the
+//! AST, plus file-backed pages the kernel can drop at any time.
+//!
+//! Pipes, sockets and other non-seekable descriptors are read into memory
+//! (up to the size budget) instead.
+//!
+//! A mapped file is only as stable as the file itself, so the functions
+//! that map are `unsafe`: the caller promises the file won't change while
+//! it is mapped.
+
+use crate::{parse_with_limits, Command, ParseError, ParseLimits};
+use std::ffi::{c_int, c_long, c_void};
+use std::fs::File;
+use std::io::{self, Read};
+use std::ops::Deref;
+use std::os::fd::{AsRawFd, BorrowedFd};
+use std::path::Path;
+use std::ptr::NonNull;
+
+const PROT_READ: c_int = 1;
+const MAP_PRIVATE: c_int = 2;
+const MADV_SEQUENTIAL: c_int = 2;
+
+// Memory-mapping primitives from libc - declared here to avoid a libc
+// dependency. The values above are the same on Linux and macOS.
+extern "C" {
+    fn mmap(
+        addr: *mut c_void,
+        len: usize,
+        prot: c_int,
+        flags: c_int,
+        fd: c_int,
+        offset: c_long,
+    ) -> *mut c_void;
+    fn munmap(addr: *mut c_void, len: usize) -> c_int;
+    fn madvise(addr: *mut c_void, len: usize, advice: c_int) -> c_int;
+}
+
+/// Parse a bash script file without reading it into memory
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_file, ParseLimits};
+///
+/// init();
+///
+/// // SAFETY: nothing else writes install.sh while it is parsed
+/// let ast = unsafe { parse_file("install.sh", &ParseLimits::unlimited()) }.unwrap();
+/// ```
+///
+/// # Safety
+///
+/// As for [`ScriptFile::open()`], until the call returns.
+///
+/// # Errors
+///
+/// Returns `ParseError::Io` if the file can't be read or isn't UTF-8, and
+/// otherwise the same errors as [`parse_with_limits()`].
+pub unsafe fn parse_file(
+    path: impl AsRef<Path>,
+    limits: &ParseLimits,
+) -> Result<Command, ParseError> {
+    let file = File::open(path)?;
+    let script = ScriptFile::load(&file, limits.max_script_size)?;
+    parse_with_limits(&script, limits)
+}
+
+/// Parse a bash script from an open file descriptor
+///
+/// The descriptor is not closed. Regular files are mapped from offset 0
+/// regardless of the current file position; anything else is read to EOF.
+///
+/// # Safety
+///
+/// As for [`ScriptFile::open()`], until the call returns.
+///
+/// # Errors
+///
+/// Returns `ParseError::Io` if the descriptor can't be read or isn't UTF-8,
+/// and otherwise the same errors as [`parse_with_limits()`].
+pub unsafe fn parse_fd(fd: BorrowedFd<'_>, limits: &ParseLimits) -> Result<Command, ParseError> {
+    let file = File::from(fd.try_clone_to_owned()?);
+    let script = ScriptFile::load(&file, limits.max_script_size)?;
+    parse_with_limits(&script, limits)
+}
+
+/// A script loaded from a file, memory-mapped where possible
+///
+/// Dereferences to the script text, so it can be passed to any of the parse
+/// functions, including [`parse_iter()`](crate::parse_iter). The text of a
+/// regular file is its mapped pages, so the file must stay as it is; see
+/// [`open()`](Self::open).
+pub struct ScriptFile {
+    data: ScriptData,
+}
+
+enum ScriptData {
+    Mapped { ptr: NonNull<u8>, len: usize },
+    Owned(String),
+}
+
+// SAFETY: the mapping is read-only and owned by this value, and whoever
+// created it promised the file won't change (see open())
+#[allow(clippy::non_send_fields_in_send_ty)]
+unsafe impl Send for ScriptFile {}
+// SAFETY: as above; shared access only ever reads
+unsafe impl Sync for ScriptFile {}
+
+impl ScriptFile {
+    /// Open and map (or read) a script file
+    ///
+    /// # Safety
+    ///
+    /// A regular file is mapped, not copied, so it must not be written to
+    /// or truncated while the returned value lives. A write would change
+    /// text already handed out as `&str`, possibly to invalid UTF-8, and
+    /// reading a page past a truncated end raises `SIGBUS`. Files nothing
+    /// else writes to meanwhile are fine; read any others into a `String`.
+    ///
+    /// # Errors
+    ///
+    /// Fails if the file can't be opened, mapped or read, or isn't UTF-8.
+    pub unsafe fn open(path: impl AsRef<Path>) -> io::Result<Self> {
+        Self::load(&File::open(path)?, usize::MAX).map_err(into_io_error)
+    }
+
+    /// Map (or read) a script from an open file descriptor
+    ///
+    /// # Safety
+    ///
+    /// As for [`open()`](Self::open).
+    ///
+    /// # Errors
+    ///
+    /// Fails if the descriptor can't be mapped or read, or isn't UTF-8.
+    pub unsafe fn from_fd(fd: BorrowedFd<'_>) -> io::Result<Self> {
+        Self::load(&File::from(fd.try_clone_to_owned()?), usize::MAX).map_err(into_io_error)
+    }
+
+    /// The script text
+    #[must_use]
+    pub fn as_str(&self) -> &str {
+        self
+    }
+
+    /// Load `file`, rejecting inputs larger than `max_len` bytes
+    ///
+    /// Oversized input is turned away before any of it is mapped or
+    /// validated as UTF-8: regular files by their size, and streams once
+    /// reading one byte past the budget succeeds. That read may end inside
+    /// a character, so the size is checked before the encoding.
+    fn load(file: &File, max_len: usize) -> Result<Self, ParseError> {
+        let metadata = file.metadata()?;
+        if metadata.is_file() {
+            let len = usize::try_from(metadata.len()).map_err(|_| ParseError::InputTooLarge)?;
+            if len > max_len {
+                return Err(ParseError::InputTooLarge);
+            }
+            return Ok(Self::map(file, len)?);
+        }
+
+        let mut bytes = Vec::new();
+        let budget = u64::try_from(max_len).unwrap_or(u64::MAX).saturating_add(1);
+        file.take(budget).read_to_end(&mut bytes)?;
+        if bytes.len() > max_len {
+            return Err(ParseError::InputTooLarge);
+        }
+        let text =
+            String::from_utf8(bytes).map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))?;
+        Ok(Self {
+            data: ScriptData::Owned(text),
+        })
+    }
+
+    fn map(file: &File, len: usize) -> io::Result<Self> {
+        // mmap rejects empty mappings
+        if len == 0 {
+            return Ok(Self {
+                data: ScriptData::Owned(String::new()),
+            });
+        }
+
+        // SAFETY: a fresh private read-only mapping of an open descriptor;
+        // failure is reported as MAP_FAILED (-1)
+        let addr = unsafe {
+            mmap(
+                std::ptr::null_mut(),
+                len,
+                PROT_READ,
+                MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if addr as isize == -1 {
+            return Err(io::Error::last_os_error());
+        }
+        let ptr = NonNull::new(addr.cast::<u8>()).ok_or_else(io::Error::last_os_error)?;
+
+        // Bash reads the script front to back exactly once
+        // SAFETY: addr/len is the mapping we just created
+        unsafe {
+            madvise(addr, len, MADV_SEQUENTIAL);
+        }
+
+        // Constructed before validation so the mapping is unmapped on error
+        let script = Self {
+            data: ScriptData::Mapped { ptr, len },
+        };
+        // SAFETY: the mapping stays valid for as long as `script`
+        let bytes = unsafe { std::slice::from_raw_parts(ptr.as_ptr(), len) };
+        std::str::from_utf8(bytes).map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))?;
+        Ok(script)
+    }
+}
+
+/// A loading error for the `io::Result` APIs, which have no size budget
+fn into_io_error(e: ParseError) -> io::Error {
+    match e {
+        ParseError::Io(e) => e,
+        e => io::Error::other(e),
+    }
+}
+
+impl Deref for ScriptFile {
+    type Target = str;
+
+    fn deref(&self) -> &str {
+        match &self.data {
+            // SAFETY: the mapping was validated as UTF-8 in map(), lives as
+            // long as self, and its file hasn't changed (see open())
+            ScriptData::Mapped { ptr, len } => unsafe {
+                std::str::from_utf8_unchecked(std::slice::from_raw_parts(ptr.as_ptr(), *len))
+            },
+            ScriptData::Owned(text) => text,
+        }
+    }
+}
+
+impl Drop for ScriptFile {
+    fn drop(&mut self) {
+        if let ScriptData::Mapped { ptr, len } = self.data {
+            // SAFETY: unmaps the mapping created in map(), which nothing
+            // else references once self is gone
+            unsafe {
+                munmap(ptr.as_ptr().cast(), len);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{init, MAX_SCRIPT_SIZE};
+    use std::io::Write;
+    use std::os::fd::AsFd;
+    use std::path::PathBuf;
+
+    fn setup() {
+        init();
+    }
+
+    /// A script file in the temp dir, removed on drop
+    struct TempScript(PathBuf);
+
+    impl TempScript {
+        fn new(name: &str, contents: &[u8]) -> Self {
+            let path =
+                std::env::temp_dir().join(format!("bash-ast-{}-{name}.sh", std::process::id()));
+            std::fs::write(&path, contents).unwrap();
+            Self(path)
+        }
+    }
+
+    impl Drop for TempScript {
+        fn drop(&mut self) {
+            let _ = std::fs::remove_file(&self.0);
+        }
+    }
+
+    #[test]
+    fn test_parse_file() {
+        setup();
+        let file = TempScript::new("simple", b"echo one\necho two\n");
+        // SAFETY: the test's own files are never changed once written
+        let cmd = unsafe { parse_file(&file.0, &ParseLimits::default()) }.unwrap();
+        assert!(matches!(cmd, Command::List { .. }));
+    }
+
+    #[test]
+    fn test_parse_file_beyond_default_limit() {
+        setup();
+        let mut contents = "# padding\n".repeat(MAX_SCRIPT_SIZE / 10 + 1);
+        contents.push_str("echo done\n");
+        let file = TempScript::new("large", contents.as_bytes());
+
+        // SAFETY: the test's own files are never changed once written
+        let (default, unlimited) = unsafe {
+            (
+                parse_file(&file.0, &ParseLimits::default()),
+                parse_file(&file.0, &ParseLimits::unlimited()),
+            )
+        };
+        assert!(matches!(default, Err(ParseError::InputTooLarge)));
+        let cmd = unlimited.unwrap();
+        assert!(matches!(cmd, Command::Simple { .. }));
+    }
+
+    #[test]
+    fn test_parse_file_errors() {
+        setup();
+        let invalid = TempScript::new("latin1", b"echo caf\xe9\n");
+        let empty = TempScript::new("empty", b"");
+        let parse = |path: &Path| {
+            // SAFETY: the test's own files are never changed once written
+            unsafe { parse_file(path, &ParseLimits::default()) }
+        };
+
+        assert!(matches!(
+            parse(Path::new("/nonexistent/script.sh")),
+            Err(ParseError::Io(_))
+        ));
+        assert!(matches!(parse(&invalid.0), Err(ParseError::Io(_))));
+        assert!(matches!(parse(&empty.0), Err(ParseError::EmptyInput)));
+    }
+
+    #[test]
+    fn test_parse_fd_regular_file() {
+        setup();
+        let script = TempScript::new("fd", b"for i in a b; do echo $i; done\n");
+        let file = File::open(&script.0).unwrap();
+
+        // SAFETY: the test's own files are never changed once written
+        let cmd = unsafe { parse_fd(file.as_fd(), &ParseLimits::default()) }.unwrap();
+        assert!(matches!(cmd, Command::For { .. }));
+    }
+
+    #[test]
+    fn test_parse_fd_pipe() {
+        setup();
+        let (reader, mut writer) = io::pipe().unwrap();
+        writer.write_all(b"cat file | grep x\n").unwrap();
+        drop(writer);
+
+        // SAFETY: pipes are read, not mapped
+        let cmd = unsafe { parse_fd(reader.as_fd(), &ParseLimits::default()) }.unwrap();
+        assert!(matches!(cmd, Command::Pipeline { .. }));
+    }
+
+    #[test]
+    fn test_parse_fd_pipe_over_budget() {
+        setup();
+        let (reader, mut writer) = io::pipe().unwrap();
+        writer.write_all(b"echo 0123456789\n").unwrap();
+        drop(writer);
+
+        let limits = ParseLimits::default().with_max_script_size(8);
+        // SAFETY: pipes are read, not mapped
+        let result = unsafe { parse_fd(reader.as_fd(), &limits) };
+        assert!(matches!(result, Err(ParseError::InputTooLarge)));
+
+        // Reading stops one byte past the budget, inside the "é" here
+        let (reader, mut writer) = io::pipe().unwrap();
+        writer.write_all("echo café\n".as_bytes()).unwrap();
+        drop(writer);
+        let limits = ParseLimits::default().with_max_script_size(8);
+        // SAFETY: pipes are read, not mapped
+        let result = unsafe { parse_fd(reader.as_fd(), &limits) };
+        assert!(matches!(result, Err(ParseError::InputTooLarge)));
+    }
+
+    #[test]
+    fn test_parse_file_over_budget_is_not_validated() {
+        setup();
+        // Invalid UTF-8 past the budget: rejected by size, not encoding
+        let file = TempScript::new("oversized", b"echo one\n\xff\xff\n");
+        let limits = ParseLimits::default().with_max_script_size(4);
+        // SAFETY: the test's own files are never changed once written
+        let result = unsafe { parse_file(&file.0, &limits) };
+        assert!(matches!(result, Err(ParseError::InputTooLarge)));
+    }
+
+    #[test]
+    fn test_script_file_with_parse_iter() {
+        setup();
+        let file = TempScript::new("iter", b"a\nb\nc\n");
+        // SAFETY: the test's own files are never changed once written
+        let script = unsafe { ScriptFile::open(&file.0) }.unwrap();
+
+        assert_eq!(script.as_str(), "a\nb\nc\n");
+        assert_eq!(crate::parse_iter(&script).count(), 3);
+    }
+}
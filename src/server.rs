@@ -16,6 +16,12 @@
 //! {"result":{"type":"simple","words":[{"word":"echo"},{"word":"hello"}],"redirects":[]}}
 //! ```
 //!
+//! A request may tighten the server's [`ParseLimits`] for itself (see
+//! [`RequestLimits`]); a parse that goes over them fails early.
+//! ```json
+//! {"method":"parse","script":"echo hello","limits":{"max_nodes":1000,"max_time_ms":50}}
+//! ```
+//!
 //! ### `to_bash`
 //! Convert AST back to bash script.
 //! ```json
@@ -37,13 +43,14 @@
 //! {"error":"Syntax error in script"}
 //! ```
 
-use crate::{parse, schema_json, to_bash, Command};
+use crate::{parse_to_json_writer, parse_with_limits, schema_json, to_bash, Command, ParseLimits};
 use serde::{Deserialize, Serialize};
 use std::io::{BufRead, BufReader, Write};
 use std::os::unix::net::{UnixListener, UnixStream};
 use std::path::Path;
 use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::Arc;
+use std::time::Duration;
 
 /// Default socket path using `XDG_RUNTIME_DIR` or falling back to /tmp
 #[must_use]
@@ -62,6 +69,9 @@ pub enum Request {
     Parse {
         /// The bash script to parse
         script: String,
+        /// Limits for this request, within the server's
+        #[serde(default)]
+        limits: RequestLimits,
     },
     /// Convert AST back to bash script
     ToBash {
@@ -103,12 +113,58 @@ impl Request {
     #[must_use]
     pub fn script(&self) -> Option<&str> {
         match self {
-            Self::Parse { script } => Some(script),
+            Self::Parse { script, .. } => Some(script),
             _ => None,
         }
     }
 }
 
+/// Limits a parse request asks for
+///
+/// Each one given replaces the server's own if it is lower; a request can't
+/// loosen them.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct RequestLimits {
+    /// Largest accepted script, in bytes
+    pub max_size: Option<usize>,
+    /// Deepest accepted nesting of commands
+    pub max_depth: Option<usize>,
+    /// Most commands, words and redirects in the AST
+    pub max_nodes: Option<usize>,
+    /// Most words
+    pub max_words: Option<usize>,
+    /// Most bytes of word text
+    pub max_word_bytes: Option<usize>,
+    /// Most bytes of here-document text
+    pub max_heredoc_bytes: Option<usize>,
+    /// Longest the parser, and then the conversion, may each take, in
+    /// milliseconds
+    pub max_time_ms: Option<u64>,
+}
+
+impl RequestLimits {
+    /// `limits`, tightened by the limits of the request
+    #[must_use]
+    pub fn within(&self, limits: &ParseLimits) -> ParseLimits {
+        let min =
+            |requested: Option<usize>, limit: usize| requested.map_or(limit, |r| r.min(limit));
+        let time = self.max_time_ms.map(Duration::from_millis);
+        let mut limits = *limits;
+        limits.max_script_size = min(self.max_size, limits.max_script_size);
+        limits.max_depth = min(self.max_depth, limits.max_depth);
+        limits.max_nodes = min(self.max_nodes, limits.max_nodes);
+        limits.max_words = min(self.max_words, limits.max_words);
+        limits.max_word_bytes = min(self.max_word_bytes, limits.max_word_bytes);
+        limits.max_heredoc_bytes = min(self.max_heredoc_bytes, limits.max_heredoc_bytes);
+        limits.max_time = match (time, limits.max_time) {
+            (Some(requested), Some(limit)) => Some(requested.min(limit)),
+            (requested, limit) => requested.or(limit),
+        };
+        limits
+    }
+}
+
 /// Response from the server
 #[derive(Debug, Clone, PartialEq, Eq, Serialize, Deserialize)]
 #[serde(untagged)]
@@ -156,8 +212,17 @@ impl Response {
 /// Handle a single request and return a response
 #[must_use]
 pub fn handle_request(request: &Request) -> Response {
+    handle_request_within(request, &ParseLimits::default())
+}
+
+/// Handle a single request, parsing within `limits`, and return a response
+#[must_use]
+pub fn handle_request_within(request: &Request, limits: &ParseLimits) -> Response {
     match request {
-        Request::Parse { script } => match parse(script) {
+        Request::Parse {
+            script,
+            limits: requested,
+        } => match parse_with_limits(script, &requested.within(limits)) {
             Ok(ast) => Response::success(ast),
             Err(e) => Response::error(e.to_string()),
         },
@@ -182,13 +247,40 @@ pub fn parse_request(line: &str) -> Result<Request, Response> {
 /// Handle a single line of input and return a response string
 #[must_use]
 pub fn handle_line(line: &str) -> String {
+    handle_line_within(line, &ParseLimits::default())
+}
+
+/// Handle a single line of input, parsing within `limits`, and return a
+/// response string
+#[must_use]
+pub fn handle_line_within(line: &str, limits: &ParseLimits) -> String {
     let response = match parse_request(line) {
-        Ok(request) => handle_request(&request),
+        Ok(Request::Parse {
+            script,
+            limits: requested,
+        }) => return parse_response(&script, &requested.within(limits)),
+        Ok(request) => handle_request_within(&request, limits),
         Err(err_response) => err_response,
     };
     serde_json::to_string(&response).expect("response serialization cannot fail")
 }
 
+/// Handle a parse request, writing the AST straight into the response
+///
+/// Nothing needs the typed AST here, so this skips building it and the
+/// `serde_json::Value` that [`Response::success`] would copy it into.
+fn parse_response(script: &str, limits: &ParseLimits) -> String {
+    let mut response = br#"{"result":"#.to_vec();
+    match parse_to_json_writer(script, limits, false, &mut response) {
+        Ok(()) => {
+            response.push(b'}');
+            String::from_utf8(response).expect("serde_json writes UTF-8")
+        }
+        Err(e) => serde_json::to_string(&Response::error(e.to_string()))
+            .expect("response serialization cannot fail"),
+    }
+}
+
 /// Server configuration
 #[derive(Debug, Clone)]
 pub struct ServerConfig {
@@ -196,6 +288,8 @@ pub struct ServerConfig {
     pub socket_path: String,
     /// Whether to remove existing socket file on startup
     pub remove_existing: bool,
+    /// Limits every parse request is held to; requests can only tighten them
+    pub limits: ParseLimits,
 }
 
 impl Default for ServerConfig {
@@ -203,6 +297,7 @@ impl Default for ServerConfig {
         Self {
             socket_path: default_socket_path(),
             remove_existing: true,
+            limits: ParseLimits::default(),
         }
     }
 }
@@ -298,7 +393,6 @@ impl Server {
     }
 
     /// Handle a single client connection
-    #[allow(clippy::unused_self)] // Method logically belongs to Server
     fn handle_client(&self, stream: UnixStream) {
         // Clone the stream to get separate handles for reading and writing.
         // This avoids issues with BufReader's internal buffering when sharing
@@ -317,7 +411,7 @@ impl Server {
             match line {
                 Ok(line) if line.is_empty() => {}
                 Ok(line) => {
-                    let response = handle_line(&line);
+                    let response = handle_line_within(&line, &self.config.limits);
                     if writeln!(writer, "{response}").is_err() {
                         break;
                     }
@@ -350,7 +444,8 @@ pub fn run_server(socket_path: &str) -> std::io::Result<()> {
 #[cfg(test)]
 mod tests {
     use super::*;
-    use crate::ast::{RedirectTarget, RedirectType, Word};
+    use crate::ast::{Nested, RedirectTarget, RedirectType, Word};
+    use crate::{parse, Limit, ParseError};
     use std::io::Write;
     use std::os::unix::net::UnixStream;
     use std::thread;
@@ -419,6 +514,41 @@ mod tests {
         assert!(result.is_err());
     }
 
+    #[test]
+    fn test_parse_request_limits() {
+        let json = r#"{"method":"parse","script":"ls","limits":{"max_nodes":10,"max_time_ms":5}}"#;
+        let Ok(Request::Parse { limits, .. }) = parse_request(json) else {
+            panic!("expected a parse request");
+        };
+        assert_eq!(limits.max_nodes, Some(10));
+        assert_eq!(limits.max_time_ms, Some(5));
+        assert_eq!(limits.max_words, None);
+
+        let json = r#"{"method":"parse","script":"ls","limits":{"max_nodez":10}}"#;
+        assert!(parse_request(json).is_err());
+    }
+
+    #[test]
+    fn test_request_limits_only_tighten() {
+        let server = ParseLimits::default()
+            .with_max_nodes(100)
+            .with_max_time(Duration::from_millis(20));
+        let requested = RequestLimits {
+            max_nodes: Some(1000),
+            max_words: Some(5),
+            max_time_ms: Some(50),
+            ..RequestLimits::default()
+        };
+        let limits = requested.within(&server);
+        assert_eq!(limits.max_nodes, 100);
+        assert_eq!(limits.max_words, 5);
+        assert_eq!(limits.max_time, Some(Duration::from_millis(20)));
+        assert_eq!(limits.max_script_size, server.max_script_size);
+
+        let limits = requested.within(&ParseLimits::default());
+        assert_eq!(limits.max_time, Some(Duration::from_millis(50)));
+    }
+
     #[test]
     fn test_parse_request_missing_ast() {
         let json = r#"{"method":"to_bash"}"#;
@@ -487,6 +617,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "echo hello".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
@@ -502,6 +633,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "for i in a b c; do echo $i; done".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
@@ -516,6 +648,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "cat file | grep pattern | wc -l".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
@@ -530,6 +663,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "if then fi".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_error());
@@ -543,6 +677,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: String::new(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_error());
@@ -556,14 +691,19 @@ mod tests {
         let req = Request::ToBash {
             ast: Command::Simple {
                 line: None,
+                span: None,
                 words: vec![
                     Word {
-                        word: "echo".to_string(),
+                        span: None,
+                        word: "echo".into(),
                         flags: 0,
+                        substitutions: Vec::new(),
                     },
                     Word {
-                        word: "hello".to_string(),
+                        span: None,
+                        word: "hello".into(),
                         flags: 0,
+                        substitutions: Vec::new(),
                     },
                 ],
                 redirects: vec![],
@@ -582,18 +722,24 @@ mod tests {
         let req = Request::ToBash {
             ast: Command::For {
                 line: None,
-                variable: "i".to_string(),
-                words: Some(vec!["a".to_string(), "b".to_string(), "c".to_string()]),
-                body: Box::new(Command::Simple {
+                span: None,
+                variable: "i".into(),
+                words: Some(vec!["a".into(), "b".into(), "c".into()]),
+                body: Nested::new(Command::Simple {
                     line: None,
+                    span: None,
                     words: vec![
                         Word {
-                            word: "echo".to_string(),
+                            span: None,
+                            word: "echo".into(),
                             flags: 0,
+                            substitutions: Vec::new(),
                         },
                         Word {
-                            word: "$i".to_string(),
+                            span: None,
+                            word: "$i".into(),
                             flags: 0,
+                            substitutions: Vec::new(),
                         },
                     ],
                     redirects: vec![],
@@ -616,11 +762,15 @@ mod tests {
         let req = Request::ToBash {
             ast: Command::Simple {
                 line: None,
+                span: None,
                 words: vec![Word {
-                    word: "echo".to_string(),
+                    span: None,
+                    word: "echo".into(),
                     flags: 0,
+                    substitutions: Vec::new(),
                 }],
                 redirects: vec![crate::ast::Redirect {
+                    span: None,
                     direction: RedirectType::Output,
                     source_fd: None,
                     target: RedirectTarget::File("file.txt".to_string()),
@@ -674,6 +824,7 @@ mod tests {
         for script in cases {
             let parsed = handle_request(&Request::Parse {
                 script: script.to_string(),
+                limits: RequestLimits::default(),
             });
             let Response::Success { result } = parsed else {
                 panic!("parse request failed for {script}");
@@ -728,6 +879,24 @@ mod tests {
         assert!(resp.is_success());
     }
 
+    #[test]
+    fn test_handle_line_within_limits() {
+        setup();
+        let line = r#"{"method":"parse","script":"echo a b c","limits":{"max_words":3}}"#;
+        let resp: Response = serde_json::from_str(&handle_line(line)).unwrap();
+        let Response::Error { error } = resp else {
+            panic!("expected an error");
+        };
+        assert_eq!(error, ParseError::LimitExceeded(Limit::Words).to_string());
+
+        let line = r#"{"method":"parse","script":"echo a b c"}"#;
+        let limits = ParseLimits::default().with_max_nodes(3);
+        let resp: Response = serde_json::from_str(&handle_line_within(line, &limits)).unwrap();
+        assert!(resp.is_error());
+        let resp: Response = serde_json::from_str(&handle_line(line)).unwrap();
+        assert!(resp.is_success());
+    }
+
     #[test]
     fn test_handle_line_invalid_json() {
         let line = "not valid json at all";
@@ -747,6 +916,23 @@ mod tests {
         assert!(resp.is_error());
     }
 
+    #[test]
+    fn test_handle_line_parse_matches_typed_ast() {
+        setup();
+        let script = "! grep -q x <<<\"$y\" && for i in a b; do echo $i & done";
+        let line = serde_json::json!({"method": "parse", "script": script}).to_string();
+        let ast = parse(script).unwrap();
+        assert_eq!(
+            handle_line(&line),
+            format!(r#"{{"result":{}}}"#, serde_json::to_string(&ast).unwrap())
+        );
+
+        let response: Response =
+            serde_json::from_str(&handle_line(r#"{"method":"parse","script":"if then fi"}"#))
+                .unwrap();
+        assert!(response.is_error());
+    }
+
     #[test]
     fn test_handle_line_response_is_single_line() {
         setup();
@@ -1101,6 +1287,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "echo line1\necho line2\necho line3".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
@@ -1114,6 +1301,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "# comment\necho hello".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
@@ -1124,6 +1312,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "cat <<EOF\nhello\nworld\nEOF".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
@@ -1134,6 +1323,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "(echo hello; echo world)".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
@@ -1147,6 +1337,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "foo() { echo bar; }".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
@@ -1161,6 +1352,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "case $x in a) echo a;; b) echo b;; esac".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
@@ -1174,6 +1366,7 @@ mod tests {
         setup();
         let req = Request::Parse {
             script: "if true; then echo a; elif false; then echo b; else echo c; fi".to_string(),
+            limits: RequestLimits::default(),
         };
         let resp = handle_request(&req);
         assert!(resp.is_success());
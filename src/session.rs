@@ -0,0 +1,238 @@
+//! Parsing many scripts one after another with recycled storage
+//!
+//! Each [`parse()`](crate::parse) builds its AST from nothing: a string for
+//! every word and name, new stacks for the conversion, and a tree that is
+//! dropped again as soon as the caller is done with it. A [`ParseSession`]
+//! keeps what carries over from one script to the next. Words, names and
+//! patterns come from an [`Interner`] that outlives each tree, so the
+//! strings that recur across scripts (`echo`, `-f`, `"$@"`) are allocated
+//! once per session rather than once per parse; the conversion's stacks
+//! keep their capacity; and an [`AstArena`] can be refilled in place.
+
+use crate::convert::{self, Scratch};
+use crate::{AstArena, Command, Interner, ParseError, ParseLimits};
+
+/// Default most strings a session's interner keeps (65,536)
+pub const DEFAULT_MAX_INTERNED: usize = 1 << 16;
+
+/// Storage shared by a run of parses
+///
+/// Each parse replaces the result of the one before, so the session holds
+/// one AST at a time. Those that must outlive the next parse can be
+/// cloned; they share their strings with the session.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, ParseSession};
+///
+/// init();
+///
+/// let mut session = ParseSession::new();
+/// for script in ["ls -la", "ls -la /tmp", "git status"] {
+///     let cmd = session.parse_into(script).unwrap();
+///     println!("{:?}", cmd.line());
+/// }
+/// println!("{:.0}% of strings reused", session.interner().stats().hit_rate() * 100.0);
+/// ```
+pub struct ParseSession {
+    limits: ParseLimits,
+    interner: Interner,
+    max_interned: usize,
+    scratch: Scratch,
+    /// The result of the last `parse_into()`
+    last: Option<Command>,
+    /// The result of the last `parse_into_arena()`
+    arena: Option<AstArena>,
+}
+
+impl Default for ParseSession {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl ParseSession {
+    /// A session with the default limits
+    #[must_use]
+    pub fn new() -> Self {
+        Self {
+            limits: ParseLimits::default(),
+            interner: Interner::new(),
+            max_interned: DEFAULT_MAX_INTERNED,
+            scratch: Scratch::default(),
+            last: None,
+            arena: None,
+        }
+    }
+
+    /// Check each script against `limits` rather than the defaults
+    #[must_use]
+    pub const fn with_limits(mut self, limits: &ParseLimits) -> Self {
+        self.limits = *limits;
+        self
+    }
+
+    /// Keep at most about `max` distinct strings between parses
+    ///
+    /// Once the interner holds more, the strings no AST still uses are
+    /// dropped before the next parse. Scripts that share few words (generated
+    /// names, hashes, paths) would otherwise grow it without end.
+    #[must_use]
+    pub const fn with_max_interned(mut self, max: usize) -> Self {
+        self.max_interned = max;
+        self
+    }
+
+    /// Parse `script`, replacing the AST of the last parse
+    ///
+    /// Returns the same AST and errors as
+    /// [`parse_with_limits()`](crate::parse_with_limits). After an error the
+    /// session holds no AST, and carries on with the next script as usual.
+    pub fn parse_into(&mut self, script: &str) -> Result<&Command, ParseError> {
+        let cmd = self.parse(script)?;
+        Ok(self.last.insert(cmd))
+    }
+
+    /// Parse `script` into the session's arena, replacing the tree of the
+    /// last parse
+    ///
+    /// As [`parse_into()`](Self::parse_into), but the tree is flattened into
+    /// an [`AstArena`] that keeps its tables' capacity from one script to the
+    /// next.
+    ///
+    /// # Errors
+    ///
+    /// As for [`parse_into()`](Self::parse_into), plus
+    /// [`ParseError::ConversionError`] if the tree is too large for an
+    /// arena.
+    pub fn parse_into_arena(&mut self, script: &str) -> Result<&AstArena, ParseError> {
+        let cmd = self.parse(script)?;
+        let arena = match self.arena.take() {
+            Some(mut arena) => {
+                arena.rebuild(&cmd)?;
+                arena
+            }
+            None => AstArena::try_from(&cmd)?,
+        };
+        Ok(self.arena.insert(arena))
+    }
+
+    /// The interner the session's ASTs take their strings from
+    #[must_use]
+    pub const fn interner(&self) -> &Interner {
+        &self.interner
+    }
+
+    fn parse(&mut self, script: &str) -> Result<Command, ParseError> {
+        // Drop the last tree first, so the strings only it used can go
+        self.last = None;
+        if self.interner.len() > self.max_interned {
+            self.interner.release_unused();
+        }
+
+        let (interner, scratch) = (&mut self.interner, &mut self.scratch);
+        // SAFETY: these are the statically linked parser's own entry points
+        unsafe {
+            crate::with_parsed(&crate::static_api(false), script, &self.limits, |cmd_ptr| {
+                let converter = convert::Converter::with_interner(interner)
+                    .with_limits(&self.limits)
+                    .with_scratch(scratch);
+                crate::convert_script(converter, cmd_ptr)
+            })
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{init, parse, parse_with_limits, to_json, Symbol};
+
+    fn setup() {
+        init();
+    }
+
+    /// The first word of a simple command
+    fn first_word(cmd: &Command) -> Symbol {
+        match cmd {
+            Command::Simple { words, .. } => words[0].word.clone(),
+            _ => panic!("expected a simple command"),
+        }
+    }
+
+    #[test]
+    fn test_parse_into_matches_parse() {
+        setup();
+        let mut session = ParseSession::new();
+        for script in [
+            "echo hello",
+            "for i in a b; do echo \"$i\" > out; done",
+            "case $x in a) f;; esac\ncat <<EOF\n$y\nEOF",
+            "echo hello",
+        ] {
+            let cmd = session.parse_into(script).unwrap();
+            assert_eq!(to_json(cmd, false), to_json(&parse(script).unwrap(), false));
+        }
+        assert!(session.interner().stats().hits > 0);
+    }
+
+    #[test]
+    fn test_strings_outlive_each_parse() {
+        setup();
+        let mut session = ParseSession::new();
+        let kept = first_word(session.parse_into("echo one").unwrap());
+        let again = first_word(session.parse_into("echo two").unwrap());
+        assert!(Symbol::ptr_eq(&kept, &again));
+    }
+
+    #[test]
+    fn test_errors_leave_session_usable() {
+        setup();
+        let limits = ParseLimits::default().with_max_depth(3);
+        let mut session = ParseSession::new().with_limits(&limits);
+        assert!(matches!(
+            session.parse_into("if then fi"),
+            Err(ParseError::SyntaxError(_))
+        ));
+        let deep = "{ { { { echo; }; }; }; }";
+        assert_eq!(
+            session.parse_into(deep).unwrap_err().to_string(),
+            parse_with_limits(deep, &limits).unwrap_err().to_string()
+        );
+        let cmd = session.parse_into("echo ok").unwrap();
+        assert_eq!(first_word(cmd), "echo");
+    }
+
+    #[test]
+    fn test_unused_strings_are_released() {
+        setup();
+        let mut session = ParseSession::new().with_max_interned(4);
+        for i in 0..10 {
+            session
+                .parse_into(&format!("echo word{i} more{i}"))
+                .unwrap();
+        }
+        // The last AST's three strings, and those of the one before it
+        assert!(session.interner().len() <= 6);
+    }
+
+    #[test]
+    fn test_session_is_send() {
+        fn assert_send<T: Send>() {}
+        assert_send::<ParseSession>();
+    }
+
+    #[test]
+    fn test_parse_into_arena() {
+        setup();
+        let mut session = ParseSession::new();
+        for script in ["a | b | c && d", "echo hi > out", "if x; then y; fi"] {
+            let arena = session.parse_into_arena(script).unwrap();
+            assert_eq!(
+                to_json(&arena.to_command(), false),
+                to_json(&parse(script).unwrap(), false)
+            );
+        }
+    }
+}
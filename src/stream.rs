@@ -0,0 +1,541 @@
+//! Streaming parser for top-level commands
+//!
+//! [`parse()`](crate::parse) wraps the whole script in a group and returns a
+//! single tree, so nothing is available until the entire script has been
+//! parsed and both the C and Rust trees for all of it are in memory at once.
+//! [`parse_iter()`] instead drives bash's own `parse_command()` loop and
+//! yields each top-level command as soon as it is parsed, disposing its C
+//! tree immediately.
+
+use crate::{
+    budget_error, budget_micros, convert, ffi, nul_error, syntax_error_detail, Command, ParseError,
+    ParseLimits, SyntaxErrorDetail, MAX_DEPTH,
+};
+use std::iter::FusedIterator;
+use std::marker::PhantomData;
+
+/// Parse a bash script one top-level command at a time
+///
+/// Top-level commands are the newline-separated statements of the script;
+/// `a; b` on one line is a single `List` command, as in bash. Blank lines and
+/// comments produce no items. Line numbers are relative to the start of the
+/// script, exactly as with [`parse()`](crate::parse).
+///
+/// Because only one command's tree exists at a time, the script size is not
+/// limited by `MAX_SCRIPT_SIZE`.
+///
+/// Parsing stops at the first error, which is yielded as the last item,
+/// unless [`recover_errors()`](TopLevelCommands::recover_errors) is used.
+/// Only one iterator can be active at a time; a second one yields
+/// `ParseError::StreamBusy`. Other parse functions may be called freely
+/// between items.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_iter};
+///
+/// init();
+///
+/// for cmd in parse_iter("echo one\necho two\n") {
+///     println!("{}", serde_json::to_string(&cmd.unwrap()).unwrap());
+/// }
+/// ```
+#[must_use]
+pub const fn parse_iter(script: &str) -> TopLevelCommands<'_> {
+    parse_iter_with_limits(script, &ParseLimits::unlimited().with_max_depth(MAX_DEPTH))
+}
+
+/// Parse a bash script one top-level command at a time, within a resource
+/// budget
+///
+/// Each command is held to `limits` as though it were a script of its own:
+/// `max_script_size` bounds the bytes read for it, and the other limits
+/// its tree and how long it takes to parse. The script as a whole is not
+/// limited. A command that goes over the budget is yielded as
+/// `ParseError::LimitExceeded` and ends the iteration, even with
+/// [`recover_errors()`](TopLevelCommands::recover_errors), as bash's parser
+/// stopped reading the script there.
+///
+/// [`parse_iter()`] is this with only the default `max_depth`.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_iter_with_limits, ParseLimits};
+/// use std::time::Duration;
+///
+/// init();
+///
+/// let limits = ParseLimits::default()
+///     .with_max_nodes(10_000)
+///     .with_max_time(Duration::from_millis(50));
+/// for cmd in parse_iter_with_limits("echo one\necho two\n", &limits) {
+///     println!("{}", serde_json::to_string(&cmd.unwrap()).unwrap());
+/// }
+/// ```
+#[must_use]
+pub const fn parse_iter_with_limits<'a>(
+    script: &'a str,
+    limits: &ParseLimits,
+) -> TopLevelCommands<'a> {
+    TopLevelCommands {
+        script,
+        limits: *limits,
+        state: StreamState::Pending,
+        offset: 0,
+        recover: false,
+        _not_send: PhantomData,
+    }
+}
+
+/// Iterator over the top-level commands of a script, from [`parse_iter()`]
+pub struct TopLevelCommands<'a> {
+    script: &'a str,
+    /// Budget for each command
+    limits: ParseLimits,
+    state: StreamState,
+    offset: usize,
+    /// Keep going after syntax errors
+    recover: bool,
+    /// The stream lives in bash's global parser state
+    _not_send: PhantomData<*const ()>,
+}
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum StreamState {
+    /// Not started; the C stream is opened by the first `next()`
+    Pending,
+    Open,
+    Done,
+}
+
+impl TopLevelCommands<'_> {
+    /// Continue past syntax errors instead of stopping at the first one
+    ///
+    /// After an error, parsing resumes at the next line, as in an
+    /// interactive shell. Each error is yielded in place of the command it
+    /// broke, so the items are every command that parsed plus one
+    /// `ParseError::SyntaxError` per error. An error inside a multi-line
+    /// command may be followed by spurious errors for its remaining lines
+    /// (e.g. an unexpected `fi`).
+    ///
+    /// Other errors still end the iteration.
+    #[must_use]
+    pub const fn recover_errors(mut self) -> Self {
+        self.recover = true;
+        self
+    }
+
+    /// Number of bytes of the script consumed so far
+    ///
+    /// Bash reads its input a line at a time, so after an item has been
+    /// returned this is the offset just past the line that command ended on
+    /// (including any here-document bodies it read).
+    #[must_use]
+    pub const fn offset(&self) -> usize {
+        self.offset
+    }
+
+    /// Open the C stream on the first call to `next()`
+    fn open(&mut self) -> Result<(), ParseError> {
+        if self.script.trim().is_empty() {
+            return Err(ParseError::EmptyInput);
+        }
+
+        let bytes = self.script.as_bytes();
+        // SAFETY: the C stream borrows the script, which outlives `self`;
+        // finish() closes the stream at the latest when `self` drops
+        if unsafe { ffi::safe_parse_stream_begin(bytes.as_ptr().cast(), bytes.len()) } != 0 {
+            return Err(ParseError::StreamBusy);
+        }
+
+        self.state = StreamState::Open;
+        Ok(())
+    }
+
+    /// Convert the command just parsed from `length` bytes of the script
+    ///
+    /// # Safety
+    ///
+    /// `cmd_ptr` must point to a valid command tree.
+    unsafe fn convert(
+        &self,
+        cmd_ptr: *const ffi::COMMAND,
+        length: usize,
+    ) -> Result<Command, ParseError> {
+        if length > self.limits.max_script_size {
+            return Err(ParseError::InputTooLarge);
+        }
+
+        let mut converter = convert::Converter::default().with_limits(&self.limits);
+        converter.convert(cmd_ptr).ok_or_else(|| {
+            converter
+                .stopped()
+                .map_or(ParseError::ConversionError(None), ParseError::from)
+        })
+    }
+
+    /// Close the C stream (if open) and stop iterating
+    fn finish(&mut self) {
+        if self.state == StreamState::Open {
+            // SAFETY: this iterator owns the open stream
+            unsafe {
+                ffi::safe_parse_stream_end();
+            }
+        }
+        self.state = StreamState::Done;
+    }
+}
+
+impl Iterator for TopLevelCommands<'_> {
+    type Item = Result<Command, ParseError>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        match self.state {
+            StreamState::Done => return None,
+            StreamState::Pending => {
+                if let Err(e) = self.open() {
+                    self.finish();
+                    return Some(Err(e));
+                }
+            }
+            StreamState::Open => {}
+        }
+
+        let mut cmd_ptr = std::ptr::null_mut();
+        let start = self.offset;
+
+        // SAFETY: this iterator owns the open stream; a returned command is
+        // ours to convert and dispose
+        let (status, result) = unsafe {
+            // Parses run between items set budgets of their own
+            ffi::safe_parse_set_budget(
+                self.limits.max_words.min(self.limits.max_nodes),
+                budget_micros(self.limits.max_time),
+            );
+            ffi::safe_parse_set_cancel(std::ptr::null());
+            let status = ffi::safe_parse_stream_next(&raw mut cmd_ptr);
+            self.offset = ffi::safe_parse_stream_offset();
+
+            let result = if status == 1 {
+                let result = self.convert(cmd_ptr, self.offset - start);
+                ffi::dispose_command(cmd_ptr);
+                Some(result)
+            } else {
+                budget_error(ffi::safe_parse_budget_exceeded(), &self.limits, false).map(Err)
+            };
+            (status, result)
+        };
+
+        match (status, result) {
+            (1, Some(Ok(cmd))) => Some(Ok(cmd)),
+            (_, Some(Err(e))) => {
+                self.finish();
+                Some(Err(e))
+            }
+            (0, _) => {
+                self.finish();
+                None
+            }
+            (-2, _) => {
+                self.finish();
+                let consumed = &self.script.as_bytes()[..self.offset];
+                Some(Err(
+                    nul_error(consumed).unwrap_or(ParseError::SyntaxError(None))
+                ))
+            }
+            _ => {
+                // SAFETY: the stream's parse just ran
+                let detail =
+                    unsafe { syntax_error_detail(ffi::safe_parse_error, self.script.as_bytes()) };
+                if !self.recover {
+                    self.finish();
+                }
+                Some(Err(ParseError::SyntaxError(detail.map(Box::new))))
+            }
+        }
+    }
+}
+
+impl FusedIterator for TopLevelCommands<'_> {}
+
+/// The result of [`parse_recover()`]
+#[derive(Debug, Clone)]
+pub struct RecoveredScript {
+    /// Every top-level command that parsed, in order
+    pub commands: Vec<Command>,
+    /// Every syntax error, in order
+    pub errors: Vec<SyntaxErrorDetail>,
+}
+
+/// Parse a script in one pass, collecting all syntax errors
+///
+/// Uses [`parse_iter()`] with [`recover_errors()`](TopLevelCommands::recover_errors),
+/// so a syntax error costs only the line it was found on and the rest of
+/// the script is still parsed. An empty script has no commands and no
+/// errors.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, parse_recover};
+///
+/// init();
+///
+/// let result = parse_recover("echo one\nif then fi\necho two\n").unwrap();
+/// assert_eq!(result.commands.len(), 2);
+/// assert_eq!(result.errors.len(), 1);
+/// ```
+///
+/// # Errors
+///
+/// Returns errors other than syntax errors, such as
+/// `ParseError::InvalidString` or `ParseError::StreamBusy`.
+pub fn parse_recover(script: &str) -> Result<RecoveredScript, ParseError> {
+    let mut recovered = RecoveredScript {
+        commands: Vec::new(),
+        errors: Vec::new(),
+    };
+
+    for item in parse_iter(script).recover_errors() {
+        match item {
+            Ok(cmd) => recovered.commands.push(cmd),
+            Err(ParseError::SyntaxError(detail)) => {
+                recovered.errors.push(detail.map_or_else(
+                    || SyntaxErrorDetail {
+                        message: "syntax error".to_string(),
+                        line: None,
+                        column: None,
+                        token: None,
+                        expected: None,
+                        source_line: None,
+                    },
+                    |detail| *detail,
+                ));
+            }
+            Err(ParseError::EmptyInput) => break,
+            Err(e) => return Err(e),
+        }
+    }
+
+    Ok(recovered)
+}
+
+impl Drop for TopLevelCommands<'_> {
+    fn drop(&mut self) {
+        self.finish();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{init, parse, Limit};
+
+    fn setup() {
+        init();
+    }
+
+    fn first_word(cmd: &Command) -> &str {
+        match cmd {
+            Command::Simple { words, .. } => &words[0].word,
+            _ => panic!("Expected Simple command, got {cmd:?}"),
+        }
+    }
+
+    #[test]
+    fn test_yields_each_top_level_command() {
+        setup();
+        let cmds: Vec<_> = parse_iter("echo one\n\n# comment\nls -l\npwd\n")
+            .collect::<Result<_, _>>()
+            .unwrap();
+
+        let words: Vec<_> = cmds.iter().map(first_word).collect();
+        assert_eq!(words, ["echo", "ls", "pwd"]);
+    }
+
+    #[test]
+    fn test_line_numbers_are_absolute() {
+        setup();
+        let cmds: Vec<_> = parse_iter("echo one\n\nif true; then\n  echo two\nfi\necho three")
+            .collect::<Result<_, _>>()
+            .unwrap();
+
+        assert_eq!(cmds.len(), 3);
+        assert!(matches!(cmds[0], Command::Simple { line: Some(1), .. }));
+        assert!(matches!(cmds[2], Command::Simple { line: Some(6), .. }));
+    }
+
+    #[test]
+    fn test_same_line_list_is_one_command() {
+        setup();
+        let cmds: Vec<_> = parse_iter("a; b && c\nd\n")
+            .collect::<Result<_, _>>()
+            .unwrap();
+
+        assert_eq!(cmds.len(), 2);
+        assert!(matches!(cmds[0], Command::List { .. }));
+    }
+
+    #[test]
+    fn test_offsets_advance_by_line() {
+        setup();
+        let script = "echo one\necho two\n";
+        let mut iter = parse_iter(script);
+
+        assert!(iter.next().unwrap().is_ok());
+        assert_eq!(iter.offset(), "echo one\n".len());
+        assert!(iter.next().unwrap().is_ok());
+        assert_eq!(iter.offset(), script.len());
+        assert!(iter.next().is_none());
+    }
+
+    #[test]
+    fn test_heredoc_body_belongs_to_its_command() {
+        setup();
+        let cmds: Vec<_> = parse_iter("cat <<EOF\nhello\nEOF\necho after\n")
+            .collect::<Result<_, _>>()
+            .unwrap();
+
+        assert_eq!(cmds.len(), 2);
+        assert_eq!(first_word(&cmds[1]), "echo");
+    }
+
+    #[test]
+    fn test_limits_apply_to_each_command() {
+        setup();
+        let script = "echo one\necho two\necho 0123456789abcdef\necho never\n";
+        let mut iter =
+            parse_iter_with_limits(script, &ParseLimits::default().with_max_script_size(16));
+        assert!(iter.next().unwrap().is_ok());
+        assert!(iter.next().unwrap().is_ok());
+        assert!(matches!(iter.next(), Some(Err(ParseError::InputTooLarge))));
+        assert!(iter.next().is_none());
+
+        let limits = ParseLimits::default().with_max_words(3);
+        let items: Vec<_> = parse_iter_with_limits("echo a b\necho a b c d e\necho c\n", &limits)
+            .recover_errors()
+            .collect();
+        assert_eq!(items.len(), 2);
+        assert!(items[0].is_ok());
+        assert!(matches!(
+            items[1],
+            Err(ParseError::LimitExceeded(Limit::Words))
+        ));
+    }
+
+    #[test]
+    fn test_error_ends_stream() {
+        setup();
+        let mut iter = parse_iter("echo ok\nif then fi\necho never\n");
+
+        assert!(iter.next().unwrap().is_ok());
+        assert!(matches!(iter.next(), Some(Err(ParseError::SyntaxError(_)))));
+        assert!(iter.next().is_none());
+    }
+
+    #[test]
+    fn test_recover_errors() {
+        setup();
+        let items: Vec<_> = parse_iter("echo a\nif then fi\necho b\ncase x in\necho c\n")
+            .recover_errors()
+            .collect();
+
+        assert!(items[0].is_ok());
+        let Err(ParseError::SyntaxError(detail)) = &items[1] else {
+            panic!("Expected a syntax error, got {:?}", items[1]);
+        };
+        // Only Linux records the details (see SyntaxErrorDetail)
+        if cfg!(target_os = "linux") {
+            let detail = detail.as_ref().unwrap();
+            assert_eq!(detail.line, Some(2));
+            assert_eq!(detail.token.as_deref(), Some("then"));
+        }
+        assert_eq!(first_word(items[2].as_ref().unwrap()), "echo");
+        assert!(items[3..].iter().any(Result::is_err));
+    }
+
+    #[test]
+    fn test_parse_recover() {
+        setup();
+        let result = parse_recover("echo one\nfi\nls\ndone\npwd\n").unwrap();
+
+        let words: Vec<_> = result.commands.iter().map(first_word).collect();
+        assert_eq!(words, ["echo", "ls", "pwd"]);
+        let lines: Vec<_> = result.errors.iter().map(|e| e.line).collect();
+        assert_eq!(lines, [Some(2), Some(4)]);
+        assert_eq!(result.errors[1].token.as_deref(), Some("done"));
+
+        let empty = parse_recover("\n").unwrap();
+        assert!(empty.commands.is_empty() && empty.errors.is_empty());
+    }
+
+    #[test]
+    fn test_empty_and_nul_input() {
+        setup();
+        assert!(matches!(
+            parse_iter("  \n").next(),
+            Some(Err(ParseError::EmptyInput))
+        ));
+        assert!(matches!(
+            parse_iter("echo \0 x\n").next(),
+            Some(Err(ParseError::InvalidString(_)))
+        ));
+    }
+
+    #[test]
+    fn test_only_one_stream_at_a_time() {
+        setup();
+        let mut first = parse_iter("echo one\necho two\n");
+        assert!(first.next().unwrap().is_ok());
+
+        assert!(matches!(
+            parse_iter("echo other").next(),
+            Some(Err(ParseError::StreamBusy))
+        ));
+
+        // The first stream is unaffected, and a new one works once it's gone
+        assert!(first.next().unwrap().is_ok());
+        drop(first);
+        assert!(parse_iter("echo again").next().unwrap().is_ok());
+    }
+
+    #[test]
+    fn test_parse_between_items() {
+        setup();
+        let mut iter = parse_iter("echo one\nfor i in a; do echo $i; done\n");
+
+        assert_eq!(first_word(&iter.next().unwrap().unwrap()), "echo");
+        assert!(parse("while true; do break; done").is_ok());
+        assert!(parse("if then fi").is_err());
+        assert!(matches!(
+            iter.next().unwrap().unwrap(),
+            Command::For { line: Some(2), .. }
+        ));
+    }
+
+    #[test]
+    fn test_matches_whole_script_parse() {
+        setup();
+        let script = "x=1\nfunction f { echo $x; }\nf | grep 1 > out\n";
+        let streamed: Vec<_> = parse_iter(script).collect::<Result<_, _>>().unwrap();
+
+        // parse() joins top-level commands into a left-deep List chain
+        let mut expected = Vec::new();
+        let mut cmd = parse(script).unwrap();
+        while let Command::List {
+            left, op, right, ..
+        } = cmd
+        {
+            assert_eq!(op, crate::ListOp::Semi);
+            expected.push(right.into_inner());
+            cmd = left.into_inner();
+        }
+        expected.push(cmd);
+        expected.reverse();
+
+        let json = |cmds: &[Command]| serde_json::to_string(cmds).unwrap();
+        assert_eq!(json(&streamed), json(&expected));
+    }
+}
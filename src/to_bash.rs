@@ -3,10 +3,14 @@
 //! This module converts a bash AST (as produced by `parse()`) back into
 //! executable bash code. The output may not be formatted identically to
 //! the original, but it will be semantically equivalent.
+//!
+//! Commands are written from an explicit stack of steps rather than by
+//! recursion, so there is no limit on how deeply an AST may nest.
 
 use crate::ast::{
     CaseClause, Command, ConditionalExpr, ListOp, Redirect, RedirectTarget, RedirectType, Word,
 };
+use crate::Symbol;
 
 /// Convert a Command AST to a bash script string
 ///
@@ -24,127 +28,305 @@ use crate::ast::{
 #[must_use]
 pub fn to_bash(cmd: &Command) -> String {
     let mut output = String::new();
-    write_command(cmd, &mut output);
+    write_command_impl(cmd, &mut output, true);
     output
 }
 
-/// Write a command to the output string
-fn write_command(cmd: &Command, out: &mut String) {
-    write_command_impl(cmd, out, true);
-}
-
 /// Write a command, optionally including heredoc content
-#[allow(clippy::too_many_lines)]
 fn write_command_impl(cmd: &Command, out: &mut String, include_heredoc_content: bool) {
-    match cmd {
-        Command::Simple {
-            words,
-            redirects,
-            assignments,
-            ..
-        } => {
-            write_simple_impl(
-                words,
-                redirects,
-                assignments.as_deref(),
-                out,
+    let mut writer = Writer {
+        out,
+        steps: vec![Step::Command(cmd, include_heredoc_content)],
+        heredocs: 0,
+    };
+    writer.run();
+}
+
+/// One piece of output still to be written
+#[derive(Clone, Copy)]
+enum Step<'a> {
+    /// A command, with its heredoc content if the flag is set
+    Command(&'a Command, bool),
+    /// Fixed text
+    Text(&'static str),
+    /// The keyword closing a part of a compound command after the given command
+    Separator(&'a Command, &'static str),
+    /// The operator between the sides of a `;` or newline list, or the space
+    /// after a `&` that has another command following it, given the number
+    /// of heredocs written before the left side
+    ListSeparator {
+        op: ListOp,
+        left: &'a Command,
+        right: &'a Command,
+        include_heredoc_content: bool,
+        heredocs_before: usize,
+    },
+    /// The rest of a `;`/newline sequence, with heredoc content if the flag
+    /// is set
+    Sequence(&'a [(Command, ListOp)], bool),
+    /// A compound command's redirects, without heredoc content
+    Redirects(&'a [Redirect]),
+    /// The content of every heredoc inside a command
+    Heredocs(&'a Command),
+    /// The content of the heredocs among a compound command's redirects
+    RedirectHeredocs(&'a [Redirect]),
+    /// The `elif`/`else` part of an if statement, after the given branch
+    ElseChain(&'a Command, &'a Command),
+    /// A case clause
+    Clause(&'a CaseClause),
+    /// A case clause's terminator
+    ClauseEnd(&'a CaseClause),
+    /// A conditional expression
+    Cond(&'a ConditionalExpr),
+}
+
+/// Writes commands by taking steps off a stack
+///
+/// Each step writes what it can straight away and plans the rest as further
+/// steps, which are pushed in reverse so the first is taken next.
+struct Writer<'a, 'o> {
+    out: &'o mut String,
+    steps: Vec<Step<'a>>,
+    /// Heredoc markers written so far
+    heredocs: usize,
+}
+
+impl<'a> Writer<'a, '_> {
+    fn run(&mut self) {
+        let mut plan = Vec::new();
+        while let Some(step) = self.steps.pop() {
+            self.step(step, &mut plan);
+            plan.reverse();
+            self.steps.append(&mut plan);
+        }
+    }
+
+    fn step(&mut self, step: Step<'a>, plan: &mut Vec<Step<'a>>) {
+        let out = &mut *self.out;
+        match step {
+            Step::Command(cmd, include_heredoc_content) => {
+                self.command(cmd, include_heredoc_content, plan);
+            }
+            Step::Text(text) => out.push_str(text),
+            Step::Separator(preceding_cmd, suffix) => {
+                write_compound_separator(out, preceding_cmd, suffix);
+            }
+            Step::ListSeparator {
+                op,
+                left,
+                right,
                 include_heredoc_content,
-            );
+                heredocs_before,
+            } => {
+                // For semi, use newline if:
+                // 1. Commands are on different lines, OR
+                // 2. Left command has a heredoc (heredoc content must come before the next command)
+                let left_has_heredoc = self.heredocs > heredocs_before;
+                let use_newline = op == ListOp::Semi
+                    && ((include_heredoc_content && left_has_heredoc)
+                        || match (get_last_line(left), get_first_line(right)) {
+                            (Some(l), Some(r)) => r > l,
+                            _ => false,
+                        });
+                match op {
+                    ListOp::Semi if use_newline => out.push('\n'),
+                    ListOp::Semi => out.push_str("; "),
+                    ListOp::Newline => out.push('\n'),
+                    // Heredoc content after the `&` ends its line
+                    ListOp::Amp if include_heredoc_content && left_has_heredoc => out.push('\n'),
+                    ListOp::Amp => out.push(' '),
+                    ListOp::And | ListOp::Or => unreachable!(),
+                }
+            }
+            Step::Sequence(items, include_heredoc_content) => {
+                plan_sequence_item(items, include_heredoc_content, self.heredocs, plan);
+            }
+            Step::Redirects(redirects) => {
+                self.heredocs += redirects.iter().filter(|r| is_heredoc_redirect(r)).count();
+                write_redirects_impl(redirects, out, false);
+            }
+            Step::Heredocs(cmd) => write_deferred_heredocs(cmd, out),
+            Step::RedirectHeredocs(redirects) => {
+                write_deferred_heredocs_from_redirects(redirects, out);
+            }
+            Step::ElseChain(cmd, previous_branch) => plan_else_chain(cmd, previous_branch, plan),
+            Step::Clause(clause) => {
+                // Write patterns
+                for (i, pattern) in clause.patterns.iter().enumerate() {
+                    if i > 0 {
+                        out.push('|');
+                    }
+                    out.push_str(pattern);
+                }
+                out.push_str(") ");
+
+                // Write action
+                if let Some(action) = &clause.action {
+                    plan.push(Step::Command(action, false));
+                }
+                plan.push(Step::ClauseEnd(clause));
+            }
+            Step::ClauseEnd(clause) => {
+                // Write terminator
+                if let Some(flags) = &clause.flags {
+                    if flags.fallthrough {
+                        out.push_str(";&");
+                    } else if flags.test_next {
+                        out.push_str(";;&");
+                    } else {
+                        out.push_str(";;");
+                    }
+                } else {
+                    out.push_str(";;");
+                }
+                out.push(' ');
+            }
+            Step::Cond(expr) => write_cond_expr(expr, out, plan),
         }
-        Command::Pipeline {
-            commands, negated, ..
-        } => write_pipeline(commands, *negated, out, include_heredoc_content),
-        Command::List {
-            op, left, right, ..
-        } => write_list(*op, left, right, out, include_heredoc_content),
-        Command::For {
-            variable,
-            words,
-            body,
-            redirects,
-            ..
-        } => {
-            write_for(
+    }
+
+    /// Write the start of a command and plan the rest
+    #[allow(clippy::too_many_lines)] // One arm per command type
+    fn command(
+        &mut self,
+        cmd: &'a Command,
+        include_heredoc_content: bool,
+        plan: &mut Vec<Step<'a>>,
+    ) {
+        let out = &mut *self.out;
+        match cmd {
+            Command::Simple {
+                words,
+                redirects,
+                assignments,
+                ..
+            } => {
+                self.heredocs += redirects.iter().filter(|r| is_heredoc_redirect(r)).count();
+                write_simple_impl(
+                    words,
+                    redirects,
+                    assignments.as_deref(),
+                    out,
+                    include_heredoc_content,
+                );
+            }
+            Command::Pipeline {
+                commands, negated, ..
+            } => write_pipeline(commands, *negated, out, include_heredoc_content, plan),
+            Command::List {
+                op, left, right, ..
+            } => {
+                let heredocs_before = self.heredocs;
+                write_list(
+                    *op,
+                    left,
+                    right,
+                    include_heredoc_content,
+                    heredocs_before,
+                    plan,
+                );
+            }
+            Command::Sequence { items, .. } => {
+                write_sequence(items, include_heredoc_content, plan);
+            }
+            Command::For {
                 variable,
-                words.as_deref(),
+                words,
                 body,
                 redirects,
-                out,
-                include_heredoc_content,
-            );
-        }
-        Command::While {
-            test,
-            body,
-            redirects,
-            ..
-        } => write_while(test, body, redirects, out, include_heredoc_content),
-        Command::Until {
-            test,
-            body,
-            redirects,
-            ..
-        } => write_until(test, body, redirects, out, include_heredoc_content),
-        Command::If {
-            condition,
-            then_branch,
-            else_branch,
-            redirects,
-            ..
-        } => {
-            write_if(
+                ..
+            } => {
+                write_for(
+                    variable,
+                    words.as_deref(),
+                    body,
+                    redirects,
+                    out,
+                    include_heredoc_content,
+                    plan,
+                );
+            }
+            Command::While {
+                test,
+                body,
+                redirects,
+                ..
+            } => {
+                out.push_str("while ");
+                plan_loop(test, body, redirects, include_heredoc_content, plan);
+            }
+            Command::Until {
+                test,
+                body,
+                redirects,
+                ..
+            } => {
+                out.push_str("until ");
+                plan_loop(test, body, redirects, include_heredoc_content, plan);
+            }
+            Command::If {
                 condition,
                 then_branch,
-                else_branch.as_deref(),
+                else_branch,
                 redirects,
-                out,
-                include_heredoc_content,
-            );
-        }
-        Command::Case {
-            word,
-            clauses,
-            redirects,
-            ..
-        } => write_case(word, clauses, redirects, out, include_heredoc_content),
-        Command::Select {
-            variable,
-            words,
-            body,
-            redirects,
-            ..
-        } => {
-            write_select(
+                ..
+            } => {
+                write_if(
+                    condition,
+                    then_branch,
+                    else_branch.as_deref(),
+                    redirects,
+                    out,
+                    include_heredoc_content,
+                    plan,
+                );
+            }
+            Command::Case {
+                word,
+                clauses,
+                redirects,
+                ..
+            } => write_case(word, clauses, redirects, out, include_heredoc_content, plan),
+            Command::Select {
                 variable,
-                words.as_deref(),
+                words,
                 body,
                 redirects,
-                out,
-                include_heredoc_content,
-            );
-        }
-        Command::Group {
-            body, redirects, ..
-        } => write_group(body, redirects, out, include_heredoc_content),
-        Command::Subshell {
-            body, redirects, ..
-        } => write_subshell(body, redirects, out, include_heredoc_content),
-        Command::FunctionDef { name, body, .. } => {
-            write_function_def(name, body, out, include_heredoc_content);
-        }
-        Command::Arithmetic { expression, .. } => write_arithmetic(expression, out),
-        Command::ArithmeticFor {
-            init,
-            test,
-            step,
-            body,
-            ..
-        } => {
-            write_arith_for(init, test, step, body, out, include_heredoc_content);
-        }
-        Command::Conditional { expr, .. } => write_conditional(expr, out),
-        Command::Coproc { name, body, .. } => {
-            write_coproc(name.as_deref(), body, out, include_heredoc_content);
+                ..
+            } => {
+                write_select(
+                    variable,
+                    words.as_deref(),
+                    body,
+                    redirects,
+                    out,
+                    include_heredoc_content,
+                    plan,
+                );
+            }
+            Command::Group {
+                body, redirects, ..
+            } => write_group(body, redirects, out, include_heredoc_content, plan),
+            Command::Subshell {
+                body, redirects, ..
+            } => write_subshell(body, redirects, out, include_heredoc_content, plan),
+            Command::FunctionDef { name, body, .. } => {
+                write_function_def(name, body, out, include_heredoc_content, plan);
+            }
+            Command::Arithmetic { expression, .. } => write_arithmetic(expression, out),
+            Command::ArithmeticFor {
+                init,
+                test,
+                step,
+                body,
+                ..
+            } => {
+                write_arith_for(init, test, step, body, out, include_heredoc_content, plan);
+            }
+            Command::Conditional { expr, .. } => write_conditional(expr, out, plan),
+            Command::Coproc { name, body, .. } => {
+                write_coproc(name.as_deref(), body, out, include_heredoc_content, plan);
+            }
         }
     }
 }
@@ -350,99 +532,50 @@ fn write_redirect(redirect: &Redirect, out: &mut String) {
 }
 
 /// Write a pipeline (cmd1 | cmd2 | cmd3)
-fn write_pipeline(
-    commands: &[Command],
+fn write_pipeline<'a>(
+    commands: &'a [Command],
     negated: bool,
     out: &mut String,
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
     if negated {
         out.push_str("! ");
     }
     for (i, cmd) in commands.iter().enumerate() {
         if i > 0 {
-            out.push_str(" | ");
+            plan.push(Step::Text(" | "));
         }
-        write_command_impl(cmd, out, false);
+        plan.push(Step::Command(cmd, false));
     }
     if include_heredoc_content {
-        write_deferred_heredocs_from_commands(commands, out);
+        plan.extend(commands.iter().map(Step::Heredocs));
     }
 }
 
-/// Get the line number of the first token in a command
 /// Get the first line number of a command (for determining where it starts).
-/// For List nodes, recurses into the left child to find the actual first command.
+/// For List and Sequence nodes, descends into the first command.
 fn get_first_line(cmd: &Command) -> Option<u32> {
-    match cmd {
-        Command::List { left, .. } => get_first_line(left),
-        _ => cmd.line(),
+    let mut cmd = cmd;
+    loop {
+        match cmd {
+            Command::List { left, .. } => cmd = left,
+            Command::Sequence { items, .. } if !items.is_empty() => cmd = &items[0].0,
+            _ => return cmd.line(),
+        }
     }
 }
 
 /// Get the last line number of a command (for determining where it ends).
-/// For List nodes, recurses into the right child to find the actual last command.
+/// For List and Sequence nodes, descends into the last command.
 fn get_last_line(cmd: &Command) -> Option<u32> {
-    match cmd {
-        Command::List { right, .. } => get_last_line(right),
-        _ => cmd.line(),
-    }
-}
-
-/// Check if a command subtree contains any heredoc redirects.
-fn has_heredoc(cmd: &Command) -> bool {
-    match cmd {
-        Command::Simple { redirects, .. } => redirects.iter().any(is_heredoc_redirect),
-        Command::Pipeline { commands, .. } => commands.iter().any(has_heredoc),
-        Command::List { left, right, .. } => has_heredoc(left) || has_heredoc(right),
-        Command::For {
-            body, redirects, ..
-        }
-        | Command::Select {
-            body, redirects, ..
-        }
-        | Command::Group {
-            body, redirects, ..
-        }
-        | Command::Subshell {
-            body, redirects, ..
-        } => has_heredoc(body) || redirects.iter().any(is_heredoc_redirect),
-        Command::While {
-            test,
-            body,
-            redirects,
-            ..
-        }
-        | Command::Until {
-            test,
-            body,
-            redirects,
-            ..
-        } => has_heredoc(test) || has_heredoc(body) || redirects.iter().any(is_heredoc_redirect),
-        Command::If {
-            condition,
-            then_branch,
-            else_branch,
-            redirects,
-            ..
-        } => {
-            has_heredoc(condition)
-                || has_heredoc(then_branch)
-                || else_branch.as_deref().is_some_and(has_heredoc)
-                || redirects.iter().any(is_heredoc_redirect)
-        }
-        Command::Case {
-            clauses, redirects, ..
-        } => {
-            clauses
-                .iter()
-                .any(|clause| clause.action.as_deref().is_some_and(has_heredoc))
-                || redirects.iter().any(is_heredoc_redirect)
+    let mut cmd = cmd;
+    loop {
+        match cmd {
+            Command::List { right, .. } => cmd = right,
+            Command::Sequence { items, .. } if !items.is_empty() => cmd = &items[items.len() - 1].0,
+            _ => return cmd.line(),
         }
-        Command::FunctionDef { body, .. }
-        | Command::ArithmeticFor { body, .. }
-        | Command::Coproc { body, .. } => has_heredoc(body),
-        Command::Arithmetic { .. } | Command::Conditional { .. } => false,
     }
 }
 
@@ -450,93 +583,115 @@ fn is_heredoc_redirect(redirect: &Redirect) -> bool {
     redirect.direction == RedirectType::HereDoc
 }
 
-/// Collect all heredocs from a command tree in lexical order.
-fn collect_heredocs(cmd: &Command) -> Vec<&Redirect> {
-    let mut heredocs = Vec::new();
-    collect_heredocs_impl(cmd, &mut heredocs);
-    heredocs
+/// Check if a command is empty (e.g., the right side of "cmd &")
+const fn is_empty_simple(cmd: &Command) -> bool {
+    matches!(
+        cmd,
+        Command::Simple { words, redirects, assignments, .. }
+        if words.is_empty() && redirects.is_empty() && assignments.is_none()
+    )
 }
 
-fn collect_redirect_heredocs<'a>(redirects: &'a [Redirect], heredocs: &mut Vec<&'a Redirect>) {
-    for redirect in redirects {
-        if is_heredoc_redirect(redirect) {
-            heredocs.push(redirect);
-        }
+/// Collect all heredocs from a command tree in lexical order.
+fn collect_heredocs(cmd: &Command) -> Vec<&Redirect> {
+    /// A command still to search, or redirects to take once its children
+    /// have been searched
+    enum Item<'a> {
+        Command(&'a Command),
+        Redirects(&'a [Redirect]),
     }
-}
 
-fn collect_heredocs_impl<'a>(cmd: &'a Command, heredocs: &mut Vec<&'a Redirect>) {
-    match cmd {
-        Command::Simple { redirects, .. } => collect_redirect_heredocs(redirects, heredocs),
-        Command::Pipeline { commands, .. } => {
-            for command in commands {
-                collect_heredocs_impl(command, heredocs);
+    let mut heredocs = Vec::new();
+    let mut stack = vec![Item::Command(cmd)];
+    // Children of the current command, in lexical order
+    let mut children = Vec::new();
+    while let Some(item) = stack.pop() {
+        let cmd = match item {
+            Item::Command(cmd) => cmd,
+            Item::Redirects(redirects) => {
+                heredocs.extend(redirects.iter().filter(|r| is_heredoc_redirect(r)));
+                continue;
             }
-        }
-        Command::List { left, right, .. } => {
-            collect_heredocs_impl(left, heredocs);
-            collect_heredocs_impl(right, heredocs);
-        }
-        Command::For {
-            body, redirects, ..
-        }
-        | Command::Select {
-            body, redirects, ..
-        }
-        | Command::Group {
-            body, redirects, ..
-        }
-        | Command::Subshell {
-            body, redirects, ..
-        } => {
-            collect_heredocs_impl(body, heredocs);
-            collect_redirect_heredocs(redirects, heredocs);
-        }
-        Command::While {
-            test,
-            body,
-            redirects,
-            ..
-        }
-        | Command::Until {
-            test,
-            body,
-            redirects,
-            ..
-        } => {
-            collect_heredocs_impl(test, heredocs);
-            collect_heredocs_impl(body, heredocs);
-            collect_redirect_heredocs(redirects, heredocs);
-        }
-        Command::If {
-            condition,
-            then_branch,
-            else_branch,
-            redirects,
-            ..
-        } => {
-            collect_heredocs_impl(condition, heredocs);
-            collect_heredocs_impl(then_branch, heredocs);
-            if let Some(else_branch) = else_branch {
-                collect_heredocs_impl(else_branch, heredocs);
+        };
+        let redirects: &[Redirect] = match cmd {
+            Command::Simple { redirects, .. } => {
+                heredocs.extend(redirects.iter().filter(|r| is_heredoc_redirect(r)));
+                continue;
             }
-            collect_redirect_heredocs(redirects, heredocs);
-        }
-        Command::Case {
-            clauses, redirects, ..
-        } => {
-            for clause in clauses {
-                if let Some(action) = &clause.action {
-                    collect_heredocs_impl(action, heredocs);
-                }
+            Command::Pipeline { commands, .. } => {
+                children.extend(commands);
+                &[]
+            }
+            Command::List { left, right, .. } => {
+                children.extend([&**left, &**right]);
+                &[]
+            }
+            Command::Sequence { items, .. } => {
+                children.extend(items.iter().map(|(cmd, _)| cmd));
+                &[]
+            }
+            Command::For {
+                body, redirects, ..
+            }
+            | Command::Select {
+                body, redirects, ..
+            }
+            | Command::Group {
+                body, redirects, ..
             }
-            collect_redirect_heredocs(redirects, heredocs);
+            | Command::Subshell {
+                body, redirects, ..
+            } => {
+                children.push(&**body);
+                redirects
+            }
+            Command::While {
+                test,
+                body,
+                redirects,
+                ..
+            }
+            | Command::Until {
+                test,
+                body,
+                redirects,
+                ..
+            } => {
+                children.extend([&**test, &**body]);
+                redirects
+            }
+            Command::If {
+                condition,
+                then_branch,
+                else_branch,
+                redirects,
+                ..
+            } => {
+                children.extend([&**condition, &**then_branch]);
+                children.extend(else_branch.as_deref());
+                redirects
+            }
+            Command::Case {
+                clauses, redirects, ..
+            } => {
+                children.extend(clauses.iter().filter_map(|clause| clause.action.as_deref()));
+                redirects
+            }
+            Command::FunctionDef { body, .. }
+            | Command::ArithmeticFor { body, .. }
+            | Command::Coproc { body, .. } => {
+                children.push(&**body);
+                &[]
+            }
+            Command::Arithmetic { .. } | Command::Conditional { .. } => continue,
+        };
+        // The command's own redirects come after everything inside it
+        stack.push(Item::Redirects(redirects));
+        while let Some(child) = children.pop() {
+            stack.push(Item::Command(child));
         }
-        Command::FunctionDef { body, .. }
-        | Command::ArithmeticFor { body, .. }
-        | Command::Coproc { body, .. } => collect_heredocs_impl(body, heredocs),
-        Command::Arithmetic { .. } | Command::Conditional { .. } => {}
     }
+    heredocs
 }
 
 fn write_deferred_heredocs(cmd: &Command, out: &mut String) {
@@ -555,108 +710,142 @@ fn write_deferred_heredocs_from_redirects(redirects: &[Redirect], out: &mut Stri
     }
 }
 
-fn write_deferred_heredocs_from_commands(commands: &[Command], out: &mut String) {
-    for command in commands {
-        write_deferred_heredocs(command, out);
-    }
-}
-
-fn write_deferred_heredocs_from_opt_command(cmd: Option<&Command>, out: &mut String) {
-    if let Some(cmd) = cmd {
-        write_deferred_heredocs(cmd, out);
-    }
-}
-
-/// Write a list (cmd1 && cmd2, cmd1 || cmd2, etc.)
-fn write_list(
+/// Plan a list (cmd1 && cmd2, cmd1 || cmd2, etc.)
+fn write_list<'a>(
     op: ListOp,
-    left: &Command,
-    right: &Command,
-    out: &mut String,
+    left: &'a Command,
+    right: &'a Command,
     include_heredoc_content: bool,
+    heredocs_before: usize,
+    plan: &mut Vec<Step<'a>>,
 ) {
     // Check if right side is empty (e.g., "cmd &" has empty right side)
-    let right_is_empty = matches!(
-        right,
-        Command::Simple { words, redirects, assignments, .. }
-        if words.is_empty() && redirects.is_empty() && assignments.is_none()
-    );
-
-    let left_has_heredoc = has_heredoc(left);
-
-    // For semi, use newline if:
-    // 1. Commands are on different lines, OR
-    // 2. Left command has a heredoc (heredoc content must come before the next command)
-    let use_newline = op == ListOp::Semi
-        && ((include_heredoc_content && left_has_heredoc)
-            || match (get_last_line(left), get_first_line(right)) {
-                (Some(l), Some(r)) => r > l,
-                _ => false,
-            });
+    let right_is_empty = is_empty_simple(right);
 
     match op {
         // These operators keep both commands on the same logical command line, so any
         // heredoc content must be deferred until after the entire list is written.
         ListOp::And | ListOp::Or | ListOp::Amp => {
-            write_command_impl(left, out, false);
-
-            match op {
-                ListOp::And => out.push_str(" && "),
-                ListOp::Or => out.push_str(" || "),
-                ListOp::Amp => {
-                    out.push_str(" &");
-                    if !right_is_empty {
-                        out.push(' ');
-                    }
-                }
+            plan.push(Step::Command(left, false));
+            plan.push(Step::Text(match op {
+                ListOp::And => " && ",
+                ListOp::Or => " || ",
+                ListOp::Amp if right_is_empty => " &",
+                ListOp::Amp => " & ",
                 ListOp::Semi | ListOp::Newline => unreachable!(),
-            }
+            }));
 
             if !right_is_empty {
-                write_command_impl(right, out, false);
+                plan.push(Step::Command(right, false));
             }
 
             if include_heredoc_content {
-                write_deferred_heredocs(left, out);
+                plan.push(Step::Heredocs(left));
                 if !right_is_empty {
-                    write_deferred_heredocs(right, out);
+                    plan.push(Step::Heredocs(right));
                 }
             }
         }
         ListOp::Semi | ListOp::Newline => {
-            write_command_impl(left, out, include_heredoc_content);
-
-            match op {
-                ListOp::Semi if use_newline => out.push('\n'),
-                ListOp::Semi => out.push_str("; "),
-                ListOp::Newline => out.push('\n'),
-                ListOp::And | ListOp::Or | ListOp::Amp => unreachable!(),
-            }
-
+            plan.push(Step::Command(left, include_heredoc_content));
+            plan.push(Step::ListSeparator {
+                op,
+                left,
+                right,
+                include_heredoc_content,
+                heredocs_before,
+            });
             if !right_is_empty {
-                write_command_impl(right, out, include_heredoc_content);
+                plan.push(Step::Command(right, include_heredoc_content));
             }
         }
     }
 }
 
+/// Plan a sequence of commands joined by list operators
+///
+/// `&&`/`||` sequences are one logical command line, so their heredoc
+/// content waits until the end as in [`write_list()`]. A `;`/newline
+/// sequence is planned a command at a time by [`Step::Sequence`].
+fn write_sequence<'a>(
+    items: &'a [(Command, ListOp)],
+    include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
+) {
+    if !items.first().is_some_and(|(_, op)| op.is_and_or()) {
+        plan.push(Step::Sequence(items, include_heredoc_content));
+        return;
+    }
+    for (i, (cmd, op)) in items.iter().enumerate() {
+        plan.push(Step::Command(cmd, false));
+        let text = match op {
+            ListOp::And => " && ",
+            ListOp::Or => " || ",
+            ListOp::Amp => " &",
+            ListOp::Semi | ListOp::Newline if i + 1 == items.len() => continue,
+            ListOp::Semi | ListOp::Newline => "; ",
+        };
+        plan.push(Step::Text(text));
+    }
+    if include_heredoc_content {
+        plan.extend(items.iter().map(|(cmd, _)| Step::Heredocs(cmd)));
+    }
+}
+
+/// Plan the first command of a `;`/newline sequence and its separator
+///
+/// Each command's heredoc content follows it, so whether the separator must
+/// be a newline depends on the heredocs written for that command alone.
+fn plan_sequence_item<'a>(
+    items: &'a [(Command, ListOp)],
+    include_heredoc_content: bool,
+    heredocs_before: usize,
+    plan: &mut Vec<Step<'a>>,
+) {
+    let Some(((cmd, op), rest)) = items.split_first() else {
+        return;
+    };
+    if *op == ListOp::Amp {
+        plan.extend([Step::Command(cmd, false), Step::Text(" &")]);
+        if include_heredoc_content {
+            plan.push(Step::Heredocs(cmd));
+        }
+    } else {
+        plan.push(Step::Command(cmd, include_heredoc_content));
+    }
+    if let Some((right, _)) = rest.first() {
+        plan.extend([
+            Step::ListSeparator {
+                op: *op,
+                left: cmd,
+                right,
+                include_heredoc_content,
+                heredocs_before,
+            },
+            Step::Sequence(rest, include_heredoc_content),
+        ]);
+    }
+}
+
 /// Check if a command ends with a background operator (needs no semicolon after)
 fn ends_with_background(cmd: &Command) -> bool {
-    match cmd {
-        Command::List {
-            op: ListOp::Amp,
-            right,
-            ..
-        } => {
-            // Check if right is empty (pure background) or also ends with &
-            matches!(
-                right.as_ref(),
-                Command::Simple { words, redirects, assignments, .. }
-                if words.is_empty() && redirects.is_empty() && assignments.is_none()
-            ) || ends_with_background(right)
+    let mut cmd = cmd;
+    loop {
+        match cmd {
+            Command::List { op, right, .. } => {
+                // A pure background list, or one whose right side also ends with &
+                if *op == ListOp::Amp && is_empty_simple(right) {
+                    return true;
+                }
+                cmd = right;
+            }
+            Command::Sequence { items, .. } => match items.last() {
+                Some((_, ListOp::Amp)) => return true,
+                Some((last, _)) => cmd = last,
+                None => return false,
+            },
+            _ => return false,
         }
-        Command::List { right, .. } => ends_with_background(right),
-        _ => false,
     }
 }
 
@@ -669,14 +858,32 @@ fn write_compound_separator(out: &mut String, preceding_cmd: &Command, suffix: &
     out.push_str(suffix);
 }
 
+/// Plan the body of a for or select loop, after its word list
+fn plan_loop_body<'a>(
+    body: &'a Command,
+    redirects: &'a [Redirect],
+    include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
+) {
+    plan.extend([
+        Step::Command(body, false),
+        Step::Separator(body, "done"),
+        Step::Redirects(redirects),
+    ]);
+    if include_heredoc_content {
+        plan.extend([Step::Heredocs(body), Step::RedirectHeredocs(redirects)]);
+    }
+}
+
 /// Write a for loop
-fn write_for(
+fn write_for<'a>(
     variable: &str,
-    words: Option<&[String]>,
-    body: &Command,
-    redirects: &[Redirect],
+    words: Option<&[Symbol]>,
+    body: &'a Command,
+    redirects: &'a [Redirect],
     out: &mut String,
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
     out.push_str("for ");
     out.push_str(variable);
@@ -688,114 +895,68 @@ fn write_for(
         }
     }
     out.push_str("; do ");
-    write_command_impl(body, out, false);
-    write_compound_separator(out, body, "done");
-    write_redirects_impl(redirects, out, false);
-    if include_heredoc_content {
-        write_deferred_heredocs(body, out);
-        write_deferred_heredocs_from_redirects(redirects, out);
-    }
-}
-
-/// Write a while loop
-fn write_while(
-    test: &Command,
-    body: &Command,
-    redirects: &[Redirect],
-    out: &mut String,
-    include_heredoc_content: bool,
-) {
-    out.push_str("while ");
-    write_command_impl(test, out, false);
-    write_compound_separator(out, test, "do");
-    out.push(' ');
-    write_command_impl(body, out, false);
-    write_compound_separator(out, body, "done");
-    write_redirects_impl(redirects, out, false);
-    if include_heredoc_content {
-        write_deferred_heredocs(test, out);
-        write_deferred_heredocs(body, out);
-        write_deferred_heredocs_from_redirects(redirects, out);
-    }
+    plan_loop_body(body, redirects, include_heredoc_content, plan);
 }
 
-/// Write an until loop
-fn write_until(
-    test: &Command,
-    body: &Command,
-    redirects: &[Redirect],
-    out: &mut String,
+/// Plan a while or until loop, after its keyword
+fn plan_loop<'a>(
+    test: &'a Command,
+    body: &'a Command,
+    redirects: &'a [Redirect],
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
-    out.push_str("until ");
-    write_command_impl(test, out, false);
-    write_compound_separator(out, test, "do");
-    out.push(' ');
-    write_command_impl(body, out, false);
-    write_compound_separator(out, body, "done");
-    write_redirects_impl(redirects, out, false);
+    plan.extend([
+        Step::Command(test, false),
+        Step::Separator(test, "do"),
+        Step::Text(" "),
+        Step::Command(body, false),
+        Step::Separator(body, "done"),
+        Step::Redirects(redirects),
+    ]);
     if include_heredoc_content {
-        write_deferred_heredocs(test, out);
-        write_deferred_heredocs(body, out);
-        write_deferred_heredocs_from_redirects(redirects, out);
+        plan.extend([
+            Step::Heredocs(test),
+            Step::Heredocs(body),
+            Step::RedirectHeredocs(redirects),
+        ]);
     }
 }
 
 /// Write an if statement
-fn write_if(
-    condition: &Command,
-    then_branch: &Command,
-    else_branch: Option<&Command>,
-    redirects: &[Redirect],
+fn write_if<'a>(
+    condition: &'a Command,
+    then_branch: &'a Command,
+    else_branch: Option<&'a Command>,
+    redirects: &'a [Redirect],
     out: &mut String,
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
     out.push_str("if ");
-    write_command_impl(condition, out, false);
-    write_compound_separator(out, condition, "then");
-    out.push(' ');
-    write_command_impl(then_branch, out, false);
-
+    plan.extend([
+        Step::Command(condition, false),
+        Step::Separator(condition, "then"),
+        Step::Text(" "),
+        Step::Command(then_branch, false),
+    ]);
     if let Some(else_cmd) = else_branch {
-        // Check if it's an elif (nested if in else)
-        if let Command::If {
-            condition: elif_cond,
-            then_branch: elif_then,
-            else_branch: elif_else,
-            ..
-        } = else_cmd
-        {
-            write_compound_separator(out, then_branch, "elif");
-            out.push(' ');
-            write_command_impl(elif_cond, out, false);
-            write_compound_separator(out, elif_cond, "then");
-            out.push(' ');
-            write_command_impl(elif_then, out, false);
-            // Recursively handle more elif/else
-            if let Some(nested_else) = elif_else {
-                write_else_chain(nested_else.as_ref(), elif_then, out);
-            }
-        } else {
-            write_compound_separator(out, then_branch, "else");
-            out.push(' ');
-            write_command_impl(else_cmd, out, false);
-        }
+        plan.push(Step::ElseChain(else_cmd, then_branch));
     }
-
-    write_compound_separator(out, else_branch.map_or(then_branch, last_if_branch), "fi");
-    write_redirects_impl(redirects, out, false);
+    plan.extend([
+        Step::Separator(else_branch.map_or(then_branch, last_if_branch), "fi"),
+        Step::Redirects(redirects),
+    ]);
     if include_heredoc_content {
-        write_deferred_heredocs(condition, out);
-        write_deferred_heredocs(then_branch, out);
-        if let Some(else_cmd) = else_branch {
-            write_deferred_heredocs(else_cmd, out);
-        }
-        write_deferred_heredocs_from_redirects(redirects, out);
+        plan.extend([Step::Heredocs(condition), Step::Heredocs(then_branch)]);
+        plan.extend(else_branch.map(Step::Heredocs));
+        plan.push(Step::RedirectHeredocs(redirects));
     }
 }
 
-/// Helper to write elif/else chains
-fn write_else_chain(cmd: &Command, previous_branch: &Command, out: &mut String) {
+/// Plan an elif/else chain
+fn plan_else_chain<'a>(cmd: &'a Command, previous_branch: &'a Command, plan: &mut Vec<Step<'a>>) {
+    // Check if it's an elif (nested if in else)
     if let Command::If {
         condition,
         then_branch,
@@ -803,93 +964,77 @@ fn write_else_chain(cmd: &Command, previous_branch: &Command, out: &mut String)
         ..
     } = cmd
     {
-        write_compound_separator(out, previous_branch, "elif");
-        out.push(' ');
-        write_command_impl(condition, out, false);
-        write_compound_separator(out, condition, "then");
-        out.push(' ');
-        write_command_impl(then_branch, out, false);
+        plan.extend([
+            Step::Separator(previous_branch, "elif"),
+            Step::Text(" "),
+            Step::Command(condition, false),
+            Step::Separator(condition, "then"),
+            Step::Text(" "),
+            Step::Command(then_branch, false),
+        ]);
         if let Some(nested_else) = else_branch {
-            write_else_chain(nested_else.as_ref(), then_branch, out);
+            plan.push(Step::ElseChain(nested_else, then_branch));
         }
     } else {
-        write_compound_separator(out, previous_branch, "else");
-        out.push(' ');
-        write_command_impl(cmd, out, false);
+        plan.extend([
+            Step::Separator(previous_branch, "else"),
+            Step::Text(" "),
+            Step::Command(cmd, false),
+        ]);
     }
 }
 
 fn last_if_branch(cmd: &Command) -> &Command {
-    match cmd {
-        Command::If {
-            then_branch,
-            else_branch,
-            ..
-        } => else_branch.as_deref().map_or(then_branch, last_if_branch),
-        other => other,
+    let mut cmd = cmd;
+    while let Command::If {
+        then_branch,
+        else_branch,
+        ..
+    } = cmd
+    {
+        match else_branch {
+            Some(else_branch) => cmd = else_branch,
+            None => return then_branch,
+        }
     }
+    cmd
 }
 
 /// Write a case statement
-fn write_case(
+fn write_case<'a>(
     word: &str,
-    clauses: &[CaseClause],
-    redirects: &[Redirect],
+    clauses: &'a [CaseClause],
+    redirects: &'a [Redirect],
     out: &mut String,
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
     out.push_str("case ");
     out.push_str(word);
     out.push_str(" in ");
 
-    for clause in clauses {
-        // Write patterns
-        for (i, pattern) in clause.patterns.iter().enumerate() {
-            if i > 0 {
-                out.push('|');
-            }
-            out.push_str(pattern);
-        }
-        out.push_str(") ");
-
-        // Write action
-        if let Some(action) = &clause.action {
-            write_command_impl(action, out, false);
-        }
-
-        // Write terminator
-        if let Some(flags) = &clause.flags {
-            if flags.fallthrough {
-                out.push_str(";&");
-            } else if flags.test_next {
-                out.push_str(";;&");
-            } else {
-                out.push_str(";;");
-            }
-        } else {
-            out.push_str(";;");
-        }
-        out.push(' ');
-    }
-
-    out.push_str("esac");
-    write_redirects_impl(redirects, out, false);
+    plan.extend(clauses.iter().map(Step::Clause));
+    plan.extend([Step::Text("esac"), Step::Redirects(redirects)]);
     if include_heredoc_content {
-        for clause in clauses {
-            write_deferred_heredocs_from_opt_command(clause.action.as_deref(), out);
-        }
-        write_deferred_heredocs_from_redirects(redirects, out);
+        plan.extend(
+            clauses
+                .iter()
+                .filter_map(|clause| clause.action.as_deref())
+                .map(Step::Heredocs),
+        );
+        plan.push(Step::RedirectHeredocs(redirects));
     }
 }
 
 /// Write a select statement
-fn write_select(
+fn write_select<'a>(
     variable: &str,
-    words: Option<&[String]>,
-    body: &Command,
-    redirects: &[Redirect],
+    words: Option<&[Symbol]>,
+    body: &'a Command,
+    redirects: &'a [Redirect],
     out: &mut String,
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
     out.push_str("select ");
     out.push_str(variable);
@@ -901,54 +1046,58 @@ fn write_select(
         }
     }
     out.push_str("; do ");
-    write_command_impl(body, out, false);
-    write_compound_separator(out, body, "done");
-    write_redirects_impl(redirects, out, false);
-    if include_heredoc_content {
-        write_deferred_heredocs(body, out);
-        write_deferred_heredocs_from_redirects(redirects, out);
-    }
+    plan_loop_body(body, redirects, include_heredoc_content, plan);
 }
 
 /// Write a brace group
-fn write_group(
-    body: &Command,
-    redirects: &[Redirect],
+fn write_group<'a>(
+    body: &'a Command,
+    redirects: &'a [Redirect],
     out: &mut String,
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
     out.push_str("{ ");
-    write_command_impl(body, out, false);
-    write_compound_separator(out, body, "}");
-    write_redirects_impl(redirects, out, false);
+    plan.extend([
+        Step::Command(body, false),
+        Step::Separator(body, "}"),
+        Step::Redirects(redirects),
+    ]);
     if include_heredoc_content {
-        write_deferred_heredocs(body, out);
-        write_deferred_heredocs_from_redirects(redirects, out);
+        plan.extend([Step::Heredocs(body), Step::RedirectHeredocs(redirects)]);
     }
 }
 
 /// Write a subshell
-fn write_subshell(
-    body: &Command,
-    redirects: &[Redirect],
+fn write_subshell<'a>(
+    body: &'a Command,
+    redirects: &'a [Redirect],
     out: &mut String,
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
     out.push_str("( ");
-    write_command_impl(body, out, false);
-    out.push_str(" )");
-    write_redirects_impl(redirects, out, false);
+    plan.extend([
+        Step::Command(body, false),
+        Step::Text(" )"),
+        Step::Redirects(redirects),
+    ]);
     if include_heredoc_content {
-        write_deferred_heredocs(body, out);
-        write_deferred_heredocs_from_redirects(redirects, out);
+        plan.extend([Step::Heredocs(body), Step::RedirectHeredocs(redirects)]);
     }
 }
 
 /// Write a function definition
-fn write_function_def(name: &str, body: &Command, out: &mut String, include_heredoc_content: bool) {
+fn write_function_def<'a>(
+    name: &str,
+    body: &'a Command,
+    out: &mut String,
+    include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
+) {
     out.push_str(name);
     out.push_str("() ");
-    write_command_impl(body, out, include_heredoc_content);
+    plan.push(Step::Command(body, include_heredoc_content));
 }
 
 /// Write an arithmetic expression
@@ -959,13 +1108,14 @@ fn write_arithmetic(expression: &str, out: &mut String) {
 }
 
 /// Write an arithmetic for loop
-fn write_arith_for(
+fn write_arith_for<'a>(
     init: &str,
     test: &str,
     step: &str,
-    body: &Command,
+    body: &'a Command,
     out: &mut String,
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
     out.push_str("for ((");
     out.push_str(init);
@@ -974,22 +1124,20 @@ fn write_arith_for(
     out.push_str("; ");
     out.push_str(step);
     out.push_str(")); do ");
-    write_command_impl(body, out, false);
-    write_compound_separator(out, body, "done");
+    plan.extend([Step::Command(body, false), Step::Separator(body, "done")]);
     if include_heredoc_content {
-        write_deferred_heredocs(body, out);
+        plan.push(Step::Heredocs(body));
     }
 }
 
 /// Write a conditional expression [[ ... ]]
-fn write_conditional(expr: &ConditionalExpr, out: &mut String) {
+fn write_conditional<'a>(expr: &'a ConditionalExpr, out: &mut String, plan: &mut Vec<Step<'a>>) {
     out.push_str("[[ ");
-    write_cond_expr(expr, out);
-    out.push_str(" ]]");
+    plan.extend([Step::Cond(expr), Step::Text(" ]]")]);
 }
 
 /// Write a conditional expression (internal)
-fn write_cond_expr(expr: &ConditionalExpr, out: &mut String) {
+fn write_cond_expr<'a>(expr: &'a ConditionalExpr, out: &mut String, plan: &mut Vec<Step<'a>>) {
     match expr {
         ConditionalExpr::Unary { op, arg } => {
             out.push_str(op);
@@ -1004,36 +1152,32 @@ fn write_cond_expr(expr: &ConditionalExpr, out: &mut String) {
             out.push_str(right);
         }
         ConditionalExpr::And { left, right } => {
-            write_cond_expr(left, out);
-            out.push_str(" && ");
-            write_cond_expr(right, out);
+            plan.extend([Step::Cond(left), Step::Text(" && "), Step::Cond(right)]);
         }
         ConditionalExpr::Or { left, right } => {
-            write_cond_expr(left, out);
-            out.push_str(" || ");
-            write_cond_expr(right, out);
+            plan.extend([Step::Cond(left), Step::Text(" || "), Step::Cond(right)]);
         }
         ConditionalExpr::Not { expr } => {
             out.push_str("! ");
-            write_cond_expr(expr, out);
+            plan.push(Step::Cond(expr));
         }
         ConditionalExpr::Term { word } => {
             out.push_str(word);
         }
         ConditionalExpr::Expr { expr } => {
             out.push_str("( ");
-            write_cond_expr(expr, out);
-            out.push_str(" )");
+            plan.extend([Step::Cond(expr), Step::Text(" )")]);
         }
     }
 }
 
 /// Write a coproc
-fn write_coproc(
+fn write_coproc<'a>(
     name: Option<&str>,
-    body: &Command,
+    body: &'a Command,
     out: &mut String,
     include_heredoc_content: bool,
+    plan: &mut Vec<Step<'a>>,
 ) {
     out.push_str("coproc ");
     // Only print name if it's not the default "COPROC" or if body is a group/complex command
@@ -1048,12 +1192,13 @@ fn write_coproc(
             out.push(' ');
         }
     }
-    write_command_impl(body, out, include_heredoc_content);
+    plan.push(Step::Command(body, include_heredoc_content));
 }
 
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::ast::Nested;
     use crate::{init, parse};
 
     fn setup() {
@@ -1063,11 +1208,14 @@ mod tests {
     fn simple_cmd(words: &[&str]) -> Command {
         Command::Simple {
             line: None,
+            span: None,
             words: words
                 .iter()
                 .map(|word| Word {
-                    word: (*word).to_string(),
+                    span: None,
+                    word: (*word).into(),
                     flags: 0,
+                    substitutions: Vec::new(),
                 })
                 .collect(),
             redirects: Vec::new(),
@@ -1077,6 +1225,7 @@ mod tests {
 
     fn heredoc_redirect(eof: &str, content: &str) -> Redirect {
         Redirect {
+            span: None,
             direction: RedirectType::HereDoc,
             source_fd: Some(0),
             target: RedirectTarget::File(content.to_string()),
@@ -1397,58 +1546,80 @@ mod tests {
     }
 
     #[test]
-    fn test_has_heredoc_descends_into_nested_commands() {
-        let cmd = Command::If {
+    fn test_semi_list_breaks_line_after_nested_heredoc() {
+        let cmd = Command::List {
             line: None,
-            condition: Box::new(simple_cmd(&["true"])),
-            then_branch: Box::new(Command::Case {
+            span: None,
+            op: ListOp::Semi,
+            left: Nested::new(Command::If {
                 line: None,
-                word: "x".to_string(),
-                clauses: vec![CaseClause {
-                    patterns: vec!["a".to_string()],
-                    action: Some(Box::new(Command::Group {
-                        line: None,
-                        body: Box::new(Command::Simple {
+                span: None,
+                condition: Nested::new(simple_cmd(&["true"])),
+                then_branch: Nested::new(Command::Case {
+                    line: None,
+                    span: None,
+                    word: "x".into(),
+                    clauses: vec![CaseClause {
+                        patterns: vec!["a".into()],
+                        action: Some(Nested::new(Command::Group {
                             line: None,
-                            words: vec![Word {
-                                word: "cat".to_string(),
-                                flags: 0,
-                            }],
-                            redirects: vec![heredoc_redirect("EOF", "hello\n")],
-                            assignments: None,
-                        }),
-                        redirects: Vec::new(),
-                    })),
-                    flags: None,
-                }],
+                            span: None,
+                            body: Nested::new(Command::Simple {
+                                line: None,
+                                span: None,
+                                words: vec![Word {
+                                    span: None,
+                                    word: "cat".into(),
+                                    flags: 0,
+                                    substitutions: Vec::new(),
+                                }],
+                                redirects: vec![heredoc_redirect("EOF", "hello\n")],
+                                assignments: None,
+                            }),
+                            redirects: Vec::new(),
+                        })),
+                        flags: None,
+                    }],
+                    redirects: Vec::new(),
+                }),
+                else_branch: None,
                 redirects: Vec::new(),
             }),
-            else_branch: None,
-            redirects: Vec::new(),
+            right: Nested::new(simple_cmd(&["break"])),
         };
 
-        assert!(has_heredoc(&cmd));
+        assert_eq!(
+            to_bash(&cmd),
+            "if true; then case x in a) { cat <<EOF; } ;; esac; fi\nhello\nEOF\nbreak"
+        );
     }
 
     #[test]
     fn test_collect_heredocs_preserves_lexical_order() {
         let cmd = Command::List {
             line: None,
+            span: None,
             op: ListOp::And,
-            left: Box::new(Command::Simple {
+            left: Nested::new(Command::Simple {
                 line: None,
+                span: None,
                 words: vec![Word {
-                    word: "cat".to_string(),
+                    span: None,
+                    word: "cat".into(),
                     flags: 0,
+                    substitutions: Vec::new(),
                 }],
                 redirects: vec![heredoc_redirect("A", "one\n")],
                 assignments: None,
             }),
-            right: Box::new(Command::Simple {
+            right: Nested::new(Command::Simple {
                 line: None,
+                span: None,
                 words: vec![Word {
-                    word: "cat".to_string(),
+                    span: None,
+                    word: "cat".into(),
                     flags: 0,
+                    substitutions: Vec::new(),
                 }],
                 redirects: vec![heredoc_redirect("B", "two\n")],
                 assignments: None,
@@ -1467,17 +1638,21 @@ mod tests {
     fn test_write_list_without_heredoc_content_keeps_inline_separator() {
         let cmd = Command::List {
             line: None,
+            span: None,
             op: ListOp::Semi,
-            left: Box::new(Command::Simple {
+            left: Nested::new(Command::Simple {
                 line: None,
+                span: None,
                 words: vec![Word {
-                    word: "cat".to_string(),
+                    span: None,
+                    word: "cat".into(),
                     flags: 0,
+                    substitutions: Vec::new(),
                 }],
                 redirects: vec![heredoc_redirect("EOF", "hello\n")],
                 assignments: None,
             }),
-            right: Box::new(simple_cmd(&["break"])),
+            right: Nested::new(simple_cmd(&["break"])),
         };
 
         let mut out = String::new();
@@ -1485,17 +1660,85 @@ mod tests {
         assert_eq!(out, "cat <<EOF; break");
     }
 
+    #[test]
+    fn test_sequence_writes_heredoc_after_its_command() {
+        let cat = Command::Simple {
+            line: None,
+            span: None,
+            words: vec![Word {
+                span: None,
+                word: "cat".into(),
+                flags: 0,
+                substitutions: Vec::new(),
+            }],
+            redirects: vec![heredoc_redirect("EOF", "hello\n")],
+            assignments: None,
+        };
+        let cmd = Command::Sequence {
+            line: None,
+            span: None,
+            items: vec![
+                (simple_cmd(&["true"]), ListOp::Semi),
+                (cat.clone(), ListOp::Amp),
+                (simple_cmd(&["wait"]), ListOp::Semi),
+                (cat, ListOp::Semi),
+                (simple_cmd(&["exit"]), ListOp::Semi),
+            ],
+        };
+
+        assert_eq!(
+            to_bash(&cmd),
+            "true; cat <<EOF &\nhello\nEOF\nwait; cat <<EOF\nhello\nEOF\nexit"
+        );
+    }
+
+    #[test]
+    fn test_and_or_sequence_defers_heredocs() {
+        let cmd = Command::Sequence {
+            line: None,
+            span: None,
+            items: vec![
+                (
+                    Command::Simple {
+                        line: None,
+                        span: None,
+                        words: vec![Word {
+                            span: None,
+                            word: "cat".into(),
+                            flags: 0,
+                            substitutions: Vec::new(),
+                        }],
+                        redirects: vec![heredoc_redirect("EOF", "hello\n")],
+                        assignments: None,
+                    },
+                    ListOp::And,
+                ),
+                (simple_cmd(&["true"]), ListOp::Or),
+                (simple_cmd(&["false"]), ListOp::Semi),
+            ],
+        };
+
+        assert_eq!(to_bash(&cmd), "cat <<EOF && true || false\nhello\nEOF");
+        assert!(ends_with_background(&Command::Sequence {
+            line: None,
+            span: None,
+            items: vec![(cmd, ListOp::Amp)],
+        }));
+    }
+
     #[test]
     fn test_ends_with_background_detects_nested_amp_lists() {
         let cmd = Command::List {
             line: None,
+            span: None,
             op: ListOp::Semi,
-            left: Box::new(simple_cmd(&["echo", "one"])),
-            right: Box::new(Command::List {
+            left: Nested::new(simple_cmd(&["echo", "one"])),
+            right: Nested::new(Command::List {
                 line: None,
+                span: None,
                 op: ListOp::Amp,
-                left: Box::new(simple_cmd(&["sleep", "1"])),
-                right: Box::new(simple_cmd(&[])),
+                left: Nested::new(simple_cmd(&["sleep", "1"])),
+                right: Nested::new(simple_cmd(&[])),
             }),
         };
 
@@ -1506,13 +1749,15 @@ mod tests {
     fn test_last_if_branch_returns_terminal_else_branch() {
         let cmd = Command::If {
             line: None,
-            condition: Box::new(simple_cmd(&["cond1"])),
-            then_branch: Box::new(simple_cmd(&["then1"])),
-            else_branch: Some(Box::new(Command::If {
+            span: None,
+            condition: Nested::new(simple_cmd(&["cond1"])),
+            then_branch: Nested::new(simple_cmd(&["then1"])),
+            else_branch: Some(Nested::new(Command::If {
                 line: None,
-                condition: Box::new(simple_cmd(&["cond2"])),
-                then_branch: Box::new(simple_cmd(&["then2"])),
-                else_branch: Some(Box::new(simple_cmd(&["final-else"]))),
+                span: None,
+                condition: Nested::new(simple_cmd(&["cond2"])),
+                then_branch: Nested::new(simple_cmd(&["then2"])),
+                else_branch: Some(Nested::new(simple_cmd(&["final-else"]))),
                 redirects: Vec::new(),
             })),
             redirects: Vec::new(),
@@ -1531,4 +1776,22 @@ mod tests {
             other => panic!("expected simple command, got {other:?}"),
         }
     }
+
+    #[test]
+    fn test_deeply_nested_commands() {
+        let depth = 10_000;
+        let mut cmd = simple_cmd(&["true"]);
+        for _ in 0..depth {
+            cmd = Command::Subshell {
+                line: None,
+                span: None,
+                body: Nested::new(cmd),
+                redirects: Vec::new(),
+            };
+        }
+
+        let script = to_bash(&cmd);
+        assert_eq!(script.matches('(').count(), depth);
+        assert!(script.contains("true"));
+    }
 }
@@ -0,0 +1,1341 @@
+//! Borrowed views of bash's parse tree
+//!
+//! [`ParsedScript`] keeps the tree bash's parser built and hands out
+//! [`CommandRef`] views into it. Nothing is converted until it is asked
+//! for: a word's text is the parser's own bytes, and children are reached
+//! by following the tree's pointers. Tools that look at a few nodes only
+//! pay for those nodes.
+//!
+//! The views present the tree in the shape of [`Command`]: a negated simple
+//! command is a pipeline of one command, nested pipelines are flattened,
+//! assignments are kept apart from words, and lines follow the same rules.
+
+#![allow(clippy::cast_sign_loss)]
+
+use crate::cancel::Interrupt;
+use crate::convert::{
+    self, effective_line, is_pipe, line_or_none, list_op, redirect_target, redirect_type,
+    redirects, source_fd, words, TargetRef, CASEPAT_FALLTHROUGH, CASEPAT_TESTNEXT,
+    CMD_INVERT_RETURN, COND_AND, COND_BINARY, COND_EXPR, COND_OR, COND_TERM, COND_UNARY,
+    MAX_LIST_LENGTH, W_ASSIGNMENT,
+};
+use crate::{ffi, Command, ListOp, ParseError, ParseLimits, RedirectType};
+use std::borrow::Cow;
+use std::ffi::{c_char, CStr};
+use std::fmt;
+use std::ptr::NonNull;
+
+// Every view borrows from a `ParsedScript`, whose tree stays allocated and
+// unchanged until the script is dropped. That is what makes dereferencing
+// the tree's pointers below sound.
+
+/// A parsed script, kept in bash's own representation
+///
+/// Parsing stops at bash's tree: [`command()`](Self::command) gives
+/// borrowed views into it, and [`to_owned()`](Self::to_owned) converts it
+/// to a [`Command`] when one is needed. The tree is freed on drop.
+///
+/// Like the parser itself, a `ParsedScript` must stay on the thread that
+/// parsed it.
+///
+/// # Example
+///
+/// ```no_run
+/// use bash_ast::{init, CommandRef, ParsedScript};
+///
+/// init();
+///
+/// // Print the name of every command a script runs, without converting
+/// // anything else
+/// fn visit(cmd: CommandRef<'_>) {
+///     if let CommandRef::Simple(simple) = cmd {
+///         if let Some(name) = simple.words().next() {
+///             println!("{}", name.to_string_lossy());
+///         }
+///     }
+///     cmd.children().for_each(visit);
+/// }
+///
+/// let script = ParsedScript::parse("make && make install || echo failed").unwrap();
+/// visit(script.command());
+/// ```
+pub struct ParsedScript {
+    root: NonNull<ffi::COMMAND>,
+}
+
+impl ParsedScript {
+    /// Parse a bash script
+    ///
+    /// # Errors
+    ///
+    /// Returns the same errors as [`parse()`](crate::parse).
+    pub fn parse(script: &str) -> Result<Self, ParseError> {
+        Self::parse_with_limits(script, &ParseLimits::default())
+    }
+
+    /// Parse a bash script with a custom resource budget
+    ///
+    /// # Errors
+    ///
+    /// Returns the same errors as
+    /// [`parse_with_limits()`](crate::parse_with_limits).
+    pub fn parse_with_limits(script: &str, limits: &ParseLimits) -> Result<Self, ParseError> {
+        // SAFETY: these are the statically linked parser's own entry points
+        let root = unsafe {
+            crate::parse_tree(&crate::static_api(false), script, limits, &Interrupt::NONE)?
+        };
+        let root = NonNull::new(root).expect("parse_tree returns a tree on success");
+        Ok(Self { root })
+    }
+
+    /// Parse a bash script that need not be UTF-8
+    ///
+    /// Bash parses bytes, so a script in Latin-1 or any other encoding is
+    /// parsed as it is, without validating or converting it first. The
+    /// views' text is then the script's own bytes: [`WordRef::as_bytes()`]
+    /// gives it back exactly, and [`WordRef::to_str()`] and
+    /// [`WordRef::to_string_lossy()`] check or decode it only when called.
+    /// [`to_owned()`](Self::to_owned) replaces invalid UTF-8 with U+FFFD, as
+    /// the AST holds strings.
+    ///
+    /// # Example
+    ///
+    /// ```no_run
+    /// use bash_ast::{init, CommandRef, ParsedScript};
+    ///
+    /// init();
+    ///
+    /// // "café" in Latin-1
+    /// let script = ParsedScript::parse_bytes(b"echo caf\xe9").unwrap();
+    /// if let CommandRef::Simple(simple) = script.command() {
+    ///     let word = simple.words().nth(1).unwrap();
+    ///     assert_eq!(word.as_bytes(), b"caf\xe9");
+    ///     assert!(word.to_str().is_err());
+    /// }
+    /// ```
+    ///
+    /// # Errors
+    ///
+    /// Returns the same errors as [`parse()`](crate::parse), except that a
+    /// script is empty only if it holds nothing but ASCII whitespace.
+    pub fn parse_bytes(script: &[u8]) -> Result<Self, ParseError> {
+        Self::parse_bytes_with_limits(script, &ParseLimits::default())
+    }
+
+    /// Parse a bash script that need not be UTF-8, with a custom resource
+    /// budget
+    ///
+    /// # Errors
+    ///
+    /// As for [`parse_bytes()`](Self::parse_bytes), with `limits` in place
+    /// of the defaults.
+    pub fn parse_bytes_with_limits(
+        script: &[u8],
+        limits: &ParseLimits,
+    ) -> Result<Self, ParseError> {
+        // SAFETY: these are the statically linked parser's own entry points
+        let root = unsafe {
+            crate::parse_tree_bytes(&crate::static_api(false), script, limits, &Interrupt::NONE)?
+        };
+        let root = NonNull::new(root).expect("parse_tree returns a tree on success");
+        Ok(Self { root })
+    }
+
+    /// The script's command
+    #[must_use]
+    pub fn command(&self) -> CommandRef<'_> {
+        // SAFETY: the tree lives as long as `self`
+        unsafe {
+            let root = self.root.as_ref();
+            // Skip the artificial group that safe_parse_buffer adds
+            if root.type_ == ffi::command_type_cm_group {
+                child((*root.value.Group).command)
+            } else {
+                CommandRef::new(root)
+            }
+        }
+    }
+
+    /// Convert the whole script to a [`Command`], as [`parse()`](crate::parse)
+    /// returns it
+    ///
+    /// # Errors
+    ///
+    /// Returns `ParseError::ConversionError` if the script is nested too
+    /// deeply to convert.
+    pub fn to_owned(&self) -> Result<Command, ParseError> {
+        // SAFETY: the tree lives as long as `self`
+        unsafe { convert::convert_command(self.root.as_ptr()) }
+            .map(crate::unwrap_script_group)
+            .ok_or(ParseError::ConversionError(None))
+    }
+}
+
+impl Drop for ParsedScript {
+    fn drop(&mut self) {
+        // SAFETY: the tree came from the static parser and no view of it
+        // outlives `self`
+        unsafe { ffi::dispose_command(self.root.as_ptr()) };
+    }
+}
+
+impl fmt::Debug for ParsedScript {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("ParsedScript").finish_non_exhaustive()
+    }
+}
+
+/// A view of one command in a [`ParsedScript`]
+///
+/// The variants match [`Command`]'s.
+#[derive(Clone, Copy)]
+#[allow(missing_docs)]
+pub enum CommandRef<'a> {
+    Simple(SimpleRef<'a>),
+    Pipeline(PipelineRef<'a>),
+    List(ListRef<'a>),
+    For(ForRef<'a>),
+    While(WhileRef<'a>),
+    Until(WhileRef<'a>),
+    If(IfRef<'a>),
+    Case(CaseRef<'a>),
+    Select(ForRef<'a>),
+    Group(GroupRef<'a>),
+    Subshell(GroupRef<'a>),
+    FunctionDef(FunctionDefRef<'a>),
+    Arithmetic(ArithmeticRef<'a>),
+    ArithmeticFor(ArithmeticForRef<'a>),
+    Conditional(ConditionalRef<'a>),
+    Coproc(CoprocRef<'a>),
+}
+
+impl<'a> CommandRef<'a> {
+    /// View a command of the tree
+    ///
+    /// # Safety
+    ///
+    /// `cmd` must belong to a tree owned by a live `ParsedScript` that
+    /// outlives `'a`.
+    unsafe fn new(cmd: &'a ffi::COMMAND) -> Self {
+        let negated = (cmd.flags & CMD_INVERT_RETURN) != 0;
+
+        match cmd.type_ {
+            // `! cmd` is a negated pipeline of one command
+            ffi::command_type_cm_simple if negated => Self::Pipeline(PipelineRef { cmd }),
+            ffi::command_type_cm_simple => Self::simple(cmd),
+            ffi::command_type_cm_connection => {
+                let conn = &*cmd.value.Connection;
+                if is_pipe(conn) {
+                    Self::Pipeline(PipelineRef { cmd })
+                } else {
+                    Self::List(ListRef { cmd, conn })
+                }
+            }
+            ffi::command_type_cm_for => {
+                let for_cmd = &*cmd.value.For;
+                Self::For(ForRef {
+                    cmd,
+                    line: for_cmd.line,
+                    name: &*for_cmd.name,
+                    map_list: for_cmd.map_list,
+                    action: for_cmd.action,
+                })
+            }
+            ffi::command_type_cm_select => {
+                let select_cmd = &*cmd.value.Select;
+                Self::Select(ForRef {
+                    cmd,
+                    line: select_cmd.line,
+                    name: &*select_cmd.name,
+                    map_list: select_cmd.map_list,
+                    action: select_cmd.action,
+                })
+            }
+            ffi::command_type_cm_while => Self::While(WhileRef {
+                cmd,
+                while_cmd: &*cmd.value.While,
+            }),
+            // Until uses the same structure as while
+            ffi::command_type_cm_until => Self::Until(WhileRef {
+                cmd,
+                while_cmd: &*cmd.value.While,
+            }),
+            ffi::command_type_cm_if => Self::If(IfRef {
+                cmd,
+                if_cmd: &*cmd.value.If,
+            }),
+            ffi::command_type_cm_case => Self::Case(CaseRef {
+                cmd,
+                case_cmd: &*cmd.value.Case,
+            }),
+            ffi::command_type_cm_group => Self::Group(GroupRef {
+                cmd,
+                line: 0,
+                body: (*cmd.value.Group).command,
+            }),
+            ffi::command_type_cm_subshell => {
+                let subshell_cmd = &*cmd.value.Subshell;
+                Self::Subshell(GroupRef {
+                    cmd,
+                    line: subshell_cmd.line,
+                    body: subshell_cmd.command,
+                })
+            }
+            ffi::command_type_cm_function_def => Self::FunctionDef(FunctionDefRef {
+                cmd,
+                func_def: &*cmd.value.Function_def,
+            }),
+            ffi::command_type_cm_arith => Self::Arithmetic(ArithmeticRef {
+                cmd,
+                arith_cmd: &*cmd.value.Arith,
+            }),
+            ffi::command_type_cm_arith_for => Self::ArithmeticFor(ArithmeticForRef {
+                cmd,
+                arith_for: &*cmd.value.ArithFor,
+            }),
+            ffi::command_type_cm_cond => Self::Conditional(ConditionalRef {
+                cmd,
+                cond_cmd: &*cmd.value.Cond,
+            }),
+            ffi::command_type_cm_coproc => Self::Coproc(CoprocRef {
+                cmd,
+                coproc_cmd: &*cmd.value.Coproc,
+            }),
+            other => panic!("bash's parser produced unknown command type {other}"),
+        }
+    }
+
+    /// View a simple command, ignoring its negation
+    unsafe fn simple(cmd: &'a ffi::COMMAND) -> Self {
+        Self::Simple(SimpleRef {
+            cmd,
+            simple: &*cmd.value.Simple,
+        })
+    }
+
+    /// The COMMAND this view starts at
+    const fn raw(&self) -> &'a ffi::COMMAND {
+        match self {
+            Self::Simple(SimpleRef { cmd, .. })
+            | Self::Pipeline(PipelineRef { cmd })
+            | Self::List(ListRef { cmd, .. })
+            | Self::For(ForRef { cmd, .. })
+            | Self::Select(ForRef { cmd, .. })
+            | Self::While(WhileRef { cmd, .. })
+            | Self::Until(WhileRef { cmd, .. })
+            | Self::If(IfRef { cmd, .. })
+            | Self::Case(CaseRef { cmd, .. })
+            | Self::Group(GroupRef { cmd, .. })
+            | Self::Subshell(GroupRef { cmd, .. })
+            | Self::FunctionDef(FunctionDefRef { cmd, .. })
+            | Self::Arithmetic(ArithmeticRef { cmd, .. })
+            | Self::ArithmeticFor(ArithmeticForRef { cmd, .. })
+            | Self::Conditional(ConditionalRef { cmd, .. })
+            | Self::Coproc(CoprocRef { cmd, .. }) => cmd,
+        }
+    }
+
+    /// Get the line number where this command starts, if known
+    ///
+    /// Always the same as [`Command::line()`] of the converted command.
+    #[must_use]
+    pub const fn line(&self) -> Option<u32> {
+        let own_line = match self {
+            Self::Pipeline(_) | Self::List(_) => return None,
+            Self::Simple(simple) => simple.simple.line,
+            Self::For(for_ref) | Self::Select(for_ref) => for_ref.line,
+            Self::Subshell(group) => group.line,
+            Self::Case(case) => case.case_cmd.line,
+            Self::Arithmetic(arith) => arith.arith_cmd.line,
+            Self::ArithmeticFor(arith_for) => arith_for.arith_for.line,
+            Self::Conditional(cond) => cond.cond_cmd.line,
+            Self::While(_)
+            | Self::Until(_)
+            | Self::If(_)
+            | Self::Group(_)
+            | Self::FunctionDef(_)
+            | Self::Coproc(_) => 0,
+        };
+        line_or_none(effective_line(own_line, self.raw().line as u32))
+    }
+
+    /// The commands directly inside this one, in the order [`Command`]
+    /// holds them
+    ///
+    /// Pipelines yield each of their commands; lists, their two sides; a
+    /// case statement, the action of each clause that has one.
+    #[must_use]
+    pub fn children(&self) -> Children<'a> {
+        let inner = match *self {
+            Self::Simple(_) | Self::Arithmetic(_) | Self::Conditional(_) => {
+                ChildrenInner::Fixed([None, None, None])
+            }
+            Self::Pipeline(pipeline) => ChildrenInner::Pipeline(pipeline.commands()),
+            Self::List(list) => ChildrenInner::Fixed([Some(list.left()), list.right(), None]),
+            Self::For(for_ref) | Self::Select(for_ref) => {
+                ChildrenInner::Fixed([Some(for_ref.body()), None, None])
+            }
+            Self::While(while_ref) | Self::Until(while_ref) => {
+                ChildrenInner::Fixed([Some(while_ref.test()), Some(while_ref.body()), None])
+            }
+            Self::If(if_ref) => ChildrenInner::Fixed([
+                Some(if_ref.condition()),
+                Some(if_ref.then_branch()),
+                if_ref.else_branch(),
+            ]),
+            Self::Case(case) => ChildrenInner::Case(case.clauses()),
+            Self::Group(group) | Self::Subshell(group) => {
+                ChildrenInner::Fixed([Some(group.body()), None, None])
+            }
+            Self::FunctionDef(func) => ChildrenInner::Fixed([Some(func.body()), None, None]),
+            Self::ArithmeticFor(arith_for) => {
+                ChildrenInner::Fixed([Some(arith_for.body()), None, None])
+            }
+            Self::Coproc(coproc) => ChildrenInner::Fixed([Some(coproc.body()), None, None]),
+        };
+        Children(inner)
+    }
+
+    /// Convert this command and everything in it to a [`Command`]
+    ///
+    /// # Errors
+    ///
+    /// Returns `ParseError::ConversionError` if the command is nested too
+    /// deeply to convert.
+    pub fn to_command(&self) -> Result<Command, ParseError> {
+        // SAFETY: the tree outlives the view
+        let cmd = unsafe { convert::convert_command(self.raw()) }
+            .ok_or(ParseError::ConversionError(None))?;
+
+        // A command inside a pipeline loses its `!`, as it does when the
+        // pipeline is converted
+        match (self, cmd) {
+            (Self::Simple(_), Command::Pipeline { mut commands, .. }) if commands.len() == 1 => {
+                Ok(commands.remove(0))
+            }
+            (_, cmd) => Ok(cmd),
+        }
+    }
+}
+
+impl fmt::Debug for CommandRef<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self.to_command() {
+            Ok(cmd) => cmd.fmt(f),
+            Err(_) => f.write_str("CommandRef(..)"),
+        }
+    }
+}
+
+/// View a required child command
+///
+/// # Safety
+///
+/// As for `CommandRef::new`.
+unsafe fn child<'a>(cmd: *const ffi::COMMAND) -> CommandRef<'a> {
+    CommandRef::new(
+        cmd.as_ref()
+            .expect("bash's parser fills in every required command"),
+    )
+}
+
+/// View an optional child command
+///
+/// # Safety
+///
+/// As for `CommandRef::new`.
+unsafe fn optional_child<'a>(cmd: *const ffi::COMMAND) -> Option<CommandRef<'a>> {
+    cmd.as_ref().map(|cmd| CommandRef::new(cmd))
+}
+
+/// The text of a C string, or an empty string for null
+///
+/// # Safety
+///
+/// `ptr` must be null or point into a tree that outlives `'a`.
+const unsafe fn text<'a>(ptr: *const c_char) -> &'a CStr {
+    if ptr.is_null() {
+        c""
+    } else {
+        CStr::from_ptr(ptr)
+    }
+}
+
+/// The words of a list, skipping null entries
+///
+/// # Safety
+///
+/// As for `CommandRef::new`.
+unsafe fn word_refs<'a>(list: *mut ffi::WORD_LIST) -> impl Iterator<Item = WordRef<'a>> {
+    words(list).map(|desc| WordRef { desc })
+}
+
+/// An iterator over the commands directly inside a command
+///
+/// Returned by [`CommandRef::children()`].
+pub struct Children<'a>(ChildrenInner<'a>);
+
+enum ChildrenInner<'a> {
+    Fixed([Option<CommandRef<'a>>; 3]),
+    Pipeline(PipelineCommands<'a>),
+    Case(Clauses<'a>),
+}
+
+impl<'a> Iterator for Children<'a> {
+    type Item = CommandRef<'a>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        match &mut self.0 {
+            ChildrenInner::Fixed(children) => children.iter_mut().find_map(Option::take),
+            ChildrenInner::Pipeline(commands) => commands.next(),
+            ChildrenInner::Case(clauses) => clauses.find_map(|clause| clause.action()),
+        }
+    }
+}
+
+/// A word, borrowed from the parser
+#[derive(Clone, Copy)]
+pub struct WordRef<'a> {
+    desc: &'a ffi::WORD_DESC,
+}
+
+impl<'a> WordRef<'a> {
+    /// The word's text
+    #[must_use]
+    pub const fn text(&self) -> &'a CStr {
+        // SAFETY: the tree outlives the view
+        unsafe { text(self.desc.word) }
+    }
+
+    /// The word's text as bytes
+    #[must_use]
+    pub const fn as_bytes(&self) -> &'a [u8] {
+        self.text().to_bytes()
+    }
+
+    /// The word's text as a string, if it is valid UTF-8
+    ///
+    /// # Errors
+    ///
+    /// Returns the UTF-8 error if the word isn't valid UTF-8, as words of
+    /// scripts parsed with [`ParsedScript::parse_bytes()`] may not be.
+    pub const fn to_str(&self) -> Result<&'a str, std::str::Utf8Error> {
+        std::str::from_utf8(self.as_bytes())
+    }
+
+    /// The word's text as a string, as [`Word::word`](crate::Word::word)
+    /// holds it
+    ///
+    /// Borrowed unless the text isn't valid UTF-8.
+    #[must_use]
+    pub fn to_string_lossy(&self) -> Cow<'a, str> {
+        self.text().to_string_lossy()
+    }
+
+    /// Word flags (`W_HASDOLLAR`, `W_QUOTED`, etc.)
+    #[must_use]
+    pub const fn flags(&self) -> u32 {
+        self.desc.flags as u32
+    }
+
+    const fn is_assignment(self) -> bool {
+        (self.flags() & W_ASSIGNMENT) != 0
+    }
+}
+
+impl fmt::Debug for WordRef<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        self.text().fmt(f)
+    }
+}
+
+/// A redirect, borrowed from the parser
+#[derive(Clone, Copy)]
+pub struct RedirectRef<'a> {
+    redir: &'a ffi::REDIRECT,
+}
+
+/// Target of a [`RedirectRef`]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum RedirectTargetRef<'a> {
+    /// A filename
+    File(&'a CStr),
+    /// A file descriptor number
+    Fd(i32),
+}
+
+impl<'a> RedirectRef<'a> {
+    /// The type of redirection
+    #[must_use]
+    pub const fn direction(&self) -> RedirectType {
+        redirect_type(self.redir.instruction)
+    }
+
+    /// Source file descriptor (if applicable)
+    #[must_use]
+    pub const fn source_fd(&self) -> Option<i32> {
+        // SAFETY: the tree outlives the view
+        unsafe { source_fd(self.redir) }
+    }
+
+    /// Target (filename or fd number)
+    #[must_use]
+    pub fn target(&self) -> RedirectTargetRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe {
+            match redirect_target(self.redir) {
+                TargetRef::Fd(fd) => RedirectTargetRef::Fd(fd),
+                TargetRef::File(filename) => RedirectTargetRef::File(text(filename)),
+            }
+        }
+    }
+
+    /// For here-documents, the delimiter word
+    #[must_use]
+    pub fn here_doc_eof(&self) -> Option<&'a CStr> {
+        // SAFETY: the tree outlives the view
+        (!self.redir.here_doc_eof.is_null()).then(|| unsafe { text(self.redir.here_doc_eof) })
+    }
+}
+
+/// The redirects attached directly to a command
+///
+/// # Safety
+///
+/// As for `CommandRef::new`.
+unsafe fn own_redirects<'a>(cmd: &ffi::COMMAND) -> impl Iterator<Item = RedirectRef<'a>> {
+    redirects(cmd.redirects).map(|redir| RedirectRef { redir })
+}
+
+/// Simple command: `cmd arg1 arg2`
+#[derive(Clone, Copy)]
+pub struct SimpleRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    simple: &'a ffi::SIMPLE_COM,
+}
+
+impl<'a> SimpleRef<'a> {
+    /// The command's words, without its assignments
+    pub fn words(&self) -> impl Iterator<Item = WordRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { word_refs(self.simple.words) }.filter(|word| !word.is_assignment())
+    }
+
+    /// The assignments before the command, such as `A=1` in `A=1 cmd`
+    pub fn assignments(&self) -> impl Iterator<Item = WordRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { word_refs(self.simple.words) }.filter(|word| word.is_assignment())
+    }
+
+    /// The command's redirects
+    pub fn redirects(&self) -> impl Iterator<Item = RedirectRef<'a>> {
+        // Redirects live on both the simple command and its COMMAND
+        // SAFETY: the tree outlives the view
+        unsafe { redirects(self.simple.redirects) }
+            .map(|redir| RedirectRef { redir })
+            .chain(unsafe { own_redirects(self.cmd) })
+    }
+}
+
+/// Pipeline: `cmd1 | cmd2 | cmd3`
+#[derive(Clone, Copy)]
+pub struct PipelineRef<'a> {
+    cmd: &'a ffi::COMMAND,
+}
+
+impl<'a> PipelineRef<'a> {
+    /// Whether the pipeline is negated with `!`
+    #[must_use]
+    pub const fn negated(&self) -> bool {
+        (self.cmd.flags & CMD_INVERT_RETURN) != 0
+    }
+
+    /// The commands of the pipeline, in order
+    #[must_use]
+    pub fn commands(&self) -> PipelineCommands<'a> {
+        PipelineCommands {
+            pending: vec![self.cmd],
+        }
+    }
+}
+
+/// An iterator over the commands of a pipeline
+///
+/// Returned by [`PipelineRef::commands()`].
+pub struct PipelineCommands<'a> {
+    // Subtrees still to visit, the next one last
+    pending: Vec<&'a ffi::COMMAND>,
+}
+
+impl<'a> Iterator for PipelineCommands<'a> {
+    type Item = CommandRef<'a>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        loop {
+            let cmd = self.pending.pop()?;
+            // SAFETY: the tree outlives the view
+            unsafe {
+                match cmd.type_ {
+                    ffi::command_type_cm_connection if is_pipe(&*cmd.value.Connection) => {
+                        let conn = &*cmd.value.Connection;
+                        for side in [conn.second, conn.first] {
+                            self.pending.push(
+                                side.as_ref()
+                                    .expect("bash's parser fills in both sides of a pipeline"),
+                            );
+                        }
+                    }
+                    // Nested pipelines, including negated simple commands,
+                    // are flattened and lose their `!`
+                    ffi::command_type_cm_simple => return Some(CommandRef::simple(cmd)),
+                    _ => return Some(CommandRef::new(cmd)),
+                }
+            }
+        }
+    }
+}
+
+/// List/connection: commands joined by `&&`, `||`, `;`, `&`
+#[derive(Clone, Copy)]
+pub struct ListRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    conn: &'a ffi::CONNECTION,
+}
+
+impl<'a> ListRef<'a> {
+    /// The operator joining the commands
+    #[must_use]
+    pub const fn op(&self) -> ListOp {
+        list_op(self.conn.connector)
+    }
+
+    /// The first command
+    #[must_use]
+    pub fn left(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.conn.first) }
+    }
+
+    /// The second command
+    ///
+    /// `None` after a trailing `&`, where [`Command::List`] holds an empty
+    /// simple command.
+    #[must_use]
+    pub fn right(&self) -> Option<CommandRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { optional_child(self.conn.second) }
+    }
+}
+
+/// For loop: `for var in list; do ...; done`, or a select statement
+#[derive(Clone, Copy)]
+pub struct ForRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    line: i32,
+    name: &'a ffi::WORD_DESC,
+    map_list: *mut ffi::WORD_LIST,
+    action: *mut ffi::COMMAND,
+}
+
+impl<'a> ForRef<'a> {
+    /// The loop variable
+    #[must_use]
+    pub const fn variable(&self) -> &'a CStr {
+        // SAFETY: the tree outlives the view
+        unsafe { text(self.name.word) }
+    }
+
+    /// The words after `in`; none for `for var; do`
+    pub fn words(&self) -> impl Iterator<Item = WordRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { word_refs(self.map_list) }
+    }
+
+    /// The loop body
+    #[must_use]
+    pub fn body(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.action) }
+    }
+
+    /// Redirects of the whole loop
+    pub fn redirects(&self) -> impl Iterator<Item = RedirectRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { own_redirects(self.cmd) }
+    }
+}
+
+/// While or until loop: `while test; do ...; done`
+#[derive(Clone, Copy)]
+pub struct WhileRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    while_cmd: &'a ffi::WHILE_COM,
+}
+
+impl<'a> WhileRef<'a> {
+    /// The loop test
+    #[must_use]
+    pub fn test(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.while_cmd.test) }
+    }
+
+    /// The loop body
+    #[must_use]
+    pub fn body(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.while_cmd.action) }
+    }
+
+    /// Redirects of the whole loop
+    pub fn redirects(&self) -> impl Iterator<Item = RedirectRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { own_redirects(self.cmd) }
+    }
+}
+
+/// If statement: `if test; then ...; [else ...;] fi`
+#[derive(Clone, Copy)]
+pub struct IfRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    if_cmd: &'a ffi::IF_COM,
+}
+
+impl<'a> IfRef<'a> {
+    /// The condition
+    #[must_use]
+    pub fn condition(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.if_cmd.test) }
+    }
+
+    /// The `then` branch
+    #[must_use]
+    pub fn then_branch(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.if_cmd.true_case) }
+    }
+
+    /// The `else` branch; an `elif` is an `If` here
+    #[must_use]
+    pub fn else_branch(&self) -> Option<CommandRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { optional_child(self.if_cmd.false_case) }
+    }
+
+    /// Redirects of the whole statement
+    pub fn redirects(&self) -> impl Iterator<Item = RedirectRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { own_redirects(self.cmd) }
+    }
+}
+
+/// Case statement: `case word in pattern) ...;; esac`
+#[derive(Clone, Copy)]
+pub struct CaseRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    case_cmd: &'a ffi::CASE_COM,
+}
+
+impl<'a> CaseRef<'a> {
+    /// The word being matched
+    #[must_use]
+    pub fn word(&self) -> &'a CStr {
+        // SAFETY: the tree outlives the view
+        unsafe { text((*self.case_cmd.word).word) }
+    }
+
+    /// The clauses, in order
+    #[must_use]
+    pub const fn clauses(&self) -> Clauses<'a> {
+        Clauses {
+            current: self.case_cmd.clauses,
+            remaining: MAX_LIST_LENGTH,
+            _tree: std::marker::PhantomData,
+        }
+    }
+
+    /// Redirects of the whole statement
+    pub fn redirects(&self) -> impl Iterator<Item = RedirectRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { own_redirects(self.cmd) }
+    }
+}
+
+/// An iterator over the clauses of a case statement
+///
+/// Returned by [`CaseRef::clauses()`].
+pub struct Clauses<'a> {
+    current: *mut ffi::PATTERN_LIST,
+    remaining: usize,
+    _tree: std::marker::PhantomData<&'a ffi::PATTERN_LIST>,
+}
+
+impl<'a> Iterator for Clauses<'a> {
+    type Item = CaseClauseRef<'a>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        // Stop at MAX_LIST_LENGTH, like convert_pattern_list
+        self.remaining = self.remaining.checked_sub(1)?;
+        // SAFETY: the tree outlives the view
+        let pattern = unsafe { self.current.as_ref()? };
+        self.current = pattern.next;
+        Some(CaseClauseRef { pattern })
+    }
+}
+
+/// A case clause: `pattern) ...;;`
+#[derive(Clone, Copy)]
+pub struct CaseClauseRef<'a> {
+    pattern: &'a ffi::PATTERN_LIST,
+}
+
+impl<'a> CaseClauseRef<'a> {
+    /// Patterns to match
+    pub fn patterns(&self) -> impl Iterator<Item = WordRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { word_refs(self.pattern.patterns) }
+    }
+
+    /// Command to execute if matched
+    #[must_use]
+    pub fn action(&self) -> Option<CommandRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { optional_child(self.pattern.action) }
+    }
+
+    /// `;&` - fallthrough to next clause
+    #[must_use]
+    pub const fn fallthrough(&self) -> bool {
+        (self.pattern.flags & CASEPAT_FALLTHROUGH) != 0
+    }
+
+    /// `;;&` - test next pattern
+    #[must_use]
+    pub const fn test_next(&self) -> bool {
+        (self.pattern.flags & CASEPAT_TESTNEXT) != 0
+    }
+}
+
+/// Brace group `{ ...; }` or subshell `( ... )`
+#[derive(Clone, Copy)]
+pub struct GroupRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    line: i32,
+    body: *mut ffi::COMMAND,
+}
+
+impl<'a> GroupRef<'a> {
+    /// The commands inside
+    #[must_use]
+    pub fn body(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.body) }
+    }
+
+    /// Redirects of the whole group
+    pub fn redirects(&self) -> impl Iterator<Item = RedirectRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { own_redirects(self.cmd) }
+    }
+}
+
+/// Function definition: `name() { ...; }`
+#[derive(Clone, Copy)]
+pub struct FunctionDefRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    func_def: &'a ffi::FUNCTION_DEF,
+}
+
+impl<'a> FunctionDefRef<'a> {
+    /// The function's name
+    #[must_use]
+    pub fn name(&self) -> &'a CStr {
+        // SAFETY: the tree outlives the view
+        unsafe { text((*self.func_def.name).word) }
+    }
+
+    /// The function body
+    #[must_use]
+    pub fn body(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.func_def.command) }
+    }
+
+    /// The file the function was defined in, if bash recorded one
+    #[must_use]
+    pub fn source_file(&self) -> Option<&'a CStr> {
+        let source_file = self.func_def.source_file;
+        // SAFETY: the tree outlives the view
+        (!source_file.is_null()).then(|| unsafe { text(source_file) })
+    }
+}
+
+/// Arithmetic evaluation: `(( expr ))`
+#[derive(Clone, Copy)]
+pub struct ArithmeticRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    arith_cmd: &'a ffi::ARITH_COM,
+}
+
+impl<'a> ArithmeticRef<'a> {
+    /// The words of the expression, which [`Command::Arithmetic`] joins
+    /// with spaces
+    pub fn expression(&self) -> impl Iterator<Item = WordRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { word_refs(self.arith_cmd.exp) }
+    }
+}
+
+/// C-style for loop: `for ((init; test; step)); do ...; done`
+#[derive(Clone, Copy)]
+pub struct ArithmeticForRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    arith_for: &'a ffi::ARITH_FOR_COM,
+}
+
+impl<'a> ArithmeticForRef<'a> {
+    /// The words of the initializer
+    pub fn init(&self) -> impl Iterator<Item = WordRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { word_refs(self.arith_for.init) }
+    }
+
+    /// The words of the test
+    pub fn test(&self) -> impl Iterator<Item = WordRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { word_refs(self.arith_for.test) }
+    }
+
+    /// The words of the step
+    pub fn step(&self) -> impl Iterator<Item = WordRef<'a>> {
+        // SAFETY: the tree outlives the view
+        unsafe { word_refs(self.arith_for.step) }
+    }
+
+    /// The loop body
+    #[must_use]
+    pub fn body(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.arith_for.action) }
+    }
+}
+
+/// Conditional expression: `[[ expr ]]`
+#[derive(Clone, Copy)]
+pub struct ConditionalRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    cond_cmd: &'a ffi::COND_COM,
+}
+
+impl<'a> ConditionalRef<'a> {
+    /// The expression
+    #[must_use]
+    pub const fn expr(&self) -> CondRef<'a> {
+        CondRef {
+            cond: self.cond_cmd,
+            negation_seen: false,
+        }
+    }
+}
+
+/// A node of a `[[ ... ]]` expression
+#[derive(Clone, Copy)]
+pub struct CondRef<'a> {
+    cond: &'a ffi::COND_COM,
+    // Set once the node's `!` has been reported as `CondKind::Not`
+    negation_seen: bool,
+}
+
+/// What a [`CondRef`] is; the variants match
+/// [`ConditionalExpr`](crate::ConditionalExpr)'s
+#[derive(Clone, Copy)]
+#[allow(missing_docs)]
+pub enum CondKind<'a> {
+    Unary {
+        op: &'a CStr,
+        arg: &'a CStr,
+    },
+    Binary {
+        op: &'a CStr,
+        left: &'a CStr,
+        right: &'a CStr,
+    },
+    And {
+        left: CondRef<'a>,
+        right: CondRef<'a>,
+    },
+    Or {
+        left: CondRef<'a>,
+        right: CondRef<'a>,
+    },
+    Not {
+        expr: CondRef<'a>,
+    },
+    Term {
+        word: &'a CStr,
+    },
+    Expr {
+        expr: CondRef<'a>,
+    },
+}
+
+impl<'a> CondRef<'a> {
+    /// What kind of node this is, with its operands
+    ///
+    /// # Panics
+    ///
+    /// Panics if bash's parser produced a node type this crate doesn't know.
+    #[must_use]
+    pub fn kind(&self) -> CondKind<'a> {
+        let cond = self.cond;
+        if (cond.flags & CMD_INVERT_RETURN) != 0 && !self.negation_seen {
+            return CondKind::Not {
+                expr: Self {
+                    cond,
+                    negation_seen: true,
+                },
+            };
+        }
+
+        let nested = |cond: *mut ffi::COND_COM| Self {
+            // SAFETY: the tree outlives the view
+            cond: unsafe { cond.as_ref() }.expect("bash's parser fills in every operand of [[ ]]"),
+            negation_seen: false,
+        };
+        // For unary and binary tests, the operands are in left->op and
+        // right->op
+        // SAFETY: the tree outlives the view
+        let operand = |cond: *mut ffi::COND_COM| unsafe {
+            text(cond.as_ref().map_or(std::ptr::null(), |c| word_text(c.op)))
+        };
+        // SAFETY: the tree outlives the view
+        let op = unsafe { text(word_text(cond.op)) };
+
+        match cond.type_ {
+            COND_AND => CondKind::And {
+                left: nested(cond.left),
+                right: nested(cond.right),
+            },
+            COND_OR => CondKind::Or {
+                left: nested(cond.left),
+                right: nested(cond.right),
+            },
+            COND_UNARY => CondKind::Unary {
+                op,
+                arg: operand(cond.left),
+            },
+            COND_BINARY => CondKind::Binary {
+                op,
+                left: operand(cond.left),
+                right: operand(cond.right),
+            },
+            COND_TERM => CondKind::Term { word: op },
+            COND_EXPR => CondKind::Expr {
+                expr: nested(cond.left),
+            },
+            other => panic!("bash's parser produced unknown [[ ]] node type {other}"),
+        }
+    }
+}
+
+/// The text pointer of a word, or null for no word
+///
+/// # Safety
+///
+/// `word` must be null or valid.
+const unsafe fn word_text(word: *const ffi::WORD_DESC) -> *const c_char {
+    if word.is_null() {
+        std::ptr::null()
+    } else {
+        (*word).word
+    }
+}
+
+/// Coprocess: `coproc [name] { ...; }`
+#[derive(Clone, Copy)]
+pub struct CoprocRef<'a> {
+    cmd: &'a ffi::COMMAND,
+    coproc_cmd: &'a ffi::COPROC_COM,
+}
+
+impl<'a> CoprocRef<'a> {
+    /// The coprocess name, if one was given
+    #[must_use]
+    pub fn name(&self) -> Option<&'a CStr> {
+        let name = self.coproc_cmd.name;
+        // SAFETY: the tree outlives the view
+        (!name.is_null()).then(|| unsafe { text(name) })
+    }
+
+    /// The coprocess body
+    #[must_use]
+    pub fn body(&self) -> CommandRef<'a> {
+        // SAFETY: the tree outlives the view
+        unsafe { child(self.coproc_cmd.command) }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{init, parse};
+
+    fn setup() {
+        init();
+    }
+
+    /// The first word of every simple command, found through the views
+    fn command_names(cmd: CommandRef<'_>, names: &mut Vec<String>) {
+        if let CommandRef::Simple(simple) = cmd {
+            if let Some(word) = simple.words().next() {
+                names.push(word.to_string_lossy().into_owned());
+            }
+        }
+        for child in cmd.children() {
+            command_names(child, names);
+        }
+    }
+
+    #[test]
+    fn test_simple_command_words() {
+        setup();
+        let script = ParsedScript::parse("A=1 B=2 echo hello >out").unwrap();
+        let CommandRef::Simple(simple) = script.command() else {
+            panic!("expected a simple command");
+        };
+
+        let words: Vec<_> = simple.words().map(|w| w.as_bytes()).collect();
+        assert_eq!(words, [&b"echo"[..], b"hello"]);
+        let assignments: Vec<_> = simple.assignments().map(|w| w.text()).collect();
+        assert_eq!(assignments, [c"A=1", c"B=2"]);
+
+        let redirect = simple.redirects().next().unwrap();
+        assert_eq!(redirect.direction(), RedirectType::Output);
+        assert_eq!(redirect.target(), RedirectTargetRef::File(c"out"));
+        assert_eq!(script.command().line(), Some(1));
+    }
+
+    #[test]
+    fn test_children_walk() {
+        setup();
+        let script = ParsedScript::parse(
+            "if make; then ! install | tee log; fi\n\
+             case $1 in start) run ;; *) ;; esac\n\
+             f() { (cleanup) & }\n",
+        )
+        .unwrap();
+
+        let mut names = Vec::new();
+        command_names(script.command(), &mut names);
+        assert_eq!(names, ["make", "install", "tee", "run", "cleanup"]);
+    }
+
+    #[test]
+    fn test_negation_matches_ast() {
+        setup();
+        let script = ParsedScript::parse("! a | b").unwrap();
+        let CommandRef::Pipeline(pipeline) = script.command() else {
+            panic!("expected a pipeline");
+        };
+        assert!(pipeline.negated());
+        assert_eq!(pipeline.commands().count(), 2);
+
+        let script = ParsedScript::parse("a | ! b").unwrap();
+        let CommandRef::Pipeline(pipeline) = script.command() else {
+            panic!("expected a pipeline");
+        };
+        assert!(!pipeline.negated());
+        let last = pipeline.commands().last().unwrap();
+        assert!(matches!(last, CommandRef::Simple(_)));
+        assert!(matches!(last.to_command(), Ok(Command::Simple { .. })));
+    }
+
+    #[test]
+    fn test_conditional() {
+        setup();
+        let script = ParsedScript::parse("[[ ! -f a && b == c ]]").unwrap();
+        let CommandRef::Conditional(cond) = script.command() else {
+            panic!("expected a conditional");
+        };
+        let CondKind::And { left, right } = cond.expr().kind() else {
+            panic!("expected &&");
+        };
+        let CondKind::Not { expr } = left.kind() else {
+            panic!("expected !");
+        };
+        assert!(matches!(expr.kind(), CondKind::Unary { op, arg } if op == c"-f" && arg == c"a"));
+        assert!(matches!(
+            right.kind(),
+            CondKind::Binary { op, left, right } if op == c"==" && left == c"b" && right == c"c"
+        ));
+    }
+
+    #[test]
+    fn test_to_owned_matches_parse() {
+        setup();
+        let script = "for i in 1 2; do echo $i; done > out &";
+        let parsed = ParsedScript::parse(script).unwrap();
+        let owned = serde_json::to_string(&parsed.to_owned().unwrap()).unwrap();
+        assert_eq!(
+            owned,
+            serde_json::to_string(&parse(script).unwrap()).unwrap()
+        );
+
+        let CommandRef::List(list) = parsed.command() else {
+            panic!("expected a list");
+        };
+        assert_eq!(list.op(), ListOp::Amp);
+        assert!(list.right().is_none());
+        let left = serde_json::to_string(&list.left().to_command().unwrap()).unwrap();
+        assert!(left.starts_with(r#"{"type":"for","line":1"#));
+    }
+
+    #[test]
+    fn test_errors() {
+        setup();
+        assert!(matches!(
+            ParsedScript::parse("if then fi"),
+            Err(ParseError::SyntaxError(_))
+        ));
+        assert!(matches!(
+            ParsedScript::parse("  "),
+            Err(ParseError::EmptyInput)
+        ));
+    }
+
+    #[test]
+    fn test_parse_bytes() {
+        setup();
+        // Latin-1: "café", then a here-document of "naïve"
+        let script = ParsedScript::parse_bytes(b"cat caf\xe9 <<EOF\nna\xefve\nEOF\n").unwrap();
+        let CommandRef::Simple(simple) = script.command() else {
+            panic!("expected a simple command");
+        };
+        let word = simple.words().nth(1).unwrap();
+        assert_eq!(word.as_bytes(), b"caf\xe9");
+        assert!(word.to_str().is_err());
+        assert_eq!(word.to_string_lossy(), "caf\u{fffd}");
+        let redirect = simple.redirects().next().unwrap();
+        assert_eq!(redirect.target(), RedirectTargetRef::File(c"na\xefve\n"));
+
+        let owned = script.to_owned().unwrap();
+        let Command::Simple { words, .. } = &owned else {
+            panic!("expected a simple command");
+        };
+        assert_eq!(words[1].word, "caf\u{fffd}");
+
+        assert!(matches!(
+            ParsedScript::parse_bytes(b" \t\n"),
+            Err(ParseError::EmptyInput)
+        ));
+        assert!(matches!(
+            ParsedScript::parse_bytes(b"if \xff then fi"),
+            Err(ParseError::SyntaxError(_))
+        ));
+        assert!(matches!(
+            ParsedScript::parse_bytes(b"echo a\0b"),
+            Err(ParseError::InvalidString(_))
+        ));
+    }
+}
@@ -0,0 +1,621 @@
+//! Walking an AST
+//!
+//! [`Command::walk()`] iterates over every command, word and redirect of a
+//! tree in source order, and [`Command::visit()`] and
+//! [`Command::visit_mut()`] hand them to a [`Visitor`] or [`VisitorMut`],
+//! which also hears when each command's subtree ends and can prune subtrees
+//! or stop early. Like the conversion, the walks keep their own stack
+//! instead of recursing, so they handle any tree the parser accepts.
+//!
+//! # Example
+//!
+//! ```
+//! use bash_ast::visit::{Flow, Visitor};
+//! use bash_ast::{Command, Word};
+//!
+//! /// Words of commands outside functions
+//! #[derive(Default)]
+//! struct TopLevelWords<'a>(Vec<&'a str>);
+//!
+//! impl<'a> Visitor<'a> for TopLevelWords<'a> {
+//!     fn enter_command(&mut self, cmd: &'a Command) -> Flow {
+//!         if matches!(cmd, Command::FunctionDef { .. }) {
+//!             Flow::Prune
+//!         } else {
+//!             Flow::Continue
+//!         }
+//!     }
+//!
+//!     fn visit_word(&mut self, word: &'a Word) -> Flow {
+//!         self.0.push(&word.word);
+//!         Flow::Continue
+//!     }
+//! }
+//!
+//! let json = r#"{"type":"list","op":"semi",
+//!     "left":{"type":"function_def","name":"f","body":{"type":"simple",
+//!         "words":[{"word":"inner"}],"redirects":[]}},
+//!     "right":{"type":"simple","words":[{"word":"f"}],"redirects":[]}}"#;
+//! let cmd: Command = serde_json::from_str(json).unwrap();
+//!
+//! let mut words = TopLevelWords::default();
+//! cmd.visit(&mut words);
+//! assert_eq!(words.0, ["f"]);
+//! assert_eq!(cmd.simple_commands().count(), 2);
+//! ```
+
+use crate::ast::{CaseClause, Command, Redirect, Word};
+use std::ptr;
+
+/// A node of an AST, as [`Command::walk()`] yields them
+#[derive(Debug, Clone, Copy)]
+pub enum Node<'a> {
+    Command(&'a Command),
+    Word(&'a Word),
+    Redirect(&'a Redirect),
+}
+
+/// What a walk does after a visitor's hook
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum Flow {
+    /// Go on into the node's children
+    #[default]
+    Continue,
+    /// Skip the node's children, and go on with its next sibling
+    Prune,
+    /// End the walk
+    Stop,
+}
+
+/// Hooks for [`Command::visit()`]
+///
+/// A command's words, redirects and child commands are visited between
+/// its `enter_command()` and `leave_command()`, in source order. A word's
+/// children are the commands of its substitutions. Every hook does nothing
+/// by default.
+pub trait Visitor<'a> {
+    /// Called on reaching a command, before anything inside it
+    fn enter_command(&mut self, _cmd: &'a Command) -> Flow {
+        Flow::Continue
+    }
+
+    /// Called once everything inside a command has been visited, or
+    /// skipped if `enter_command()` pruned it, unless the walk was stopped
+    fn leave_command(&mut self, _cmd: &'a Command) {}
+
+    /// Called on reaching a word, before its substitutions
+    fn visit_word(&mut self, _word: &'a Word) -> Flow {
+        Flow::Continue
+    }
+
+    /// Called on reaching a redirect
+    fn visit_redirect(&mut self, _redirect: &'a Redirect) -> Flow {
+        Flow::Continue
+    }
+}
+
+/// Hooks for [`Command::visit_mut()`], which may change the nodes they are
+/// given
+///
+/// Hooks are called as for [`Visitor`]. The children of a node are found
+/// after its hook returns, so a hook that replaces them has the walk go
+/// into the new ones.
+pub trait VisitorMut {
+    /// Called on reaching a command, before anything inside it
+    fn enter_command(&mut self, _cmd: &mut Command) -> Flow {
+        Flow::Continue
+    }
+
+    /// Called once everything inside a command has been visited, or
+    /// skipped if `enter_command()` pruned it, unless the walk was stopped
+    fn leave_command(&mut self, _cmd: &mut Command) {}
+
+    /// Called on reaching a word, before its substitutions
+    fn visit_word(&mut self, _word: &mut Word) -> Flow {
+        Flow::Continue
+    }
+
+    /// Called on reaching a redirect
+    fn visit_redirect(&mut self, _redirect: &mut Redirect) -> Flow {
+        Flow::Continue
+    }
+}
+
+/// Iterator over the nodes of a tree, from [`Command::walk()`]
+pub struct Walk<'a> {
+    /// Nodes still to yield, the next one last
+    stack: Vec<Node<'a>>,
+}
+
+impl<'a> Iterator for Walk<'a> {
+    type Item = Node<'a>;
+
+    fn next(&mut self) -> Option<Node<'a>> {
+        let node = self.stack.pop()?;
+        let start = self.stack.len();
+        children(node, |child| self.stack.push(child));
+        self.stack[start..].reverse();
+        Some(node)
+    }
+}
+
+/// A step of [`Command::visit()`]
+enum Step<'a> {
+    Enter(Node<'a>),
+    Leave(&'a Command),
+}
+
+/// A node of the tree [`Command::visit_mut()`] is walking
+enum NodeMut<'a> {
+    Command(&'a mut Command),
+    Word(&'a mut Word),
+    Redirect(&'a mut Redirect),
+}
+
+/// A step of [`Command::visit_mut()`], pointing into the tree
+enum StepMut {
+    Command(*mut Command),
+    Word(*mut Word),
+    Redirect(*mut Redirect),
+    Leave(*mut Command),
+}
+
+impl From<NodeMut<'_>> for StepMut {
+    fn from(node: NodeMut<'_>) -> Self {
+        match node {
+            NodeMut::Command(cmd) => Self::Command(ptr::from_mut(cmd)),
+            NodeMut::Word(word) => Self::Word(ptr::from_mut(word)),
+            NodeMut::Redirect(redirect) => Self::Redirect(ptr::from_mut(redirect)),
+        }
+    }
+}
+
+/// Hand each word, redirect and child command of a command to `$push`, in
+/// source order, as `$node`s
+///
+/// Written once for shared and mutable borrows: the bindings take the
+/// borrow of `$cmd`.
+macro_rules! command_children {
+    ($cmd:expr, $node:ident, $push:expr) => {{
+        let push = $push;
+        match $cmd {
+            Command::Simple {
+                words, redirects, ..
+            } => {
+                for word in words {
+                    push($node::Word(word));
+                }
+                for redirect in redirects {
+                    push($node::Redirect(redirect));
+                }
+            }
+            Command::Pipeline { commands, .. } => {
+                for cmd in commands {
+                    push($node::Command(cmd));
+                }
+            }
+            Command::List { left, right, .. } => {
+                push($node::Command(left));
+                push($node::Command(right));
+            }
+            Command::Sequence { items, .. } => {
+                for (cmd, _) in items {
+                    push($node::Command(cmd));
+                }
+            }
+            Command::While {
+                test,
+                body,
+                redirects,
+                ..
+            }
+            | Command::Until {
+                test,
+                body,
+                redirects,
+                ..
+            } => {
+                push($node::Command(test));
+                push($node::Command(body));
+                for redirect in redirects {
+                    push($node::Redirect(redirect));
+                }
+            }
+            Command::If {
+                condition,
+                then_branch,
+                else_branch,
+                redirects,
+                ..
+            } => {
+                push($node::Command(condition));
+                push($node::Command(then_branch));
+                if let Some(else_branch) = else_branch {
+                    push($node::Command(else_branch));
+                }
+                for redirect in redirects {
+                    push($node::Redirect(redirect));
+                }
+            }
+            Command::Case {
+                clauses, redirects, ..
+            } => {
+                for clause in clauses {
+                    if let CaseClause {
+                        action: Some(action),
+                        ..
+                    } = clause
+                    {
+                        push($node::Command(action));
+                    }
+                }
+                for redirect in redirects {
+                    push($node::Redirect(redirect));
+                }
+            }
+            Command::For {
+                body, redirects, ..
+            }
+            | Command::Select {
+                body, redirects, ..
+            }
+            | Command::Group {
+                body, redirects, ..
+            }
+            | Command::Subshell {
+                body, redirects, ..
+            } => {
+                push($node::Command(body));
+                for redirect in redirects {
+                    push($node::Redirect(redirect));
+                }
+            }
+            Command::FunctionDef { body, .. }
+            | Command::ArithmeticFor { body, .. }
+            | Command::Coproc { body, .. } => push($node::Command(body)),
+            Command::Arithmetic { .. } | Command::Conditional { .. } => {}
+        }
+    }};
+}
+
+/// Hand the children of `node` to `push`, in source order
+fn children<'a>(node: Node<'a>, mut push: impl FnMut(Node<'a>)) {
+    match node {
+        Node::Command(cmd) => command_children!(cmd, Node, &mut push),
+        Node::Word(word) => word
+            .substitutions
+            .iter()
+            .for_each(|cmd| push(Node::Command(cmd))),
+        Node::Redirect(_) => {}
+    }
+}
+
+/// Hand the children of the node `step` points to to `push`, in source
+/// order
+///
+/// # Safety
+///
+/// `step` must point to a live node that nothing else borrows.
+unsafe fn children_mut(step: &StepMut, mut push: impl FnMut(NodeMut<'_>)) {
+    match *step {
+        StepMut::Command(cmd) => command_children!(&mut *cmd, NodeMut, &mut push),
+        StepMut::Word(word) => (*word)
+            .substitutions
+            .iter_mut()
+            .for_each(|cmd| push(NodeMut::Command(cmd))),
+        StepMut::Redirect(_) | StepMut::Leave(_) => {}
+    }
+}
+
+impl Command {
+    /// Iterate over this command and every command, word and redirect
+    /// inside it, in source order
+    ///
+    /// Each command comes before its words, redirects and children, and
+    /// each word before the commands of its substitutions.
+    #[must_use]
+    pub fn walk(&self) -> Walk<'_> {
+        Walk {
+            stack: vec![Node::Command(self)],
+        }
+    }
+
+    /// Iterate over this command and every command inside it, in source
+    /// order
+    pub fn commands(&self) -> impl Iterator<Item = &Self> {
+        self.walk().filter_map(|node| match node {
+            Node::Command(cmd) => Some(cmd),
+            Node::Word(_) | Node::Redirect(_) => None,
+        })
+    }
+
+    /// Iterate over the simple commands in this one, in source order
+    pub fn simple_commands(&self) -> impl Iterator<Item = &Self> {
+        self.commands()
+            .filter(|cmd| matches!(cmd, Self::Simple { .. }))
+    }
+
+    /// Iterate over the function definitions in this command, in source
+    /// order
+    pub fn function_defs(&self) -> impl Iterator<Item = &Self> {
+        self.commands()
+            .filter(|cmd| matches!(cmd, Self::FunctionDef { .. }))
+    }
+
+    /// Walk this command with `visitor`
+    ///
+    /// Returns [`Flow::Stop`] if a hook stopped the walk, and
+    /// [`Flow::Continue`] otherwise.
+    pub fn visit<'a, V: Visitor<'a> + ?Sized>(&'a self, visitor: &mut V) -> Flow {
+        let mut steps = vec![Step::Enter(Node::Command(self))];
+        while let Some(step) = steps.pop() {
+            let node = match step {
+                Step::Enter(node) => node,
+                Step::Leave(cmd) => {
+                    visitor.leave_command(cmd);
+                    continue;
+                }
+            };
+            let flow = match node {
+                Node::Command(cmd) => {
+                    let flow = visitor.enter_command(cmd);
+                    steps.push(Step::Leave(cmd));
+                    flow
+                }
+                Node::Word(word) => visitor.visit_word(word),
+                Node::Redirect(redirect) => visitor.visit_redirect(redirect),
+            };
+            match flow {
+                Flow::Continue => {
+                    let start = steps.len();
+                    children(node, |child| steps.push(Step::Enter(child)));
+                    steps[start..].reverse();
+                }
+                Flow::Prune => {}
+                Flow::Stop => return Flow::Stop,
+            }
+        }
+        Flow::Continue
+    }
+
+    /// Walk this command with `visitor`, which may change it
+    ///
+    /// Returns [`Flow::Stop`] if a hook stopped the walk, and
+    /// [`Flow::Continue`] otherwise.
+    pub fn visit_mut<V: VisitorMut + ?Sized>(&mut self, visitor: &mut V) -> Flow {
+        visit_mut(self, visitor)
+    }
+}
+
+/// The body of [`Command::visit_mut()`], kept out of `impl Command` so the
+/// `unsafe` in it stays away from the type serde deserializes
+fn visit_mut<V: VisitorMut + ?Sized>(root: &mut Command, visitor: &mut V) -> Flow {
+    let mut steps = vec![StepMut::Command(ptr::from_mut(root))];
+    while let Some(step) = steps.pop() {
+        // SAFETY: every step points into the tree `root` borrows, and
+        // only one node is borrowed at a time. A node's children are
+        // found once its hook has returned, the children of one node
+        // are disjoint, and a command is left only after all of them.
+        unsafe {
+            let flow = match step {
+                StepMut::Command(cmd) => {
+                    let flow = visitor.enter_command(&mut *cmd);
+                    steps.push(StepMut::Leave(cmd));
+                    flow
+                }
+                StepMut::Word(word) => visitor.visit_word(&mut *word),
+                StepMut::Redirect(redirect) => visitor.visit_redirect(&mut *redirect),
+                StepMut::Leave(cmd) => {
+                    visitor.leave_command(&mut *cmd);
+                    continue;
+                }
+            };
+            match flow {
+                Flow::Continue => {
+                    let start = steps.len();
+                    children_mut(&step, |child| steps.push(child.into()));
+                    steps[start..].reverse();
+                }
+                Flow::Prune => {}
+                Flow::Stop => return Flow::Stop,
+            }
+        }
+    }
+    Flow::Continue
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// `f() { cat <in "$(date)"; }; if true; then wc; fi >out`
+    const SCRIPT: &str = r#"{"type":"list","op":"semi",
+        "left":{"type":"function_def","name":"f","body":{"type":"group","redirects":[],
+          "body":{"type":"simple","words":[{"word":"cat"},{"word":"\"$(date)\"",
+            "substitutions":[{"type":"simple","words":[{"word":"date"}],"redirects":[]}]}],
+            "redirects":[{"direction":"input","source_fd":0,"target":"in"}]}}},
+        "right":{"type":"if",
+          "condition":{"type":"simple","words":[{"word":"true"}],"redirects":[]},
+          "then_branch":{"type":"simple","words":[{"word":"wc"}],"redirects":[]},
+          "redirects":[{"direction":"output","source_fd":1,"target":"out"}]}}"#;
+
+    fn script() -> Command {
+        serde_json::from_str(SCRIPT).unwrap()
+    }
+
+    fn describe(node: Node<'_>) -> String {
+        match node {
+            Node::Command(cmd) => serde_json::to_value(cmd).unwrap()["type"]
+                .as_str()
+                .unwrap()
+                .to_string(),
+            Node::Word(word) => format!("word {}", word.word),
+            Node::Redirect(redirect) => format!("redirect {:?}", redirect.target),
+        }
+    }
+
+    /// Records every hook call, pruning commands of one type and stopping
+    /// at one word
+    #[derive(Default)]
+    struct Trace {
+        calls: Vec<String>,
+        prune: &'static str,
+        stop: &'static str,
+    }
+
+    impl<'a> Visitor<'a> for Trace {
+        fn enter_command(&mut self, cmd: &'a Command) -> Flow {
+            let kind = describe(Node::Command(cmd));
+            let flow = if kind == self.prune {
+                Flow::Prune
+            } else {
+                Flow::Continue
+            };
+            self.calls.push(format!("enter {kind}"));
+            flow
+        }
+
+        fn leave_command(&mut self, cmd: &'a Command) {
+            self.calls
+                .push(format!("leave {}", describe(Node::Command(cmd))));
+        }
+
+        fn visit_word(&mut self, word: &'a Word) -> Flow {
+            self.calls.push(describe(Node::Word(word)));
+            if word.word.as_str() == self.stop {
+                Flow::Stop
+            } else {
+                Flow::Continue
+            }
+        }
+
+        fn visit_redirect(&mut self, redirect: &'a Redirect) -> Flow {
+            self.calls.push(describe(Node::Redirect(redirect)));
+            Flow::Continue
+        }
+    }
+
+    #[test]
+    fn test_walk_in_source_order() {
+        let cmd = script();
+        let nodes: Vec<_> = cmd.walk().map(describe).collect();
+        assert_eq!(
+            nodes,
+            [
+                "list",
+                "function_def",
+                "group",
+                "simple",
+                "word cat",
+                "word \"$(date)\"",
+                "simple",
+                "word date",
+                "redirect File(\"in\")",
+                "if",
+                "simple",
+                "word true",
+                "simple",
+                "word wc",
+                "redirect File(\"out\")",
+            ]
+        );
+    }
+
+    #[test]
+    fn test_queries() {
+        let cmd = script();
+        assert_eq!(cmd.commands().count(), 8);
+        assert_eq!(cmd.simple_commands().count(), 4);
+        let names: Vec<_> = cmd
+            .function_defs()
+            .map(|cmd| match cmd {
+                Command::FunctionDef { name, .. } => name.as_str(),
+                _ => unreachable!(),
+            })
+            .collect();
+        assert_eq!(names, ["f"]);
+    }
+
+    #[test]
+    fn test_visit_matches_walk() {
+        let cmd = script();
+        let mut trace = Trace::default();
+        assert_eq!(cmd.visit(&mut trace), Flow::Continue);
+        let entered: Vec<_> = trace
+            .calls
+            .iter()
+            .filter(|call| !call.starts_with("leave "))
+            .map(|call| call.trim_start_matches("enter ").to_string())
+            .collect();
+        let walked: Vec<_> = cmd.walk().map(describe).collect();
+        assert_eq!(entered, walked);
+        assert_eq!(trace.calls.last().unwrap(), "leave list");
+    }
+
+    #[test]
+    fn test_visit_prunes_and_stops() {
+        let cmd = script();
+        let mut trace = Trace {
+            prune: "function_def",
+            stop: "true",
+            ..Trace::default()
+        };
+        assert_eq!(cmd.visit(&mut trace), Flow::Stop);
+        assert_eq!(
+            trace.calls,
+            [
+                "enter list",
+                "enter function_def",
+                "leave function_def",
+                "enter if",
+                "enter simple",
+                "word true",
+            ]
+        );
+    }
+
+    #[test]
+    fn test_visit_mut_reaches_substitutions() {
+        struct Upper;
+
+        impl VisitorMut for Upper {
+            fn visit_word(&mut self, word: &mut Word) -> Flow {
+                word.word = word.word.to_uppercase().into();
+                Flow::Continue
+            }
+        }
+
+        let mut cmd = script();
+        assert_eq!(cmd.visit_mut(&mut Upper), Flow::Continue);
+        let words: Vec<_> = cmd
+            .walk()
+            .filter_map(|node| match node {
+                Node::Word(word) => Some(word.word.to_string()),
+                _ => None,
+            })
+            .collect();
+        assert_eq!(words, ["CAT", "\"$(DATE)\"", "DATE", "TRUE", "WC"]);
+    }
+
+    #[test]
+    fn test_visit_mut_walks_replaced_children() {
+        /// Replaces the body of every group with a copy of `with`
+        struct Replace(Command);
+
+        impl VisitorMut for Replace {
+            fn enter_command(&mut self, cmd: &mut Command) -> Flow {
+                if let Command::Group { body, .. } = cmd {
+                    **body = self.0.clone();
+                }
+                Flow::Continue
+            }
+        }
+
+        let mut cmd = script();
+        let with =
+            serde_json::from_str(r#"{"type":"simple","words":[{"word":"new"}],"redirects":[]}"#)
+                .unwrap();
+        cmd.visit_mut(&mut Replace(with));
+        assert_eq!(cmd.simple_commands().count(), 3);
+    }
+}
@@ -1,8 +1,8 @@
 #![allow(dead_code)]
 
 use bash_ast::{
-    init, parse, to_bash, CaseClause, CaseClauseFlags, Command, ConditionalExpr, ListOp, Redirect,
-    RedirectTarget, RedirectType, Word,
+    init, parse, to_bash, CaseClause, CaseClauseFlags, Command, ConditionalExpr, ListOp, Nested,
+    Redirect, RedirectTarget, RedirectType, Symbol, Word,
 };
 
 pub fn setup() {
@@ -155,21 +155,26 @@ pub const fn to_bash_roundtrip_matrix_scripts() -> &'static [&'static str] {
 
 pub fn word(text: &str) -> Word {
     Word {
-        word: text.to_string(),
+        span: None,
+        word: text.into(),
         flags: 0,
+        substitutions: Vec::new(),
     }
 }
 
 pub fn word_with_flags(text: &str, flags: u32) -> Word {
     Word {
-        word: text.to_string(),
+        span: None,
+        word: text.into(),
         flags,
+        substitutions: Vec::new(),
     }
 }
 
 pub fn simple(words: &[&str]) -> Command {
     Command::Simple {
         line: None,
+        span: None,
         words: words.iter().map(|&text| word(text)).collect(),
         redirects: Vec::new(),
         assignments: None,
@@ -183,6 +188,7 @@ pub fn simple_with(
 ) -> Command {
     Command::Simple {
         line: None,
+        span: None,
         words,
         redirects,
         assignments: assignments.map(|items| items.into_iter().map(str::to_string).collect()),
@@ -192,6 +198,7 @@ pub fn simple_with(
 pub const fn pipeline(commands: Vec<Command>) -> Command {
     Command::Pipeline {
         line: None,
+        span: None,
         commands,
         negated: false,
     }
@@ -200,6 +207,7 @@ pub const fn pipeline(commands: Vec<Command>) -> Command {
 pub const fn negated_pipeline(commands: Vec<Command>) -> Command {
     Command::Pipeline {
         line: None,
+        span: None,
         commands,
         negated: true,
     }
@@ -208,16 +216,18 @@ pub const fn negated_pipeline(commands: Vec<Command>) -> Command {
 pub fn list(op: ListOp, left: Command, right: Command) -> Command {
     Command::List {
         line: None,
+        span: None,
         op,
-        left: Box::new(left),
-        right: Box::new(right),
+        left: Nested::new(left),
+        right: Nested::new(right),
     }
 }
 
 pub fn group(body: Command) -> Command {
     Command::Group {
         line: None,
-        body: Box::new(body),
+        span: None,
+        body: Nested::new(body),
         redirects: Vec::new(),
     }
 }
@@ -225,7 +235,8 @@ pub fn group(body: Command) -> Command {
 pub fn group_with_redirects(body: Command, redirects: Vec<Redirect>) -> Command {
     Command::Group {
         line: None,
-        body: Box::new(body),
+        span: None,
+        body: Nested::new(body),
         redirects,
     }
 }
@@ -233,7 +244,8 @@ pub fn group_with_redirects(body: Command, redirects: Vec<Redirect>) -> Command
 pub fn subshell(body: Command) -> Command {
     Command::Subshell {
         line: None,
-        body: Box::new(body),
+        span: None,
+        body: Nested::new(body),
         redirects: Vec::new(),
     }
 }
@@ -241,9 +253,10 @@ pub fn subshell(body: Command) -> Command {
 pub fn for_loop(variable: &str, words: Option<Vec<&str>>, body: Command) -> Command {
     Command::For {
         line: None,
-        variable: variable.to_string(),
-        words: words.map(|items| items.into_iter().map(str::to_string).collect()),
-        body: Box::new(body),
+        span: None,
+        variable: variable.into(),
+        words: words.map(|items| items.into_iter().map(Symbol::from).collect()),
+        body: Nested::new(body),
         redirects: Vec::new(),
     }
 }
@@ -251,8 +264,9 @@ pub fn for_loop(variable: &str, words: Option<Vec<&str>>, body: Command) -> Comm
 pub fn while_loop(test: Command, body: Command) -> Command {
     Command::While {
         line: None,
-        test: Box::new(test),
-        body: Box::new(body),
+        span: None,
+        test: Nested::new(test),
+        body: Nested::new(body),
         redirects: Vec::new(),
     }
 }
@@ -260,8 +274,9 @@ pub fn while_loop(test: Command, body: Command) -> Command {
 pub fn until_loop(test: Command, body: Command) -> Command {
     Command::Until {
         line: None,
-        test: Box::new(test),
-        body: Box::new(body),
+        span: None,
+        test: Nested::new(test),
+        body: Nested::new(body),
         redirects: Vec::new(),
     }
 }
@@ -269,20 +284,18 @@ pub fn until_loop(test: Command, body: Command) -> Command {
 pub fn if_cmd(condition: Command, then_branch: Command, else_branch: Option<Command>) -> Command {
     Command::If {
         line: None,
-        condition: Box::new(condition),
-        then_branch: Box::new(then_branch),
-        else_branch: else_branch.map(Box::new),
+        span: None,
+        condition: Nested::new(condition),
+        then_branch: Nested::new(then_branch),
+        else_branch: else_branch.map(Nested::new),
         redirects: Vec::new(),
     }
 }
 
 pub fn case_clause(patterns: &[&str], action: Option<Command>) -> CaseClause {
     CaseClause {
-        patterns: patterns
-            .iter()
-            .map(std::string::ToString::to_string)
-            .collect(),
-        action: action.map(Box::new),
+        patterns: patterns.iter().copied().map(Symbol::from).collect(),
+        action: action.map(Nested::new),
         flags: None,
     }
 }
@@ -294,11 +307,8 @@ pub fn case_clause_with_flags(
     test_next: bool,
 ) -> CaseClause {
     CaseClause {
-        patterns: patterns
-            .iter()
-            .map(std::string::ToString::to_string)
-            .collect(),
-        action: action.map(Box::new),
+        patterns: patterns.iter().copied().map(Symbol::from).collect(),
+        action: action.map(Nested::new),
         flags: Some(CaseClauseFlags {
             fallthrough,
             test_next,
@@ -309,7 +319,8 @@ pub fn case_clause_with_flags(
 pub fn case_cmd(word: &str, clauses: Vec<CaseClause>) -> Command {
     Command::Case {
         line: None,
-        word: word.to_string(),
+        span: None,
+        word: word.into(),
         clauses,
         redirects: Vec::new(),
     }
@@ -318,9 +329,10 @@ pub fn case_cmd(word: &str, clauses: Vec<CaseClause>) -> Command {
 pub fn select_cmd(variable: &str, words: Option<Vec<&str>>, body: Command) -> Command {
     Command::Select {
         line: None,
-        variable: variable.to_string(),
-        words: words.map(|items| items.into_iter().map(str::to_string).collect()),
-        body: Box::new(body),
+        span: None,
+        variable: variable.into(),
+        words: words.map(|items| items.into_iter().map(Symbol::from).collect()),
+        body: Nested::new(body),
         redirects: Vec::new(),
     }
 }
@@ -328,8 +340,9 @@ pub fn select_cmd(variable: &str, words: Option<Vec<&str>>, body: Command) -> Co
 pub fn function_def(name: &str, body: Command) -> Command {
     Command::FunctionDef {
         line: None,
-        name: name.to_string(),
-        body: Box::new(body),
+        span: None,
+        name: name.into(),
+        body: Nested::new(body),
         source_file: None,
     }
 }
@@ -337,6 +350,7 @@ pub fn function_def(name: &str, body: Command) -> Command {
 pub fn arithmetic(expression: &str) -> Command {
     Command::Arithmetic {
         line: None,
+        span: None,
         expression: expression.to_string(),
     }
 }
@@ -344,15 +358,20 @@ pub fn arithmetic(expression: &str) -> Command {
 pub fn arithmetic_for(init: &str, test: &str, step: &str, body: Command) -> Command {
     Command::ArithmeticFor {
         line: None,
+        span: None,
         init: init.to_string(),
         test: test.to_string(),
         step: step.to_string(),
-        body: Box::new(body),
+        body: Nested::new(body),
     }
 }
 
 pub const fn conditional(expr: ConditionalExpr) -> Command {
-    Command::Conditional { line: None, expr }
+    Command::Conditional {
+        line: None,
+        span: None,
+        expr,
+    }
 }
 
 pub fn cond_unary(op: &str, arg: &str) -> ConditionalExpr {
@@ -372,46 +391,46 @@ pub fn cond_binary(left: &str, op: &str, right: &str) -> ConditionalExpr {
 
 pub fn cond_and(left: ConditionalExpr, right: ConditionalExpr) -> ConditionalExpr {
     ConditionalExpr::And {
-        left: Box::new(left),
-        right: Box::new(right),
+        left: Nested::new(left),
+        right: Nested::new(right),
     }
 }
 
 pub fn cond_or(left: ConditionalExpr, right: ConditionalExpr) -> ConditionalExpr {
     ConditionalExpr::Or {
-        left: Box::new(left),
-        right: Box::new(right),
+        left: Nested::new(left),
+        right: Nested::new(right),
     }
 }
 
 pub fn cond_not(expr: ConditionalExpr) -> ConditionalExpr {
     ConditionalExpr::Not {
-        expr: Box::new(expr),
+        expr: Nested::new(expr),
     }
 }
 
 pub fn cond_term(word: &str) -> ConditionalExpr {
-    ConditionalExpr::Term {
-        word: word.to_string(),
-    }
+    ConditionalExpr::Term { word: word.into() }
 }
 
 pub fn cond_expr(expr: ConditionalExpr) -> ConditionalExpr {
     ConditionalExpr::Expr {
-        expr: Box::new(expr),
+        expr: Nested::new(expr),
     }
 }
 
 pub fn coproc(name: Option<&str>, body: Command) -> Command {
     Command::Coproc {
         line: None,
+        span: None,
         name: name.map(str::to_string),
-        body: Box::new(body),
+        body: Nested::new(body),
     }
 }
 
 pub fn redirect_file(direction: RedirectType, source_fd: Option<i32>, target: &str) -> Redirect {
     Redirect {
+        span: None,
         direction,
         source_fd,
         target: RedirectTarget::File(target.to_string()),
@@ -421,6 +440,7 @@ pub fn redirect_file(direction: RedirectType, source_fd: Option<i32>, target: &s
 
 pub const fn redirect_fd(direction: RedirectType, source_fd: Option<i32>, target: i32) -> Redirect {
     Redirect {
+        span: None,
         direction,
         source_fd,
         target: RedirectTarget::Fd(target),
@@ -430,6 +450,7 @@ pub const fn redirect_fd(direction: RedirectType, source_fd: Option<i32>, target
 
 pub fn heredoc(content: &str, eof: Option<&str>) -> Redirect {
     Redirect {
+        span: None,
         direction: RedirectType::HereDoc,
         source_fd: Some(0),
         target: RedirectTarget::File(content.to_string()),
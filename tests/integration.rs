@@ -6,7 +6,9 @@
 //! state. This is enforced via .cargo/config.toml setting `RUST_TEST_THREADS=1`.
 
 use bash_ast::{
-    init, parse, parse_to_json, Command, ConditionalExpr, ListOp, ParseError, MAX_SCRIPT_SIZE,
+    from_json, from_json_with_limits, init, parse, parse_flat, parse_to_json, parse_to_json_writer,
+    parse_with_limits, to_bash, to_json, Command, ConditionalExpr, ListOp, ParseError, ParseLimits,
+    MAX_SCRIPT_SIZE,
 };
 use proptest::prelude::*;
 
@@ -151,10 +153,7 @@ fn test_for_loop() {
     } = cmd
     {
         assert_eq!(variable, "i");
-        assert_eq!(
-            words,
-            Some(vec!["a".to_string(), "b".to_string(), "c".to_string()])
-        );
+        assert_eq!(words, Some(vec!["a".into(), "b".into(), "c".into()]));
     } else {
         panic!("Expected For command");
     }
@@ -494,10 +493,7 @@ fn test_select() {
     } = cmd
     {
         assert_eq!(variable, "opt");
-        assert_eq!(
-            words,
-            Some(vec!["a".to_string(), "b".to_string(), "c".to_string()])
-        );
+        assert_eq!(words, Some(vec!["a".into(), "b".into(), "c".into()]));
     } else {
         panic!("Expected Select command");
     }
@@ -611,6 +607,17 @@ fn test_syntax_errors() {
     }
 }
 
+#[test]
+fn test_parse_after_syntax_error() {
+    // A syntax error leaves a newline token queued in bash's parser; the
+    // next parse must skip the empty unit it produces
+    for script in ["if then fi", "fi", "echo 'unterminated", "((("] {
+        assert!(parse_with_limits(script, &ParseLimits::default()).is_err());
+        let cmd = parse_ok("echo after\necho again");
+        assert_eq!(cmd.line(), Some(1), "after {script:?}");
+    }
+}
+
 #[test]
 fn test_empty_input() {
     for script in ["", "   ", "\n\t  "] {
@@ -719,6 +726,162 @@ fn test_deeply_nested_subshells() {
     assert!(parse(&script).is_ok());
 }
 
+#[test]
+fn test_ten_thousand_level_list() {
+    // Each command of a list nests a level deeper than the one before it
+    let depth = 10_000;
+    let script = vec!["true"; depth].join(" && ");
+    assert!(matches!(parse_err(&script), ParseError::ConversionError(_)));
+
+    let limits = ParseLimits::default().with_max_depth(depth);
+    let cmd = parse_with_limits(&script, &limits).unwrap();
+
+    let mut json = Vec::new();
+    parse_to_json_writer(&script, &limits, false, &mut json).unwrap();
+    let json = String::from_utf8(json).unwrap();
+    assert_eq!(json, to_json(&cmd, false));
+
+    let read = from_json_with_limits(&json, &limits).unwrap();
+    let regenerated = to_bash(&read);
+    let reparsed = parse_with_limits(&regenerated, &limits).unwrap();
+    assert_eq!(to_bash(&reparsed), regenerated);
+    // Dropping trees this deep doesn't recurse either
+    drop((cmd, read, reparsed));
+
+    let limits = ParseLimits::default().with_max_depth(depth / 2);
+    assert!(matches!(
+        parse_with_limits(&script, &limits),
+        Err(ParseError::ConversionError(_))
+    ));
+    assert!(matches!(
+        parse_to_json_writer(&script, &limits, false, &mut Vec::new()),
+        Err(ParseError::ConversionError(_))
+    ));
+}
+
+#[test]
+fn test_flat_statement_list() {
+    setup();
+    let depth = 5_000;
+    let script = vec!["echo x"; depth].join("\n");
+    let limits = ParseLimits::default().with_max_depth(16);
+    let cmd = parse_flat(&script, &limits).unwrap();
+
+    let Command::Sequence { items, .. } = &cmd else {
+        panic!("Expected Sequence, got {cmd:?}");
+    };
+    assert_eq!(items.len(), depth);
+    assert!(items
+        .iter()
+        .all(|(cmd, _)| simple_words(cmd) == ["echo", "x"]));
+
+    // Regenerates the same script as the nested form
+    let nested = parse_with_limits(&script, &ParseLimits::unlimited()).unwrap();
+    assert_eq!(to_bash(&cmd), to_bash(&nested));
+    let json = to_json(&cmd, false);
+    assert_eq!(to_json(&from_json(&json).unwrap(), false), json);
+}
+
+#[test]
+fn test_flat_list_precedence() {
+    setup();
+    let limits = ParseLimits::default();
+    for script in [
+        "a && b || c",
+        "a; b && c; d",
+        "a & b; c &",
+        "a && b &",
+        "x; { y; z; }",
+    ] {
+        let cmd = parse_flat(script, &limits).unwrap();
+        assert_eq!(
+            to_bash(&cmd),
+            to_bash(&parse_ok(script)),
+            "Mismatch for {script:?}"
+        );
+    }
+
+    let cmd = parse_flat("a; b && c; d", &limits).unwrap();
+    let Command::Sequence { items, .. } = &cmd else {
+        panic!("Expected Sequence, got {cmd:?}");
+    };
+    let ops: Vec<_> = items.iter().map(|(_, op)| *op).collect();
+    assert_eq!(ops, [ListOp::Semi, ListOp::Semi, ListOp::Semi]);
+    assert!(matches!(items[1].0, Command::Sequence { .. }));
+}
+
+#[cfg(target_os = "linux")]
+#[test]
+fn test_substitution_trees() {
+    setup();
+    let script = r#"diff "$(cat "$(ls)")" <(sort f) $((1 + 2)) '$(no)'"#;
+    let cmd = bash_ast::parse_with_substitutions(script, &ParseLimits::default()).unwrap();
+    let Command::Simple { words, .. } = &cmd else {
+        panic!("Expected Simple command, got {cmd:?}");
+    };
+    let counts: Vec<_> = words.iter().map(|w| w.substitutions.len()).collect();
+    assert_eq!(counts, [0, 1, 1, 0, 0]);
+
+    // The nested substitution belongs to the word inside the outer one
+    let inner = &words[1].substitutions[0];
+    assert_eq!(simple_words(inner), ["cat", "\"$(ls)\""]);
+    let Command::Simple { words: inner, .. } = inner else {
+        unreachable!();
+    };
+    assert_eq!(simple_words(&inner[1].substitutions[0]), ["ls"]);
+    assert_eq!(simple_words(&words[2].substitutions[0]), ["sort", "f"]);
+
+    // Text is unchanged, and the trees survive JSON and the arena
+    assert_eq!(to_bash(&cmd), to_bash(&parse_ok(script)));
+    let json = to_json(&cmd, false);
+    assert_eq!(to_json(&from_json(&json).unwrap(), false), json);
+    let arena = bash_ast::AstArena::try_from(&cmd).unwrap();
+    assert_eq!(to_json(&arena.to_command(), false), json);
+}
+
+#[cfg(target_os = "linux")]
+#[test]
+fn test_spans() {
+    setup();
+    let script = "x=1 echo \"a b\" 2>&1 >out\nif true; then\n  (( i++ ))\nfi >log";
+    let cmd = bash_ast::parse_with_spans(script, &ParseLimits::default()).unwrap();
+    let text = |span: Option<bash_ast::Span>| {
+        let span = span.expect("every node has a span");
+        &script[span.start..span.end]
+    };
+    let Command::List { left, right, .. } = &cmd else {
+        panic!("Expected List, got {cmd:?}");
+    };
+    assert_eq!(text(cmd.span()), script);
+
+    let Command::Simple {
+        words, redirects, ..
+    } = left.as_ref()
+    else {
+        panic!("Expected Simple command, got {left:?}");
+    };
+    assert_eq!(text(left.span()), "x=1 echo \"a b\" 2>&1 >out");
+    assert_eq!(text(words[1].span.as_deref().copied()), "\"a b\"");
+    assert_eq!(text(redirects[0].span.as_deref().copied()), "2>&1");
+    assert_eq!(text(redirects[1].span.as_deref().copied()), ">out");
+
+    let Command::If { then_branch, .. } = right.as_ref() else {
+        panic!("Expected If, got {right:?}");
+    };
+    assert_eq!(text(right.span()), "if true; then\n  (( i++ ))\nfi >log");
+    let span = then_branch.span().unwrap();
+    assert_eq!(text(Some(span)), "(( i++ ))");
+    assert_eq!((span.line, span.column), (3, 3));
+    assert_eq!((span.end_line, span.end_column), (3, 12));
+
+    // Spans survive JSON and the arena
+    let json = to_json(&cmd, false);
+    assert!(json.contains(r#""span":{"start":4,"end":8,"line":1,"column":5,"#));
+    assert_eq!(to_json(&from_json(&json).unwrap(), false), json);
+    let arena = bash_ast::AstArena::try_from(&cmd).unwrap();
+    assert_eq!(to_json(&arena.to_command(), false), json);
+}
+
 // ============================================================================
 // Unicode and Special Characters
 // ============================================================================
@@ -764,7 +927,8 @@ fn test_long_input() {
 
 #[test]
 fn test_many_pipelines() {
-    for n in [10, 50, 100] {
+    // Long pipelines are flattened without recursing once per stage
+    for n in [10, 50, 100, 1000] {
         let script = (0..n).map(|_| "cat").collect::<Vec<_>>().join(" | ");
         let cmd = parse_ok(&script);
         assert!(assert_pipeline(&cmd, n));
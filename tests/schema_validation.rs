@@ -4,8 +4,8 @@
 
 mod common;
 
-use bash_ast::{parse_to_json, schema_json};
-use common::{to_bash_regression_scripts, to_bash_roundtrip_matrix_scripts};
+use bash_ast::{parse_flat, parse_to_json, schema_json, to_json, ParseLimits};
+use common::{setup, to_bash_regression_scripts, to_bash_roundtrip_matrix_scripts};
 use jsonschema::validator_for;
 use std::fs;
 use std::path::Path;
@@ -59,3 +59,17 @@ fn test_schema_accepts_extended_roundtrip_corpus() {
 
     assert!(count > 0, "expected extended corpus fixtures");
 }
+
+#[test]
+fn test_schema_accepts_flat_lists() {
+    let schema: serde_json::Value = serde_json::from_str(&schema_json(true)).unwrap();
+    let validator = validator_for(&schema).expect("generated schema should be valid");
+
+    setup();
+    let limits = ParseLimits::default();
+    for script in to_bash_regression_scripts() {
+        let cmd = parse_flat(script, &limits)
+            .unwrap_or_else(|e| panic!("failed to parse corpus script {script:?}: {e}"));
+        validate_instance(&validator, &to_json(&cmd, false), script);
+    }
+}
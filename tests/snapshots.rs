@@ -7,7 +7,11 @@
 
 mod common;
 
-use bash_ast::parse_to_json;
+use bash_ast::view::{CondKind, CondRef, RedirectRef, RedirectTargetRef, WordRef};
+use bash_ast::{
+    parse, parse_to_json, AstArena, CaseClause, CaseClauseFlags, Command, CommandRef,
+    ConditionalExpr, Nested, ParsedScript, Redirect, RedirectTarget, Word,
+};
 use common::{normalize_json_for_comparison, semantic_roundtrip, setup};
 use std::fs;
 use std::path::Path;
@@ -95,6 +99,376 @@ fn test_snapshots() {
     println!("\nAll {} snapshot tests passed!", scripts.len());
 }
 
+/// Verify that the JSON written straight from bash's tree is byte-for-byte
+/// what serializing the typed AST gives
+#[test]
+fn test_snapshots_direct_json_matches_ast() {
+    setup();
+
+    let snapshot_dir = Path::new(env!("CARGO_MANIFEST_DIR")).join("tests/snapshots");
+
+    let scripts: Vec<_> = fs::read_dir(&snapshot_dir)
+        .expect("Failed to read snapshots directory")
+        .filter_map(std::result::Result::ok)
+        .map(|e| e.path())
+        .filter(|p| p.extension().is_some_and(|ext| ext == "sh"))
+        .collect();
+
+    for script_path in &scripts {
+        let script = fs::read_to_string(script_path)
+            .unwrap_or_else(|e| panic!("Failed to read {script_path:?}: {e}"));
+        let ast = parse(&script).unwrap_or_else(|e| panic!("{script_path:?}: {e}"));
+
+        assert_eq!(
+            parse_to_json(&script, true).unwrap(),
+            serde_json::to_string_pretty(&ast).unwrap(),
+            "{script_path:?}: pretty output differs"
+        );
+        assert_eq!(
+            parse_to_json(&script, false).unwrap(),
+            serde_json::to_string(&ast).unwrap(),
+            "{script_path:?}: compact output differs"
+        );
+    }
+}
+
+/// Verify that the borrowed views show the same tree as the typed AST
+///
+/// Builds a `Command` from the view accessors alone and compares it with
+/// `ParsedScript::to_owned()` and `parse()`, line numbers included.
+#[test]
+fn test_snapshots_view_matches_ast() {
+    setup();
+
+    let snapshot_dir = Path::new(env!("CARGO_MANIFEST_DIR")).join("tests/snapshots");
+
+    let scripts: Vec<_> = fs::read_dir(&snapshot_dir)
+        .expect("Failed to read snapshots directory")
+        .filter_map(std::result::Result::ok)
+        .map(|e| e.path())
+        .filter(|p| p.extension().is_some_and(|ext| ext == "sh"))
+        .collect();
+
+    for script_path in &scripts {
+        let script = fs::read_to_string(script_path)
+            .unwrap_or_else(|e| panic!("Failed to read {script_path:?}: {e}"));
+        let parsed =
+            ParsedScript::parse(&script).unwrap_or_else(|e| panic!("{script_path:?}: {e}"));
+
+        let expected = serde_json::to_string(&parse(&script).unwrap()).unwrap();
+        assert_eq!(
+            serde_json::to_string(&parsed.to_owned().unwrap()).unwrap(),
+            expected,
+            "{script_path:?}: to_owned() differs from parse()"
+        );
+        assert_eq!(
+            serde_json::to_string(&from_view(parsed.command())).unwrap(),
+            expected,
+            "{script_path:?}: views differ from parse()"
+        );
+    }
+}
+
+fn text(word: WordRef<'_>) -> String {
+    word.to_string_lossy().into_owned()
+}
+
+fn texts<'a, T: From<String>>(words: impl Iterator<Item = WordRef<'a>>) -> Vec<T> {
+    words.map(|word| text(word).into()).collect()
+}
+
+fn joined<'a>(words: impl Iterator<Item = WordRef<'a>>) -> String {
+    texts::<String>(words).join(" ")
+}
+
+fn non_empty<T>(words: Vec<T>) -> Option<Vec<T>> {
+    (!words.is_empty()).then_some(words)
+}
+
+fn redirect(redir: RedirectRef<'_>) -> Redirect {
+    Redirect {
+        span: None,
+        direction: redir.direction(),
+        source_fd: redir.source_fd(),
+        target: match redir.target() {
+            RedirectTargetRef::File(file) => {
+                RedirectTarget::File(file.to_string_lossy().into_owned())
+            }
+            RedirectTargetRef::Fd(fd) => RedirectTarget::Fd(fd),
+        },
+        here_doc_eof: redir
+            .here_doc_eof()
+            .map(|eof| eof.to_string_lossy().into_owned()),
+    }
+}
+
+fn redirects<'a>(list: impl Iterator<Item = RedirectRef<'a>>) -> Vec<Redirect> {
+    list.map(redirect).collect()
+}
+
+fn boxed(cmd: CommandRef<'_>) -> Nested<Command> {
+    Nested::new(from_view(cmd))
+}
+
+fn cond(node: CondRef<'_>) -> ConditionalExpr {
+    let string = |s: &std::ffi::CStr| s.to_string_lossy().into_owned();
+    let boxed = |node| Nested::new(cond(node));
+    match node.kind() {
+        CondKind::Unary { op, arg } => ConditionalExpr::Unary {
+            op: string(op),
+            arg: string(arg),
+        },
+        CondKind::Binary { op, left, right } => ConditionalExpr::Binary {
+            op: string(op),
+            left: string(left),
+            right: string(right),
+        },
+        CondKind::And { left, right } => ConditionalExpr::And {
+            left: boxed(left),
+            right: boxed(right),
+        },
+        CondKind::Or { left, right } => ConditionalExpr::Or {
+            left: boxed(left),
+            right: boxed(right),
+        },
+        CondKind::Not { expr } => ConditionalExpr::Not { expr: boxed(expr) },
+        CondKind::Term { word } => ConditionalExpr::Term { word: string(word) },
+        CondKind::Expr { expr } => ConditionalExpr::Expr { expr: boxed(expr) },
+    }
+}
+
+/// Build a `Command` using nothing but the view accessors
+#[allow(clippy::too_many_lines)]
+fn from_view(cmd: CommandRef<'_>) -> Command {
+    let line = cmd.line();
+    match cmd {
+        CommandRef::Simple(simple) => Command::Simple {
+            line,
+            span: None,
+            words: simple
+                .words()
+                .map(|w| Word {
+                    span: None,
+                    word: text(w).into(),
+                    flags: w.flags(),
+                    substitutions: Vec::new(),
+                })
+                .collect(),
+            redirects: redirects(simple.redirects()),
+            assignments: non_empty(texts(simple.assignments())),
+        },
+        CommandRef::Pipeline(pipeline) => Command::Pipeline {
+            line,
+            span: None,
+            commands: pipeline.commands().map(from_view).collect(),
+            negated: pipeline.negated(),
+        },
+        CommandRef::List(list) => Command::List {
+            line,
+            span: None,
+            op: list.op(),
+            left: boxed(list.left()),
+            right: list.right().map_or_else(
+                || {
+                    Nested::new(Command::Simple {
+                        line: None,
+                        span: None,
+                        words: vec![],
+                        redirects: vec![],
+                        assignments: None,
+                    })
+                },
+                boxed,
+            ),
+        },
+        CommandRef::For(for_ref) => Command::For {
+            line,
+            span: None,
+            variable: for_ref.variable().to_string_lossy().into(),
+            words: non_empty(texts(for_ref.words())),
+            body: boxed(for_ref.body()),
+            redirects: redirects(for_ref.redirects()),
+        },
+        CommandRef::Select(select) => Command::Select {
+            line,
+            span: None,
+            variable: select.variable().to_string_lossy().into(),
+            words: non_empty(texts(select.words())),
+            body: boxed(select.body()),
+            redirects: redirects(select.redirects()),
+        },
+        CommandRef::While(while_ref) => Command::While {
+            line,
+            span: None,
+            test: boxed(while_ref.test()),
+            body: boxed(while_ref.body()),
+            redirects: redirects(while_ref.redirects()),
+        },
+        CommandRef::Until(until) => Command::Until {
+            line,
+            span: None,
+            test: boxed(until.test()),
+            body: boxed(until.body()),
+            redirects: redirects(until.redirects()),
+        },
+        CommandRef::If(if_ref) => Command::If {
+            line,
+            span: None,
+            condition: boxed(if_ref.condition()),
+            then_branch: boxed(if_ref.then_branch()),
+            else_branch: if_ref.else_branch().map(boxed),
+            redirects: redirects(if_ref.redirects()),
+        },
+        CommandRef::Case(case) => Command::Case {
+            line,
+            span: None,
+            word: case.word().to_string_lossy().into(),
+            clauses: case
+                .clauses()
+                .map(|clause| CaseClause {
+                    patterns: texts(clause.patterns()),
+                    action: clause.action().map(boxed),
+                    flags: (clause.fallthrough() || clause.test_next()).then_some(
+                        CaseClauseFlags {
+                            fallthrough: clause.fallthrough(),
+                            test_next: clause.test_next(),
+                        },
+                    ),
+                })
+                .collect(),
+            redirects: redirects(case.redirects()),
+        },
+        CommandRef::Group(group) => Command::Group {
+            line,
+            span: None,
+            body: boxed(group.body()),
+            redirects: redirects(group.redirects()),
+        },
+        CommandRef::Subshell(subshell) => Command::Subshell {
+            line,
+            span: None,
+            body: boxed(subshell.body()),
+            redirects: redirects(subshell.redirects()),
+        },
+        CommandRef::FunctionDef(func) => Command::FunctionDef {
+            line,
+            span: None,
+            name: func.name().to_string_lossy().into(),
+            body: boxed(func.body()),
+            source_file: func
+                .source_file()
+                .map(|file| file.to_string_lossy().into_owned()),
+        },
+        CommandRef::Arithmetic(arith) => Command::Arithmetic {
+            line,
+            span: None,
+            expression: joined(arith.expression()),
+        },
+        CommandRef::ArithmeticFor(arith_for) => Command::ArithmeticFor {
+            line,
+            span: None,
+            init: joined(arith_for.init()),
+            test: joined(arith_for.test()),
+            step: joined(arith_for.step()),
+            body: boxed(arith_for.body()),
+        },
+        CommandRef::Conditional(conditional) => Command::Conditional {
+            line,
+            span: None,
+            expr: cond(conditional.expr()),
+        },
+        CommandRef::Coproc(coproc) => Command::Coproc {
+            line,
+            span: None,
+            name: coproc
+                .name()
+                .map(|name| name.to_string_lossy().into_owned()),
+            body: boxed(coproc.body()),
+        },
+    }
+}
+
+/// Verify that flattening each snapshot into an arena and back loses nothing
+#[test]
+fn test_snapshots_arena_roundtrip() {
+    setup();
+
+    let snapshot_dir = Path::new(env!("CARGO_MANIFEST_DIR")).join("tests/snapshots");
+
+    let scripts: Vec<_> = fs::read_dir(&snapshot_dir)
+        .expect("Failed to read snapshots directory")
+        .filter_map(std::result::Result::ok)
+        .map(|e| e.path())
+        .filter(|p| p.extension().is_some_and(|ext| ext == "sh"))
+        .collect();
+
+    for script_path in &scripts {
+        let script = fs::read_to_string(script_path)
+            .unwrap_or_else(|e| panic!("Failed to read {script_path:?}: {e}"));
+        let ast = parse(&script).unwrap_or_else(|e| panic!("{script_path:?}: {e}"));
+        let arena = AstArena::try_from(&ast).unwrap();
+
+        assert_eq!(
+            serde_json::to_string(&arena.to_command()).unwrap(),
+            serde_json::to_string(&ast).unwrap(),
+            "{script_path:?}: arena round trip differs"
+        );
+        assert_eq!(
+            arena.iter().map(|(_, node)| node.line).collect::<Vec<_>>(),
+            walk_lines(&ast),
+            "{script_path:?}: arena is not in walk order"
+        );
+    }
+}
+
+/// The line of every command in `cmd`, parents before children
+fn walk_lines(cmd: &Command) -> Vec<Option<u32>> {
+    fn walk(cmd: &Command, lines: &mut Vec<Option<u32>>) {
+        lines.push(cmd.line());
+        match cmd {
+            Command::Simple { .. } | Command::Arithmetic { .. } | Command::Conditional { .. } => {}
+            Command::Pipeline { commands, .. } => commands.iter().for_each(|c| walk(c, lines)),
+            Command::List { left, right, .. } => {
+                walk(left, lines);
+                walk(right, lines);
+            }
+            Command::Sequence { items, .. } => items.iter().for_each(|(c, _)| walk(c, lines)),
+            Command::While { test, body, .. } | Command::Until { test, body, .. } => {
+                walk(test, lines);
+                walk(body, lines);
+            }
+            Command::If {
+                condition,
+                then_branch,
+                else_branch,
+                ..
+            } => {
+                walk(condition, lines);
+                walk(then_branch, lines);
+                if let Some(else_branch) = else_branch {
+                    walk(else_branch, lines);
+                }
+            }
+            Command::Case { clauses, .. } => {
+                for action in clauses.iter().filter_map(|clause| clause.action.as_deref()) {
+                    walk(action, lines);
+                }
+            }
+            Command::For { body, .. }
+            | Command::Select { body, .. }
+            | Command::Group { body, .. }
+            | Command::Subshell { body, .. }
+            | Command::FunctionDef { body, .. }
+            | Command::ArithmeticFor { body, .. }
+            | Command::Coproc { body, .. } => walk(body, lines),
+        }
+    }
+
+    let mut lines = Vec::new();
+    walk(cmd, &mut lines);
+    lines
+}
+
 /// Verify that we can re-parse the JSON output and get equivalent structure
 #[test]
 fn test_snapshots_roundtrip() {
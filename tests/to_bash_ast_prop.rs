@@ -38,7 +38,9 @@ fn word_flags(text: &str) -> u32 {
 fn arb_word() -> impl Strategy<Value = Word> {
     arb_word_text().prop_map(|text| Word {
         flags: word_flags(&text),
-        word: text,
+        word: text.into(),
+        substitutions: Vec::new(),
+        span: None,
     })
 }
 
@@ -68,42 +70,49 @@ fn arb_redirect() -> impl Strategy<Value = Redirect> {
             source_fd: Some(0),
             target: RedirectTarget::File(target),
             here_doc_eof: None,
+            span: None,
         }),
         file_target.clone().prop_map(|target| Redirect {
             direction: RedirectType::Output,
             source_fd: Some(1),
             target: RedirectTarget::File(target),
             here_doc_eof: None,
+            span: None,
         }),
         file_target.clone().prop_map(|target| Redirect {
             direction: RedirectType::Append,
             source_fd: Some(1),
             target: RedirectTarget::File(target),
             here_doc_eof: None,
+            span: None,
         }),
         file_target.clone().prop_map(|target| Redirect {
             direction: RedirectType::ErrAndOut,
             source_fd: Some(1),
             target: RedirectTarget::File(target),
             here_doc_eof: None,
+            span: None,
         }),
         Just(Redirect {
             direction: RedirectType::DupOutput,
             source_fd: Some(2),
             target: RedirectTarget::Fd(1),
             here_doc_eof: None,
+            span: None,
         }),
         Just(Redirect {
             direction: RedirectType::Close,
             source_fd: Some(3),
             target: RedirectTarget::Fd(-1),
             here_doc_eof: None,
+            span: None,
         }),
         heredoc_content.prop_map(|content| Redirect {
             direction: RedirectType::HereDoc,
             source_fd: Some(0),
             target: RedirectTarget::File(content),
             here_doc_eof: Some("EOF".to_string()),
+            span: None,
         }),
     ]
 }
@@ -125,6 +134,7 @@ fn arb_simple() -> impl Strategy<Value = Command> {
     )
         .prop_map(|(words, assignments, redirects)| Command::Simple {
             line: None,
+            span: None,
             words,
             redirects,
             assignments: (!assignments.is_empty()).then_some(assignments),
@@ -136,6 +146,7 @@ fn arb_shallow_command() -> impl Strategy<Value = Command> {
     let simple_pair = (simple.clone(), simple.clone());
     let empty_right = Just(Command::Simple {
         line: None,
+        span: None,
         words: Vec::new(),
         redirects: Vec::new(),
         assignments: None,
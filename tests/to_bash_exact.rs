@@ -5,7 +5,7 @@
 
 mod common;
 
-use bash_ast::{to_bash, Command, ListOp, RedirectType};
+use bash_ast::{to_bash, Command, ListOp, Nested, RedirectType};
 use common::{
     arithmetic_for, assert_semantic_roundtrip_ast, case_clause, case_clause_with_flags, case_cmd,
     cond_and, cond_binary, cond_expr, cond_not, cond_or, cond_term, cond_unary, conditional,
@@ -345,7 +345,8 @@ fn test_function_definition_uses_canonical_syntax() {
 fn test_subshell_with_redirects_exact_output() {
     let ast = Command::Subshell {
         line: None,
-        body: Box::new(simple(&["echo", "hi"])),
+        span: None,
+        body: Nested::new(simple(&["echo", "hi"])),
         redirects: vec![redirect_file(RedirectType::Output, Some(1), "out")],
     };
     assert_exact_and_semantic(&ast, "( echo hi ) >out");
@@ -393,15 +394,18 @@ fn test_arithmetic_for_with_background_body_exact_output() {
 fn test_semi_list_uses_newline_when_commands_have_distinct_lines() {
     let ast = Command::List {
         line: None,
+        span: None,
         op: ListOp::Semi,
-        left: Box::new(Command::Simple {
+        left: Nested::new(Command::Simple {
             line: Some(1),
+            span: None,
             words: vec![word("echo"), word("one")],
             redirects: Vec::new(),
             assignments: None,
         }),
-        right: Box::new(Command::Simple {
+        right: Nested::new(Command::Simple {
             line: Some(2),
+            span: None,
             words: vec![word("echo"), word("two")],
             redirects: Vec::new(),
             assignments: None,
@@ -414,15 +418,18 @@ fn test_semi_list_uses_newline_when_commands_have_distinct_lines() {
 fn test_semi_list_stays_inline_on_same_line() {
     let ast = Command::List {
         line: None,
+        span: None,
         op: ListOp::Semi,
-        left: Box::new(Command::Simple {
+        left: Nested::new(Command::Simple {
             line: Some(1),
+            span: None,
             words: vec![word("echo"), word("one")],
             redirects: Vec::new(),
             assignments: None,
         }),
-        right: Box::new(Command::Simple {
+        right: Nested::new(Command::Simple {
             line: Some(1),
+            span: None,
             words: vec![word("echo"), word("two")],
             redirects: Vec::new(),
             assignments: None,
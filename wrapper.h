@@ -38,6 +38,37 @@ extern COMMAND *safe_parse_verbose(char *string, int flags);
 /* Parse a complete multi-command script */
 extern COMMAND *safe_parse_script(char *string, int flags);
 
+/* Parse a multi-command script from a borrowed, non-NUL-terminated buffer */
+extern COMMAND *safe_parse_buffer(const char *buffer, size_t length);
+extern COMMAND *safe_parse_buffer_verbose(const char *buffer, size_t length);
+extern int safe_parse_input_had_nul(void);
+
+/* The first syntax error of the last parse, if any */
+extern const char *safe_parse_error(int *line, const char **token, const char **expected,
+                                    const char **source_line, size_t *offset);
+
+/* Word and time budget of the parses that follow, and which ran out */
+extern void safe_parse_set_budget(size_t max_words, uint64_t max_micros);
+extern int safe_parse_budget_exceeded(void);
+/* Flag that cancels the next parse once set */
+extern void safe_parse_set_cancel(const int *flag);
+
+/* Command trees of the substitutions in the last parsed buffer */
+extern int safe_parse_capture_substitutions(int enable);
+extern size_t safe_parse_substitution_count(void);
+extern COMMAND *safe_parse_substitution(size_t index, const char **text);
+
+/* Where the words, redirects and some commands of the last parse end */
+extern int safe_parse_record_positions(int enable);
+extern size_t safe_parse_position_count(void);
+extern int safe_parse_position(size_t index, const void **node, size_t *end);
+
+/* Parse a script one top-level command at a time */
+extern int safe_parse_stream_begin(const char *buffer, size_t length);
+extern int safe_parse_stream_next(COMMAND **command);
+extern size_t safe_parse_stream_offset(void);
+extern void safe_parse_stream_end(void);
+
 /* Initialization functions we need to call */
 extern void initialize_shell_builtins(void);
 extern void initialize_traps(void);